@@ -10,6 +10,8 @@
 
 void lan_poll_task_init(void);
 void lan_poll_task_run(void);
+void lan_poll_task_wait(void);
 
-#endif // LAN_POLL_TASK_H
+void LAN_IntISR(void);
 
+#endif // LAN_POLL_TASK_H
@@ -9,6 +9,9 @@
 #ifndef LOGGER_TASK_H
 #define LOGGER_TASK_H
 
+/* TCP diagnostic stream: the log, or "get NAME\n" exports the file */
+#define DIAG_TCP_PORT	5009U
+
 void logger_task_init(void);
 void logger_task_run(void);
 
@@ -79,6 +79,7 @@ extern volatile size_t MaxTail;
 ErrorStatus InitComm(void);
 ErrorStatus Transmit(const void *ptr);
 ErrorStatus Transmit_RTOS(const void *ptr);
+ErrorStatus Transmit_TCP(void);
 
 void myxfunc_out_dummy(unsigned char c);
 void myxfunc_out_RTOS(unsigned char c);
@@ -21,9 +21,58 @@
 
 void enc28j60_init(const uint8_t *macadr);
 
+// Tx ring
+typedef struct enc28j60_tx_stat {
+	uint32_t	frames;		/*!< frames queued */
+	uint32_t	ok;		/*!< frames sent */
+	uint32_t	collisions;	/*!< collisions, from tx status vectors */
+	uint32_t	late_col;	/*!< late collisions */
+	uint32_t	aborts;		/*!< excessive collisions or defer */
+	uint32_t	errors;		/*!< TXERIF or stuck TXRTS, tx logic reset */
+	uint32_t	ring_full;	/*!< sends waited for a free slot */
+	uint32_t	drops;		/*!< frames not sent */
+	uint32_t	dma_replies;	/*!< rx hook replies, copied in the chip */
+	uint32_t	dma_errors;	/*!< DMA copy not finished */
+} enc28j60_tx_stat_t;
+
+void enc28j60_tx_poll(void);
+const enc28j60_tx_stat_t *enc28j60_get_tx_stat(void);
+
+// INT pin control (LAN_RX_INTERRUPT)
+void enc28j60_int_enable(void);
+void enc28j60_int_disable(void);
+
 // Snd/Rcv packets
 void enc28j60_send_packet(uint8_t *data, uint16_t len);
+void enc28j60_send_packet2(const uint8_t *hdr, uint16_t hdrlen,
+			   const uint8_t *data, uint16_t len);
 uint16_t enc28j60_recv_packet(uint8_t *buf, uint16_t buflen);
+typedef uint8_t *(*enc28j60_getbuf_t)(uint16_t len);
+int32_t enc28j60_recv_packet_alloc(enc28j60_getbuf_t getbuf, uint8_t **pbuf);
+
+// Rx hook: answers a frame from the head of it while the frame is in the
+// chip. The reply is the head, changed in place, followed by the frame
+// bytes after the head, copied from the rx ring to the tx ring by the
+// chip DMA. Returns the reply length, 0 - the frame is read as usual
+// and the head must be left as it was. The hook runs inside the chip
+// read: it must not touch the chip nor wait.
+#define	ENC28J60_RX_HEAD_MAX	64U
+
+typedef uint16_t (*enc28j60_rxhook_t)(uint8_t *head, uint16_t len);
+void enc28j60_set_rx_hook(enc28j60_rxhook_t hook, uint16_t headlen);
+
+// Rx filters (ERXFCON)
+#define	ENC28J60_PM_WINDOW	64U	/* pattern match window, bytes */
+
+typedef struct enc28j60_rx_filter {
+	uint8_t		erxfcon;			/*!< ERXFCON_* filters */
+	uint16_t	pm_offset;			/*!< pattern window start in the frame */
+	uint8_t		pm_mask[ENC28J60_PM_WINDOW / 8U];	/*!< window bytes checked, EPMM0 bit 0 first */
+	uint8_t		pm_data[ENC28J60_PM_WINDOW];	/*!< window contents, masked bytes only */
+	uint8_t		ht[8];				/*!< multicast hash table, EHT0 first */
+} enc28j60_rx_filter_t;
+
+void enc28j60_set_rx_filter(const enc28j60_rx_filter_t *f);
 
 // R/W control registers
 uint8_t enc28j60_rcr(uint8_t adr);
@@ -33,6 +82,31 @@ void enc28j60_wcr16(uint8_t adr, uint16_t arg);
 void enc28j60_bfc(uint8_t adr, uint8_t mask); // Clr bits (reg &= ~mask)
 void enc28j60_bfs(uint8_t adr, uint8_t mask); // Set bits (reg |= mask)
 
+// Batched register ops, one CS frame per op
+#define	ENC28J60_BATCH_MAX	16U
+
+typedef struct enc28j60_op {
+	uint8_t		cmd;		/*!< opcode | address */
+	uint8_t		data;		/*!< argument or read result */
+	uint8_t		dummy;		/*!< MAC/MII read, skip a byte */
+} enc28j60_op_t;
+
+typedef struct enc28j60_batch {
+	enc28j60_op_t	op[ENC28J60_BATCH_MAX];
+	uint8_t		n;		/*!< ops queued */
+	uint8_t		bank;		/*!< bank after the queued ops */
+	uint8_t		overflow;	/*!< too many ops queued */
+} enc28j60_batch_t;
+
+void enc28j60_batch_init(enc28j60_batch_t *b);
+uint8_t enc28j60_batch_rcr(enc28j60_batch_t *b, uint8_t adr);
+void enc28j60_batch_wcr(enc28j60_batch_t *b, uint8_t adr, uint8_t arg);
+void enc28j60_batch_wcr16(enc28j60_batch_t *b, uint8_t adr, uint16_t arg);
+void enc28j60_batch_bfc(enc28j60_batch_t *b, uint8_t adr, uint8_t mask);
+void enc28j60_batch_bfs(enc28j60_batch_t *b, uint8_t adr, uint8_t mask);
+ErrorStatus enc28j60_batch_run(enc28j60_batch_t *b);
+#define	enc28j60_batch_result(b, idx)	((b)->op[(idx)].data)
+
 // R/W Rx/Tx buffer
 void enc28j60_read_buffer(uint8_t *buf, uint16_t len);
 void enc28j60_write_buffer(uint8_t *buf, uint16_t len);
@@ -44,7 +118,10 @@ void enc28j60_write_phy(uint8_t adr, uint16_t data);
 #define	MIN_ETH_FRAME_SIZE	(uint16_t)64
 
 #define ENC28J60_BUFSIZE	0x2000
-#define ENC28J60_RXSIZE		0x1A00
+#define ENC28J60_TX_SLOTS	4	/* frames queued in the chip */
+#define ENC28J60_TX_SLOTSIZE	0x260	/* ctrl byte + frame + tx status vector */
+#define ENC28J60_TXSIZE		(ENC28J60_TX_SLOTS * ENC28J60_TX_SLOTSIZE)
+#define ENC28J60_RXSIZE		(ENC28J60_BUFSIZE - ENC28J60_TXSIZE)
 #define ENC28J60_BUFEND		(ENC28J60_BUFSIZE-1)
 
 #define ENC28J60_MAXFRAME	600
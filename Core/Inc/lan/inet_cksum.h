@@ -0,0 +1,90 @@
+/** @file inet_cksum.h
+ *  @brief Internet checksum (RFC 1071) and incremental update (RFC 1624)
+ *
+ *  All sums are kept in memory byte order: the words are loaded as they
+ *  lie in the frame and the folded result is stored back as is, so no
+ *  byte swaps are needed on the little endian core. Host order constants
+ *  (lengths, protocol numbers) must be added as htons(x).
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef INET_CKSUM_H
+#define INET_CKSUM_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * @brief inet_sum adds buf to the unfolded one's complement sum
+ * @param sum initial value, memory order
+ * @param buf data, any alignment
+ * @param len length in bytes
+ * @return the sum, to be finished by inet_fold()
+ */
+uint32_t inet_sum(uint32_t sum, const void *buf, uint16_t len);
+
+/**
+ * @brief inet_fold folds the sum to 16 bits and complements it
+ * @param sum
+ * @return checksum, memory order
+ */
+static inline uint16_t inet_fold(uint32_t sum)
+{
+	sum = (sum & 0xFFFFU) + (sum >> 16);
+	sum = (sum & 0xFFFFU) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+/**
+ * @brief inet_cksum checksum of one block
+ * @param buf
+ * @param len
+ * @return checksum, memory order
+ */
+static inline uint16_t inet_cksum(const void *buf, uint16_t len)
+{
+	return inet_fold(inet_sum(0U, buf, len));
+}
+
+/**
+ * @brief inet_cksum_adjust16 patches the checksum after a 16 bit field
+ *        has been changed, HC' = ~(~HC + ~m + m') (RFC 1624, eqn. 3)
+ * @param cksum old checksum
+ * @param old old value of the field, memory order
+ * @param new new value of the field, memory order
+ * @return new checksum
+ */
+static inline uint16_t inet_cksum_adjust16(uint16_t cksum, uint16_t old, uint16_t new)
+{
+	return inet_fold((uint32_t)(uint16_t)~cksum + (uint16_t)~old + new);
+}
+
+/**
+ * @brief inet_cksum_adjust32 same for a 32 bit field (an IP address)
+ * @param cksum old checksum
+ * @param old old value of the field, memory order
+ * @param new new value of the field, memory order
+ * @return new checksum
+ */
+static inline uint16_t inet_cksum_adjust32(uint16_t cksum, uint32_t old, uint32_t new)
+{
+	uint32_t sum = (uint16_t)~cksum;
+
+	sum += (uint16_t)~(old & 0xFFFFU);
+	sum += (uint16_t)~(old >> 16);
+	sum += new & 0xFFFFU;
+	sum += new >> 16;
+	return inet_fold(sum);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INET_CKSUM_H
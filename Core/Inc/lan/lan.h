@@ -33,19 +33,38 @@
 
 #define WITH_ICMP
 #define WITH_DHCP
-			#undef	WITH_DHCP/* !!!!!!!!!!!!!!!!!!!!!!!!!!!! */
 #define WITH_UDP
-#define WITH_TCP
-			#undef WITH_TCP	/* !!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
-#define WITH_TCP_REXMIT
-			#undef WITH_TCP_REXMIT /* !!!!!!!!!!!!!!!!!!!!!! */
+#define WITH_TCP		/* single connection stream server */
 //#define	NUM_ETH_BUFFERS		10U
-#define	NUM_ETH_BUFFERS		6U
+//#define	NUM_ETH_BUFFERS		6U
+/* buffer classes, 3592 bytes as 6 full frames did */
+#define	ETH_BUF_SMALL		128U	/* ARP, NTP, MQTT-SN acks */
+#define	ETH_BUF_SMALL_NUM	6U
+#define	ETH_BUF_MEDIUM		256U
+#define	ETH_BUF_MEDIUM_NUM	4U
+#define	ETH_BUF_FULL		ENC28J60_MAXFRAME
+#define	ETH_BUF_FULL_NUM	3U
+/* IP reassembly: a datagram of up to IP_REASM_SIZE bytes (IP header
+ * included) is put together in a large buffer, one per slot */
+#define	IP_REASM_SIZE		1500U
+#ifdef STM32F303xC
+#	define	IP_REASM_SLOTS		2U
+#else
+#	define	IP_REASM_SLOTS		1U
+#endif
+#define	IP_REASM_TIMEOUT	3000U	/* ms from the first fragment */
+#define	ETH_BUF_LARGE		((14U + IP_REASM_SIZE + 3U) & ~3U)	/* + ethernet header */
+#define	ETH_BUF_LARGE_NUM	IP_REASM_SLOTS
+#define	NUM_ETH_BUFFERS		(ETH_BUF_SMALL_NUM + ETH_BUF_MEDIUM_NUM + ETH_BUF_FULL_NUM + \
+				 ETH_BUF_LARGE_NUM)
 //#define	NUM_SOCKETS		NUM_ETH_BUFFERS
 #define	NUM_SOCKETS		10U
 
-#define ARP_TIMEOUT		200U	/*milliseconds */
-#define NUM_ARP_RETRIES		50U
+#define ARP_TIMEOUT		200U	/* first retry interval, milliseconds */
+#define ARP_BACKOFF_MAX		3200U	/* retry interval limit, milliseconds */
+#define NUM_ARP_RETRIES		6U	/* requests before parked frames are dropped */
+#define ARP_PENDING_SIZE	2U	/* next hops being resolved at once */
+#define ARP_PENDING_FRAMES	2U	/* frames parked per next hop */
 
 /* every 30 s decrement occurs */
 #define	ARP_TIMEOUT_S		((uint32_t)(2*60*2))	/* 2 hours */
@@ -53,6 +72,10 @@
 
 #define	START_EUPH_PORT		50000U
 
+/* interrupt driven RX (LAN_RX_INTERRUPT in main.h) */
+#define	LAN_RX_IDLE_POLL_MS	20U	/* fallback poll period, ms */
+#define	LAN_RX_BURST		16U	/* max frames drained per wake-up */
+
 
 #define		FRAME_BUSY	((uint8_t)0)
 #define		FRAME_NOT_BUSY	((uint8_t)(~FRAME_BUSY))
@@ -64,11 +87,24 @@
 
 /* typedef	uint8_t 		udp_data_t[UDP_PAYLOAD_SIZE]; */
 
-enum	EthBufState			/*!< ethernet buffer state */
+enum	EthBufOwner			/*!< who holds the ethernet buffer */
 	{
-		ETH_BUF_BUSY = 1,
-		ETH_BUF_FREE = 2,
+		LAN_BUF_RX = 0,		/*!< lan_poll, frame being received */
+		LAN_BUF_ARP,		/*!< frame parked for ARP resolution */
+		LAN_BUF_SOCK,		/*!< frame queued to a socket */
+		LAN_BUF_TX,		/*!< frame built by the stack for sending */
+		LAN_BUF_REASM,		/*!< datagram being reassembled */
+		LAN_BUF_OWNERS
 	};
+
+typedef struct lan_buf_stat {
+	uint32_t	free;				/*!< free buffers now */
+	uint32_t	min_free;			/*!< low-water mark of free */
+	uint32_t	held[LAN_BUF_OWNERS];		/*!< buffers held now */
+	uint32_t	held_max[LAN_BUF_OWNERS];	/*!< high-water marks */
+	uint32_t	fails[LAN_BUF_OWNERS];		/*!< lan_getmem() failed */
+	uint32_t	free_errors;			/*!< bad or double lan_freemem() */
+} lan_buf_stat_t;
 enum	SocketState			/*!< socket state */
 	{
 		SOCK_BUSY = 1,
@@ -96,19 +132,29 @@ enum	YesNo				/*!< type for events */
 #	define IP_DEFAULT_GATEWAY	inet_addr(192,168,0,1)
 #endif
 
-#define ARP_CACHE_SIZE			3
+#define ARP_CACHE_BITS			4	/* 16 entries, open addressed hash */
+#define ARP_CACHE_SIZE			(1U << ARP_CACHE_BITS)
+#define ARP_CACHE_MASK			(ARP_CACHE_SIZE - 1U)
 #define IP_PACKET_TTL			64
-#define TCP_MAX_CONNECTIONS		5
-#define TCP_WINDOW_SIZE			65535
+#define TCP_MAX_CONNECTIONS		1
 #define TCP_SYN_MSS			512
-#ifdef WITH_TCP_REXMIT
-#	define TCP_REXMIT_TIMEOUT	1000
-#	define TCP_REXMIT_LIMIT		5
+#define TCP_DEFAULT_MSS			536	/* no MSS option from the peer */
+#define TCP_REXMIT_TIMEOUT		1000U	/* first retransmission, ms */
+#define TCP_REXMIT_TIMEOUT_MAX		8000U	/* backoff limit, ms */
+#define TCP_REXMIT_LIMIT		6U	/* then the connection is dropped */
+#define TCP_DUP_ACKS			3U	/* fast retransmit */
+#define TCP_FIN_TIMEOUT			5000U	/* our FIN acked, peer FIN wait, ms */
+/* send queue: unacknowledged and unsent bytes, power of 2 */
+#ifdef STM32F303xC
+#	define TCP_TXQ_SIZE		2048U
 #else
-#	define TCP_CONN_TIMEOUT		2500
+#	define TCP_TXQ_SIZE		1024U
 #endif
+#define TCP_RXQ_SIZE			64U	/* received bytes, our window */
 
 #define		UDP_PAYLOAD_START	((uint16_t)42)
+/* UDP payload sent in IP fragments, max: a 1500 byte datagram */
+#define		UDP_DGRAM_MAX		((uint16_t)1472)
 
 /*
  * BE conversion
@@ -168,10 +214,21 @@ typedef  struct __attribute__((packed)) arp_message {
 typedef struct arp_cache_entry {
 			uint32_t	ip_addr;
 			int32_t		age;
+			uint32_t	used;		/*!< tick of the last lookup, LRU */
 			uint8_t		mac_addr[6];
 
 	} arp_cache_entry_t;
 
+typedef struct arp_pending {
+			uint32_t	ip_addr;	/*!< next hop, 0 - free entry */
+			uint32_t	next_try;	/*!< tick of the next request */
+			uint32_t	backoff;	/*!< current retry interval, ms */
+			uint8_t		tries;		/*!< requests sent */
+			uint8_t		nframes;	/*!< frames parked */
+			uint8_t		*frame[ARP_PENDING_FRAMES];	/*!< eth_buf slots */
+			uint16_t	len[ARP_PENDING_FRAMES];	/*!< frame lengths */
+	} arp_pending_t;
+
 /*
  * IP
  */
@@ -181,9 +238,19 @@ typedef struct arp_cache_entry {
 #define			SOC_MODE_WRITE		(uint8_t)0x02 /*!< for transmission */
 #define			SOC_NEW_DATA		(uint8_t)0x80 /*!< new data has arrived */
 
+#define			SOC_RXQ_MAX		3U	/*!< received frames queued per socket, max */
+#define			SOC_RXQ_DEPTH		2U	/*!< default queue depth */
+#define			SOC_RXQ_DROP_OLDEST	(uint8_t)0x00 /*!< full queue drops the oldest frame */
+#define			SOC_RXQ_DROP_NEWEST	(uint8_t)0x01 /*!< full queue drops the arrived frame */
+
+#define			SOC_HASH_BITS		3U	/*!< local port table, log2 of buckets */
+#define			SOC_HASH_SIZE		(1U << SOC_HASH_BITS)
+#define			SOC_HASH_MASK		(SOC_HASH_SIZE - 1U)
+
 
 #define			SOC_ERR_WRONG_SOC_MODE	(uint16_t)0x01	/*!< socket mode id is inadequate to operation */
 #define			SOC_ERR_NOT_ENOUGH_MEM_BUF  (uint16_t)0x02 /*!< not enough buffer memory to hold received data */
+#define			SOC_ERR_NOT_RESOLVED	(uint16_t)0x03	/*!< next hop MAC is being resolved, the datagram is not sent */
 
 enum	DataLost_	{		/* Is the data lost or not */
 	SOC_DATA_NOT_LOST = 0,
@@ -196,7 +263,6 @@ typedef	enum	DataLost_	DataLost_t;
 
 
 typedef  struct /*__attribute__((packed))*/ socket {
-			uint8_t			*buf;			/*!< ptr to the buffer for eth.frame*/
 			uint32_t		loc_ip_addr;		/*!< local IP*/
 			uint32_t		rem_ip_addr;		/*!< remote IP */
 			uint16_t		rem_port;		/*!< remote port */
@@ -206,9 +272,19 @@ typedef  struct /*__attribute__((packed))*/ socket {
 			enum SocketState        soc_state;
 			uint8_t			proto;			/*!< protocol */
 			uint8_t			mode;			/*!< read or write ?*/
-			DataLost_t		datalost;		/*!< the previous new data is overwritten */
+			DataLost_t		datalost;		/*!< a received frame was dropped */
+			uint8_t			rxq_depth;		/*!< frames queued, max */
+			uint8_t			rxq_policy;		/*!< SOC_RXQ_DROP_OLDEST or _NEWEST */
+			uint32_t		rxq_drops;		/*!< frames dropped, the queue is full */
 			void *			TaskToNotify;		/*!< task handle to be notified */
 			uint32_t		readTimeOutMS;		/*!< socket read operation timeout */
+			/* cached eth/ip/udp header for write_socket */
+			uint32_t		hdr_ip_sum;		/*!< ip header sum w/o total_len */
+			uint32_t		hdr_udp_sum;		/*!< pseudo header + ports sum */
+			uint32_t		hdr_arp_gen;		/*!< arp cache generation of the MAC */
+			uint32_t		hdr_src_ip;		/*!< local IP the header is built for */
+			uint8_t			hdr_valid;		/*!< header is built */
+			uint8_t			hdr[UDP_PAYLOAD_START];	/*!< the header */
 	} socket_t;
 
 typedef	socket_t	*socket_p;				/*!< pointer to the socket */
@@ -300,17 +376,20 @@ typedef enum 	tcp_status_code {
 
 typedef struct __attribute__((packed)) tcp_state {
 		tcp_status_code_t	status;
-		uint32_t		event_time;
-		uint32_t		seq_num;
-		uint32_t		ack_num;
+		uint32_t		event_time;	/*!< retransmission timer start */
+		uint32_t		seq_num;	/*!< next to send */
+		uint32_t		ack_num;	/*!< next expected */
 		uint32_t		remote_addr;
 		uint16_t		remote_port;
 		uint16_t		local_port;
-#ifdef WITH_TCP_REXMIT
-		uint8_t			is_closing;
+		uint8_t			is_closing;	/*!< our FIN is sent */
 		uint8_t			rexmit_count;
-		uint32_t		seq_num_saved;
-#endif
+		uint32_t		seq_num_saved;	/*!< oldest unacknowledged */
+		uint32_t		seq_num_max;	/*!< highest sent */
+		uint32_t		rto;		/*!< retransmission timeout, ms */
+		uint16_t		snd_wnd;	/*!< peer window */
+		uint16_t		mss;		/*!< segment size to the peer */
+		uint8_t			dup_acks;
 	} tcp_state_t;
 
 typedef enum tcp_sending_mode {
@@ -319,8 +398,6 @@ typedef enum tcp_sending_mode {
 		TCP_SENDING_RESEND
 	} tcp_sending_mode_t;
 
-#define TCP_OPTION_PUSH			0x01
-#define TCP_OPTION_CLOSE		0x02
 
 /*
  * DHCP
@@ -366,6 +443,7 @@ typedef struct __attribute__((packed)) dhcp_message {
 #define DHCP_CODE_DHCPSERVER		(uint8_t)54
 #define DHCP_CODE_RENEWTIME		(uint8_t)58
 #define DHCP_CODE_REBINDTIME		(uint8_t)59
+#define DHCP_CODE_PARAMLIST		(uint8_t)55
 
 typedef struct __attribute__((packed)) dhcp_option {
 		uint8_t			code;
@@ -386,20 +464,45 @@ typedef enum dhcp_status_code {
 		DHCP_INIT,
 		DHCP_ASSIGNED,
 		DHCP_WAITING_OFFER,
-		DHCP_WAITING_ACK
+		DHCP_WAITING_ACK,
+		DHCP_REBOOTING,		/*!< INIT-REBOOT, the cached address is requested */
+		DHCP_RENEWING,		/*!< T1 passed, unicast request to the server */
+		DHCP_DISABLED		/*!< static address from IP_CFG */
 	} dhcp_status_code_t;
 
+#define DHCP_LEASE_MAX			21600U	/* lease and T1 limit, s */
+#define DHCP_REBOOT_TIMEOUT		250U	/* INIT-REBOOT retry, ms */
+#define DHCP_REBOOT_TRIES		4U	/* then DISCOVER */
+#define DHCP_REQUEST_TIMEOUT		2000U	/* REQUEST after OFFER retry, ms */
+#define DHCP_REQUEST_TRIES		3U	/* then DISCOVER again */
+#define DHCP_DISCOVER_TIMEOUT		4000U	/* first DISCOVER retry, ms */
+#define DHCP_DISCOVER_BACKOFF_MAX	64000U	/* retry interval limit, ms */
+#define DHCP_RENEW_RETRY		10000U	/* RENEWING retry, ms */
+
+typedef struct dhcp_lease {
+		uint32_t		ip_addr;	/*!< 0 - no lease */
+		uint32_t		ip_mask;
+		uint32_t		ip_gateway;
+		uint32_t		server;		/*!< DHCP server id */
+		uint32_t		lease_time;	/*!< seconds */
+		uint8_t			gw_mac[6];	/*!< MAC of the gateway */
+		uint8_t			gw_mac_valid;
+		uint8_t			pad;
+	} dhcp_lease_t;
+
+/* called from the lan poll task: a new lease, the gateway MAC learned,
+ * or ip_addr == 0 if the lease is refused by the server */
+typedef void (*dhcp_lease_cb_t)(const dhcp_lease_t *lease);
+
 /*
  * LAN
  */
 
 /*extern uint8_t 	net_buf[NUM_ETH_BUFFERS][ENC28J60_MAXFRAME]; */
 
-#ifndef WITH_DHCP
 extern uint32_t ip_addr;
 extern uint32_t ip_mask;
 extern uint32_t ip_gateway;
-#endif
 
 extern uint8_t mac_addr[6];
 
@@ -408,20 +511,71 @@ void lan_init(void);
 void lan_poll(void);
 uint8_t lan_up(void);
 
+#ifdef WITH_DHCP
+/**
+ * @brief dhcp_set_lease gives the last lease to try with INIT-REBOOT,
+ *        must be called before lan_init(); ip_addr == 0 selects DHCP
+ * @param lease
+ */
+void dhcp_set_lease(const dhcp_lease_t *lease);
+
+/**
+ * @brief dhcp_set_lease_cb sets the function the lease is saved with
+ * @param cb
+ */
+void dhcp_set_lease_cb(dhcp_lease_cb_t cb);
+#endif
+
 
 // UDP calls
 uint8_t udp_send(eth_frame_t *frame, uint16_t len);
 void udp_reply(eth_frame_t *frame, uint16_t len);
 
-// TCP callbacks
-// uint8_t tcp_listen(uint8_t id, eth_frame_t *frame);
-// void tcp_read(uint8_t id, eth_frame_t *frame, uint8_t re);
-// void tcp_write(uint8_t id, eth_frame_t *frame, uint16_t len);
-// void tcp_closed(uint8_t id, uint8_t hard);
+#ifdef WITH_TCP
+// TCP stream: one connection, one writer and one reader task
 
-// TCP calls
-uint8_t tcp_open(uint32_t addr, uint16_t port, uint16_t local_port);
-void tcp_send(uint8_t id, eth_frame_t *frame, uint16_t len, uint8_t options);
+/**
+  * sets the port the server accepts the connection on
+  * a new connection replaces the current one
+  * @param port local port, host order; 0 - no new connections
+  * @return none
+  */
+void tcp_stream_listen(uint16_t port);
+
+/**
+  * @return 1 if a connection is established and not being closed
+  */
+uint8_t tcp_stream_up(void);
+
+/**
+  * @return bytes tcp_stream_write() takes now
+  */
+size_t tcp_stream_space(void);
+
+/**
+  * queues the data to the connection, does not block
+  * the bytes stay queued until acknowledged by the peer
+  * @param buf data
+  * @param len length
+  * @return bytes queued
+  */
+size_t tcp_stream_write(const uint8_t *buf, size_t len);
+
+/**
+  * takes the received bytes, does not block
+  * @param buf destination
+  * @param len size of buf
+  * @return bytes read
+  */
+size_t tcp_stream_read(uint8_t *buf, size_t len);
+
+/**
+  * closes the connection after the queued data is sent
+  * @param none
+  * @return none
+  */
+void tcp_stream_close(void);
+#endif
 
 // htonl
 uint32_t htonl(uint32_t a);
@@ -453,25 +607,32 @@ socket_p close_socket(socket_p soc);
 
 /**
   * sends data from buf via previously opened socket
+  * payloads above udp_max_payload(0) go in IP fragments
   * @param soc the pointer to the socket
   * @param *buf is the pointer to the data
-  * @param buflen length of the data
+  * @param buflen length of the data, udp_max_payload(1) max
   * @return ErrorStatus SUCCESS or ERROR
   */
 ErrorStatus write_socket(socket_p soc, uint8_t* buf, int32_t buflen);
 
+/**
+  * the largest payload write_socket() takes
+  * @param fragments 0 - in a single frame, else in IP fragments
+  * @return bytes
+  */
+uint16_t udp_max_payload(uint8_t fragments);
+
 /** reads bytes from network
   * @param  soc pointer to the previously open socket
   * @return number of received bytes if OK; NULL if not ok, last_error field contains additional info
   */
 uint16_t read_socket(socket_p soc, uint8_t* buf, int32_t buflen);
 
-/** runs out of freertos!  every 1ms by TIM0 stimulus
-  * returns num of free netbuffers
-  * @param none
-  * @return nb number of free buffers
-  */
-void	nb_stat(void);
+/**
+ * @brief lan_get_buf_stat copies the ethernet buffer pool counters
+ * @param st destination
+ */
+void	lan_get_buf_stat(lan_buf_stat_t *st);
 
 /**
  * @brief arp_get_capacity returns number of the entries
@@ -508,5 +669,14 @@ socket_p change_soc_mode(socket_p soc, const uint8_t mode);
 
 socket_p set_notif_params(socket_p soc, void * TaskToNotify, uint32_t readTimeOutMS);
 
+/**
+  * sets the receive queue of the socket
+  * @param  soc - socket to be changed
+  * @param  depth - frames queued, 1...SOC_RXQ_MAX
+  * @param  policy - SOC_RXQ_DROP_OLDEST or SOC_RXQ_DROP_NEWEST
+  * @retval soc pointer in OK, NULL if ERROR
+  */
+socket_p set_rxq_params(socket_p soc, uint8_t depth, uint8_t policy);
+
 #endif
 /* ############################################################################################# */
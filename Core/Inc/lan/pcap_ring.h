@@ -0,0 +1,51 @@
+/** @file pcap_ring.h
+ *  @brief sampled capture ring of the received frames, pcap export
+ *
+ *  The lan poll task stores the head of every PCAP_SAMPLE_DEFAULT-th
+ *  frame it does not handle, with the tick it arrived at. Readers take
+ *  a snapshot of the ring and stream it out as a pcap file (LINKTYPE
+ *  ETHERNET), the records are checked against the writer with a per
+ *  slot sequence number, no lock is taken on either side.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef PCAP_RING_H
+#define PCAP_RING_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define	PCAP_RING_SLOTS		16U	/* frames kept, power of 2 */
+#define	PCAP_SNAPLEN		64U	/* bytes kept of each frame */
+#define	PCAP_SAMPLE_DEFAULT	1U	/* every n-th frame, 0 - off */
+#define	PCAP_FILE_NAME		"PCAP"	/* tftp virtual file */
+
+#define	PCAP_HDR_LEN		24U
+#define	PCAP_REC_HDR_LEN	16U
+
+typedef struct pcap_export {
+	uint32_t	next;		/*!< sequence number of the next record */
+	uint32_t	end;		/*!< sequence number after the last one */
+	uint16_t	pos;		/*!< bytes of rec sent */
+	uint16_t	len;		/*!< bytes in rec */
+	uint8_t		rec[PCAP_REC_HDR_LEN + PCAP_SNAPLEN];
+} pcap_export_t;
+
+void pcap_capture(const uint8_t *frame, uint16_t len);
+void pcap_set_sampling(uint16_t every);
+
+void pcap_export_begin(pcap_export_t *ex);
+size_t pcap_export_read(pcap_export_t *ex, uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PCAP_RING_H
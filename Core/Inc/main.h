@@ -131,6 +131,13 @@ void Error_Handler(void);
 
 #define LAN_NOTIFICATION	1
 
+/* ENC28J60 INT pin (active low), drives the LAN task instead of 2 ms polling */
+#define ENC28J60_INT_Pin GPIO_PIN_8
+#define ENC28J60_INT_GPIO_Port GPIOB
+#define ENC28J60_INT_EXTI_IRQn EXTI9_5_IRQn
+
+#define LAN_RX_INTERRUPT	1
+
 /* USER CODE END Private defines */
 
 #ifdef __cplusplus
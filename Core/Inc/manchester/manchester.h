@@ -41,6 +41,26 @@
 #define MAX_NUM_START_BITS 16
 #define MAX_NUM_STOP_BITS 16
 
+/* receive a frame by capturing all its edges with the timer and DMA,
+ * comment out to use the EXTI edge-by-edge receiver */
+#define MANCHESTER_RX_DMA
+
+/* active pulses of a frame the capture buffer holds, at most one per bit
+ * plus the start of the frame */
+#define MANCHESTER_CAPTURE_PAIRS 48u
+
+/* transmit a frame as a waveform the timer plays out by DMA,
+ * comment out to drive the pin from the task every half-bit */
+#define MANCHESTER_TX_DMA
+
+/* bits of a frame the waveform buffer holds */
+#define MANCHESTER_WAVE_BITS 48u
+
+/* check the timer stages and turn them into register images once in
+ * MANCHESTER_InitContext, a stage change then writes only the registers
+ * which differ; comment out to program every stage from the table */
+#define MANCHESTER_TIMER_IMAGES
+
 /**
  * Bit order LSB or MSB
  */
@@ -110,4 +130,8 @@ ErrorStatus MANCHESTER_Transmit(MANCHESTER_Data_t *data,
 
 void MANCHESTER_TimerISR(void);
 
+#ifdef MANCHESTER_TX_DMA
+void MANCHESTER_DmaISR(void);
+#endif
+
 #endif // MANCHESTER_H
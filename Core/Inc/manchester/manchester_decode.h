@@ -0,0 +1,38 @@
+/** @file manchester_decode.h
+ *  @brief table-driven decoder of captured Manchester frames
+ *
+ *  The input is the time of every edge of a frame, the first edge going
+ *  to the active level, as the DMA capture of manchester.c stores them.
+ *  The decoder has no hardware dependencies and is built on the host too.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef MANCHESTER_DECODE_H
+#define MANCHESTER_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "manchester.h"
+
+/* start, data and stop bits of the longest frame decoded */
+#define MANCHESTER_DECODE_BITS 64u
+
+typedef enum MANCHESTER_DecodeStatus {
+	mdOk,
+	mdBadPulse,	/* a level lasted neither one nor two half-bits */
+	mdBadSymbol,	/* both halves of a bit at the same level */
+	mdShort,	/* the edges end before the frame does */
+	mdBadStartStop,	/* a start or a stop bit of the wrong value */
+	mdTooLong,	/* the frame does not fit MANCHESTER_DECODE_BITS */
+} MANCHESTER_DecodeStatus_t;
+
+MANCHESTER_DecodeStatus_t MANCHESTER_Decode(const uint32_t *edges,
+					    size_t numEdges,
+					    const MANCHESTER_Context_t *context,
+					    MANCHESTER_Data_t *data);
+
+#endif // MANCHESTER_DECODE_H
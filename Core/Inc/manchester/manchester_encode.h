@@ -0,0 +1,31 @@
+/** @file manchester_encode.h
+ *  @brief Manchester waveform builder
+ *
+ *  The frame is laid out as one GPIO BSRR word per half-bit for the
+ *  timer-paced DMA of manchester.c. No hardware dependencies, the host
+ *  build plays the waveform into its line simulator and checks the timer
+ *  set up for it on a plain register block.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef MANCHESTER_ENCODE_H
+#define MANCHESTER_ENCODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "manchester.h"
+
+/* words of the waveform of a frame of nBits start, data and stop bits */
+#define MANCHESTER_WAVE_WORDS(nBits) (2u * (nBits) + 1u)
+
+size_t MANCHESTER_Encode(const MANCHESTER_Data_t *data,
+			 const MANCHESTER_Context_t *context, uint32_t *wave,
+			 uint32_t high, uint32_t low);
+
+void MANCHESTER_WaveTimerArm(TIM_TypeDef *tim, uint32_t halfBitTime);
+
+#endif // MANCHESTER_ENCODE_H
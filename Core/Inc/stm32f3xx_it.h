@@ -86,6 +86,8 @@ void USART3_IRQHandler(void);
 
 /* USER CODE BEGIN EFP */
 void EXTI0_IRQHandler(void);
+void DMA1_Channel7_IRQHandler(void);
+void EXTI9_5_IRQHandler(void);
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
@@ -109,6 +109,7 @@ typedef struct tftp_context_ {
 	tftp_state_t		State;
 /* file handle */
 	fHandle_t		file;
+	uint8_t			Capture;	/*!< the capture ring is read, not a file */
 /* UDP sockets */
 	socket_p		in_sock;	/*!< pointer to the input socket */
 	socket_p		out_sock;	/*!< pointer to the output socket */
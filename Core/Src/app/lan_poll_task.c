@@ -6,15 +6,20 @@
  *  @date 09-03-2019
  */
 
+#include "main.h"
 #include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
 #include "watchdog.h"
 #include "logging.h"
 #include "lan.h"
 #include "task_tokens.h"
 
 #include "messages.h"
+#include "lan_poll_task.h"
 
 extern osMutexId ETH_Mutex01Handle;
+extern osThreadId LANPollTaskHandle;
 
 /**
  * @brief lan_poll_task_init
@@ -31,10 +36,39 @@ void lan_poll_task_init(void)
  */
 void lan_poll_task_run(void)
 {
+	/* no lan_up() check: the DHCP client runs from lan_poll() */
 	if (ETH_Mutex01Handle != NULL) {
-		if (lan_up() == 1U) {
-			lan_poll();
-		}
+		lan_poll();
 	}
 	i_am_alive(LAN_POLL_TASK_MAGIC);
 }
+
+/**
+ * @brief lan_poll_task_wait blocks the task until the next poll
+ * @note with LAN_RX_INTERRUPT the task sleeps until the ENC28J60 INT edge
+ *       or LAN_RX_IDLE_POLL_MS timeout (covers a missed edge, a frame
+ *       left in the chip when the buffers were exhausted, and the
+ *       PKTIF errata)
+ */
+void lan_poll_task_wait(void)
+{
+#if (LAN_RX_INTERRUPT == 1)
+	(void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LAN_RX_IDLE_POLL_MS));
+#else
+	vTaskDelay(pdMS_TO_TICKS(2U));
+#endif
+}
+
+/**
+ * @brief LAN_IntISR is called from the ENC28J60 INT EXTI handler
+ */
+void LAN_IntISR(void)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+	if (LANPollTaskHandle != NULL) {
+		vTaskNotifyGiveFromISR(LANPollTaskHandle,
+				       &xHigherPriorityTaskWoken);
+	}
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
@@ -174,7 +174,10 @@ void service_task_run(void)
 
 		size_t n_entries = arp_get_capacity();
 		for(size_t i  = 0U; i < n_entries; i++) {
-			log_xputs(MSG_LEVEL_INFO, arp_get_entry_string(i));
+			char *entry = arp_get_entry_string(i);
+			if (entry != NULL) {
+				log_xputs(MSG_LEVEL_INFO, entry);
+			}
 		}
 	}
 
@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include "rtc.h"
+#include "rtc_helpers.h"
 
 #include "rtc_magics.h"
 
@@ -41,6 +42,8 @@ static inline void Cold_Boot(void);
 static Boot_t HW_Boot_Select(void);
 static FRESULT SaveIPCfg(const Media_Desc_t *media);
 static ErrorStatus Init_NIC(const Media_Desc_t *media);
+static void Load_Lease(const Media_Desc_t *media);
+static void Save_Lease(const dhcp_lease_t *lease);
 
 volatile Boot_t Boot_Mode = COLD_BOOT; /* boot mode - cold or warm */
 volatile uint32_t RCC_CSR_copy;	/* copy of the RCC_CSR */
@@ -59,6 +62,18 @@ const Media_Desc_t Media0 = { .readFunc = Read_FRAM,
 /* configuration file */
 static const char *IP_Cfg_File = "IP_CFG";
 
+/* last DHCP lease, binary */
+static const char *Lease_File = "LEASE";
+
+#define LEASE_MAGIC	0x45534C44U	/* "DLSE" */
+
+struct lease_file {
+	uint32_t magic;
+	dhcp_lease_t lease;
+	uint32_t saved;		/* RTC seconds */
+	uint32_t expires;	/* RTC seconds */
+};
+
 /* cold bood flag */
 static Boot_t boot_flag = COLD_BOOT;
 
@@ -67,10 +82,10 @@ static const struct ip_cfg IP_Cfg_File_Default = {
 	.MAC_addr.mac_v = { "EE65EE33FF81" },
 	.MAC_addr.mac_pad = { "     \n" },
 	.Own_IP.ip_n = { "IP__" },
-	.Own_IP.ip_v = { "192"
-			 "168"
+	.Own_IP.ip_v = { "000"	/* 0.0.0.0 - DHCP */
+			 "000"
 			 "000"
-			 "223" },
+			 "000" },
 	.Own_IP.ip_p = { "00000" },
 	.Own_IP.ip_nl = { "\n" },
 	.Net_Mask.ip_n = { "NM__" },
@@ -202,6 +217,11 @@ ErrorStatus AppStartUp(void)
 	}
 	/* ip configuration retrieved  */
 	log_xputs(MSG_LEVEL_INFO, "IP configuration OK!\n");
+	if (ip_addr == 0U) {
+		log_xputs(MSG_LEVEL_INFO, "DHCP\n");
+		Load_Lease(&Media0);
+		dhcp_set_lease_cb(Save_Lease);
+	}
 	lan_init();
 	retVal = SUCCESS;
 
@@ -364,3 +384,69 @@ static ErrorStatus Init_NIC(const Media_Desc_t *media)
 fExit:
 	return retVal;
 }
+
+/**
+ * @brief Load_Lease gives the last DHCP lease to the client, it asks
+ *        for the address again at once (INIT-REBOOT)
+ * @param media
+ */
+static void Load_Lease(const Media_Desc_t *media)
+{
+	struct lease_file buf;
+	size_t br = 0U;
+	tTime now;
+	FRESULT res;
+
+	res = ReadBytes(media, Lease_File, 0U, sizeof(struct lease_file),
+			&br, (uint8_t *)&buf);
+	if ((res != FR_OK) || (br != sizeof(struct lease_file)) ||
+	    (buf.magic != LEASE_MAGIC)) {
+		goto fExit;
+	}
+	/* the RTC went back: the age is unknown, the server decides */
+	if ((GetTimeFromRTC(&now) == SUCCESS) && (now.Seconds >= buf.saved) &&
+	    (now.Seconds >= buf.expires)) {
+		log_xputs(MSG_LEVEL_INFO, "DHCP lease expired.\n");
+		goto fExit;
+	}
+	log_xputs(MSG_LEVEL_INFO, "DHCP lease found.\n");
+	dhcp_set_lease(&buf.lease);
+fExit:
+	return;
+}
+
+/**
+ * @brief Save_Lease writes the lease to the file, runs in the lan poll task
+ * @param lease the lease, ip_addr == 0 - refused, the file is deleted
+ */
+static void Save_Lease(const dhcp_lease_t *lease)
+{
+	struct lease_file buf;
+	tTime now;
+	size_t bw = 0U;
+	FRESULT res;
+
+	if (lease->ip_addr == 0U) {
+		res = DeleteFile(&Media0, Lease_File);
+		if (res == FR_NO_FILE) {
+			res = FR_OK;
+		}
+		goto fExit;
+	}
+	memset(&buf, 0, sizeof(buf));
+	now.Seconds = 0U;
+	(void)GetTimeFromRTC(&now);
+	buf.magic = LEASE_MAGIC;
+	buf.lease = *lease;
+	buf.saved = now.Seconds;
+	buf.expires = now.Seconds + lease->lease_time;
+	res = WriteBytes(&Media0, Lease_File, 0U, sizeof(buf), &bw,
+			 (const uint8_t *)&buf);
+	if ((res == FR_OK) && (bw != sizeof(buf))) {
+		res = FR_INVALID_PARAMETER;
+	}
+fExit:
+	if (res != FR_OK) {
+		log_xputs(MSG_LEVEL_SERIOUS, "DHCP lease not saved.\n");
+	}
+}
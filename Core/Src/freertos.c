@@ -450,12 +450,11 @@ void MX_FREERTOS_Init(void)
 void __attribute__ ((noreturn)) Start_LANPollTask(void const *argument)
 {
 	(void)argument;
-	const TickType_t xPeriod = pdMS_TO_TICKS(2U);
 	lan_poll_task_init();
 	/* infinite loop */
 	for (;;) {
 		lan_poll_task_run();
-		vTaskDelay(xPeriod);
+		lan_poll_task_wait();
 	}
 }
 
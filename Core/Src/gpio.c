@@ -158,6 +158,17 @@ void MX_GPIO_Init(void)
   HAL_NVIC_SetPriority(EXTI0_IRQn, 5, 0);
 //  HAL_NVIC_EnableIRQ(EXTI0_IRQn);
 
+#if (LAN_RX_INTERRUPT == 1)
+  /*Configure GPIO pin : ENC28J60 INT, falling edge = frame pending */
+  GPIO_InitStruct.Pin = ENC28J60_INT_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(ENC28J60_INT_GPIO_Port, &GPIO_InitStruct);
+
+  HAL_NVIC_SetPriority(ENC28J60_INT_EXTI_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(ENC28J60_INT_EXTI_IRQn);
+#endif
+
   /* USER CODE END 2 */
 
 }
@@ -281,6 +281,42 @@ fExit:
 }
 /* end of the function Transmit_RTOS() */
 
+/**
+  * @brief  Transmit_TCP queues the log to the TCP diagnostic stream
+  * @note   the buffers are switched only when the whole buffer fits the
+  *         send queue, the log waits in the active buffer meanwhile
+  * @retval ERROR or SUCCESS
+  */
+ErrorStatus Transmit_TCP(void)
+{
+	ErrorStatus result = SUCCESS;
+	size_t tmptail;
+
+	if ((TxTail == (size_t)0U) || (tcp_stream_space() < BUFSIZE)) {
+		goto fExit; /* nothing to do or no room yet */
+	}
+	if (osMutexWait(xfunc_outMutexHandle, 0) != osOK) {
+		goto fExit; /* try next time*/
+	}
+	tmptail = TxTail;
+	if (pActTxBuf == TxBuf1) {
+		pActTxBuf = TxBuf2;
+		pXmitTxBuf = TxBuf1;
+	} else {
+		pActTxBuf = TxBuf1;
+		pXmitTxBuf = TxBuf2;
+	}
+	TxTail = 0U;
+	osMutexRelease(xfunc_outMutexHandle);
+
+	if (tcp_stream_write((uint8_t *)pXmitTxBuf, tmptail) != tmptail) {
+		result = ERROR; /* the connection is gone */
+	}
+fExit:
+	return result;
+}
+/* end of the function Transmit_TCP() */
+
 /**
  * @brief HAL_UART_TxCpltCallback
  * @param huart
@@ -9,6 +9,8 @@
 #endif
 
 
+#include <string.h>
+
 #include "FreeRTOS.h"
 #include "task.h"
 #include "cmsis_os.h"
@@ -22,6 +24,7 @@
 #endif
 
 #include "enc28j60.h"
+#include "inet_cksum.h"
 
 #include "spi.h"
 
@@ -42,11 +45,115 @@
 
 
 
+/* pin macros may be overridden by the host register model */
+#ifndef		ENC28J60_CS_L
 #define		ENC28J60_CS_L	{ ENC28J60_CS_GPIO_Port->BSRR = (uint32_t)ENC28J60_CS_Pin << 16U; }
 #define		ENC28J60_CS_H	{ ENC28J60_CS_GPIO_Port->BSRR = ENC28J60_CS_Pin; }
+#endif
 
+#ifndef		ENC28J60_RST_L
 #define		ENC28J60_RST_L	{ ENC28J60_RESET_GPIO_Port->BSRR = (uint32_t)ENC28J60_RESET_Pin << 16U;}
 #define		ENC28J60_RST_H	{ ENC28J60_RESET_GPIO_Port->BSRR = ENC28J60_RESET_Pin; }
+#endif
+
+/* polled register level SPI2 access, may be overridden by the host model */
+#ifndef		ENC28J60_SPI_XCHG
+#define		ENC28J60_SPI_XCHG(data)	enc28j60_spi_xchg(data)
+#define		ENC28J60_SPI_SYNC()	enc28j60_spi_sync()
+#define		ENC28J60_SPI_FLUSH()	enc28j60_spi_flush()
+
+/**
+  * @brief  enc28j60_spi_sync prepares SPI2 for polled access
+  * @note   drops stale rx data left by HAL transmit-only transfers
+  *         (FRAM and buffer writes share the bus)
+  */
+static inline void enc28j60_spi_sync(void)
+{
+	SPI_TypeDef *spi = hspi2.Instance;
+
+	if ((spi->CR1 & SPI_CR1_SPE) == 0U) {
+#if defined (STM32F303xC)
+		spi->CR2 |= SPI_CR2_FRXTH;	/* RXNE on 8 bit */
+#endif
+		spi->CR1 |= SPI_CR1_SPE;
+	}
+	while ((spi->SR & SPI_SR_RXNE) != 0U) {
+		(void)*(__IO uint8_t *)&spi->DR;
+	}
+	(void)spi->SR;				/* clears OVR */
+}
+
+static inline uint8_t enc28j60_spi_xchg(uint8_t data)
+{
+	SPI_TypeDef *spi = hspi2.Instance;
+
+	while ((spi->SR & SPI_SR_TXE) == 0U) {
+	}
+	*(__IO uint8_t *)&spi->DR = data;
+	while ((spi->SR & SPI_SR_RXNE) == 0U) {
+	}
+	return *(__IO uint8_t *)&spi->DR;
+}
+
+/* CS must not go high before the last clock (MAC/MII hold time) */
+static inline void enc28j60_spi_flush(void)
+{
+	while ((hspi2.Instance->SR & SPI_SR_BSY) != 0U) {
+	}
+}
+#endif
+
+/* shorter buffer transfers are clocked by polled SPI */
+#define		ENC28J60_DMA_MIN	16U
+
+/* receive status vector, precedes every frame in the rx ring */
+typedef struct __attribute__((packed)) enc28j60_rsv {
+	uint16_t	next;		/* next packet pointer */
+	uint16_t	rxlen;		/* byte count including crc */
+	uint16_t	status;		/* bit 7 - received ok */
+} enc28j60_rsv_t;
+
+/* tx ring in the chip buffer, ENC28J60_TX_SLOTS slots after the rx ring */
+#define		ENC28J60_TX_SLOT(n)	(ENC28J60_TXSTART + (uint16_t)(n) * ENC28J60_TX_SLOTSIZE)
+#define		ENC28J60_TSV_LEN	7U
+#define		ENC28J60_TX_MAXLEN	(ENC28J60_TX_SLOTSIZE - 1U - ENC28J60_TSV_LEN)
+#define		ENC28J60_TX_TIMEOUT_MS	20U	/* TXRTS stuck, reset tx logic */
+#define		ENC28J60_DMA_TIMEOUT_MS	2U	/* a 600 byte copy takes ~100 us */
+
+/* tx status vector bits */
+#define		TSV2_COLCNT		0x0FU
+#define		TSV2_DONE		0x80U
+#define		TSV3_EXDEFER		0x08U
+#define		TSV3_EXCOL		0x10U
+#define		TSV3_LATECOL		0x20U
+
+typedef struct enc28j60_tx_ring {
+	uint16_t	len[ENC28J60_TX_SLOTS];	/* frame length in the slot */
+	uint8_t		head;			/* next free slot */
+	uint8_t		tail;			/* oldest queued slot */
+	uint8_t		count;			/* slots in use */
+	uint8_t		busy;			/* tail slot is being sent */
+	uint32_t	started;		/* tick of TXRTS */
+} enc28j60_tx_ring_t;
+
+static enc28j60_tx_ring_t tx_ring;
+static enc28j60_tx_stat_t tx_stat;
+
+/* replies built from the rx ring, see enc28j60_set_rx_hook() */
+static enc28j60_rxhook_t rx_hook;
+static uint16_t rx_hook_head;
+
+/* rx filter registers, restored by enc28j60_init() */
+typedef struct enc28j60_rxf {
+	uint8_t		valid;
+	uint8_t		erxfcon;
+	uint8_t		epmm[ENC28J60_PM_WINDOW / 8U];
+	uint8_t		eht[8];
+	uint16_t	epmo;
+	uint16_t	epmcs;
+} enc28j60_rxf_t;
+
+static enc28j60_rxf_t rxf;
 
 /* set by SPI routines */
 /* shared by all functions using spi1*/
@@ -67,27 +174,27 @@ volatile	uint32_t	enc_hw_err_cnt = 0;
 
 /**
   * @brief  enc28j60_rxtx is a basic function for reading and writing ENC28J60 registers
-  * @note
+  * @note   must be called inside a CS frame, see enc28j60_op_begin()
   * @param  a data byte to be sent
   * @retval a read data byte
   */
 uint8_t enc28j60_rxtx(uint8_t data)
 {
-static	HAL_StatusTypeDef	IOresult;
-	uint8_t		retdata;
-	retdata = 0u;
-//	if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
-//		taskENTER_CRITICAL();
-//	}
-//	ENC28J60_CS_L;
-//	ENC28J60_CS_L;
-//	ENC28J60_CS_L;
-	IOresult = HAL_SPI_TransmitReceive(&hspi2, &data, &retdata, (uint16_t)0x01, (uint32_t)0x05);
-//	ENC28J60_CS_H;
-//	if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
-//		taskEXIT_CRITICAL();
-//	}
-	return retdata;
+	return ENC28J60_SPI_XCHG(data);
+}
+
+/* opens a CS framed op */
+static inline void enc28j60_op_begin(void)
+{
+	ENC28J60_SPI_SYNC();
+	ENC28J60_CS_L;
+}
+
+/* closes a CS framed op */
+static inline void enc28j60_op_end(void)
+{
+	ENC28J60_SPI_FLUSH();
+	ENC28J60_CS_H;
 }
 
 #define enc28j60_rx() enc28j60_rxtx((uint8_t)0xff)
@@ -98,22 +205,22 @@ uint8_t enc28j60_read_op(uint8_t cmd, uint8_t adr)
 {
 	uint8_t data;
 
-	ENC28J60_CS_L;
+	enc28j60_op_begin();
 	enc28j60_tx(cmd | (adr & ENC28J60_ADDR_MASK));
 	if(adr & 0x80) // throw out dummy byte
 		enc28j60_rx(); // when reading MII/MAC register
 	data = enc28j60_rx();
-	ENC28J60_CS_H;
+	enc28j60_op_end();
 	return data;
 }
 
 // Generic SPI write command
 void enc28j60_write_op(uint8_t cmd, uint8_t adr, uint8_t data)
 {
-	ENC28J60_CS_L;
+	enc28j60_op_begin();
 	enc28j60_tx(cmd | (adr & ENC28J60_ADDR_MASK));
 	enc28j60_tx(data);
-	ENC28J60_CS_H;
+	enc28j60_op_end();
 }
 
 
@@ -125,9 +232,9 @@ void enc28j60_write_op(uint8_t cmd, uint8_t adr, uint8_t data)
   */
 void enc28j60_soft_reset(void)
 {
-	ENC28J60_CS_L;
+	enc28j60_op_begin();
 	enc28j60_tx(ENC28J60_SPI_SC);
-	ENC28J60_CS_H;
+	enc28j60_op_end();
 
 	enc28j60_current_bank = 0;
 
@@ -148,8 +255,13 @@ void enc28j60_set_bank(uint8_t adr)
 	if( (adr & ENC28J60_ADDR_MASK) < ENC28J60_COMMON_CR ) {
 		bank = (adr >> 5) & 0x03; //BSEL1|BSEL0=0x03
 		if(bank != enc28j60_current_bank) {
-			enc28j60_write_op(ENC28J60_SPI_BFC, ECON1, 0x03);
-			enc28j60_write_op(ENC28J60_SPI_BFS, ECON1, bank);
+			// touch only the bits which differ
+			if ((enc28j60_current_bank & ~bank) != 0U)
+				enc28j60_write_op(ENC28J60_SPI_BFC, ECON1,
+						  enc28j60_current_bank & ~bank);
+			if ((bank & ~enc28j60_current_bank) != 0U)
+				enc28j60_write_op(ENC28J60_SPI_BFS, ECON1,
+						  bank & ~enc28j60_current_bank);
 			enc28j60_current_bank = bank;
 		}
 	}
@@ -199,57 +311,172 @@ void enc28j60_bfs(uint8_t adr, uint8_t mask)
 	enc28j60_write_op(ENC28J60_SPI_BFS, adr, mask);
 }
 
-// Read Rx/Tx buffer (at ERDPT)
-void enc28j60_read_buffer(uint8_t *buf, uint16_t len)
+/*
+ * Batched register ops
+ * A batch is built and run with ETH_Mutex01Handle taken. Bank switches
+ * are resolved while building, against the cached bank. Each op still
+ * gets its own CS frame (the chip latches the opcode on CS), but the ops
+ * are clocked back to back by polled SPI, without the per-byte HAL calls.
+ */
+
+// Start an empty batch
+void enc28j60_batch_init(enc28j60_batch_t *b)
 {
-	ENC28J60_CS_L;
-	enc28j60_tx(ENC28J60_SPI_RBM);
+	b->n = 0U;
+	b->bank = enc28j60_current_bank;
+	b->overflow = 0U;
+}
 
-#ifdef	USE_HAL_IO_SPI
-	while(len--) {
-		*(buf++) = enc28j60_rx();
-	}
+static void enc28j60_batch_put(enc28j60_batch_t *b, uint8_t cmd, uint8_t adr,
+			       uint8_t data)
+{
+	enc28j60_op_t	*op;
 
-#endif
-#ifdef	USE_HAL_DMA_SPI
-	HAL_StatusTypeDef	IOresult;
-	RX_ready_flag = 0;
+	if (b->n >= ENC28J60_BATCH_MAX) {
+		b->overflow = 1U;
+		return;
+	}
+	op = &b->op[b->n++];
+	op->cmd = cmd | (adr & ENC28J60_ADDR_MASK);
+	op->data = data;
+	op->dummy = ((cmd == ENC28J60_SPI_RCR) && ((adr & 0x80) != 0U)) ? 1U : 0U;
+}
 
-	if (len > sizeof(uint16_t)) {
-		IOresult = HAL_SPI_Receive_DMA(&hspi2, buf, len);
-		while (RX_ready_flag == 0) { taskYIELD();}
+static void enc28j60_batch_set_bank(enc28j60_batch_t *b, uint8_t adr)
+{
+	uint8_t bank;
 
-	} else {
-		IOresult = HAL_SPI_Receive(&hspi2, buf, len, 05);
+	if ((adr & ENC28J60_ADDR_MASK) < ENC28J60_COMMON_CR) {
+		bank = (adr >> 5) & 0x03;
+		if (bank != b->bank) {
+			if ((b->bank & ~bank) != 0U)
+				enc28j60_batch_put(b, ENC28J60_SPI_BFC, ECON1,
+						   b->bank & ~bank);
+			if ((bank & ~b->bank) != 0U)
+				enc28j60_batch_put(b, ENC28J60_SPI_BFS, ECON1,
+						   bank & ~b->bank);
+			b->bank = bank;
+		}
 	}
-#endif
+}
 
-	ENC28J60_CS_H;
+// Queue register read, returns index for enc28j60_batch_result()
+uint8_t enc28j60_batch_rcr(enc28j60_batch_t *b, uint8_t adr)
+{
+	enc28j60_batch_set_bank(b, adr);
+	enc28j60_batch_put(b, ENC28J60_SPI_RCR, adr, 0U);
+	return (uint8_t)(b->n - 1U);
 }
 
-// Write Rx/Tx buffer (at EWRPT)
-void enc28j60_write_buffer(uint8_t *buf, uint16_t len)
+// Queue register write
+void enc28j60_batch_wcr(enc28j60_batch_t *b, uint8_t adr, uint8_t arg)
 {
-	ENC28J60_CS_L;
-	enc28j60_tx(ENC28J60_SPI_WBM);
+	enc28j60_batch_set_bank(b, adr);
+	enc28j60_batch_put(b, ENC28J60_SPI_WCR, adr, arg);
+}
 
-#ifdef	USE_HAL_IO_SPI
-	while(len--)  {
-		enc28j60_tx(*(buf++));
+// Queue register pair write
+void enc28j60_batch_wcr16(enc28j60_batch_t *b, uint8_t adr, uint16_t arg)
+{
+	enc28j60_batch_set_bank(b, adr);
+	enc28j60_batch_put(b, ENC28J60_SPI_WCR, adr, (uint8_t)arg);
+	enc28j60_batch_put(b, ENC28J60_SPI_WCR, adr + 1U, (uint8_t)(arg >> 8));
+}
+
+// Queue bit clear
+void enc28j60_batch_bfc(enc28j60_batch_t *b, uint8_t adr, uint8_t mask)
+{
+	enc28j60_batch_set_bank(b, adr);
+	enc28j60_batch_put(b, ENC28J60_SPI_BFC, adr, mask);
+}
+
+// Queue bit set
+void enc28j60_batch_bfs(enc28j60_batch_t *b, uint8_t adr, uint8_t mask)
+{
+	enc28j60_batch_set_bank(b, adr);
+	enc28j60_batch_put(b, ENC28J60_SPI_BFS, adr, mask);
+}
+
+/**
+  * @brief  enc28j60_batch_run clocks out the queued ops
+  * @param  b the batch, read results are stored in place
+  * @retval ERROR if the batch overflowed (nothing is sent), SUCCESS otherwise
+  */
+ErrorStatus enc28j60_batch_run(enc28j60_batch_t *b)
+{
+	enc28j60_op_t	*op;
+	uint8_t		i;
+
+	if (b->overflow != 0U) {
+		return ERROR;
 	}
-#endif
+	ENC28J60_SPI_SYNC();
+	for (i = 0U; i < b->n; i++) {
+		op = &b->op[i];
+		ENC28J60_CS_L;
+		(void)ENC28J60_SPI_XCHG(op->cmd);
+		if ((op->cmd & 0xE0U) == ENC28J60_SPI_RCR) {
+			if (op->dummy != 0U) {
+				(void)ENC28J60_SPI_XCHG(0xFFU);
+			}
+			op->data = ENC28J60_SPI_XCHG(0xFFU);
+		} else {
+			(void)ENC28J60_SPI_XCHG(op->data);
+		}
+		enc28j60_op_end();
+	}
+	enc28j60_current_bank = b->bank;
+	return SUCCESS;
+}
+
+// Read data of an open RBM op
+static void enc28j60_rbm_data(uint8_t *buf, uint16_t len)
+{
 #ifdef	USE_HAL_DMA_SPI
-	HAL_StatusTypeDef	IOresult;
-	TX_done_flag = 0;
+	if (len >= ENC28J60_DMA_MIN) {
+		RX_ready_flag = 0;
+		(void)HAL_SPI_Receive_DMA(&hspi2, buf, len);
+		while (RX_ready_flag == 0) { taskYIELD();}
+		return;
+	}
+#endif
+	while(len--) {
+		*(buf++) = enc28j60_rx();
+	}
+}
 
-	if (len > sizeof(uint16_t)) {
-		IOresult = HAL_SPI_Transmit_DMA(&hspi2, buf, len);
+// Write data of an open WBM op
+static void enc28j60_wbm_data(const uint8_t *buf, uint16_t len)
+{
+#ifdef	USE_HAL_DMA_SPI
+	if (len >= ENC28J60_DMA_MIN) {
+		TX_done_flag = 0;
+		(void)HAL_SPI_Transmit_DMA(&hspi2, (uint8_t *)buf, len);
 		while (TX_done_flag == 0) { taskYIELD();}
-	} else {
-		IOresult = HAL_SPI_Transmit(&hspi2, buf, len, 05);
+		return;
 	}
 #endif
-	ENC28J60_CS_H;
+	while(len--)  {
+		enc28j60_tx(*(buf++));
+	}
+}
+
+// Read Rx/Tx buffer (at ERDPT)
+void enc28j60_read_buffer(uint8_t *buf, uint16_t len)
+{
+	enc28j60_op_begin();
+	enc28j60_tx(ENC28J60_SPI_RBM);
+	enc28j60_rbm_data(buf, len);
+	enc28j60_op_end();
+}
+
+// Write Rx/Tx buffer (at EWRPT)
+void enc28j60_write_buffer(uint8_t *buf, uint16_t len)
+{
+	enc28j60_op_begin();
+	enc28j60_tx(ENC28J60_SPI_WBM);
+	enc28j60_wbm_data(buf, len);
+	enc28j60_op_end();
 }
 
 // Read PHY register
@@ -277,6 +504,65 @@ void enc28j60_write_phy(uint8_t adr, uint16_t data)
  * Init & packet Rx/Tx
  */
 
+// Write rx filter registers
+static void enc28j60_rxf_write(void)
+{
+	uint8_t i;
+
+	for (i = 0U; i < 8U; i++) {
+		enc28j60_wcr((uint8_t)(EHT0 + i), rxf.eht[i]);
+		enc28j60_wcr((uint8_t)(EPMM0 + i), rxf.epmm[i]);
+	}
+	enc28j60_wcr16(EPMCSL, rxf.epmcs);
+	enc28j60_wcr16(EPMOL, rxf.epmo);
+	enc28j60_wcr(ERXFCON, rxf.erxfcon);
+}
+
+/**
+  * @brief  enc28j60_set_rx_filter programs ERXFCON, the pattern match
+  *         and the hash table filters
+  * @note   the pattern checksum is computed here; it is the IP checksum
+  *         of the masked bytes taken in order, EPMCSH is the first byte
+  * @param  f filters, NULL restores the reset default
+  */
+void enc28j60_set_rx_filter(const enc28j60_rx_filter_t *f)
+{
+	uint8_t sel[ENC28J60_PM_WINDOW];
+	uint16_t n = 0U;
+	uint16_t i;
+	uint16_t ck;
+
+	if (f == NULL) {
+		if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
+			memset(&rxf, 0, sizeof(rxf));
+			rxf.erxfcon = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN;
+			enc28j60_rxf_write();
+			xSemaphoreGive(ETH_Mutex01Handle);
+		}
+		return;
+	}
+	for (i = 0U; i < ENC28J60_PM_WINDOW; i++) {
+		if ((f->pm_mask[i >> 3] & (1U << (i & 7U))) != 0U) {
+			sel[n++] = f->pm_data[i];
+		}
+	}
+	ck = inet_cksum(sel, n); /* memory order: the first byte is low */
+
+/* Take MUTEX */
+	if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
+		rxf.erxfcon = f->erxfcon;
+		memcpy(rxf.epmm, f->pm_mask, sizeof(rxf.epmm));
+		memcpy(rxf.eht, f->ht, sizeof(rxf.eht));
+		rxf.epmo = f->pm_offset;
+		rxf.epmcs = (uint16_t)((ck << 8) | (ck >> 8));
+		rxf.valid = 1U;
+		enc28j60_rxf_write();
+/* Give MUTEX */
+		xSemaphoreGive(ETH_Mutex01Handle);
+	}
+}
+
+
 void enc28j60_init(const uint8_t *macadr)
 {
 	// Initialize SPI
@@ -294,7 +580,9 @@ void enc28j60_init(const uint8_t *macadr)
 		s = enc28j60_rcr(ESTAT);
 	} while ((s & (uint8_t)ESTAT_CLKRDY) == 0u);
 
-	// Setup Rx/Tx buffer
+	// Setup Rx/Tx buffer, queued frames are lost
+	tx_stat.drops += tx_ring.count;
+	memset(&tx_ring, 0, sizeof(tx_ring));
 	enc28j60_wcr16(ERXST, ENC28J60_RXSTART);
 	enc28j60_wcr16(ERXRDPT, ENC28J60_RXSTART);
 	enc28j60_wcr16(ERXND, ENC28J60_RXEND);
@@ -324,86 +612,391 @@ void enc28j60_init(const uint8_t *macadr)
 		PHLCON_LBCFG2|PHLCON_LBCFG1|PHLCON_LBCFG0|
 		PHLCON_LFRQ0|PHLCON_STRCH);
 
+	// Rx filters, the reset default (unicast, broadcast, CRC) until set
+	if (rxf.valid != 0U) {
+		enc28j60_rxf_write();
+	}
+
+#if (LAN_RX_INTERRUPT == 1)
+	// INT pin goes low on pending Rx packet or finished Tx
+	enc28j60_wcr(EIE, EIE_INTIE|EIE_PKTIE|EIE_TXIE|EIE_TXERIE);
+#endif
+
 	// Enable Rx packets
 	enc28j60_bfs(ECON1, ECON1_RXEN);
 }
 
-void enc28j60_send_packet(uint8_t *data, uint16_t len)
+/**
+  * @brief  enc28j60_int_enable (re)arms the INT pin
+  * @note   if a packet is still pending INT is asserted again at once
+  */
+void enc28j60_int_enable(void)
 {
-/* Take MUTEX */
 	if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
-//		while(enc28j60_rcr(ECON1) & ECON1_TXRTS)      // wait while tx logic is busy
-//		{
+		enc28j60_bfs(EIE, EIE_INTIE);
+		xSemaphoreGive(ETH_Mutex01Handle);
+	}
+}
+
+/**
+  * @brief  enc28j60_int_disable releases the INT pin
+  */
+void enc28j60_int_disable(void)
+{
+	if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
+		enc28j60_bfc(EIE, EIE_INTIE);
+		xSemaphoreGive(ETH_Mutex01Handle);
+	}
+}
+
+/**
+  * @brief  enc28j60_tx_start starts transmission of the tail slot
+  * @note   ETH_Mutex01Handle must be taken
+  */
+static void enc28j60_tx_start(void)
+{
+	enc28j60_batch_t	b;
+	uint16_t		adr = ENC28J60_TX_SLOT(tx_ring.tail);
+
+	enc28j60_batch_init(&b);
+	enc28j60_batch_wcr16(&b, ETXST, adr);
+	enc28j60_batch_wcr16(&b, ETXND, adr + tx_ring.len[tx_ring.tail]);
+	enc28j60_batch_bfs(&b, ECON1, ECON1_TXRTS); // Request packet send
+	(void)enc28j60_batch_run(&b);
+	tx_ring.busy = 1U;
+	tx_ring.started = HAL_GetTick();
+}
+
+/**
+  * @brief  enc28j60_tx_service retires the finished frame and starts the next one
+  * @note   ETH_Mutex01Handle must be taken
+  */
+static void enc28j60_tx_service(void)
+{
+	enc28j60_batch_t	b;
+	uint8_t			con;
+	uint8_t			ir;
+	uint8_t			tsv[ENC28J60_TSV_LEN];
+
+	if (tx_ring.busy != 0U) {
+		enc28j60_batch_init(&b);
+		con = enc28j60_batch_rcr(&b, ECON1);
+		ir = enc28j60_batch_rcr(&b, EIR);
+		(void)enc28j60_batch_run(&b);
+		con = enc28j60_batch_result(&b, con);
+		ir = enc28j60_batch_result(&b, ir);
+
+		if ((con & ECON1_TXRTS) != 0U) {
+			if (((ir & EIR_TXERIF) == 0U) &&
+			    ((HAL_GetTick() - tx_ring.started) < ENC28J60_TX_TIMEOUT_MS)) {
+				return; // still sending
+			}
 			// TXRTS may not clear - ENC28J60 bug. We must reset
 			// transmit logic in cause of Tx error
-//			if(enc28j60_rcr(EIR) & EIR_TXERIF)
-//			{
-//				enc28j60_bfs(ECON1, ECON1_TXRST);
-//				enc28j60_bfc(ECON1, ECON1_TXRST);
-//			}
-//		}
+			tx_stat.errors++;
+			tx_stat.drops++;
+		} else {
+			enc28j60_wcr16(ERDPT, ENC28J60_TX_SLOT(tx_ring.tail) +
+				       tx_ring.len[tx_ring.tail] + 1U);
+			enc28j60_read_buffer(tsv, ENC28J60_TSV_LEN);
+			tx_stat.collisions += tsv[2] & TSV2_COLCNT;
+			if ((tsv[3] & TSV3_LATECOL) != 0U) {
+				tx_stat.late_col++;
+			}
+			if ((tsv[3] & (TSV3_EXCOL | TSV3_EXDEFER)) != 0U) {
+				tx_stat.aborts++;
+			} else if (((tsv[2] & TSV2_DONE) != 0U) && ((ir & EIR_TXERIF) == 0U)) {
+				tx_stat.ok++;
+			} else {
+				tx_stat.drops++;
+			}
+			if ((ir & EIR_TXERIF) != 0U) {
+				tx_stat.errors++;
+			}
+		}
+		enc28j60_batch_init(&b);
+		if ((ir & EIR_TXERIF) != 0U || (con & ECON1_TXRTS) != 0U) {
+			enc28j60_batch_bfs(&b, (uint8_t)ECON1, (uint8_t)ECON1_TXRST);
+			enc28j60_batch_bfc(&b, (uint8_t)ECON1, (uint8_t)(ECON1_TXRST|ECON1_TXRTS));
+		}
+		enc28j60_batch_bfc(&b, (uint8_t)EIR, (uint8_t)(EIR_TXIF|EIR_TXERIF));
+		(void)enc28j60_batch_run(&b);
+
+		tx_ring.busy = 0U;
+		tx_ring.tail = (uint8_t)((tx_ring.tail + 1U) % ENC28J60_TX_SLOTS);
+		tx_ring.count--;
+	}
+	if (tx_ring.count != 0U) {
+		enc28j60_tx_start();
+	}
+}
+
+/**
+  * @brief  enc28j60_tx_poll services the tx ring, called by the lan task
+  */
+void enc28j60_tx_poll(void)
+{
+	if ((tx_ring.busy == 0U) && (tx_ring.count == 0U)) {
+		return;
+	}
+	if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
+		enc28j60_tx_service();
+		xSemaphoreGive(ETH_Mutex01Handle);
+	}
+}
+
+/**
+  * @brief  enc28j60_get_tx_stat
+  * @retval pointer to the tx counters
+  */
+const enc28j60_tx_stat_t *enc28j60_get_tx_stat(void)
+{
+	return &tx_stat;
+}
+
+/**
+  * @brief  enc28j60_tx_slot_write writes the control byte and the frame
+  *         pieces into the head slot of the tx ring in one WBM op
+  * @note   ETH_Mutex01Handle must be taken, the slot must be free
+  */
+static void enc28j60_tx_slot_write(const uint8_t *hdr, uint16_t hdrlen,
+				   const uint8_t *data, uint16_t len)
+{
+	static const uint8_t ctrl = 0x00U;	/* per packet control byte */
+
+	enc28j60_wcr16(EWRPT, ENC28J60_TX_SLOT(tx_ring.head));
+	enc28j60_op_begin();
+	enc28j60_tx(ENC28J60_SPI_WBM);
+	enc28j60_wbm_data(&ctrl, 1U);
+	enc28j60_wbm_data(hdr, hdrlen);
+	if (len != 0U) {
+		enc28j60_wbm_data(data, len);
+	}
+	enc28j60_op_end();
+}
+
+/**
+  * @brief  enc28j60_tx_slot_commit queues the head slot of len bytes,
+  *         started at once if the transmitter is idle
+  * @note   ETH_Mutex01Handle must be taken
+  */
+static void enc28j60_tx_slot_commit(uint16_t len)
+{
+	tx_ring.len[tx_ring.head] = len;
+	tx_ring.head = (uint8_t)((tx_ring.head + 1U) % ENC28J60_TX_SLOTS);
+	tx_ring.count++;
+	tx_stat.frames++;
+	if (tx_ring.busy == 0U) {
+		enc28j60_tx_start();
+	}
+}
+
+/**
+  * @brief  enc28j60_send_packet2 queues a frame gathered from two pieces
+  * @note   both pieces go into a free tx slot in one WBM op, so a cached
+  *         header and the caller's payload need no staging copy.
+  *         The frame is started at once if the transmitter is idle,
+  *         otherwise when the previous one is finished.
+  * @param  hdr first part of the frame (headers)
+  * @param  hdrlen its length
+  * @param  data second part of the frame (payload), may be NULL
+  * @param  len its length
+  * @retval none
+  */
+void enc28j60_send_packet2(const uint8_t *hdr, uint16_t hdrlen,
+			   const uint8_t *data, uint16_t len)
+{
+	if (data == NULL) {
+		len = 0U;
+	}
+	if ((uint32_t)hdrlen + len > ENC28J60_TX_MAXLEN) {
+		tx_stat.drops++;
+		return;
+	}
+/* Take MUTEX */
+	if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
 		uint8_t		s;
+
 		s = enc28j60_rcr(ESTAT);
 		if ((s & (uint8_t)ESTAT_CLKRDY) == 0u) {
 /*hardware error !*/
-		enc28j60_init(getMAC());
-		enc_hw_err_cnt++;
-			enc28j60_bfs((uint8_t)ECON1, (uint8_t)ECON1_TXRST);
-			enc28j60_bfc((uint8_t)ECON1, (uint8_t)ECON1_TXRST);
-			enc28j60_bfc((uint8_t)EIR, (uint8_t)EIR_TXERIF);
+			enc28j60_init(getMAC());
+			enc_hw_err_cnt++;
 		}
-		uint8_t		a;
-		a = enc28j60_rcr(EIR);
-		if ( (a & (uint8_t)EIR_TXERIF) == (uint8_t)EIR_TXERIF ) {
-			enc28j60_bfs((uint8_t)ECON1, (uint8_t)ECON1_TXRST);
-			enc28j60_bfc((uint8_t)ECON1, (uint8_t)ECON1_TXRST);
-			enc28j60_bfc((uint8_t)EIR, (uint8_t)EIR_TXERIF);
+		enc28j60_tx_service();
+		if (tx_ring.count == ENC28J60_TX_SLOTS) {
+			tx_stat.ring_full++;
+			do {
+				/* let rx and FRAM use the bus meanwhile */
+				xSemaphoreGive(ETH_Mutex01Handle);
+				vTaskDelay(1U);
+				(void)xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY);
+				enc28j60_tx_service();
+			} while (tx_ring.count == ENC28J60_TX_SLOTS);
 		}
 
-		enc28j60_wcr16(EWRPT, ENC28J60_TXSTART);
-		enc28j60_write_buffer((uint8_t*)"\x00", 1);
-		enc28j60_write_buffer(data, len);
-
-		enc28j60_wcr16(ETXST, ENC28J60_TXSTART);
-		enc28j60_wcr16(ETXND, ENC28J60_TXSTART + len);
-
-		enc28j60_bfs(ECON1, ECON1_TXRTS); // Request packet send
+		enc28j60_tx_slot_write(hdr, hdrlen, data, len);
+		enc28j60_tx_slot_commit(hdrlen + len);
 /* Give MUTEX */
 		xSemaphoreGive(ETH_Mutex01Handle);
 	}
 }
 
-uint16_t enc28j60_recv_packet(uint8_t *buf, uint16_t buflen)
+void enc28j60_send_packet(uint8_t *data, uint16_t len)
+{
+	enc28j60_send_packet2(data, len, NULL, 0U);
+}
+
+/* rx ring address a bytes on from the ring start, wrapped */
+static inline uint16_t enc28j60_rx_wrap(uint32_t a)
+{
+	return (uint16_t)((a > ENC28J60_RXEND) ? (a - ENC28J60_RXSIZE) : a);
+}
+
+/**
+  * @brief  enc28j60_dma_copy copies len bytes inside the chip buffer by
+  *         its DMA engine; a source in the rx ring wraps at ERXND
+  * @note   ETH_Mutex01Handle must be taken
+  * @retval SUCCESS, ERROR if the copy did not finish in time
+  */
+static ErrorStatus enc28j60_dma_copy(uint16_t src, uint16_t dst, uint16_t len)
 {
-	uint16_t len = 0, rxlen, status, temp;
+	enc28j60_batch_t	b;
+	uint32_t		start;
+
+	enc28j60_batch_init(&b);
+	enc28j60_batch_wcr16(&b, EDMAST, src);
+	enc28j60_batch_wcr16(&b, EDMAND, enc28j60_rx_wrap((uint32_t)src + len - 1U));
+	enc28j60_batch_wcr16(&b, EDMADST, dst);
+	enc28j60_batch_bfc(&b, ECON1, ECON1_CSUMEN);	/* copy, not checksum */
+	enc28j60_batch_bfs(&b, ECON1, ECON1_DMAST);
+	(void)enc28j60_batch_run(&b);
+	start = HAL_GetTick();
+	while ((enc28j60_rcr(ECON1) & ECON1_DMAST) != 0U) {
+		if ((HAL_GetTick() - start) > ENC28J60_DMA_TIMEOUT_MS) {
+			enc28j60_bfc(ECON1, ECON1_DMAST);
+			return ERROR;
+		}
+	}
+	enc28j60_bfc(EIR, EIR_DMAIF);
+	return SUCCESS;
+}
+
+/**
+  * @brief  enc28j60_rx_reply sends the reply the rx hook made of the head
+  *         of the frame at enc28j60_rxrdpt: the head goes to a tx slot
+  *         over SPI, the rest of the reply is copied from the rx ring
+  * @note   ETH_Mutex01Handle must be taken, a tx slot must be free
+  * @param  head the reply header, rx_hook_head bytes
+  * @param  len reply length
+  */
+static void enc28j60_rx_reply(const uint8_t *head, uint16_t len)
+{
+	uint16_t slot = ENC28J60_TX_SLOT(tx_ring.head);
+	uint16_t src = enc28j60_rx_wrap((uint32_t)enc28j60_rxrdpt +
+					sizeof(enc28j60_rsv_t) + rx_hook_head);
+
+	if (len > ENC28J60_TX_MAXLEN) {
+		tx_stat.drops++;
+		return;
+	}
+	enc28j60_tx_slot_write(head, (len < rx_hook_head) ? len : rx_hook_head, NULL, 0U);
+	if ((len > rx_hook_head) &&
+	    (enc28j60_dma_copy(src, slot + 1U + rx_hook_head, len - rx_hook_head) != SUCCESS)) {
+		tx_stat.dma_errors++;
+		tx_stat.drops++;
+		return;
+	}
+	tx_stat.dma_replies++;
+	enc28j60_tx_slot_commit(len);
+}
+
+/**
+  * @brief  enc28j60_set_rx_hook sets the hook offered the head of every
+  *         frame longer than headlen before the frame is read
+  * @param  hook NULL - no hook
+  * @param  headlen ENC28J60_RX_HEAD_MAX max
+  */
+void enc28j60_set_rx_hook(enc28j60_rxhook_t hook, uint16_t headlen)
+{
+	rx_hook_head = headlen;
+	rx_hook = (headlen <= ENC28J60_RX_HEAD_MAX) ? hook : NULL;
+}
+
+/**
+  * @brief  enc28j60_recv reads the next frame from the rx ring
+  * @note   with the rx hook set the head of a longer frame is read first;
+  *         a frame the hook answered is not read further nor returned
+  * @param  pbuf the buffer; if getbuf is set, the buffer taken is returned here
+  * @param  buflen size of *pbuf
+  * @param  getbuf NULL or the allocator called with the frame length
+  * @retval frame length, 0 if nothing arrived or the frame is bad,
+  *         -1 if getbuf failed: the frame stays in the ring
+  */
+static int32_t enc28j60_recv(uint8_t **pbuf, uint16_t buflen, enc28j60_getbuf_t getbuf)
+{
+	int32_t len = 0;
+	uint16_t temp;
+	uint16_t head = 0U;
+	uint16_t reply = 0U;
+	uint32_t hbuf[ENC28J60_RX_HEAD_MAX / 4U];	/* aligned as the frame buffers */
+	enc28j60_rsv_t rsv;
+	enc28j60_batch_t b;
+	enc28j60_rxhook_t hook;
 /* Take MUTEX */
 	if (xSemaphoreTake(ETH_Mutex01Handle, portMAX_DELAY) == pdTRUE) {
 
 		if(enc28j60_rcr(EPKTCNT) != 0)
 		{
+			/* a reply needs a free tx slot, no waiting here */
+			hook = (tx_ring.count < ENC28J60_TX_SLOTS) ? rx_hook : NULL;
 			enc28j60_wcr16(ERDPT, enc28j60_rxrdpt);      // ERDPT - read ptr, 16 bit
 
-			enc28j60_read_buffer((void*)&enc28j60_rxrdpt, sizeof(enc28j60_rxrdpt));
-						// 1st read - next packet ptr  16bit
-			enc28j60_read_buffer((void*)&rxlen, sizeof(rxlen));
-						// 2nd read - length of eth packet
-			enc28j60_read_buffer((void*)&status, sizeof(status));
-						// 3rd read - status flags. if 16th bit is set - RX OK!
-			if(status & 0x80) //success
+			// one RBM op: receive status vector, then the frame itself
+			enc28j60_op_begin();
+			enc28j60_tx(ENC28J60_SPI_RBM);
+			enc28j60_rbm_data((uint8_t *)&rsv, sizeof(rsv));
+			if(rsv.status & 0x80) //success
 			{
-				if ((rxlen >= MIN_ETH_FRAME_SIZE) && (rxlen <= (buflen-4))) {
-					len = rxlen - 4; //throw out crc
-					enc28j60_read_buffer(buf, len);
+				if ((rsv.rxlen >= MIN_ETH_FRAME_SIZE) && (rsv.rxlen <= (buflen-4))) {
+					len = rsv.rxlen - 4; //throw out crc
+					if ((hook != NULL) && (len > rx_hook_head)) {
+						head = rx_hook_head;
+						enc28j60_rbm_data((uint8_t *)hbuf, head);
+						reply = hook((uint8_t *)hbuf, (uint16_t)len);
+					}
+					if ((reply == 0U) && (getbuf != NULL)) {
+						*pbuf = getbuf((uint16_t)len);
+					}
+					if (reply != 0U) {
+						/* answered below, the frame is not read */
+					} else if (*pbuf != NULL) {
+						memcpy(*pbuf, hbuf, head);
+						enc28j60_rbm_data(*pbuf + head, (uint16_t)len - head);
+					} else {
+						len = -1;
+					}
 				} else {
 					bad_eth_frames_cnt++;
 				}
 			}
-			// Set Rx read pointer to next packet
-			temp = (enc28j60_rxrdpt - 1) & ENC28J60_BUFEND;
-			enc28j60_wcr16(ERXRDPT, temp);
+			enc28j60_op_end();
 
-			// Decrement packet counter
-			enc28j60_bfs(ECON2, ECON2_PKTDEC);
+			if (reply != 0U) {
+				enc28j60_rx_reply((uint8_t *)hbuf, reply);
+			}
+			if (len >= 0) {
+				// Set Rx read pointer to next packet
+				// and decrement packet counter
+				// ERXRDPT must be odd (errata) and inside the ring
+				enc28j60_rxrdpt = rsv.next;
+				temp = (enc28j60_rxrdpt == ENC28J60_RXSTART) ? ENC28J60_RXEND :
+					(enc28j60_rxrdpt - 1);
+				enc28j60_batch_init(&b);
+				enc28j60_batch_wcr16(&b, ERXRDPT, temp);
+				enc28j60_batch_bfs(&b, ECON2, ECON2_PKTDEC);
+				(void)enc28j60_batch_run(&b);
+			}
 		}
 /* Give MUTEX */
 		xSemaphoreGive(ETH_Mutex01Handle);
@@ -411,5 +1004,25 @@ uint16_t enc28j60_recv_packet(uint8_t *buf, uint16_t buflen)
 	return len;
 }
 
+uint16_t enc28j60_recv_packet(uint8_t *buf, uint16_t buflen)
+{
+	return (uint16_t)enc28j60_recv(&buf, buflen, NULL);
+}
+
+/**
+  * @brief  enc28j60_recv_packet_alloc reads the length of the next frame
+  *         first and takes the buffer for it from getbuf
+  * @param  getbuf allocator, called with the frame length w/o CRC
+  * @param  pbuf the buffer taken, NULL if none or if the rx hook
+  *         answered the frame
+  * @retval frame length, 0 if nothing arrived or the frame is bad,
+  *         -1 if getbuf failed: the frame stays in the ring
+  */
+int32_t enc28j60_recv_packet_alloc(enc28j60_getbuf_t getbuf, uint8_t **pbuf)
+{
+	*pbuf = NULL;
+	return enc28j60_recv(pbuf, ENC28J60_MAXFRAME, getbuf);
+}
+
 /*########################### EOF ################################################################*/
 
@@ -0,0 +1,90 @@
+/** @file cmsis_host.h
+ *  @brief host versions of the CMSIS core intrinsics
+ *
+ *  Force-included (-include) ahead of the sources so that the guard of
+ *  cmsis_gcc.h is taken and the ARM inline assembly is never seen.
+ *  There is a single thread on the host: LDREX/STREX are plain
+ *  accesses and STREX always succeeds, barriers are compiler fences.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef CMSIS_HOST_H
+#define CMSIS_HOST_H
+
+#define __CMSIS_GCC_H
+
+#include <stdint.h>
+
+#ifndef __ASM
+#define __ASM		__asm
+#endif
+#ifndef __INLINE
+#define __INLINE	inline
+#endif
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE	static inline
+#endif
+
+static inline void __enable_irq(void) { }
+static inline void __disable_irq(void) { }
+static inline void __enable_fault_irq(void) { }
+static inline void __disable_fault_irq(void) { }
+static inline uint32_t __get_PRIMASK(void) { return 0U; }
+static inline void __set_PRIMASK(uint32_t v) { (void)v; }
+static inline uint32_t __get_BASEPRI(void) { return 0U; }
+static inline void __set_BASEPRI(uint32_t v) { (void)v; }
+static inline void __set_BASEPRI_MAX(uint32_t v) { (void)v; }
+static inline uint32_t __get_IPSR(void) { return 0U; }	/* thread mode */
+static inline uint32_t __get_CONTROL(void) { return 0U; }
+
+static inline void __NOP(void) { }
+static inline void __WFI(void) { }
+static inline void __WFE(void) { }
+static inline void __SEV(void) { }
+static inline void __ISB(void) { __sync_synchronize(); }
+static inline void __DSB(void) { __sync_synchronize(); }
+static inline void __DMB(void) { __sync_synchronize(); }
+
+static inline uint32_t __REV(uint32_t v) { return __builtin_bswap32(v); }
+static inline uint32_t __REV16(uint32_t v)
+{
+	return ((v & 0xFF00FF00U) >> 8) | ((v & 0x00FF00FFU) << 8);
+}
+static inline int32_t __REVSH(int32_t v)
+{
+	return (int16_t)__builtin_bswap16((uint16_t)v);
+}
+static inline uint32_t __ROR(uint32_t v, uint32_t n)
+{
+	n &= 31U;
+	return (n == 0U) ? v : ((v >> n) | (v << (32U - n)));
+}
+static inline uint32_t __RBIT(uint32_t v)
+{
+	uint32_t r = 0U;
+
+	for (unsigned int i = 0U; i < 32U; i++) {
+		r = (r << 1) | ((v >> i) & 1U);
+	}
+	return r;
+}
+/* CLZ of 0 is 32 on the core, undefined for the builtin */
+static inline uint8_t __CLZ(uint32_t v)
+{
+	return (v == 0U) ? 32U : (uint8_t)__builtin_clz(v);
+}
+
+static inline uint8_t __LDREXB(volatile uint8_t *p) { return *p; }
+static inline uint16_t __LDREXH(volatile uint16_t *p) { return *p; }
+static inline uint32_t __LDREXW(volatile uint32_t *p) { return *p; }
+static inline uint32_t __STREXB(uint8_t v, volatile uint8_t *p) { *p = v; return 0U; }
+static inline uint32_t __STREXH(uint16_t v, volatile uint16_t *p) { *p = v; return 0U; }
+static inline uint32_t __STREXW(uint32_t v, volatile uint32_t *p) { *p = v; return 0U; }
+static inline void __CLREX(void) { }
+
+#define __BKPT(value)	__builtin_trap()
+
+#endif // CMSIS_HOST_H
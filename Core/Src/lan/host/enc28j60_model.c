@@ -0,0 +1,584 @@
+/** @file enc28j60_model.c
+ *  @brief host-side ENC28J60 SPI register model
+ *
+ *  Covers what the driver uses: 4 register banks + common registers,
+ *  8K buffer SRAM with ERDPT/EWRPT auto-increment and rx ring wrap,
+ *  receive status vectors, EPKTCNT/PKTDEC, TXRTS, MII access, EIE/EIR,
+ *  the INT pin, the DMA copy and the unicast, broadcast, multicast and
+ *  pattern match rx filters. Timing, collisions, the DMA checksum and the
+ *  hash table and magic packet filters are not modelled.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <string.h>
+
+#include "enc28j60_model.h"
+#include "enc28j60.h"
+
+#define	MDL_TX_MAXLEN	1536U
+#define	MDL_RSV_LEN	6U
+#define	MDL_CRC_LEN	4U
+
+enum spi_state {
+	SPI_IDLE = 0,		/* CS is high */
+	SPI_CMD,		/* waiting for the opcode */
+	SPI_RCR_DUMMY,		/* MAC/MII read, dummy byte */
+	SPI_RCR,
+	SPI_RBM,
+	SPI_WCR,
+	SPI_WBM,
+	SPI_BFS,
+	SPI_BFC,
+	SPI_DONE,		/* ignore the rest of the frame */
+};
+
+static uint8_t regs[4][32];
+static uint8_t sram[ENC28J60_BUFSIZE];
+static uint16_t phy[32];
+static uint16_t rx_wr;		/* internal ERXWRPT */
+
+static enum spi_state state = SPI_IDLE;
+static uint8_t op_adr;
+static bool int_level;		/* true - asserted (pin low) */
+static enc28j60_model_int_cb_t int_cb = NULL;
+static enc28j60_model_tx_cb_t tx_cb = NULL;
+
+static uint8_t tx_log[ENC28J60_MODEL_TX_LOG][MDL_TX_MAXLEN];
+static uint16_t tx_log_len[ENC28J60_MODEL_TX_LOG];
+static size_t tx_log_cnt;
+
+static enc28j60_model_stat_t stat;
+
+/* register by bank and 5-bit address; 0x1B..0x1F are common */
+static uint8_t *reg_p(uint8_t bank, uint8_t a)
+{
+	a &= ENC28J60_ADDR_MASK;
+	if (a >= ENC28J60_COMMON_CR) {
+		bank = 0U;
+	}
+	return &regs[bank & 0x03U][a];
+}
+
+/* register by driver address constant (bank bits 6:5) */
+static uint8_t *reg_a(uint8_t adr)
+{
+	return reg_p((uint8_t)((adr >> 5) & 0x03U), adr);
+}
+
+static uint16_t get16(uint8_t adr)
+{
+	return (uint16_t)(*reg_a(adr) | (*reg_a((uint8_t)(adr + 1U)) << 8));
+}
+
+static void set16(uint8_t adr, uint16_t v)
+{
+	*reg_a(adr) = (uint8_t)v;
+	*reg_a((uint8_t)(adr + 1U)) = (uint8_t)(v >> 8);
+}
+
+static uint8_t cur_bank(void)
+{
+	return (uint8_t)(*reg_a(ECON1) & (ECON1_BSEL1 | ECON1_BSEL0));
+}
+
+static bool is_mac_mii(uint8_t bank, uint8_t a)
+{
+	if (a >= ENC28J60_COMMON_CR) {
+		return false;
+	}
+	if (bank == 2U) {
+		return true;
+	}
+	return (bank == 3U) && ((a <= 0x05U) || (a == 0x0AU));
+}
+
+static void update_int(void)
+{
+	uint8_t eie = *reg_a(EIE);
+	uint8_t eir = *reg_a(EIR);
+	bool lvl = ((eie & EIE_INTIE) != 0U) && ((eie & eir & 0x7FU) != 0U);
+
+	if (lvl) {
+		*reg_a(ESTAT) |= ESTAT_INT;
+	} else {
+		*reg_a(ESTAT) &= (uint8_t)~ESTAT_INT;
+	}
+	if (lvl && !int_level) {
+		stat.int_edges++;
+		int_level = lvl;
+		if (int_cb != NULL) {
+			int_cb();
+		}
+	}
+	int_level = lvl;
+}
+
+static void update_pktif(void)
+{
+	if (*reg_a(EPKTCNT) != 0U) {
+		*reg_a(EIR) |= EIR_PKTIF;
+	} else {
+		*reg_a(EIR) &= (uint8_t)~EIR_PKTIF;
+	}
+}
+
+static uint16_t rx_next(uint16_t p)
+{
+	return (p == get16(ERXND)) ? get16(ERXST) : (uint16_t)((p + 1U) & ENC28J60_BUFEND);
+}
+
+static bool tx_hold;		/* TXRTS stays set until tx_finish() */
+
+static void do_transmit(uint8_t collisions, bool late)
+{
+	uint16_t st = get16(ETXST);
+	uint16_t nd = get16(ETXND);
+	uint16_t len = (uint16_t)(nd - st);
+	uint16_t i;
+
+	if ((nd > st) && (len <= MDL_TX_MAXLEN) && !late) {
+		size_t slot = tx_log_cnt % ENC28J60_MODEL_TX_LOG;
+		for (i = 0U; i < len; i++) {
+			tx_log[slot][i] = sram[(st + 1U + i) & ENC28J60_BUFEND];
+		}
+		tx_log_len[slot] = len;
+		tx_log_cnt++;
+		stat.tx_frames++;
+		if (tx_cb != NULL) {
+			tx_cb(tx_log[slot], len);
+		}
+		/* transmit status vector: byte count, "done" */
+		for (i = 0U; i < 7U; i++) {
+			sram[(nd + 1U + i) & ENC28J60_BUFEND] = 0U;
+		}
+		sram[(nd + 1U) & ENC28J60_BUFEND] = (uint8_t)len;
+		sram[(nd + 2U) & ENC28J60_BUFEND] = (uint8_t)(len >> 8);
+		sram[(nd + 3U) & ENC28J60_BUFEND] = (uint8_t)(0x80U | (collisions & 0x0FU));
+		*reg_a(EIR) |= EIR_TXIF;
+	} else {
+		if (late) {
+			sram[(nd + 3U) & ENC28J60_BUFEND] = (uint8_t)(collisions & 0x0FU);
+			sram[(nd + 4U) & ENC28J60_BUFEND] = 0x20U;
+		}
+		*reg_a(EIR) |= EIR_TXERIF;
+	}
+	*reg_a(ECON1) &= (uint8_t)~ECON1_TXRTS;
+}
+
+/* DMA copy, done at once; the source wraps in the rx ring */
+static void do_dma(void)
+{
+	uint16_t src = get16(EDMAST);
+	uint16_t nd = get16(EDMAND);
+	uint16_t dst = get16(EDMADST);
+	bool in_rx = (src >= get16(ERXST)) && (src <= get16(ERXND));
+
+	for (;;) {
+		sram[dst] = sram[src];
+		stat.dma_bytes++;
+		if (src == nd) {
+			break;
+		}
+		src = in_rx ? rx_next(src) : (uint16_t)((src + 1U) & ENC28J60_BUFEND);
+		dst = (uint16_t)((dst + 1U) & ENC28J60_BUFEND);
+	}
+	*reg_a(ECON1) &= (uint8_t)~ECON1_DMAST;
+	*reg_a(EIR) |= EIR_DMAIF;
+}
+
+/* register write with the side effects of the real chip */
+static void reg_write(uint8_t bank, uint8_t a, uint8_t v)
+{
+	uint8_t *r = reg_p(bank, a);
+	uint8_t old = *r;
+
+	a &= ENC28J60_ADDR_MASK;
+	if (a >= ENC28J60_COMMON_CR) {
+		bank = 0U;
+	}
+	*r = v;
+
+	switch (a) {
+	case (EIR & ENC28J60_ADDR_MASK):
+		/* PKTIF is read only */
+		*r = (uint8_t)((v & (uint8_t)~EIR_PKTIF) | (old & EIR_PKTIF));
+		break;
+	case (ESTAT & ENC28J60_ADDR_MASK):
+		*r = (uint8_t)(old | ESTAT_CLKRDY);
+		break;
+	case (ECON2 & ENC28J60_ADDR_MASK):
+		if ((v & ECON2_PKTDEC) != 0U) {
+			if (*reg_a(EPKTCNT) != 0U) {
+				(*reg_a(EPKTCNT))--;
+			}
+			*r &= (uint8_t)~ECON2_PKTDEC;
+			update_pktif();
+		}
+		break;
+	case (ECON1 & ENC28J60_ADDR_MASK):
+		if ((v & ECON1_TXRST) != 0U) {
+			*r &= (uint8_t)~ECON1_TXRTS;
+		} else if (((v & ECON1_TXRTS) != 0U) && ((old & ECON1_TXRTS) == 0U) &&
+			   !tx_hold) {
+			do_transmit(0U, false);
+		}
+		if (((v & ECON1_DMAST) != 0U) && ((old & ECON1_DMAST) == 0U) &&
+		    ((v & ECON1_CSUMEN) == 0U)) {
+			do_dma();
+		}
+		break;
+	default:
+		if ((bank == 0U) && ((a == ERXSTL) || (a == ERXSTH))) {
+			rx_wr = get16(ERXST);
+		} else if ((bank == 2U) && (a == (MIWRH & ENC28J60_ADDR_MASK))) {
+			phy[*reg_a(MIREGADR) & 0x1FU] = get16(MIWR);
+		} else if ((bank == 2U) && (a == (MICMD & ENC28J60_ADDR_MASK))) {
+			if ((v & MICMD_MIIRD) != 0U) {
+				set16(MIRD, phy[*reg_a(MIREGADR) & 0x1FU]);
+			}
+		}
+		break;
+	}
+	update_int();
+}
+
+void enc28j60_model_reset(void)
+{
+	memset(regs, 0, sizeof(regs));
+	memset(phy, 0, sizeof(phy));
+	*reg_a(ECON2) = ECON2_AUTOINC;
+	*reg_a(ESTAT) = ESTAT_CLKRDY;
+	set16(ERXST, 0x05FAU);
+	set16(ERXND, ENC28J60_BUFEND);
+	set16(ERXRDPT, 0x05FAU);
+	rx_wr = 0x05FAU;
+	phy[PHSTAT2] = PHSTAT2_LSTAT | PHSTAT2_DPXSTAT;
+	state = SPI_IDLE;
+	int_level = false;
+}
+
+void enc28j60_model_cs(bool level)
+{
+	if (level) {
+		if (state != SPI_IDLE) {
+			stat.cs_frames++;
+		}
+		state = SPI_IDLE;
+	} else {
+		state = SPI_CMD;
+	}
+}
+
+uint8_t enc28j60_model_xfer(uint8_t mosi)
+{
+	uint8_t miso = 0xFFU;
+	uint8_t bank = cur_bank();
+	uint16_t p;
+
+	if (state == SPI_IDLE) {
+		return miso;
+	}
+	stat.spi_bytes++;
+
+	switch (state) {
+	case SPI_CMD:
+		op_adr = (uint8_t)(mosi & ENC28J60_ADDR_MASK);
+		switch (mosi & 0xE0U) {
+		case ENC28J60_SPI_RCR:
+			state = is_mac_mii(bank, op_adr) ? SPI_RCR_DUMMY : SPI_RCR;
+			break;
+		case (ENC28J60_SPI_RBM & 0xE0U):
+			state = SPI_RBM;
+			break;
+		case ENC28J60_SPI_WCR:
+			state = SPI_WCR;
+			break;
+		case (ENC28J60_SPI_WBM & 0xE0U):
+			state = SPI_WBM;
+			break;
+		case ENC28J60_SPI_BFS:
+			state = SPI_BFS;
+			break;
+		case ENC28J60_SPI_BFC:
+			state = SPI_BFC;
+			break;
+		default:
+			if (mosi == ENC28J60_SPI_SC) {
+				enc28j60_model_reset();
+			}
+			state = SPI_DONE;
+			break;
+		}
+		break;
+	case SPI_RCR_DUMMY:
+		state = SPI_RCR;
+		break;
+	case SPI_RCR:
+		miso = *reg_p(bank, op_adr);
+		break;
+	case SPI_RBM:
+		p = get16(ERDPT);
+		miso = sram[p];
+		if ((*reg_a(ECON2) & ECON2_AUTOINC) != 0U) {
+			set16(ERDPT, rx_next(p));
+		}
+		break;
+	case SPI_WCR:
+		reg_write(bank, op_adr, mosi);
+		state = SPI_DONE;
+		break;
+	case SPI_WBM:
+		p = get16(EWRPT);
+		sram[p] = mosi;
+		if ((*reg_a(ECON2) & ECON2_AUTOINC) != 0U) {
+			set16(EWRPT, (uint16_t)((p + 1U) & ENC28J60_BUFEND));
+		}
+		break;
+	case SPI_BFS:
+		reg_write(bank, op_adr, (uint8_t)(*reg_p(bank, op_adr) | mosi));
+		state = SPI_DONE;
+		break;
+	case SPI_BFC:
+		reg_write(bank, op_adr, (uint8_t)(*reg_p(bank, op_adr) & ~mosi));
+		state = SPI_DONE;
+		break;
+	default:
+		break;
+	}
+	return miso;
+}
+
+/* pattern match: IP checksum of the masked window bytes, big endian;
+ * the window may reach into the CRC of a minimum frame, the frame here
+ * has no CRC and the masked bytes there are taken as 0 */
+static bool rx_pattern_match(const uint8_t *frame, uint16_t len)
+{
+	uint16_t ofs = get16(EPMOL);
+	uint32_t sum = 0U;
+	bool hi = true;
+	uint16_t i;
+	uint8_t b;
+
+	if ((uint32_t)ofs + ENC28J60_PM_WINDOW > (uint32_t)len + MDL_CRC_LEN) {
+		return false;
+	}
+	for (i = 0U; i < ENC28J60_PM_WINDOW; i++) {
+		if ((*reg_a((uint8_t)(EPMM0 + (i >> 3))) & (1U << (i & 7U))) != 0U) {
+			b = ((uint32_t)ofs + i < len) ? frame[ofs + i] : 0U;
+			sum += hi ? ((uint32_t)b << 8) : b;
+			hi = !hi;
+		}
+	}
+	while ((sum >> 16) != 0U) {
+		sum = (sum & 0xFFFFU) + (sum >> 16);
+	}
+	return (uint16_t)~sum == get16(EPMCSL);
+}
+
+/* ERXFCON: false if the frame is rejected */
+static bool rx_accept(const uint8_t *frame, uint16_t len)
+{
+	static const uint8_t maadr[6] = { MAADR5, MAADR4, MAADR3, MAADR2, MAADR1, MAADR0 };
+	uint8_t f = *reg_a(ERXFCON);
+	bool bcast = true;
+	bool ucast = true;
+	bool hit[4];
+	size_t n = 0U;
+	size_t matched = 0U;
+	size_t i;
+
+	for (i = 0U; i < 6U; i++) {
+		bcast = bcast && (frame[i] == 0xFFU);
+		ucast = ucast && (frame[i] == *reg_a(maadr[i]));
+	}
+	if ((f & ERXFCON_UCEN) != 0U) {
+		hit[n++] = ucast;
+	}
+	if ((f & ERXFCON_PMEN) != 0U) {
+		hit[n++] = rx_pattern_match(frame, len);
+	}
+	if ((f & ERXFCON_MCEN) != 0U) {
+		hit[n++] = ((frame[0] & 1U) != 0U) && !bcast;
+	}
+	if ((f & ERXFCON_BCEN) != 0U) {
+		hit[n++] = bcast;
+	}
+	if (n == 0U) {
+		return true; /* promiscuous */
+	}
+	for (i = 0U; i < n; i++) {
+		matched += hit[i] ? 1U : 0U;
+	}
+	return ((f & ERXFCON_ANDOR) != 0U) ? (matched == n) : (matched != 0U);
+}
+
+/**
+ * @brief enc28j60_model_inject puts a frame into the rx ring as the MAC does
+ * @param frame frame without CRC
+ * @param len frame length
+ * @param rx_ok value of the "received ok" bit of the status vector
+ * @return false if rx is disabled, the frame is filtered out or the ring is full
+ */
+bool enc28j60_model_inject(const uint8_t *frame, uint16_t len, bool rx_ok)
+{
+	uint16_t st = get16(ERXST);
+	uint16_t nd = get16(ERXND);
+	uint16_t rd = get16(ERXRDPT);
+	uint32_t size = (uint32_t)(nd - st) + 1U;
+	uint32_t used;
+	uint32_t need;
+	uint16_t p;
+	uint16_t next;
+	uint16_t cnt = (uint16_t)(len + MDL_CRC_LEN);
+	uint16_t i;
+
+	if ((*reg_a(ECON1) & ECON1_RXEN) == 0U) {
+		return false;
+	}
+	if (!rx_accept(frame, len)) {
+		stat.rx_filtered++;
+		return false;
+	}
+	used = (rx_wr >= rd) ? (uint32_t)(rx_wr - rd) : (size - (uint32_t)(rd - rx_wr));
+	need = MDL_RSV_LEN + (uint32_t)cnt;
+	need += need & 1U;
+	if ((used + need) >= size) {
+		stat.rx_overflows++;
+		*reg_a(EIR) |= EIR_RXERIF;
+		update_int();
+		return false;
+	}
+	/* next packet pointer, always even */
+	next = (uint16_t)(rx_wr + need);
+	if (next > nd) {
+		next = (uint16_t)(st + (next - nd - 1U));
+	}
+
+	p = rx_wr;
+	sram[p] = (uint8_t)next;		p = rx_next(p);
+	sram[p] = (uint8_t)(next >> 8);		p = rx_next(p);
+	sram[p] = (uint8_t)cnt;			p = rx_next(p);
+	sram[p] = (uint8_t)(cnt >> 8);		p = rx_next(p);
+	sram[p] = rx_ok ? 0x80U : 0x10U;	p = rx_next(p);
+	sram[p] = 0U;				p = rx_next(p);
+	for (i = 0U; i < len; i++) {
+		sram[p] = frame[i];
+		p = rx_next(p);
+	}
+	for (i = 0U; i < MDL_CRC_LEN; i++) {
+		sram[p] = 0xA5U;
+		p = rx_next(p);
+	}
+	rx_wr = next;
+	set16(ERXWRPT, rx_wr);
+
+	(*reg_a(EPKTCNT))++;
+	stat.rx_injected++;
+	update_pktif();
+	update_int();
+	return true;
+}
+
+bool enc28j60_model_int_asserted(void)
+{
+	return int_level;
+}
+
+void enc28j60_model_set_int_cb(enc28j60_model_int_cb_t cb)
+{
+	int_cb = cb;
+}
+
+/**
+ * @brief enc28j60_model_set_tx_cb sets the wire end of the transmitter,
+ *        cb is called with every frame sent, NULL - the log only
+ * @param cb
+ */
+void enc28j60_model_set_tx_cb(enc28j60_model_tx_cb_t cb)
+{
+	tx_cb = cb;
+}
+
+uint8_t enc28j60_model_reg(uint8_t adr)
+{
+	return *reg_a(adr);
+}
+
+uint16_t enc28j60_model_phy(uint8_t adr)
+{
+	return phy[adr & 0x1FU];
+}
+
+uint8_t *enc28j60_model_sram(void)
+{
+	return sram;
+}
+
+size_t enc28j60_model_tx_count(void)
+{
+	return tx_log_cnt;
+}
+
+/**
+ * @brief enc28j60_model_tx_frame returns a captured tx frame
+ * @param idx frame number, 0 is the oldest still in the log
+ * @param len frame length (out)
+ * @return pointer to the frame or NULL
+ */
+const uint8_t *enc28j60_model_tx_frame(size_t idx, uint16_t *len)
+{
+	size_t first = (tx_log_cnt > ENC28J60_MODEL_TX_LOG) ?
+			(tx_log_cnt - ENC28J60_MODEL_TX_LOG) : 0U;
+	size_t slot;
+
+	if ((first + idx) >= tx_log_cnt) {
+		return NULL;
+	}
+	slot = (first + idx) % ENC28J60_MODEL_TX_LOG;
+	*len = tx_log_len[slot];
+	return tx_log[slot];
+}
+
+/**
+ * @brief enc28j60_model_tx_hold makes TXRTS stay set until the test
+ *        finishes the frame, so frames can queue up in the driver
+ * @param hold true - hold, false - send at once (default)
+ */
+void enc28j60_model_tx_hold(bool hold)
+{
+	tx_hold = hold;
+}
+
+/**
+ * @brief enc28j60_model_tx_finish completes the frame started by TXRTS
+ * @param collisions collision count for the status vector
+ * @param late true - abort with a late collision (TXERIF)
+ * @return false if no frame is in progress
+ */
+bool enc28j60_model_tx_finish(uint8_t collisions, bool late)
+{
+	if ((*reg_a(ECON1) & ECON1_TXRTS) == 0U) {
+		return false;
+	}
+	do_transmit(collisions, late);
+	update_int();
+	return true;
+}
+
+void enc28j60_model_tx_clear(void)
+{
+	tx_log_cnt = 0U;
+}
+
+const enc28j60_model_stat_t *enc28j60_model_stat(void)
+{
+	return &stat;
+}
+
+void enc28j60_model_stat_clear(void)
+{
+	memset(&stat, 0, sizeof(stat));
+}
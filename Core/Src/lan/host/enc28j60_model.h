@@ -0,0 +1,73 @@
+/** @file enc28j60_model.h
+ *  @brief host-side ENC28J60 SPI register model
+ *
+ *  The model sits behind the HAL_SPI_* calls of enc28j60.c and decodes
+ *  the SPI byte stream (RCR/RBM/WCR/WBM/BFS/BFC/SC) into register and
+ *  8K SRAM accesses. It is force-included (-include) into enc28j60.c
+ *  on the host to redirect the CS/RESET pin macros.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef ENC28J60_MODEL_H
+#define ENC28J60_MODEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* pin macros used by enc28j60.c */
+#define		ENC28J60_CS_L	{ enc28j60_model_cs(false); }
+#define		ENC28J60_CS_H	{ enc28j60_model_cs(true); }
+#define		ENC28J60_RST_L	{ enc28j60_model_reset(); }
+#define		ENC28J60_RST_H	{ ; }
+
+/* polled SPI byte exchange used by enc28j60.c */
+#define		ENC28J60_SPI_XCHG(data)	enc28j60_model_xfer(data)
+#define		ENC28J60_SPI_SYNC()
+#define		ENC28J60_SPI_FLUSH()
+
+#define	ENC28J60_MODEL_TX_LOG	8U	/* captured tx frames */
+
+typedef struct enc28j60_model_stat {
+	uint32_t	cs_frames;	/*!< CS low-high cycles */
+	uint32_t	spi_bytes;	/*!< bytes clocked */
+	uint32_t	int_edges;	/*!< falling edges on INT */
+	uint32_t	rx_injected;	/*!< frames put into the rx ring */
+	uint32_t	rx_overflows;	/*!< frames dropped, ring is full */
+	uint32_t	rx_filtered;	/*!< frames rejected by ERXFCON */
+	uint32_t	tx_frames;	/*!< frames sent by TXRTS */
+	uint32_t	dma_bytes;	/*!< bytes moved by the DMA copy */
+} enc28j60_model_stat_t;
+
+/* INT pin edge callback, stands for the EXTI handler */
+typedef void (*enc28j60_model_int_cb_t)(void);
+
+/* frame put on the wire by TXRTS, the buffer is valid during the call */
+typedef void (*enc28j60_model_tx_cb_t)(const uint8_t *frame, uint16_t len);
+
+void enc28j60_model_reset(void);
+void enc28j60_model_cs(bool level);
+uint8_t enc28j60_model_xfer(uint8_t mosi);
+
+bool enc28j60_model_inject(const uint8_t *frame, uint16_t len, bool rx_ok);
+bool enc28j60_model_int_asserted(void);
+void enc28j60_model_set_int_cb(enc28j60_model_int_cb_t cb);
+
+uint8_t enc28j60_model_reg(uint8_t adr);
+uint16_t enc28j60_model_phy(uint8_t adr);
+uint8_t *enc28j60_model_sram(void);
+
+size_t enc28j60_model_tx_count(void);
+const uint8_t *enc28j60_model_tx_frame(size_t idx, uint16_t *len);
+void enc28j60_model_tx_clear(void);
+void enc28j60_model_set_tx_cb(enc28j60_model_tx_cb_t cb);
+void enc28j60_model_tx_hold(bool hold);
+bool enc28j60_model_tx_finish(uint8_t collisions, bool late);
+
+const enc28j60_model_stat_t *enc28j60_model_stat(void);
+void enc28j60_model_stat_clear(void);
+
+#endif // ENC28J60_MODEL_H
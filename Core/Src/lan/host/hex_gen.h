@@ -0,0 +1,21 @@
+/** @file hex_gen.h
+ *  @brief host stand-in of the hex/ascii helpers used by lan.c
+ *
+ *  Found before the library header only in the host build (-I order),
+ *  the functions are in lan_host_stubs.c.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef HEX_GEN_H
+#define HEX_GEN_H
+
+#include <stdint.h>
+
+char mybtol(uint8_t b);
+void uint8_to_asciiz(uint8_t b, char *buf);
+void uint16_to_asciiz(uint16_t w, char *buf);
+
+#endif // HEX_GEN_H
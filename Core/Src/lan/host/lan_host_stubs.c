@@ -0,0 +1,271 @@
+/** @file lan_host_stubs.c
+ *  @brief HAL and FreeRTOS stand-ins for the host build of the lan tests
+ *
+ *  SPI2 transfers are routed to the ENC28J60 model, DMA transfers
+ *  complete at once. There is a single thread: queues and mutexes are
+ *  plain FIFOs/counters in the static control blocks, a wait on an empty
+ *  queue or a taken mutex lets the tick run out the timeout and fails.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "cmsis_os.h"
+
+#include "spi.h"
+#include "hex_gen.h"
+#include "enc28j60_model.h"
+
+SPI_HandleTypeDef hspi2;
+
+volatile uint8_t RX_ready_flag;
+volatile uint8_t TX_done_flag;
+
+/* what the static control block holds on the host */
+typedef struct host_queue {
+	uint8_t		*storage;
+	UBaseType_t	length;
+	UBaseType_t	item_size;	/* 0 - semaphore */
+	UBaseType_t	count;
+	UBaseType_t	head;		/* index of the oldest item */
+	uint8_t		type;
+} host_queue_t;
+
+_Static_assert(sizeof(host_queue_t) <= sizeof(StaticQueue_t), "host queue must fit");
+
+static host_queue_t eth_mutex = { NULL, 1U, 0U, 1U, 0U, queueQUEUE_TYPE_MUTEX };
+osMutexId ETH_Mutex01Handle = (osMutexId)&eth_mutex;
+
+static uint32_t host_tick;
+static uint32_t host_yields;
+
+/*
+ * HAL
+ */
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData,
+					  uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi;
+	(void)Timeout;
+	while (Size--) {
+		*(pRxData++) = enc28j60_model_xfer(*(pTxData++));
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData,
+				   uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi;
+	(void)Timeout;
+	while (Size--) {
+		(void)enc28j60_model_xfer(*(pData++));
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData,
+				  uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi;
+	(void)Timeout;
+	while (Size--) {
+		*(pData++) = enc28j60_model_xfer(0xFFU);
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+	(void)HAL_SPI_Transmit(hspi, pData, Size, 0U);
+	TX_done_flag = 1U;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+	(void)HAL_SPI_Receive(hspi, pData, Size, 0U);
+	RX_ready_flag = 1U;
+	return HAL_OK;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	host_tick += Delay;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return host_tick;
+}
+
+/*
+ * FreeRTOS
+ */
+
+QueueHandle_t xQueueGenericCreateStatic(const UBaseType_t uxQueueLength,
+					const UBaseType_t uxItemSize,
+					uint8_t *pucQueueStorage,
+					StaticQueue_t *pxStaticQueue,
+					const uint8_t ucQueueType)
+{
+	host_queue_t *q = (host_queue_t *)pxStaticQueue;
+
+	memset(q, 0, sizeof(*q));
+	q->storage = pucQueueStorage;
+	q->length = uxQueueLength;
+	q->item_size = uxItemSize;
+	q->type = ucQueueType;
+	return (QueueHandle_t)q;
+}
+
+QueueHandle_t xQueueCreateMutexStatic(const uint8_t ucQueueType,
+				      StaticQueue_t *pxStaticQueue)
+{
+	host_queue_t *q;
+
+	q = (host_queue_t *)xQueueGenericCreateStatic(1U, 0U, NULL, pxStaticQueue,
+						      ucQueueType);
+	q->count = 1U;	/* created given */
+	return (QueueHandle_t)q;
+}
+
+osMutexId osMutexCreate(const osMutexDef_t *mutex_def)
+{
+	return xQueueCreateMutexStatic(queueQUEUE_TYPE_MUTEX, mutex_def->controlblock);
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+	return ((const host_queue_t *)xQueue)->count;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t xQueue, void * const pvBuffer,
+				TickType_t xTicksToWait, const BaseType_t xJustPeek)
+{
+	host_queue_t *q = (host_queue_t *)xQueue;
+
+	if (q->count == 0U) {
+		/* nobody else can give it meanwhile */
+		if (xTicksToWait != portMAX_DELAY) {
+			host_tick += xTicksToWait;
+		}
+		return pdFALSE;
+	}
+	if (q->item_size != 0U) {
+		memcpy(pvBuffer, q->storage + q->head * q->item_size, q->item_size);
+	}
+	if (xJustPeek == pdFALSE) {
+		q->head = (q->head + 1U) % q->length;
+		q->count--;
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void * const pvItemToQueue,
+			     TickType_t xTicksToWait, const BaseType_t xCopyPosition)
+{
+	host_queue_t *q = (host_queue_t *)xQueue;
+	UBaseType_t slot;
+
+	if ((q->count == q->length) && (xCopyPosition != queueOVERWRITE)) {
+		if (xTicksToWait != portMAX_DELAY) {
+			host_tick += xTicksToWait;
+		}
+		return pdFALSE;
+	}
+	if (q->item_size != 0U) {
+		if (xCopyPosition == queueOVERWRITE) {
+			q->head = 0U;
+			q->count = 0U;
+		}
+		if (xCopyPosition == queueSEND_TO_FRONT) {
+			q->head = (q->head + q->length - 1U) % q->length;
+			slot = q->head;
+		} else {
+			slot = (q->head + q->count) % q->length;
+		}
+		memcpy(q->storage + slot * q->item_size, pvItemToQueue, q->item_size);
+	}
+	q->count++;
+	return pdTRUE;
+}
+
+BaseType_t xQueueGenericSendFromISR(QueueHandle_t xQueue, const void * const pvItemToQueue,
+				    BaseType_t * const pxHigherPriorityTaskWoken,
+				    const BaseType_t xCopyPosition)
+{
+	if (pxHigherPriorityTaskWoken != NULL) {
+		*pxHigherPriorityTaskWoken = pdFALSE;
+	}
+	return xQueueGenericSend(xQueue, pvItemToQueue, 0U, xCopyPosition);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void * const pvBuffer,
+				BaseType_t * const pxHigherPriorityTaskWoken)
+{
+	if (pxHigherPriorityTaskWoken != NULL) {
+		*pxHigherPriorityTaskWoken = pdFALSE;
+	}
+	return xQueueGenericReceive(xQueue, pvBuffer, 0U, pdFALSE);
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+	return taskSCHEDULER_RUNNING;
+}
+
+/* no other tasks to run, just let the time pass */
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	host_tick += xTicksToDelay;
+	host_yields++;
+}
+
+void vPortYield(void)
+{
+	host_yields++;
+}
+
+void vPortEnterCritical(void)
+{
+}
+
+void vPortExitCritical(void)
+{
+}
+
+/*
+ * hex_gen
+ */
+
+char mybtol(uint8_t b)
+{
+	return (char)((b < 10U) ? ('0' + b) : ('A' + b - 10U));
+}
+
+/* 3 digits with the leading zeros */
+void uint8_to_asciiz(uint8_t b, char *buf)
+{
+	buf[0] = (char)('0' + b / 100U);
+	buf[1] = (char)('0' + (b / 10U) % 10U);
+	buf[2] = (char)('0' + b % 10U);
+	buf[3] = '\0';
+}
+
+/* 5 digits with the leading zeros */
+void uint16_to_asciiz(uint16_t w, char *buf)
+{
+	for (int i = 4; i >= 0; i--) {
+		buf[i] = (char)('0' + w % 10U);
+		w /= 10U;
+	}
+	buf[5] = '\0';
+}
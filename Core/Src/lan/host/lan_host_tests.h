@@ -0,0 +1,18 @@
+/** @file lan_host_tests.h
+ *  @brief host tests of the network stack
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef LAN_HOST_TESTS_H
+#define LAN_HOST_TESTS_H
+
+void TEST_enc28j60(void);
+void TEST_cksum(void);
+void TEST_lan(void);
+
+int lan_host_replay(const char *in_path, const char *out_path);
+
+#endif // LAN_HOST_TESTS_H
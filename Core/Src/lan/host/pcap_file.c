@@ -0,0 +1,175 @@
+/** @file pcap_file.c
+ *  @brief pcap file reader and writer for the host harness
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <string.h>
+
+#include "pcap_file.h"
+
+#define	PCAP_MAGIC_US		0xA1B2C3D4U
+#define	PCAP_MAGIC_NS		0xA1B23C4DU
+#define	PCAP_LINKTYPE_ETHERNET	1U
+
+typedef struct pcap_hdr {
+	uint32_t	magic;
+	uint16_t	version_major;
+	uint16_t	version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	network;
+} pcap_hdr_t;
+
+typedef struct pcap_rec_hdr {
+	uint32_t	ts_sec;
+	uint32_t	ts_frac;	/* us or ns */
+	uint32_t	incl_len;
+	uint32_t	orig_len;
+} pcap_rec_hdr_t;
+
+static uint32_t pcap_u32(const pcap_file_t *pf, uint32_t v)
+{
+	return pf->swap ? __builtin_bswap32(v) : v;
+}
+
+/**
+ * @brief pcap_file_open_read opens the file and checks the header
+ * @param pf
+ * @param path
+ * @return false if it is not an ethernet capture
+ */
+bool pcap_file_open_read(pcap_file_t *pf, const char *path)
+{
+	pcap_hdr_t h;
+
+	memset(pf, 0, sizeof(*pf));
+	pf->f = fopen(path, "rb");
+	if (pf->f == NULL) {
+		return false;
+	}
+	if (fread(&h, sizeof(h), 1U, pf->f) != 1U) {
+		goto fError;
+	}
+	if ((h.magic == PCAP_MAGIC_US) || (h.magic == PCAP_MAGIC_NS)) {
+		pf->swap = false;
+	} else if ((h.magic == __builtin_bswap32(PCAP_MAGIC_US)) ||
+		   (h.magic == __builtin_bswap32(PCAP_MAGIC_NS))) {
+		pf->swap = true;
+	} else {
+		goto fError;
+	}
+	pf->ns = (pcap_u32(pf, h.magic) == PCAP_MAGIC_NS);
+	if (pcap_u32(pf, h.network) != PCAP_LINKTYPE_ETHERNET) {
+		goto fError;
+	}
+	return true;
+fError:
+	fclose(pf->f);
+	pf->f = NULL;
+	return false;
+}
+
+/**
+ * @brief pcap_file_open_write creates the file and writes the header
+ * @param pf
+ * @param path
+ * @return false on a file error
+ */
+bool pcap_file_open_write(pcap_file_t *pf, const char *path)
+{
+	const pcap_hdr_t h = {
+		.magic = PCAP_MAGIC_US,
+		.version_major = 2U,
+		.version_minor = 4U,
+		.snaplen = PCAP_FILE_SNAPLEN,
+		.network = PCAP_LINKTYPE_ETHERNET,
+	};
+
+	memset(pf, 0, sizeof(*pf));
+	pf->f = fopen(path, "wb");
+	if (pf->f == NULL) {
+		return false;
+	}
+	pf->writing = true;
+	if (fwrite(&h, sizeof(h), 1U, pf->f) != 1U) {
+		fclose(pf->f);
+		pf->f = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief pcap_file_read reads the next record
+ * @param pf
+ * @param buf frame buffer
+ * @param buflen its size, longer records are cut
+ * @param ts_ms time stamp of the record, ms (out, may be NULL)
+ * @return bytes put into buf, -1 at the end of the file
+ */
+int32_t pcap_file_read(pcap_file_t *pf, uint8_t *buf, uint16_t buflen, uint32_t *ts_ms)
+{
+	pcap_rec_hdr_t r;
+	uint32_t len;
+	uint32_t n;
+
+	if ((pf->f == NULL) || (fread(&r, sizeof(r), 1U, pf->f) != 1U)) {
+		return -1;
+	}
+	len = pcap_u32(pf, r.incl_len);
+	n = (len > buflen) ? buflen : len;
+	if (fread(buf, 1U, n, pf->f) != n) {
+		return -1;
+	}
+	if (n < len) {
+		pf->truncated++;
+		if (fseek(pf->f, (long)(len - n), SEEK_CUR) != 0) {
+			return -1;
+		}
+	}
+	if (ts_ms != NULL) {
+		*ts_ms = pcap_u32(pf, r.ts_sec) * 1000U +
+			 pcap_u32(pf, r.ts_frac) / (pf->ns ? 1000000U : 1000U);
+	}
+	pf->frames++;
+	return (int32_t)n;
+}
+
+/**
+ * @brief pcap_file_write appends a record
+ * @param pf
+ * @param frame
+ * @param len
+ * @param ts_ms time stamp, ms
+ * @return false on a file error
+ */
+bool pcap_file_write(pcap_file_t *pf, const uint8_t *frame, uint16_t len, uint32_t ts_ms)
+{
+	pcap_rec_hdr_t r;
+
+	if ((pf->f == NULL) || !pf->writing) {
+		return false;
+	}
+	r.ts_sec = ts_ms / 1000U;
+	r.ts_frac = (ts_ms % 1000U) * 1000U;
+	r.incl_len = (len > PCAP_FILE_SNAPLEN) ? PCAP_FILE_SNAPLEN : len;
+	r.orig_len = len;
+	if ((fwrite(&r, sizeof(r), 1U, pf->f) != 1U) ||
+	    (fwrite(frame, 1U, r.incl_len, pf->f) != r.incl_len)) {
+		return false;
+	}
+	pf->frames++;
+	return true;
+}
+
+void pcap_file_close(pcap_file_t *pf)
+{
+	if (pf->f != NULL) {
+		fclose(pf->f);
+		pf->f = NULL;
+	}
+}
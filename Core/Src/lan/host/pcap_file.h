@@ -0,0 +1,37 @@
+/** @file pcap_file.h
+ *  @brief pcap file reader and writer for the host harness
+ *
+ *  Classic libpcap format, LINKTYPE_ETHERNET. Both byte orders and the
+ *  nanosecond magic are read, the files are written in the host order
+ *  with microsecond stamps.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef PCAP_FILE_H
+#define PCAP_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define	PCAP_FILE_SNAPLEN	1536U
+
+typedef struct pcap_file {
+	FILE		*f;
+	bool		swap;		/*!< the file is of the other byte order */
+	bool		ns;		/*!< nanosecond stamps */
+	bool		writing;
+	uint32_t	frames;		/*!< records read or written */
+	uint32_t	truncated;	/*!< records cut to the buffer */
+} pcap_file_t;
+
+bool pcap_file_open_read(pcap_file_t *pf, const char *path);
+bool pcap_file_open_write(pcap_file_t *pf, const char *path);
+int32_t pcap_file_read(pcap_file_t *pf, uint8_t *buf, uint16_t buflen, uint32_t *ts_ms);
+bool pcap_file_write(pcap_file_t *pf, const uint8_t *frame, uint16_t len, uint32_t ts_ms);
+void pcap_file_close(pcap_file_t *pf);
+
+#endif // PCAP_FILE_H
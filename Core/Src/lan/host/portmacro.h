@@ -0,0 +1,63 @@
+/** @file portmacro.h
+ *  @brief FreeRTOS port shim for the host build of the lan tests
+ *
+ *  Only what FreeRTOS.h/task.h/queue.h need to compile the driver
+ *  sources on the host. There is no scheduler: yields and critical
+ *  sections are no-ops, see freertos_host.c.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef PORTMACRO_H
+#define PORTMACRO_H
+
+#include <stdint.h>
+
+#define portCHAR		char
+#define portFLOAT		float
+#define portDOUBLE		double
+#define portLONG		long
+#define portSHORT		short
+#define portSTACK_TYPE		uint32_t
+#define portBASE_TYPE		long
+
+typedef portSTACK_TYPE StackType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+typedef uint32_t TickType_t;
+#define portMAX_DELAY		(TickType_t)0xffffffffUL
+#define portTICK_TYPE_IS_ATOMIC	1
+
+#define portSTACK_GROWTH	(-1)
+#define portTICK_PERIOD_MS	((TickType_t)1000 / configTICK_RATE_HZ)
+#define portBYTE_ALIGNMENT	8
+
+extern void vPortYield(void);
+#define portYIELD()		vPortYield()
+#define portEND_SWITCHING_ISR(xSwitchRequired) if ((xSwitchRequired) != pdFALSE) portYIELD()
+#define portYIELD_FROM_ISR(x)	portEND_SWITCHING_ISR(x)
+
+extern void vPortEnterCritical(void);
+extern void vPortExitCritical(void);
+#define portSET_INTERRUPT_MASK_FROM_ISR()	0
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)	(void)(x)
+#define portDISABLE_INTERRUPTS()
+#define portENABLE_INTERRUPTS()
+#define portENTER_CRITICAL()	vPortEnterCritical()
+#define portEXIT_CRITICAL()	vPortExitCritical()
+
+#define portTASK_FUNCTION_PROTO(vFunction, pvParameters) void vFunction(void *pvParameters)
+#define portTASK_FUNCTION(vFunction, pvParameters) void vFunction(void *pvParameters)
+
+#define portRECORD_READY_PRIORITY(uxPriority, uxReadyPriorities) (uxReadyPriorities) |= (1UL << (uxPriority))
+#define portRESET_READY_PRIORITY(uxPriority, uxReadyPriorities) (uxReadyPriorities) &= ~(1UL << (uxPriority))
+#define portGET_HIGHEST_PRIORITY(uxTopPriority, uxReadyPriorities) uxTopPriority = (31UL - (uint32_t)__builtin_clz((uxReadyPriorities)))
+
+#define portNOP()
+#define portINLINE		__inline
+#define portFORCE_INLINE	inline __attribute__((always_inline))
+
+#endif /* PORTMACRO_H */
@@ -0,0 +1,175 @@
+/** @file test_cksum.c
+ *  @brief tests and benchmark of the Internet checksum
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "testhelpers.h"
+#include "lan_host_tests.h"
+#include "inet_cksum.h"
+
+#define	T_MAXLEN	600U
+#define	T_ROUNDS	20000U
+
+static uint8_t tbuf[T_MAXLEN + 8U] __attribute__((aligned(4)));
+
+/* the former lan.c routine: one big endian word per iteration */
+static uint16_t ref_cksum(uint32_t sum, const uint8_t *buf, uint16_t len)
+{
+	while (len >= 2U) {
+		sum += ((uint16_t)*buf << 8) | *(buf + 1);
+		buf += 2;
+		len -= 2U;
+	}
+	if (len != 0) {
+		sum += (uint16_t)*buf << 8;
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	sum = (uint16_t)~sum;
+	return (uint16_t)((sum >> 8) | (sum << 8)); /* ~htons(), memory order */
+}
+
+static void fill_random(uint8_t *p, size_t len)
+{
+	for (size_t i = 0U; i < len; i++) {
+		p[i] = (uint8_t)rand();
+	}
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* test the kernel against the former routine */
+static void TEST_cksum_ref(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	unsigned int errors = 0U;
+	unsigned int split_errors = 0U;
+
+	srand(1U);
+	for (uint16_t len = 0U; len <= T_MAXLEN; len++) {
+		for (uint8_t ofs = 0U; ofs < 4U; ofs++) {
+			uint8_t *p = tbuf + ofs;
+
+			fill_random(p, len);
+			if (inet_cksum(p, len) != ref_cksum(0U, p, len)) {
+				errors++;
+			}
+			/* a block split at an even offset sums the same */
+			uint16_t half = (uint16_t)((len / 2U) & ~1U);
+			uint32_t sum = inet_sum(inet_sum(0U, p, half), p + half, len - half);
+			if (inet_fold(sum) != ref_cksum(0U, p, len)) {
+				split_errors++;
+			}
+		}
+	}
+	TEST_CHECK(0, errors == 0U);
+	TEST_CHECK(1, split_errors == 0U);
+
+	/* all ones does not overflow the accumulator */
+	memset(tbuf, 0xFF, sizeof(tbuf));
+	TEST_CHECK(2, inet_cksum(tbuf, T_MAXLEN) == ref_cksum(0U, tbuf, T_MAXLEN));
+	TEST_CHECK(3, inet_cksum(tbuf + 1, T_MAXLEN - 1U) == ref_cksum(0U, tbuf + 1, T_MAXLEN - 1U));
+
+	TestFooter(test_name);
+}
+
+/* test RFC 1624 patches give the recomputed checksum */
+static void TEST_cksum_adjust(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	unsigned int errors16 = 0U;
+	unsigned int errors32 = 0U;
+	uint16_t ck;
+	uint16_t w_old, w_new;
+	uint32_t d_old, d_new;
+
+	srand(2U);
+	for (unsigned int k = 0U; k < 10000U; k++) {
+		fill_random(tbuf, 20U);
+		if ((k & 7U) == 0U) {
+			memset(tbuf, 0xFF, 20U); /* sums to -0 */
+		}
+		memset(tbuf + 10, 0, 2U);
+		ck = inet_cksum(tbuf, 20U);
+		memcpy(tbuf + 10, &ck, 2U);
+
+		memcpy(&w_old, tbuf + 2, 2U);
+		w_new = (uint16_t)rand();
+		memcpy(tbuf + 2, &w_new, 2U);
+		ck = inet_cksum_adjust16(ck, w_old, w_new);
+		memcpy(tbuf + 10, &ck, 2U);
+		if (inet_cksum(tbuf, 20U) != 0U) {
+			errors16++;
+		}
+
+		memcpy(&d_old, tbuf + 16, 4U);
+		d_new = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+		memcpy(tbuf + 16, &d_new, 4U);
+		ck = inet_cksum_adjust32(ck, d_old, d_new);
+		memcpy(tbuf + 10, &ck, 2U);
+		if (inet_cksum(tbuf, 20U) != 0U) {
+			errors32++;
+		}
+	}
+	TEST_CHECK(0, errors16 == 0U);
+	TEST_CHECK(1, errors32 == 0U);
+
+	TestFooter(test_name);
+}
+
+/* compare with the former routine at the payload sizes we send */
+static void TEST_cksum_bench(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	static const uint16_t sizes[] = { 64U, 128U, 256U, 512U, 600U };
+	volatile uint16_t sink = 0U;
+	double t0, t_ref, t_new;
+
+	fill_random(tbuf, sizeof(tbuf));
+	for (size_t i = 0U; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		uint16_t len = sizes[i];
+
+		t0 = now_ns();
+		for (unsigned int k = 0U; k < T_ROUNDS; k++) {
+			sink ^= ref_cksum(k, tbuf, len);
+		}
+		t_ref = (now_ns() - t0) / T_ROUNDS;
+		t0 = now_ns();
+		for (unsigned int k = 0U; k < T_ROUNDS; k++) {
+			sink ^= inet_fold(inet_sum(k, tbuf, len));
+		}
+		t_new = (now_ns() - t0) / T_ROUNDS;
+		printf("\t%3u bytes: former %7.1f ns, inet_sum %7.1f ns, x%.1f\n",
+		       (unsigned int)len, t_ref, t_new, t_ref / t_new);
+	}
+	(void)sink;
+	TEST_PASSED(0);
+
+	TestFooter(test_name);
+}
+
+void TEST_cksum(void)
+{
+	TEST_cksum_ref();
+	TEST_cksum_adjust();
+	TEST_cksum_bench();
+}
@@ -0,0 +1,511 @@
+/** @file test_enc28j60.c
+ *  @brief tests for the ENC28J60 driver against the register model
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+#include <string.h>
+
+#include "testhelpers.h"
+#include "lan_host_tests.h"
+#include "enc28j60_model.h"
+#include "enc28j60.h"
+
+#define	T_BUFLEN	ENC28J60_MAXFRAME
+
+extern volatile uint32_t bad_eth_frames_cnt;
+
+static uint8_t mac[6] = { 0x00, 0x13, 0x37, 0x01, 0x23, 0x45 };
+static uint8_t frame[T_BUFLEN];
+static uint8_t rxbuf[T_BUFLEN];
+static unsigned int isr_calls;
+
+/* lan.c has the real one when the stack is linked in */
+__attribute__((weak)) uint8_t *getMAC(void)
+{
+	return mac;
+}
+
+static void fill_frame(uint16_t len, uint8_t seed)
+{
+	for (uint16_t i = 0U; i < len; i++) {
+		frame[i] = (uint8_t)(seed + i * 7U);
+	}
+}
+
+static void test_isr(void)
+{
+	isr_calls++;
+}
+
+static void start_chip(void)
+{
+	enc28j60_model_reset();
+	enc28j60_model_stat_clear();
+	enc28j60_model_tx_clear();
+	enc28j60_model_set_int_cb(test_isr);
+	isr_calls = 0U;
+	enc28j60_init(mac);
+}
+
+/* the drain loop of lan_poll() */
+static uint16_t drain(uint16_t *lens, uint16_t max)
+{
+	uint16_t n = 0U;
+	uint16_t len;
+
+	enc28j60_int_disable();
+	do {
+		len = enc28j60_recv_packet(rxbuf, T_BUFLEN);
+		if ((len != 0U) && (n < max)) {
+			lens[n++] = len;
+		}
+	} while (len != 0U);
+	enc28j60_int_enable();
+	return n;
+}
+
+/* test init */
+static void TEST_init(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	start_chip();
+	TEST_CHECK(0, (enc28j60_model_reg(ECON1) & ECON1_RXEN) != 0U);
+#if (LAN_RX_INTERRUPT == 1)
+	TEST_CHECK(1, enc28j60_model_reg(EIE) ==
+		      (EIE_INTIE | EIE_PKTIE | EIE_TXIE | EIE_TXERIE));
+#else
+	TEST_CHECK(1, enc28j60_model_reg(EIE) == 0U);
+#endif
+	TEST_CHECK(2, (enc28j60_model_reg(MAADR5) == mac[0]) &&
+		      (enc28j60_model_reg(MAADR0) == mac[5]));
+	TEST_CHECK(3, enc28j60_model_phy(PHCON1) == PHCON1_PDPXMD);
+	TEST_CHECK(4, !enc28j60_model_int_asserted());
+
+	TestFooter(test_name);
+}
+
+/* test idle poll costs one EPKTCNT read and no frame */
+static void TEST_rx_idle(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	start_chip();
+	enc28j60_model_stat_clear();
+	TEST_CHECK(0, enc28j60_recv_packet(rxbuf, T_BUFLEN) == 0U);
+	printf("\tidle poll: %u CS frames, %u SPI bytes\n",
+	       (unsigned int)enc28j60_model_stat()->cs_frames,
+	       (unsigned int)enc28j60_model_stat()->spi_bytes);
+	TEST_CHECK(1, isr_calls == 0U);
+
+	TestFooter(test_name);
+}
+
+/* test all pending frames are drained on one INT edge */
+static void TEST_rx_burst(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	static const uint16_t lens[] = { 60U, 61U, 128U, 333U, 592U };
+	const uint16_t n = (uint16_t)(sizeof(lens) / sizeof(lens[0]));
+	uint16_t got[8];
+	size_t i = 0U;
+
+	start_chip();
+	for (uint16_t k = 0U; k < n; k++) {
+		fill_frame(lens[k], (uint8_t)k);
+		(void)enc28j60_model_inject(frame, lens[k], true);
+	}
+	TEST_CHECK(i++, enc28j60_model_int_asserted());
+	TEST_CHECK(i++, isr_calls == 1U);
+
+	enc28j60_int_disable();
+	for (uint16_t k = 0U; k < n; k++) {
+		uint16_t len = enc28j60_recv_packet(rxbuf, T_BUFLEN);
+		fill_frame(lens[k], (uint8_t)k);
+		TEST_CHECK(i++, (len == lens[k]) && (memcmp(rxbuf, frame, len) == 0));
+	}
+	TEST_CHECK(i++, enc28j60_recv_packet(rxbuf, T_BUFLEN) == 0U);
+	enc28j60_int_enable();
+
+	TEST_CHECK(i++, enc28j60_model_reg(EPKTCNT) == 0U);
+	TEST_CHECK(i++, !enc28j60_model_int_asserted());
+	TEST_CHECK(i++, isr_calls == 1U);
+
+	/* next frame gives the next edge */
+	fill_frame(100U, 0x55U);
+	(void)enc28j60_model_inject(frame, 100U, true);
+	TEST_CHECK(i++, isr_calls == 2U);
+	TEST_CHECK(i++, drain(got, 8U) == 1U);
+
+	TestFooter(test_name);
+}
+
+/* test re-arming with a frame left in the chip asserts INT again */
+static void TEST_rx_rearm(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint16_t got[8];
+
+	start_chip();
+	fill_frame(200U, 1U);
+	(void)enc28j60_model_inject(frame, 200U, true);
+	(void)enc28j60_model_inject(frame, 200U, true);
+	TEST_CHECK(0, isr_calls == 1U);
+
+	/* burst limit of 1 */
+	enc28j60_int_disable();
+	TEST_CHECK(1, !enc28j60_model_int_asserted());
+	TEST_CHECK(2, enc28j60_recv_packet(rxbuf, T_BUFLEN) == 200U);
+	enc28j60_int_enable();
+	TEST_CHECK(3, isr_calls == 2U);
+
+	TEST_CHECK(4, drain(got, 8U) == 1U);
+	TEST_CHECK(5, !enc28j60_model_int_asserted());
+
+	TestFooter(test_name);
+}
+
+/* test bad frames are dropped and the ring stays consistent */
+static void TEST_rx_bad(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint32_t bad = bad_eth_frames_cnt;
+
+	start_chip();
+	fill_frame(100U, 2U);
+	(void)enc28j60_model_inject(frame, 100U, false);	/* rx not ok */
+	(void)enc28j60_model_inject(frame, 32U, true);		/* runt */
+	(void)enc28j60_model_inject(frame, 100U, true);
+
+	TEST_CHECK(0, enc28j60_recv_packet(rxbuf, T_BUFLEN) == 0U);
+	TEST_CHECK(1, enc28j60_recv_packet(rxbuf, T_BUFLEN) == 0U);
+	TEST_CHECK(2, bad_eth_frames_cnt == (bad + 1U));
+	TEST_CHECK(3, (enc28j60_recv_packet(rxbuf, T_BUFLEN) == 100U) &&
+		      (memcmp(rxbuf, frame, 100U) == 0));
+	TEST_CHECK(4, enc28j60_model_reg(EPKTCNT) == 0U);
+
+	TestFooter(test_name);
+}
+
+static uint16_t getbuf_len;
+static bool getbuf_fail;
+
+static uint8_t *test_getbuf(uint16_t len)
+{
+	getbuf_len = len;
+	return getbuf_fail ? NULL : rxbuf;
+}
+
+/* test the buffer is taken after the length is known */
+static void TEST_rx_alloc(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint8_t *buf;
+
+	start_chip();
+	TEST_CHECK(0, (enc28j60_recv_packet_alloc(test_getbuf, &buf) == 0) && (buf == NULL));
+
+	fill_frame(77U, 3U);
+	(void)enc28j60_model_inject(frame, 77U, true);
+	getbuf_fail = true;
+	getbuf_len = 0U;
+	/* no memory: the frame stays in the ring */
+	TEST_CHECK(1, (enc28j60_recv_packet_alloc(test_getbuf, &buf) == -1) && (buf == NULL));
+	TEST_CHECK(2, (getbuf_len == 77U) && (enc28j60_model_reg(EPKTCNT) == 1U));
+
+	getbuf_fail = false;
+	TEST_CHECK(3, (enc28j60_recv_packet_alloc(test_getbuf, &buf) == 77) && (buf == rxbuf) &&
+		      (memcmp(rxbuf, frame, 77U) == 0));
+	TEST_CHECK(4, enc28j60_model_reg(EPKTCNT) == 0U);
+
+	/* a bad frame takes no buffer */
+	(void)enc28j60_model_inject(frame, 77U, false);
+	getbuf_len = 0U;
+	TEST_CHECK(5, (enc28j60_recv_packet_alloc(test_getbuf, &buf) == 0) && (getbuf_len == 0U));
+	TEST_CHECK(6, enc28j60_model_reg(EPKTCNT) == 0U);
+
+	TestFooter(test_name);
+}
+
+/* test ERXFCON and the pattern checksum against the model */
+static void TEST_rx_filter(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	enc28j60_rx_filter_t f;
+	static const uint8_t tip[4] = { 192U, 168U, 1U, 77U };
+	static const uint8_t bcast[6] = { 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU };
+	uint32_t filtered;
+	uint8_t cs[2];
+
+	start_chip();
+	/* unicast + broadcast ARP requests for tip */
+	memset(&f, 0, sizeof(f));
+	f.erxfcon = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_PMEN;
+	memcpy(f.pm_data, bcast, 6U);
+	f.pm_data[12] = 0x08U; f.pm_data[13] = 0x06U;
+	f.pm_data[20] = 0x00U; f.pm_data[21] = 0x01U;
+	memcpy(&f.pm_data[38], tip, 4U);
+	f.pm_mask[0] = 0x3FU;			/* 0...5 */
+	f.pm_mask[1] = 0x30U;			/* 12, 13 */
+	f.pm_mask[2] = 0x30U;			/* 20, 21 */
+	f.pm_mask[4] = 0xC0U; f.pm_mask[5] = 0x03U;	/* 38...41 */
+	enc28j60_set_rx_filter(&f);
+	TEST_CHECK(0, enc28j60_model_reg(ERXFCON) == f.erxfcon);
+	TEST_CHECK(1, (enc28j60_model_reg(EPMM4) == 0xC0U) && (enc28j60_model_reg(EPMOL) == 0U));
+
+	filtered = enc28j60_model_stat()->rx_filtered;
+	memset(frame, 0, 64U);
+	memcpy(frame, bcast, 6U);
+	frame[12] = 0x08U; frame[13] = 0x06U;
+	frame[21] = 0x01U;
+	memcpy(&frame[38], tip, 4U);
+	TEST_CHECK(2, enc28j60_model_inject(frame, 64U, true));	/* who-has tip */
+	frame[41]++;
+	TEST_CHECK(3, !enc28j60_model_inject(frame, 64U, true));	/* who-has other */
+	frame[41]--;
+	frame[13] = 0x00U;
+	TEST_CHECK(4, !enc28j60_model_inject(frame, 64U, true));	/* IP broadcast */
+	memcpy(frame, mac, 6U);
+	TEST_CHECK(5, enc28j60_model_inject(frame, 64U, true));	/* unicast */
+	frame[0] = 0x01U; frame[1] = 0x00U; frame[2] = 0x5EU;
+	TEST_CHECK(6, !enc28j60_model_inject(frame, 64U, true));	/* multicast */
+	TEST_CHECK(7, enc28j60_model_stat()->rx_filtered == filtered + 3U);
+
+	/* the filters survive a chip reset */
+	cs[0] = enc28j60_model_reg(EPMCSL);
+	cs[1] = enc28j60_model_reg(EPMCSH);
+	enc28j60_model_reset();
+	enc28j60_init(mac);
+	TEST_CHECK(8, (enc28j60_model_reg(ERXFCON) == f.erxfcon) &&
+		      (enc28j60_model_reg(EPMCSL) == cs[0]) && (enc28j60_model_reg(EPMCSH) == cs[1]));
+	TEST_CHECK(9, !enc28j60_model_inject(frame, 64U, true));
+
+	enc28j60_set_rx_filter(NULL);
+	TEST_CHECK(10, enc28j60_model_reg(ERXFCON) ==
+		       (ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN));
+
+	TestFooter(test_name);
+}
+
+/* test the rx ring wraps many times */
+static void TEST_rx_wrap(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	unsigned int errors = 0U;
+	unsigned int bad_rdpt = 0U;
+	uint16_t rdpt;
+
+	start_chip();
+	for (unsigned int k = 0U; k < 500U; k++) {
+		uint16_t len = (uint16_t)(60U + ((k * 37U) % 530U));
+		fill_frame(len, (uint8_t)k);
+		if (!enc28j60_model_inject(frame, len, true)) {
+			errors++;
+			continue;
+		}
+		if ((k % 3U) == 0U) {
+			continue;	/* let frames pile up */
+		}
+		while (enc28j60_model_reg(EPKTCNT) != 0U) {
+			uint16_t got = enc28j60_recv_packet(rxbuf, T_BUFLEN);
+			if (got < 60U) {
+				errors++;
+			}
+		}
+		if (memcmp(rxbuf, frame, len) != 0) {
+			errors++;
+		}
+		rdpt = (uint16_t)(enc28j60_model_reg(ERXRDPTL) |
+				  (enc28j60_model_reg(ERXRDPTH) << 8));
+		if ((rdpt > ENC28J60_RXEND) || ((rdpt & 1U) == 0U)) {
+			bad_rdpt++;
+		}
+	}
+	TEST_CHECK(0, errors == 0U);
+	TEST_CHECK(1, enc28j60_model_stat()->rx_overflows == 0U);
+	TEST_CHECK(2, bad_rdpt == 0U);
+
+	TestFooter(test_name);
+}
+
+/* test tx */
+static void TEST_tx(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	const uint8_t *p;
+	uint16_t len = 0U;
+
+	start_chip();
+	fill_frame(100U, 3U);
+	enc28j60_send_packet(frame, 100U);
+	p = enc28j60_model_tx_frame(0U, &len);
+	TEST_CHECK(0, enc28j60_model_tx_count() == 1U);
+	TEST_CHECK(1, (p != NULL) && (len == 100U) && (memcmp(p, frame, len) == 0));
+	TEST_CHECK(2, (enc28j60_model_reg(ECON1) & ECON1_TXRTS) == 0U);
+
+	/* header and payload gathered in one WBM op */
+	enc28j60_send_packet2(frame, 42U, frame + 42U, 58U);
+	p = enc28j60_model_tx_frame(1U, &len);
+	TEST_CHECK(3, (p != NULL) && (len == 100U) && (memcmp(p, frame, len) == 0));
+
+	TestFooter(test_name);
+}
+
+/* test frames queue up in the tx ring while the transmitter is busy */
+static void TEST_tx_ring(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	enc28j60_tx_stat_t st0;
+	const enc28j60_tx_stat_t *st;
+	const uint8_t *p;
+	uint16_t len = 0U;
+	unsigned int errors = 0U;
+
+	start_chip();
+	st = enc28j60_get_tx_stat();
+	st0 = *st;
+	enc28j60_model_tx_hold(true);
+
+	/* one in flight, the rest wait in their slots */
+	for (uint8_t k = 0U; k < ENC28J60_TX_SLOTS; k++) {
+		fill_frame((uint16_t)(200U + k), k);
+		enc28j60_send_packet(frame, (uint16_t)(200U + k));
+	}
+	TEST_CHECK(0, enc28j60_model_tx_count() == 0U);
+	TEST_CHECK(1, (st->frames - st0.frames) == ENC28J60_TX_SLOTS);
+
+	/* TXIF, the next slot is started by the poll */
+	TEST_CHECK(2, enc28j60_model_tx_finish(2U, false));
+	TEST_CHECK(3, enc28j60_model_int_asserted());
+	enc28j60_tx_poll();
+	TEST_CHECK(4, (enc28j60_model_reg(ECON1) & ECON1_TXRTS) != 0U);
+	TEST_CHECK(5, enc28j60_model_tx_finish(0U, true));	/* late collision */
+	enc28j60_tx_poll();
+	while (enc28j60_model_tx_finish(0U, false)) {
+		enc28j60_tx_poll();
+	}
+	TEST_CHECK(6, enc28j60_model_tx_count() == 3U);
+	for (uint8_t k = 0U; k < 3U; k++) {
+		uint8_t n = (k == 0U) ? 0U : (uint8_t)(k + 1U);
+		fill_frame((uint16_t)(200U + n), n);
+		p = enc28j60_model_tx_frame(k, &len);
+		if ((p == NULL) || (len != 200U + n) || (memcmp(p, frame, len) != 0)) {
+			errors++;
+		}
+	}
+	TEST_CHECK(7, errors == 0U);
+	TEST_CHECK(8, ((st->ok - st0.ok) == 3U) && ((st->collisions - st0.collisions) == 2U) &&
+		      ((st->late_col - st0.late_col) == 1U) && ((st->errors - st0.errors) == 1U));
+
+	/* full ring waits, a stuck TXRTS is reset by the timeout */
+	for (uint8_t k = 0U; k <= ENC28J60_TX_SLOTS; k++) {
+		enc28j60_send_packet(frame, 100U);
+	}
+	TEST_CHECK(9, (st->ring_full - st0.ring_full) == 1U);
+	TEST_CHECK(10, (st->drops - st0.drops) == 2U);	/* + the late collision */
+
+	/* too long for a slot */
+	enc28j60_send_packet(frame, ENC28J60_TX_SLOTSIZE);
+	TEST_CHECK(11, (st->drops - st0.drops) == 3U);
+
+	/* the rest goes out back to back */
+	enc28j60_model_tx_hold(false);
+	(void)enc28j60_model_tx_finish(0U, false);
+	for (uint8_t k = 0U; k < ENC28J60_TX_SLOTS; k++) {
+		enc28j60_tx_poll();
+	}
+	TEST_CHECK(12, (enc28j60_model_reg(ECON1) & ECON1_TXRTS) == 0U);
+	TEST_CHECK(13, (st->frames - st0.frames) == (st->ok - st0.ok) + (st->drops - st0.drops) - 1U);
+
+	TestFooter(test_name);
+}
+
+/* test batched register ops and the bank cache */
+static void TEST_batch(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	enc28j60_batch_t b;
+	uint8_t r[4];
+	uint32_t frames;
+
+	start_chip();
+	enc28j60_batch_init(&b);
+	enc28j60_batch_wcr(&b, EHT0, 0x11U);		/* bank 1 */
+	enc28j60_batch_wcr16(&b, MAMXFL, 0x0234U);	/* bank 2 */
+	enc28j60_batch_wcr(&b, MAADR1, 0x33U);		/* bank 3 */
+	enc28j60_batch_wcr16(&b, ETXST, 0x1A44U);	/* bank 0 */
+	TEST_CHECK(0, enc28j60_batch_run(&b) == SUCCESS);
+
+	enc28j60_batch_init(&b);
+	r[0] = enc28j60_batch_rcr(&b, MAADR1);
+	r[1] = enc28j60_batch_rcr(&b, EHT0);
+	r[2] = enc28j60_batch_rcr(&b, MAMXFLH);
+	r[3] = enc28j60_batch_rcr(&b, ETXSTH);
+	TEST_CHECK(1, enc28j60_batch_run(&b) == SUCCESS);
+	TEST_CHECK(2, (enc28j60_batch_result(&b, r[0]) == 0x33U) &&
+		      (enc28j60_batch_result(&b, r[1]) == 0x11U) &&
+		      (enc28j60_batch_result(&b, r[2]) == 0x02U) &&
+		      (enc28j60_batch_result(&b, r[3]) == 0x1AU));
+	/* single ops must agree with the bank left by the batch */
+	TEST_CHECK(3, enc28j60_rcr(MAADR1) == 0x33U);
+	TEST_CHECK(4, enc28j60_rcr16(ETXST) == 0x1A44U);
+
+	/* overflow sends nothing */
+	enc28j60_model_stat_clear();
+	enc28j60_batch_init(&b);
+	for (uint8_t k = 0U; k <= ENC28J60_BATCH_MAX; k++) {
+		enc28j60_batch_wcr(&b, EHT1, k);
+	}
+	TEST_CHECK(5, enc28j60_batch_run(&b) == ERROR);
+	TEST_CHECK(6, enc28j60_model_stat()->spi_bytes == 0U);
+
+	/* per frame cost */
+	fill_frame(300U, 4U);
+	enc28j60_model_stat_clear();
+	enc28j60_send_packet(frame, 300U);
+	frames = enc28j60_model_stat()->cs_frames;
+	(void)enc28j60_model_inject(frame, 300U, true);
+	enc28j60_model_stat_clear();
+	TEST_CHECK(7, enc28j60_recv_packet(rxbuf, T_BUFLEN) == 300U);
+	printf("	send: %u CS frames, recv: %u CS frames\n", (unsigned int)frames,
+	       (unsigned int)enc28j60_model_stat()->cs_frames);
+
+	TestFooter(test_name);
+}
+
+void TEST_enc28j60(void)
+{
+	TEST_init();
+	TEST_rx_idle();
+	TEST_rx_burst();
+	TEST_rx_rearm();
+	TEST_rx_bad();
+	TEST_rx_alloc();
+	TEST_rx_filter();
+	TEST_rx_wrap();
+	TEST_tx();
+	TEST_tx_ring();
+	TEST_batch();
+}
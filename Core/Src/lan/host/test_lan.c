@@ -0,0 +1,1258 @@
+/** @file test_lan.c
+ *  @brief loopback harness, tests and benchmark of the network stack
+ *
+ *  lan.c is compiled into this unit to reach its static filters and
+ *  the buffer pool. Frames go in through the ENC28J60 model rx ring and
+ *  lan_poll(), the frames the chip puts on the wire are kept in a FIFO
+ *  and may be written to a pcap file. A loopback peer answers the ARP
+ *  requests of the stack for any address but ours, so the parked frames
+ *  are sent without a real network.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include "../lan.c"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "testhelpers.h"
+#include "lan_host_tests.h"
+#include "pcap_file.h"
+
+#define	H_IP		inet_addr(192, 168, 1, 10)
+#define	H_MASK		inet_addr(255, 255, 255, 0)
+#define	H_GW		inet_addr(192, 168, 1, 1)
+#define	H_PEER_IP	inet_addr(192, 168, 1, 20)
+#define	H_PEER2_IP	inet_addr(192, 168, 1, 21)
+
+#define	H_WIRE_SLOTS	32U
+#define	H_FRAME_MAX	PCAP_FILE_SNAPLEN
+#define	H_MINFRAME	60U
+#define	H_RUN_LIMIT	64U	/* lan_poll() rounds per h_run() */
+
+static const uint8_t h_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t h_peer_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+/* frames sent by the stack, oldest first */
+static struct {
+	uint8_t		frame[H_WIRE_SLOTS][H_FRAME_MAX];
+	uint16_t	len[H_WIRE_SLOTS];
+	uint32_t	count;
+	uint32_t	peer;		/* frames seen by the peer */
+	uint32_t	lost;
+	uint32_t	total;
+} wire;
+
+static pcap_file_t *h_capture;	/* the wire is written here if set */
+static uint32_t h_arp_answers;
+static bool h_peer_mute;		/* the peer does not answer ARP */
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* the wire end of the model */
+static void h_wire_tx(const uint8_t *frame, uint16_t len)
+{
+	wire.total++;
+	if (h_capture != NULL) {
+		(void)pcap_file_write(h_capture, frame, len, HAL_GetTick());
+	}
+	if (wire.count == H_WIRE_SLOTS) {
+		wire.lost++;
+		return;
+	}
+	if (len > H_FRAME_MAX) {
+		len = H_FRAME_MAX;
+	}
+	memcpy(wire.frame[wire.count], frame, len);
+	wire.len[wire.count] = len;
+	wire.count++;
+}
+
+static void h_wire_clear(void)
+{
+	wire.count = 0U;
+	wire.peer = 0U;
+	wire.lost = 0U;
+}
+
+/* puts a frame into the chip, padded to the ethernet minimum */
+static bool h_inject(const uint8_t *frame, uint16_t len)
+{
+	uint8_t pad[H_MINFRAME];
+
+	if (len < H_MINFRAME) {
+		memset(pad, 0, sizeof(pad));
+		memcpy(pad, frame, len);
+		frame = pad;
+		len = H_MINFRAME;
+	}
+	return enc28j60_model_inject(frame, len, true);
+}
+
+static uint16_t h_build_arp(uint8_t *buf, uint16_t op, const uint8_t *from_mac,
+			    uint32_t from_ip, const uint8_t *to_mac, uint32_t to_ip)
+{
+	eth_frame_t *frame = (void *)buf;
+	arp_message_t *msg = (void *)frame->data;
+
+	if (op == ARP_TYPE_REQUEST) {
+		memset(frame->to_addr, 0xFF, 6U);
+	} else {
+		memcpy(frame->to_addr, to_mac, 6U);
+	}
+	memcpy(frame->from_addr, from_mac, 6U);
+	frame->type = ETH_TYPE_ARP;
+	msg->hw_type = ARP_HW_TYPE_ETH;
+	msg->proto_type = ARP_PROTO_TYPE_IP;
+	msg->hw_addr_len = 6U;
+	msg->proto_addr_len = 4U;
+	msg->type = op;
+	memcpy(msg->mac_addr_from, from_mac, 6U);
+	msg->ip_addr_from = from_ip;
+	memcpy(msg->mac_addr_to, to_mac, 6U);
+	msg->ip_addr_to = to_ip;
+	return (uint16_t)(sizeof(eth_frame_t) + sizeof(arp_message_t));
+}
+
+/* eth and ip headers from the peer to us, returns the ip header */
+static ip_packet_t *h_build_ip(uint8_t *buf, uint32_t from_ip, uint8_t proto, uint16_t iplen)
+{
+	eth_frame_t *frame = (void *)buf;
+	ip_packet_t *ip = (void *)frame->data;
+
+	memcpy(frame->to_addr, h_mac, 6U);
+	memcpy(frame->from_addr, h_peer_mac, 6U);
+	frame->type = ETH_TYPE_IP;
+	ip->ver_head_len = 0x45U;
+	ip->tos = 0U;
+	ip->total_len = htons(iplen);
+	ip->fragment_id = 0U;
+	ip->flags_framgent_offset = 0U;
+	ip->ttl = 64U;
+	ip->protocol = proto;
+	ip->cksum = 0U;
+	ip->from_addr = from_ip;
+	ip->to_addr = H_IP;
+	ip->cksum = inet_cksum(ip, sizeof(ip_packet_t));
+	return ip;
+}
+
+static uint16_t h_build_udp(uint8_t *buf, uint32_t from_ip, uint16_t from_port,
+			    uint16_t to_port, const void *data, uint16_t len)
+{
+	uint16_t udplen = (uint16_t)(sizeof(udp_packet_t) + len);
+	ip_packet_t *ip = h_build_ip(buf, from_ip, IP_PROTOCOL_UDP,
+				     (uint16_t)(sizeof(ip_packet_t) + udplen));
+	udp_packet_t *udp = (void *)ip->data;
+
+	udp->from_port = htons(from_port);
+	udp->to_port = htons(to_port);
+	udp->len = htons(udplen);
+	udp->cksum = 0U;	/* not used */
+	memcpy(udp->data, data, len);
+	return (uint16_t)(sizeof(eth_frame_t) + sizeof(ip_packet_t) + udplen);
+}
+
+static uint16_t h_build_echo(uint8_t *buf, uint16_t seq, uint16_t len)
+{
+	uint16_t icmplen = (uint16_t)(sizeof(icmp_echo_packet_t) + len);
+	ip_packet_t *ip = h_build_ip(buf, H_PEER_IP, IP_PROTOCOL_ICMP,
+				     (uint16_t)(sizeof(ip_packet_t) + icmplen));
+	icmp_echo_packet_t *icmp = (void *)ip->data;
+
+	icmp->type = ICMP_TYPE_ECHO_RQ;
+	icmp->code = 0U;
+	icmp->cksum = 0U;
+	icmp->id = htons(0x1234U);
+	icmp->seq = htons(seq);
+	for (uint16_t i = 0U; i < len; i++) {
+		icmp->data[i] = (uint8_t)i;
+	}
+	icmp->cksum = inet_cksum(icmp, icmplen);
+	return (uint16_t)(sizeof(eth_frame_t) + sizeof(ip_packet_t) + icmplen);
+}
+
+/* readdresses the ip packet built above, fixes the checksum */
+static void h_set_to(uint8_t *buf, uint32_t to_addr)
+{
+	ip_packet_t *ip = (void *)((eth_frame_t *)buf)->data;
+
+	ip->to_addr = to_addr;
+	ip->cksum = 0U;
+	ip->cksum = inet_cksum(ip, sizeof(ip_packet_t));
+}
+
+/* the loopback peer: answers the new ARP requests on the wire */
+static void h_peer_run(void)
+{
+	uint8_t reply[H_MINFRAME];
+	uint16_t len;
+
+	for (uint32_t i = wire.peer; i < wire.count; i++) {
+		eth_frame_t *frame = (void *)wire.frame[i];
+		arp_message_t *msg = (void *)frame->data;
+
+		if (!h_peer_mute && (frame->type == ETH_TYPE_ARP) &&
+		    (msg->type == ARP_TYPE_REQUEST) && (msg->ip_addr_to != ip_addr)) {
+			len = h_build_arp(reply, ARP_TYPE_RESPONSE, h_peer_mac,
+					  msg->ip_addr_to, msg->mac_addr_from, msg->ip_addr_from);
+			if (h_inject(reply, len)) {
+				h_arp_answers++;
+			}
+		}
+	}
+	wire.peer = wire.count;
+}
+
+/* polls the stack until the chip and the peer have nothing more */
+static void h_run(void)
+{
+	h_peer_run();	/* sent by write_socket() meanwhile */
+	for (uint32_t n = 0U; n < H_RUN_LIMIT; n++) {
+		lan_poll();
+		h_peer_run();
+		if (enc28j60_model_reg(EPKTCNT) == 0U) {
+			break;
+		}
+	}
+}
+
+/* the stack at H_IP on a fresh chip, the pool counters cleared */
+static void h_start(void)
+{
+	enc28j60_model_reset();
+	enc28j60_model_stat_clear();
+	enc28j60_model_tx_clear();
+	enc28j60_model_set_tx_cb(h_wire_tx);
+	h_wire_clear();
+	wire.total = 0U;
+	h_arp_answers = 0U;
+	h_peer_mute = false;
+
+	memcpy(mac_addr, h_mac, 6U);
+	ip_addr = H_IP;
+	ip_mask = H_MASK;
+	ip_gateway = H_GW;
+	lan_init();
+
+	arp_clear_cache();
+	memset(arp_pending, 0, sizeof(arp_pending));
+	eth_buf_used = 0U;
+	eth_buf_used_max = 0U;
+	memset((void *)eth_buf_held, 0, sizeof(eth_buf_held));
+	memset((void *)eth_buf_held_max, 0, sizeof(eth_buf_held_max));
+	memset((void *)eth_buf_fails, 0, sizeof(eth_buf_fails));
+	lan_freemem_errors = 0U;
+	lan_poll();	/* rx filters */
+}
+
+/* replays the file through the stack, returns the frames read or -1 */
+static int32_t h_replay(const char *path)
+{
+	pcap_file_t pf;
+	uint8_t buf[H_FRAME_MAX];
+	int32_t len;
+	int32_t n = 0;
+
+	if (!pcap_file_open_read(&pf, path)) {
+		return -1;
+	}
+	while ((len = pcap_file_read(&pf, buf, sizeof(buf), NULL)) >= 0) {
+		if (!h_inject(buf, (uint16_t)len)) {
+			h_run();	/* the chip ring is full, drain and retry */
+			(void)h_inject(buf, (uint16_t)len);
+		}
+		h_run();
+		n++;
+	}
+	pcap_file_close(&pf);
+	return n;
+}
+
+/* index of the first frame on the wire of the type, -1 if none */
+static int h_wire_find(uint16_t type, uint8_t proto)
+{
+	for (uint32_t i = 0U; i < wire.count; i++) {
+		eth_frame_t *frame = (void *)wire.frame[i];
+		ip_packet_t *ip = (void *)frame->data;
+
+		if ((frame->type == type) && ((type != ETH_TYPE_IP) || (ip->protocol == proto))) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+static bool h_temp_path(char *path, size_t len)
+{
+	int fd;
+
+	snprintf(path, len, "/tmp/lan_host_XXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0) {
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+/* replays a generated capture, checks the answers and the wire capture */
+static void TEST_lan_loopback(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	char in_path[32];
+	char out_path[32];
+	pcap_file_t pf;
+	pcap_file_t cap;
+	uint8_t buf[H_FRAME_MAX];
+	uint8_t rx[64];
+	static const uint8_t other[H_MINFRAME] = {
+		0x02, 0x00, 0x00, 0x00, 0x00, 0x01, [12] = 0x88, [13] = 0xB5
+	};
+	socket_p rs, ws;
+	uint32_t misses;
+	lan_buf_stat_t st;
+	int k;
+
+	if (!h_temp_path(in_path, sizeof(in_path)) || !h_temp_path(out_path, sizeof(out_path))) {
+		TEST_FAILED(0, "no temp files");
+		return;
+	}
+	/* ARP who-has us, ping, datagram to the socket, an unknown type */
+	(void)pcap_file_open_write(&pf, in_path);
+	(void)pcap_file_write(&pf, buf, h_build_arp(buf, ARP_TYPE_REQUEST, h_peer_mac,
+						      H_PEER_IP, (const uint8_t[6]){ 0 },
+						      H_IP), 0U);
+	(void)pcap_file_write(&pf, buf, h_build_echo(buf, 1U, 32U), 1U);
+	(void)pcap_file_write(&pf, buf, h_build_udp(buf, H_PEER_IP, 40000U, 5000U,
+						      "hello", 5U), 2U);
+	(void)pcap_file_write(&pf, other, sizeof(other), 3U);
+	pcap_file_close(&pf);
+
+	h_start();
+	(void)pcap_file_open_write(&cap, out_path);
+	h_capture = &cap;
+	rs = bind_socket(H_PEER_IP, 0U, 5000U, SOC_MODE_READ);
+	misses = eth_filter_misses;
+
+	TEST_CHECK(0, h_replay(in_path) == 4);
+
+	k = h_wire_find(ETH_TYPE_ARP, 0U);
+	TEST_CHECK(1, (k >= 0) &&
+		      (((arp_message_t *)((eth_frame_t *)wire.frame[k])->data)->type ==
+		       ARP_TYPE_RESPONSE) &&
+		      (memcmp(((eth_frame_t *)wire.frame[k])->to_addr, h_peer_mac, 6U) == 0));
+
+	k = h_wire_find(ETH_TYPE_IP, IP_PROTOCOL_ICMP);
+	if (k >= 0) {
+		ip_packet_t *ip = (void *)((eth_frame_t *)wire.frame[k])->data;
+		icmp_echo_packet_t *icmp = (void *)ip->data;
+
+		TEST_CHECK(2, (icmp->type == ICMP_TYPE_ECHO_RPLY) && (ip->to_addr == H_PEER_IP) &&
+			      (inet_cksum(ip, sizeof(ip_packet_t)) == 0U) &&
+			      (inet_cksum(icmp, sizeof(icmp_echo_packet_t) + 32U) == 0U));
+	} else {
+		TEST_FAILED(2, "no echo reply");
+	}
+
+	TEST_CHECK(3, (read_socket_nowait(rs, rx, sizeof(rx)) == 5U) &&
+		      (memcmp(rx, "hello", 5U) == 0));
+	TEST_CHECK(4, eth_filter_misses == misses + 1U);
+
+	/* an unknown next hop: parked, ARP asked, the peer answers, sent */
+	h_wire_clear();
+	ws = bind_socket(H_PEER2_IP, 6000U, 0U, SOC_MODE_WRITE);
+	TEST_CHECK(5, write_socket(ws, (uint8_t *)"ping", 4) == SUCCESS);
+	TEST_CHECK(6, (h_wire_find(ETH_TYPE_ARP, 0U) == 0) && (arp_parked == 1U));
+	h_run();
+	k = h_wire_find(ETH_TYPE_IP, IP_PROTOCOL_UDP);
+	if (k >= 0) {
+		eth_frame_t *frame = (void *)wire.frame[k];
+		ip_packet_t *ip = (void *)frame->data;
+		udp_packet_t *udp = (void *)ip->data;
+		uint32_t sum;
+
+		sum = inet_sum(htons(IP_PROTOCOL_UDP) + udp->len, &ip->from_addr, 8U);
+		TEST_CHECK(7, (h_arp_answers == 1U) &&
+			      (memcmp(frame->to_addr, h_peer_mac, 6U) == 0) &&
+			      (udp->to_port == htons(6000U)) &&
+			      (memcmp(udp->data, "ping", 4U) == 0) &&
+			      (inet_fold(inet_sum(sum, udp, ntohs(udp->len))) == 0U));
+	} else {
+		TEST_FAILED(7, "parked datagram not sent");
+	}
+
+	/* everything sent is in the capture */
+	h_capture = NULL;
+	pcap_file_close(&cap);
+	(void)pcap_file_open_read(&cap, out_path);
+	while (pcap_file_read(&cap, buf, sizeof(buf), NULL) >= 0) {
+	}
+	pcap_file_close(&cap);
+	TEST_CHECK(8, (cap.frames == wire.total) && (wire.total == 4U));
+
+	(void)close_socket(rs);
+	(void)close_socket(ws);
+	lan_get_buf_stat(&st);
+	TEST_CHECK(9, (st.free == NUM_ETH_BUFFERS) && (st.free_errors == 0U));
+
+	remove(in_path);
+	remove(out_path);
+	TestFooter(test_name);
+}
+
+/* the cheap rejects go before the checksum */
+static void TEST_lan_ip(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint8_t buf[H_FRAME_MAX];
+	uint8_t rx[16];
+	ip_packet_t *ip = (void *)((eth_frame_t *)buf)->data;
+	socket_p rs;
+	uint32_t misses;
+	uint32_t errors;
+	uint16_t len;
+
+	h_start();
+	rs = bind_socket(H_PEER_IP, 0U, 5000U, SOC_MODE_READ);
+
+	/* broadcast to a port nobody listens on, bad checksum */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 9999U, "x", 1U);
+	h_set_to(buf, inet_addr(192, 168, 1, 255));
+	ip->cksum ^= 0x5AU;
+	misses = ip_filter_misses;
+	errors = ip_cksum_errors;
+	(void)eth_filter((eth_frame_t *)buf, len);
+	TEST_CHECK(0, (ip_filter_misses == misses + 1U) && (ip_cksum_errors == errors));
+
+	/* unicast to the socket, bad checksum: checked, not delivered */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "x", 1U);
+	ip->cksum ^= 0x5AU;
+	(void)eth_filter((eth_frame_t *)buf, len);
+	TEST_CHECK(1, (ip_cksum_errors == errors + 1U) &&
+		      (read_socket_nowait(rs, rx, sizeof(rx)) == 0U));
+
+	/* options and a length past the frame are dropped before it */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "x", 1U);
+	ip->ver_head_len = 0x46U;
+	(void)eth_filter((eth_frame_t *)buf, len);
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "x", 1U);
+	ip->total_len = htons(1000U);
+	(void)eth_filter((eth_frame_t *)buf, len);
+	TEST_CHECK(2, (ip_filter_misses == misses + 3U) && (ip_cksum_errors == errors + 1U));
+
+	/* no echo replies to broadcasts */
+	h_wire_clear();
+	len = h_build_echo(buf, 1U, 8U);
+	h_set_to(buf, IP_LIMITED_BROADCAST);
+	(void)eth_filter((eth_frame_t *)buf, len);
+	TEST_CHECK(3, wire.count == 0U);
+
+	/* a good one still passes */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "ok", 2U);
+	(void)h_inject(buf, len);
+	h_run();
+	TEST_CHECK(4, read_socket_nowait(rs, rx, sizeof(rx)) == 2U);
+
+	(void)close_socket(rs);
+	TestFooter(test_name);
+}
+
+/* size of the class of the pool buffer, 0 if it is not one */
+static uint32_t h_buf_size(const uint8_t *buf)
+{
+	uint32_t i = lan_buf_index(buf);
+
+	if (i < ETH_BUF_SMALL_NUM) {
+		return ETH_BUF_SMALL;
+	}
+	if (i < ETH_BUF_SMALL_NUM + ETH_BUF_MEDIUM_NUM) {
+		return ETH_BUF_MEDIUM;
+	}
+	if (i < ETH_BUF_LARGE_FIRST) {
+		return ETH_BUF_FULL;
+	}
+	if (i < NUM_ETH_BUFFERS) {
+		return ETH_BUF_LARGE;
+	}
+	return 0U;
+}
+
+/* every frame queued to the socket holds its payload within its buffer */
+static bool h_rxq_fits(socket_p soc)
+{
+	QueueHandle_t q = soc_rxq[soc - sockets];
+	soc_rx_item_t items[SOC_RXQ_MAX];
+	UBaseType_t n = 0U;
+	bool fits = true;
+
+	while ((n < SOC_RXQ_MAX) && (xQueueReceive(q, &items[n], 0U) == pdTRUE)) {
+		if ((UDP_PAYLOAD_START + (uint32_t)items[n].len) > h_buf_size(items[n].frame)) {
+			fits = false;
+		}
+		n++;
+	}
+	for (UBaseType_t i = 0U; i < n; i++) {
+		(void)xQueueSend(q, &items[i], 0U);
+	}
+	return fits;
+}
+
+/* the UDP length is checked against the IP payload */
+static void TEST_lan_udp_len(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint8_t buf[H_FRAME_MAX];
+	uint8_t rx[256];
+	udp_packet_t *udp = (void *)((ip_packet_t *)((eth_frame_t *)buf)->data)->data;
+	socket_p rs;
+	uint32_t errors;
+	uint16_t len;
+	lan_buf_stat_t st;
+
+	h_start();
+	rs = bind_socket(H_PEER_IP, 0U, 5000U, SOC_MODE_READ);
+	errors = udp_len_errors;
+
+	/* a short frame claiming a long datagram */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "x", 1U);
+	udp->len = htons(1000U);
+	(void)h_inject(buf, len);
+	h_run();
+	TEST_CHECK(0, (udp_len_errors == errors + 1U) && h_rxq_fits(rs) &&
+		      (read_socket_nowait(rs, rx, sizeof(rx)) == 0U));
+
+	/* shorter than its own header */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "x", 1U);
+	udp->len = htons(4U);
+	(void)h_inject(buf, len);
+	h_run();
+	TEST_CHECK(1, (udp_len_errors == errors + 2U) && h_rxq_fits(rs) &&
+		      (read_socket_nowait(rs, rx, sizeof(rx)) == 0U));
+
+	/* shorter than the IP payload: the rest is padding */
+	len = h_build_udp(buf, H_PEER_IP, 40000U, 5000U, "abcd", 4U);
+	udp->len = htons((uint16_t)(sizeof(udp_packet_t) + 2U));
+	(void)h_inject(buf, len);
+	h_run();
+	TEST_CHECK(2, h_rxq_fits(rs) && (read_socket_nowait(rs, rx, sizeof(rx)) == 2U) &&
+		      (memcmp(rx, "ab", 2U) == 0));
+
+	/* one frame of each class queued, each payload within its buffer */
+	(void)set_rxq_params(rs, SOC_RXQ_MAX, SOC_RXQ_DROP_NEWEST);
+	memset(rx, 0x5A, sizeof(rx));
+	(void)h_inject(buf, h_build_udp(buf, H_PEER_IP, 40000U, 5000U, rx, 1U));
+	(void)h_inject(buf, h_build_udp(buf, H_PEER_IP, 40000U, 5000U, rx, 150U));
+	(void)h_inject(buf, h_build_udp(buf, H_PEER_IP, 40000U, 5000U, rx, 250U));
+	h_run();
+	TEST_CHECK(3, h_rxq_fits(rs) && (read_socket_nowait(rs, rx, sizeof(rx)) == 1U) &&
+		      (read_socket_nowait(rs, rx, sizeof(rx)) == 150U) &&
+		      (read_socket_nowait(rs, rx, sizeof(rx)) == 250U));
+
+	(void)close_socket(rs);
+	lan_get_buf_stat(&st);
+	TEST_CHECK(4, (st.free == NUM_ETH_BUFFERS) && (st.free_errors == 0U));
+	TestFooter(test_name);
+}
+
+/* an address of the home slot, 0 if none found */
+static uint32_t h_arp_ip(uint32_t home, uint32_t skip)
+{
+	for (uint32_t n = 1U; n < 0x10000U; n++) {
+		uint32_t ip = inet_addr(10, 0, (uint8_t)(n >> 8), (uint8_t)n);
+
+		if ((ARP_HASH(ip) == home) && (ip != skip)) {
+			return ip;
+		}
+	}
+	return 0U;
+}
+
+/* every entry is aged once a pass, whatever the deletions shift */
+static void TEST_lan_arp_age(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	const uint32_t last = ARP_CACHE_SIZE - 1U;
+	uint32_t a = h_arp_ip(last - 1U, 0U);
+	uint32_t b = h_arp_ip(last - 1U, a);
+	uint32_t c = h_arp_ip(last, 0U);
+
+	h_start();
+	/* a chain wrapping into slot 0, its first entry outdated */
+	arp_cache[last - 1U] = (arp_cache_entry_t){ .ip_addr = a, .age = 0 };
+	arp_cache[last] = (arp_cache_entry_t){ .ip_addr = b, .age = 5 };
+	arp_cache[0] = (arp_cache_entry_t){ .ip_addr = c, .age = 5 };
+	arp_age_entries();
+	TEST_CHECK(0, (arp_find(a) < 0) && (arp_find(b) == (int)(last - 1U)) &&
+		      (arp_find(c) == (int)last));
+	TEST_CHECK(1, (arp_cache[last - 1U].age == 4) && (arp_cache[last].age == 4) &&
+		      (arp_cache[0].ip_addr == 0U));
+
+	/* outdated on the pass after the age reaches 0 */
+	for (uint32_t n = 0U; n < 4U; n++) {
+		arp_age_entries();
+	}
+	TEST_CHECK(2, (arp_find(b) >= 0) && (arp_find(c) >= 0));
+	arp_age_entries();
+	TEST_CHECK(3, (arp_find(b) < 0) && (arp_find(c) < 0));
+
+	TestFooter(test_name);
+}
+
+/* a lock-free lookup leaves the cache alone, the lan task stamps the hit */
+static void TEST_lan_arp_hit(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint32_t a = h_arp_ip(1U, 0U);
+	uint32_t tick;
+	uint8_t mac[6];
+	int i;
+
+	h_start();
+	arp_cache[1] = (arp_cache_entry_t){ .ip_addr = a, .age = 5, .used = 1U };
+	HAL_Delay(100U);
+	tick = HAL_GetTick();
+	TEST_CHECK(0, arp_lookup(a, mac) && (arp_cache[1].used == 1U) &&
+		      (arp_hit_ip == a) && (arp_hit_tick == tick));
+	HAL_Delay(100U);
+	arp_tick();
+	i = arp_find(a);
+	TEST_CHECK(1, (i == 1) && (arp_cache[i].used == tick) && (arp_hit_ip == 0U));
+
+	TestFooter(test_name);
+}
+
+#define	P_LEN		512U	/* echo data */
+#define	P_ROUNDS	24U	/* the rx ring wraps meanwhile */
+
+/* the echo reply on the wire at k answers h_build_echo(seq, len) */
+static bool h_echo_ok(int k, uint16_t seq, uint16_t len)
+{
+	ip_packet_t *ip;
+	icmp_echo_packet_t *icmp;
+
+	if (k < 0) {
+		return false;
+	}
+	ip = (void *)((eth_frame_t *)wire.frame[k])->data;
+	icmp = (void *)ip->data;
+	for (uint16_t i = 0U; i < len; i++) {
+		if (icmp->data[i] != (uint8_t)i) {
+			return false;
+		}
+	}
+	return (memcmp(((eth_frame_t *)wire.frame[k])->to_addr, h_peer_mac, 6U) == 0) &&
+	       (icmp->type == ICMP_TYPE_ECHO_RPLY) && (icmp->seq == htons(seq)) &&
+	       (ip->from_addr == H_IP) && (ip->to_addr == H_PEER_IP) &&
+	       (ntohs(ip->total_len) == sizeof(ip_packet_t) + sizeof(icmp_echo_packet_t) + len) &&
+	       (wire.len[k] == sizeof(eth_frame_t) + ntohs(ip->total_len)) &&
+	       (inet_cksum(ip, sizeof(ip_packet_t)) == 0U) &&
+	       (inet_cksum(icmp, sizeof(icmp_echo_packet_t) + len) == 0U);
+}
+
+/* SPI bytes of one ping answered by lan_poll() */
+static uint32_t h_ping_spi(uint16_t seq, uint16_t len)
+{
+	uint8_t buf[H_FRAME_MAX];
+	uint32_t spi;
+
+	(void)h_inject(buf, h_build_echo(buf, seq, len));
+	spi = enc28j60_model_stat()->spi_bytes;
+	h_run();
+	return enc28j60_model_stat()->spi_bytes - spi;
+}
+
+/* echo requests answered in the chip: the data is not read nor written */
+static void TEST_lan_icmp(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint8_t buf[H_FRAME_MAX];
+	ip_packet_t *ip = (void *)((eth_frame_t *)buf)->data;
+	uint32_t chip_spi, spi;
+	uint32_t replies;
+	uint32_t fast;
+	uint16_t len;
+	bool ok = true;
+
+	h_start();
+	replies = enc28j60_get_tx_stat()->dma_replies;
+	fast = icmp_chip_replies;
+	chip_spi = h_ping_spi(1U, P_LEN);
+	TEST_CHECK(0, (wire.count == 1U) && h_echo_ok(0, 1U, P_LEN) &&
+		      (enc28j60_get_tx_stat()->dma_replies == replies + 1U) &&
+		      (icmp_chip_replies == fast + 1U));
+
+	/* the frame straddles the end of the rx ring now and then */
+	for (uint16_t i = 0U; i < P_ROUNDS; i++) {
+		h_wire_clear();
+		(void)h_ping_spi(i, P_LEN - i * 8U);
+		ok = ok && (wire.count == 1U) && h_echo_ok(0, i, P_LEN - i * 8U);
+	}
+	TEST_CHECK(1, ok && (icmp_chip_replies == fast + 1U + P_ROUNDS));
+
+	/* no data, padded frame: the reply is the head only */
+	h_wire_clear();
+	(void)h_ping_spi(2U, 0U);
+	TEST_CHECK(2, (wire.count == 1U) && h_echo_ok(0, 2U, 0U));
+
+	/* not for the fast path: broadcast, bad header checksum */
+	h_wire_clear();
+	len = h_build_echo(buf, 3U, 16U);
+	h_set_to(buf, IP_LIMITED_BROADCAST);
+	(void)h_inject(buf, len);
+	len = h_build_echo(buf, 4U, 16U);
+	ip->cksum ^= 0x5AU;
+	(void)h_inject(buf, len);
+	h_run();
+	TEST_CHECK(3, (wire.count == 0U) && (icmp_chip_replies == fast + 2U + P_ROUNDS));
+
+	/* the way it was: the whole frame is read and written back */
+	h_wire_clear();
+	enc28j60_set_rx_hook(NULL, 0U);
+	spi = h_ping_spi(5U, P_LEN);
+	printf("\tSPI bytes per %u byte ping: %lu in the chip, %lu read and written\n",
+	       P_LEN, (unsigned long)chip_spi, (unsigned long)spi);
+	TEST_CHECK(4, h_echo_ok(0, 5U, P_LEN) && (chip_spi < P_LEN / 2U) && (spi > 2U * P_LEN));
+	enc28j60_set_rx_hook(icmp_rx_hook, ICMP_ECHO_HEAD);
+
+	TestFooter(test_name);
+}
+
+#define	F_LEN		700U	/* udp payload of the fragmented datagrams */
+#define	F_STEP		256U	/* ip payload per fragment */
+
+/* the datagram from the peer to port 5000, its ip payload in dgram */
+static uint16_t h_build_dgram(uint8_t *dgram, uint16_t len)
+{
+	udp_packet_t *udp = (void *)dgram;
+
+	udp->from_port = htons(40000U);
+	udp->to_port = htons(5000U);
+	udp->len = htons((uint16_t)(sizeof(udp_packet_t) + len));
+	udp->cksum = 0U;
+	for (uint16_t i = 0U; i < len; i++) {
+		udp->data[i] = (uint8_t)(i * 7U);
+	}
+	return (uint16_t)(sizeof(udp_packet_t) + len);
+}
+
+/* injects the fragment of the ip payload at ofs */
+static void h_inject_frag(const uint8_t *dgram, uint16_t total, uint16_t id,
+			  uint16_t ofs, uint16_t len)
+{
+	uint8_t buf[H_FRAME_MAX];
+	ip_packet_t *ip = h_build_ip(buf, H_PEER_IP, IP_PROTOCOL_UDP,
+				     (uint16_t)(sizeof(ip_packet_t) + len));
+	uint16_t flags = (uint16_t)(ofs / 8U);
+
+	if ((ofs + len) < total) {
+		flags |= 0x2000U;
+	}
+	ip->fragment_id = htons(id);
+	ip->flags_framgent_offset = htons(flags);
+	ip->cksum = 0U;
+	ip->cksum = inet_cksum(ip, sizeof(ip_packet_t));
+	memcpy(ip->data, dgram + ofs, len);
+	(void)h_inject(buf, (uint16_t)(sizeof(eth_frame_t) + sizeof(ip_packet_t) + len));
+	h_run();
+}
+
+static bool h_dgram_ok(const uint8_t *rx, uint16_t n)
+{
+	if (n != F_LEN) {
+		return false;
+	}
+	for (uint16_t i = 0U; i < n; i++) {
+		if (rx[i] != (uint8_t)(i * 7U)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* a DHCP reply to us with the options given, returns the UDP payload length */
+static uint16_t h_build_dhcp(uint8_t *buf, uint32_t offered, const uint8_t *opt,
+			     uint16_t optlen)
+{
+	uint16_t len = (uint16_t)(sizeof(dhcp_message_t) + optlen);
+	ip_packet_t *ip = h_build_ip(buf, H_PEER_IP, IP_PROTOCOL_UDP,
+				     (uint16_t)(sizeof(ip_packet_t) + sizeof(udp_packet_t) + len));
+	udp_packet_t *udp = (void *)ip->data;
+	dhcp_message_t *dhcp = (void *)udp->data;
+
+	udp->from_port = DHCP_SERVER_PORT;
+	udp->to_port = DHCP_CLIENT_PORT;
+	udp->len = htons((uint16_t)(sizeof(udp_packet_t) + len));
+	udp->cksum = 0U;
+	memset(dhcp, 0, sizeof(dhcp_message_t));
+	dhcp->operation = DHCP_OP_REPLY;
+	dhcp->transaction_id = dhcp_transaction_id;
+	dhcp->offered_addr = offered;
+	dhcp->magic_cookie = DHCP_MAGIC_COOKIE;
+	memcpy(dhcp->hw_addr, h_mac, 6U);
+	memcpy(dhcp->options, opt, optlen);
+	return len;
+}
+
+/* the option walk keeps to the option lengths */
+static void TEST_lan_dhcp_options(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint8_t buf[H_FRAME_MAX];
+	uint8_t opt[320];
+	uint16_t n;
+	const uint32_t offered = inet_addr(192, 168, 1, 77);
+
+	h_start();
+	dhcp_transaction_id = 0x12345678U;
+
+	/* a 254 byte option before the message type */
+	memset(opt, 0, sizeof(opt));
+	n = 0U;
+	opt[n++] = 43U;
+	opt[n++] = 254U;
+	n += 254U;
+	opt[n++] = DHCP_CODE_MESSAGETYPE;
+	opt[n++] = 1U;
+	opt[n++] = DHCP_MESSAGE_OFFER;
+	opt[n++] = DHCP_CODE_END;
+	dhcp_status = DHCP_WAITING_OFFER;
+	dhcp_filter((eth_frame_t *)buf, h_build_dhcp(buf, offered, opt, n));
+	TEST_CHECK(0, (dhcp_status == DHCP_WAITING_ACK) && (dhcp_lease.ip_addr == offered));
+
+	/* the longest one */
+	opt[1] = 255U;
+	memmove(&opt[257], &opt[256], 4U);
+	dhcp_status = DHCP_WAITING_OFFER;
+	dhcp_lease.ip_addr = 0U;
+	dhcp_filter((eth_frame_t *)buf, h_build_dhcp(buf, offered, opt, (uint16_t)(n + 1U)));
+	TEST_CHECK(1, (dhcp_status == DHCP_WAITING_ACK) && (dhcp_lease.ip_addr == offered));
+
+	/* a short mask is not read from the gateway option after it */
+	n = 0U;
+	opt[n++] = DHCP_CODE_MESSAGETYPE;
+	opt[n++] = 1U;
+	opt[n++] = DHCP_MESSAGE_ACK;
+	opt[n++] = DHCP_CODE_SUBNETMASK;
+	opt[n++] = 2U;
+	opt[n++] = 255U;
+	opt[n++] = 255U;
+	opt[n++] = DHCP_CODE_GATEWAY;
+	opt[n++] = 4U;
+	memcpy(&opt[n], &(uint32_t){ H_GW }, 4U);
+	n += 4U;
+	opt[n++] = DHCP_CODE_END;
+	dhcp_filter((eth_frame_t *)buf, h_build_dhcp(buf, offered, opt, n));
+	TEST_CHECK(2, (dhcp_status == DHCP_ASSIGNED) && (ip_addr == offered) &&
+		      (ip_mask == 0U) && (ip_gateway == H_GW));
+
+	/* no message type in an empty one */
+	n = 0U;
+	opt[n++] = DHCP_CODE_MESSAGETYPE;
+	opt[n++] = 0U;
+	opt[n++] = DHCP_MESSAGE_OFFER;
+	opt[n++] = DHCP_CODE_END;
+	dhcp_status = DHCP_WAITING_OFFER;
+	dhcp_filter((eth_frame_t *)buf, h_build_dhcp(buf, offered, opt, n));
+	TEST_CHECK(3, dhcp_status == DHCP_WAITING_OFFER);
+
+	dhcp_status = DHCP_DISABLED;
+	TestFooter(test_name);
+}
+
+/* a frame that can't be parked is dropped, the stack goes on */
+static void TEST_lan_park_full(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	socket_p ws[ARP_PENDING_SIZE + 1U];
+	uint32_t drops;
+	uint32_t gen;
+	uint32_t n;
+	lan_buf_stat_t st;
+
+	h_start();
+	h_peer_mute = true;
+	for (n = 0U; n <= ARP_PENDING_SIZE; n++) {
+		ws[n] = bind_socket(inet_addr(192, 168, 1, (uint8_t)(30U + n)), 6000U, 0U,
+				    SOC_MODE_WRITE);
+	}
+	/* every next hop entry is busy */
+	for (n = 0U; n < ARP_PENDING_SIZE; n++) {
+		(void)write_socket(ws[n], (uint8_t *)"x", 1);
+	}
+	drops = arp_park_drops;
+	gen = arp_gen;
+	h_wire_clear();
+	for (n = 0U; n < 8U; n++) {
+		ws[ARP_PENDING_SIZE]->last_error = 0U;
+		if ((write_socket(ws[ARP_PENDING_SIZE], (uint8_t *)"y", 1) != ERROR) ||
+		    (ws[ARP_PENDING_SIZE]->last_error != SOC_ERR_NOT_RESOLVED)) {
+			break;
+		}
+	}
+	TEST_CHECK(0, (n == 8U) && (arp_park_drops == drops + 8U));
+	TEST_CHECK(1, (wr_soc_err == 0U) && (arp_gen == gen));
+	/* the MAC is still asked for */
+	TEST_CHECK(2, (h_wire_find(ETH_TYPE_ARP, 0U) == 0) && (wire.count == 8U));
+
+	/* the answer lets the next write through */
+	h_peer_mute = false;
+	h_run();
+	h_wire_clear();
+	TEST_CHECK(3, (write_socket(ws[ARP_PENDING_SIZE], (uint8_t *)"z", 1) == SUCCESS) &&
+		      (h_wire_find(ETH_TYPE_IP, IP_PROTOCOL_UDP) >= 0));
+
+	for (n = 0U; n <= ARP_PENDING_SIZE; n++) {
+		(void)close_socket(ws[n]);
+	}
+	arp_flush(inet_addr(192, 168, 1, 30), NULL);
+	arp_flush(inet_addr(192, 168, 1, 31), NULL);
+	lan_get_buf_stat(&st);
+	TEST_CHECK(4, (st.free == NUM_ETH_BUFFERS) && (st.free_errors == 0U));
+	TestFooter(test_name);
+}
+
+/* reassembly in and out of order, the bad fragments, the timeout and
+ * a fragmented send */
+static void TEST_lan_frag(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	uint8_t dgram[F_LEN + sizeof(udp_packet_t)];
+	uint8_t rx[UDP_DGRAM_MAX];
+	uint8_t tx[1200];
+	uint16_t total = h_build_dgram(dgram, F_LEN);
+	uint32_t drops;
+	socket_p rs, ws;
+	lan_buf_stat_t st;
+	ErrorStatus res;
+	uint16_t ofs;
+	uint16_t id;
+	uint32_t sum;
+	bool ok;
+
+	h_start();
+	rs = bind_socket(H_PEER_IP, 0U, 5000U, SOC_MODE_READ);
+
+	for (ofs = 0U; ofs < total; ofs += F_STEP) {
+		h_inject_frag(dgram, total, 1U, ofs, ((total - ofs) > F_STEP) ? F_STEP : (uint16_t)(total - ofs));
+	}
+	TEST_CHECK(0, h_dgram_ok(rx, read_socket_nowait(rs, rx, sizeof(rx))) &&
+		      (ip_reasm_done == 1U));
+
+	h_inject_frag(dgram, total, 2U, 2U * F_STEP, total - 2U * F_STEP);
+	h_inject_frag(dgram, total, 2U, 0U, F_STEP);
+	TEST_CHECK(1, read_socket_nowait(rs, rx, sizeof(rx)) == 0U);
+	h_inject_frag(dgram, total, 2U, F_STEP, F_STEP);
+	TEST_CHECK(2, h_dgram_ok(rx, read_socket_nowait(rs, rx, sizeof(rx))));
+
+	/* overlap, a middle fragment of odd length: the datagram is dropped */
+	drops = ip_reasm_drops;
+	h_inject_frag(dgram, total, 3U, 0U, F_STEP);
+	h_inject_frag(dgram, total, 3U, F_STEP - 8U, F_STEP);
+	h_inject_frag(dgram, total, 4U, 0U, F_STEP - 4U);
+	lan_get_buf_stat(&st);
+	TEST_CHECK(3, (ip_reasm_drops == drops + 2U) && (st.held[LAN_BUF_REASM] == 0U) &&
+		      (read_socket_nowait(rs, rx, sizeof(rx)) == 0U));
+
+	/* the rest never comes */
+	h_inject_frag(dgram, total, 5U, 0U, F_STEP);
+	lan_get_buf_stat(&st);
+	TEST_CHECK(4, st.held[LAN_BUF_REASM] == 1U);
+	HAL_Delay(IP_REASM_TIMEOUT);
+	h_run();
+	lan_get_buf_stat(&st);
+	TEST_CHECK(5, (ip_reasm_timeouts == 1U) && (st.held[LAN_BUF_REASM] == 0U));
+
+	/* out: ARP first, then the fragments with the udp header in the first */
+	h_wire_clear();
+	for (uint16_t i = 0U; i < sizeof(tx); i++) {
+		tx[i] = (uint8_t)(i ^ 0xA5U);
+	}
+	ws = bind_socket(H_PEER2_IP, 6000U, 0U, SOC_MODE_WRITE);
+	res = write_socket(ws, tx, sizeof(tx));
+	TEST_CHECK(6, (res == ERROR) && (ws->last_error == SOC_ERR_NOT_RESOLVED) &&
+		      (h_wire_find(ETH_TYPE_ARP, 0U) == 0) && (wr_soc_err == 0U));
+	h_run();
+	h_wire_clear();
+	TEST_CHECK(7, write_socket(ws, tx, sizeof(tx)) == SUCCESS);
+
+	ok = (wire.count == 3U);
+	ofs = 0U;
+	id = 0U;
+	memset(rx, 0, sizeof(rx));
+	for (uint32_t i = 0U; ok && (i < wire.count); i++) {
+		ip_packet_t *ip = (void *)((eth_frame_t *)wire.frame[i])->data;
+		uint16_t flags = ntohs(ip->flags_framgent_offset);
+		uint16_t n = ntohs(ip->total_len) - sizeof(ip_packet_t);
+
+		id = (i == 0U) ? ip->fragment_id : id;
+		ok = (ip->fragment_id == id) && (id != 0U) &&
+		     ((flags & 0x1FFFU) * 8U == ofs) &&
+		     (((flags & 0x2000U) != 0U) == (i + 1U < wire.count)) &&
+		     (inet_cksum(ip, sizeof(ip_packet_t)) == 0U) &&
+		     (wire.len[i] <= ETH_MAXFRAME);
+		memcpy(rx + ofs, ip->data, n);
+		ofs += n;
+	}
+	TEST_CHECK(8, ok && (ofs == sizeof(tx) + sizeof(udp_packet_t)));
+	if (ok) {
+		ip_packet_t *ip = (void *)((eth_frame_t *)wire.frame[0])->data;
+		udp_packet_t *udp = (void *)rx;
+
+		sum = inet_sum(htons(IP_PROTOCOL_UDP) + udp->len, &ip->from_addr, 8U);
+		TEST_CHECK(9, (ntohs(udp->len) == ofs) &&
+			      (memcmp(udp->data, tx, sizeof(tx)) == 0) &&
+			      (inet_fold(inet_sum(sum, udp, ofs)) == 0U));
+	} else {
+		TEST_FAILED(9, "fragments");
+	}
+	TEST_CHECK(10, (write_socket(ws, tx, UDP_DGRAM_MAX + 1) == ERROR) &&
+		       (udp_max_payload(0U) == 558U));
+	wr_soc_err = 0U;
+
+	(void)close_socket(rs);
+	(void)close_socket(ws);
+	lan_get_buf_stat(&st);
+	TEST_CHECK(11, (st.free == NUM_ETH_BUFFERS) && (st.free_errors == 0U));
+	TestFooter(test_name);
+}
+
+#define	B_ROUNDS	200000U
+#define	B_WROUNDS	20000U
+#define	B_PORT		7000U
+#define	B_SOCKETS	4U
+#define	B_BURST		8U
+#define	B_BURSTS	2000U
+
+/* frames/s and per frame cost of the rx and tx paths, pool high-water */
+static void TEST_lan_bench(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	static const uint16_t sizes[] = { 18U, 64U, 256U, 512U };
+	uint8_t frame[H_FRAME_MAX];
+	uint8_t payload[ETH_MAXFRAME];
+	uint8_t rx[ETH_MAXFRAME];
+	socket_p rs[B_SOCKETS];
+	socket_p ws;
+	lan_buf_stat_t st;
+	double t0, t;
+	uint16_t len;
+	uint8_t *buf;
+	unsigned int lost = 0U;
+
+	h_start();
+	enc28j60_model_set_tx_cb(NULL);
+	for (size_t i = 0U; i < sizeof(payload); i++) {
+		payload[i] = (uint8_t)rand();
+	}
+	for (uint32_t s = 0U; s < B_SOCKETS; s++) {
+		rs[s] = bind_socket(H_PEER_IP, 0U, (uint16_t)(B_PORT + s), SOC_MODE_READ);
+	}
+
+	/* eth_filter -> udp_packet_callback, the socket queue drops the oldest */
+	printf("\trx eth_filter -> udp_packet_callback:\n");
+	for (size_t i = 0U; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		len = h_build_udp(frame, H_PEER_IP, 40000U, B_PORT, payload, sizes[i]);
+		t0 = now_ns();
+		for (uint32_t k = 0U; k < B_ROUNDS; k++) {
+			buf = lan_getmem(len, LAN_BUF_RX);
+			if (buf == NULL) {
+				lost++;
+				continue;
+			}
+			memcpy(buf, frame, len);
+			buf = (uint8_t *)eth_filter((eth_frame_t *)buf, len);
+			if (buf != NULL) {
+				(void)lan_freemem(buf);
+				lost++;
+			}
+		}
+		t = (now_ns() - t0) / B_ROUNDS;
+		printf("\t%3u bytes: %6.1f ns/frame, %5.2f Mframes/s\n",
+		       (unsigned int)sizes[i], t, 1e3 / t);
+	}
+	while (read_socket_nowait(rs[0], rx, sizeof(rx)) != 0U) {
+	}
+	TEST_CHECK(0, lost == 0U);
+
+	/* broadcast to others, rejected before the checksum */
+	len = h_build_udp(frame, H_PEER_IP, 40000U, 137U, payload, 64U);
+	h_set_to(frame, inet_addr(192, 168, 1, 255));
+	t0 = now_ns();
+	for (uint32_t k = 0U; k < B_ROUNDS; k++) {
+		buf = lan_getmem(len, LAN_BUF_RX);
+		memcpy(buf, frame, len);
+		buf = (uint8_t *)eth_filter((eth_frame_t *)buf, len);
+		(void)lan_freemem(buf);
+	}
+	t = (now_ns() - t0) / B_ROUNDS;
+	printf("	rx broadcast not for us: %6.1f ns/frame, %5.2f Mframes/s\n", t, 1e3 / t);
+
+	/* the whole rx path: chip ring, SPI model, lan_poll() */
+	len = h_build_udp(frame, H_PEER_IP, 40000U, B_PORT + 1U, payload, 64U);
+	t0 = now_ns();
+	for (uint32_t k = 0U; k < B_WROUNDS; k++) {
+		(void)h_inject(frame, len);
+		lan_poll();
+	}
+	t = (now_ns() - t0) / B_WROUNDS;
+	printf("\trx lan_poll with the SPI model: %6.1f ns/frame, %5.2f Mframes/s\n",
+	       t, 1e3 / t);
+	while (read_socket_nowait(rs[1], rx, sizeof(rx)) != 0U) {
+	}
+
+	/* write_socket on a resolved header, the SPI model included */
+	ws = bind_socket(H_PEER_IP, 6000U, 0U, SOC_MODE_WRITE);
+	printf("\ttx write_socket:\n");
+	for (size_t i = 0U; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		uint32_t errors = 0U;
+
+		t0 = now_ns();
+		for (uint32_t k = 0U; k < B_WROUNDS; k++) {
+			if (write_socket(ws, payload, sizes[i]) != SUCCESS) {
+				errors++;
+			}
+			wr_soc_err = 0U;
+		}
+		t = (now_ns() - t0) / B_WROUNDS;
+		printf("\t%3u bytes: %6.1f ns/frame, %5.2f Mframes/s\n",
+		       (unsigned int)sizes[i], t, 1e3 / t);
+		lost += errors;
+	}
+	TEST_CHECK(1, lost == 0U);
+	(void)close_socket(ws);
+
+	/* bursts of datagrams, pings and ARP requests, the reader is slow */
+	eth_buf_used_max = eth_buf_used;
+	memset((void *)eth_buf_held_max, 0, sizeof(eth_buf_held_max));
+	memset((void *)eth_buf_fails, 0, sizeof(eth_buf_fails));
+	enc28j60_model_stat_clear();
+	srand(3U);
+	for (uint32_t b = 0U; b < B_BURSTS; b++) {
+		for (uint32_t k = 0U; k < B_BURST; k++) {
+			uint32_t r = (uint32_t)rand();
+
+			switch (r & 7U) {
+			case 0:
+				len = h_build_echo(frame, (uint16_t)k, (uint16_t)(r >> 8) & 255U);
+				break;
+			case 1:
+				len = h_build_arp(frame, ARP_TYPE_REQUEST, h_peer_mac, H_PEER_IP,
+						  (const uint8_t[6]){ 0 }, H_IP);
+				break;
+			default:
+				len = h_build_udp(frame, H_PEER_IP, 40000U,
+						  (uint16_t)(B_PORT + (r >> 4) % B_SOCKETS),
+						  payload, (uint16_t)((r >> 8) % 512U));
+				break;
+			}
+			(void)h_inject(frame, len);
+		}
+		lan_poll();
+		lan_poll();
+		(void)read_socket_nowait(rs[b % B_SOCKETS], rx, sizeof(rx));
+	}
+	lan_get_buf_stat(&st);
+	printf("\tpool under %u bursts of %u: min free %lu of %u, held max rx %lu sock %lu,"
+	       " getmem fails rx %lu, chip overflows %lu\n",
+	       B_BURSTS, B_BURST, (unsigned long)st.min_free, (unsigned int)NUM_ETH_BUFFERS,
+	       (unsigned long)st.held_max[LAN_BUF_RX], (unsigned long)st.held_max[LAN_BUF_SOCK],
+	       (unsigned long)st.fails[LAN_BUF_RX],
+	       (unsigned long)enc28j60_model_stat()->rx_overflows);
+	TEST_CHECK(2, st.held_max[LAN_BUF_SOCK] <= B_SOCKETS * SOC_RXQ_DEPTH);
+
+	/* nothing leaks once the sockets are drained */
+	h_run();
+	for (uint32_t s = 0U; s < B_SOCKETS; s++) {
+		while (read_socket_nowait(rs[s], rx, sizeof(rx)) != 0U) {
+		}
+		(void)close_socket(rs[s]);
+	}
+	lan_get_buf_stat(&st);
+	TEST_CHECK(3, (st.free == NUM_ETH_BUFFERS) && (st.free_errors == 0U));
+
+	TestFooter(test_name);
+}
+
+void TEST_lan(void)
+{
+	TEST_lan_loopback();
+	TEST_lan_ip();
+	TEST_lan_udp_len();
+	TEST_lan_arp_age();
+	TEST_lan_arp_hit();
+	TEST_lan_park_full();
+	TEST_lan_dhcp_options();
+	TEST_lan_frag();
+	TEST_lan_icmp();
+	TEST_lan_bench();
+}
+
+/**
+ * @brief lan_host_replay runs a capture through the stack at H_IP, the
+ *        loopback peer answers ARP; the frames sent go to out_path
+ * @param in_path pcap file to replay
+ * @param out_path pcap file of the frames sent or NULL
+ * @return 0 on success
+ */
+int lan_host_replay(const char *in_path, const char *out_path)
+{
+	pcap_file_t cap;
+	lan_buf_stat_t st;
+	int32_t n;
+
+	h_start();
+	if (out_path != NULL) {
+		if (!pcap_file_open_write(&cap, out_path)) {
+			printf("%s: can not create\n", out_path);
+			return 1;
+		}
+		h_capture = &cap;
+	}
+	n = h_replay(in_path);
+	if (out_path != NULL) {
+		h_capture = NULL;
+		pcap_file_close(&cap);
+	}
+	if (n < 0) {
+		printf("%s: not an ethernet capture\n", in_path);
+		return 1;
+	}
+	lan_get_buf_stat(&st);
+	printf("%ld frame(s) in, %lu out, %lu ARP answered, eth misses %lu, ip misses %lu,"
+	       " pool min free %lu of %u\n",
+	       (long)n, (unsigned long)wire.total, (unsigned long)h_arp_answers,
+	       (unsigned long)eth_filter_misses, (unsigned long)ip_filter_misses,
+	       (unsigned long)st.min_free, (unsigned int)NUM_ETH_BUFFERS);
+	return 0;
+}
@@ -0,0 +1,51 @@
+/** @file test_main.c
+ *  @brief host test runner for the network stack
+ *
+ *  Build and run with the Makefile of this directory:
+ *
+ *	make -C Core/Src/lan/host run
+ *
+ *  lan_tests -r in.pcap [-w out.pcap] replays a capture through the
+ *  stack instead of running the tests, see lan_host_replay().
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <string.h>
+
+#include "testhelpers.h"
+#include "lan_host_tests.h"
+
+unsigned int test_failures = 0U;
+
+int main(int argc, char **argv)
+{
+	const char *in_path = NULL;
+	const char *out_path = NULL;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "-r") == 0) {
+			in_path = argv[i + 1];
+		} else if (strcmp(argv[i], "-w") == 0) {
+			out_path = argv[i + 1];
+		} else {
+			break;
+		}
+	}
+	if (in_path != NULL) {
+		return lan_host_replay(in_path, out_path);
+	}
+	if (argc > 1) {
+		printf("usage: %s [-r in.pcap [-w out.pcap]]\n", argv[0]);
+		return 2;
+	}
+
+	TEST_enc28j60();
+	TEST_cksum();
+	TEST_lan();
+
+	printf("%u failure(s)\n", test_failures);
+	return (test_failures == 0U) ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+/** @file testhelpers.h
+ *  @brief console test macros for the host test runs
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef TESTHELPERS_H
+#define TESTHELPERS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+extern unsigned int test_failures;
+
+#define TestHeader(name)	printf("%s:\n", (name))
+#define TestFooter(name)	printf("%s: done\n\n", (name))
+#define TEST_PASSED(i)		printf("\tcase %u passed\n", (unsigned int)(i))
+#define TEST_FAILED(i, str)	do { test_failures++; \
+				printf("\tcase %u FAILED: %s\n", (unsigned int)(i), (str)); \
+				} while (0)
+
+/* passes or fails case i depending on cond */
+#define TEST_CHECK(i, cond)	do { if (cond) { TEST_PASSED(i); } \
+				else { TEST_FAILED((i), #cond); } } while (0)
+
+#endif // TESTHELPERS_H
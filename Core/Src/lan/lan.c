@@ -10,16 +10,17 @@
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "queue.h"
 #include "cmsis_os.h"
 
 #include "mutex_helpers.h"
 
 #include "lan.h"
+#include "inet_cksum.h"
+#include "pcap_ring.h"
 #include "logging.h"
 #include "hex_gen.h"
 
-#define NET_BUF_STAT
-
 #define ETH_MAXFRAME ENC28J60_MAXFRAME
 //#define		UDP_PAYLOAD_START	((uint16_t)42)
 
@@ -35,84 +36,200 @@ static osStaticMutexDef_t ARP_Mutex_ControlBlock __attribute__((section(".ccmram
 static volatile uint8_t max_pack_cnt = 0;
 static volatile uint32_t eth_filter_misses = 0;
 static volatile uint32_t ip_filter_misses = 0;
-
-static volatile uint8_t minfreenb = NUM_ETH_BUFFERS;
-static volatile uint8_t freenb = NUM_ETH_BUFFERS;
+static volatile uint32_t ip_cksum_errors = 0;
+static volatile uint32_t ip_frags_sent = 0u;
+static volatile uint32_t icmp_chip_replies = 0u;
+static volatile uint32_t ip_reasm_done = 0u;
+static volatile uint32_t ip_reasm_drops = 0u;
+static volatile uint32_t ip_reasm_timeouts = 0u;
 
 static volatile uint32_t udp_fits_callbacks = 0u;
+static volatile uint32_t udp_len_errors = 0u;
 static volatile uint32_t udp_callbacks = 0u;
 static volatile uint32_t readsocfits = 0u;
 static volatile uint32_t socdatalosts = 0u;
-static volatile uint32_t socfastreads = 0u;
 static volatile uint32_t lan_getmem_errors = 0u;
 static volatile uint32_t lan_freemem_errors = 0u;
 static volatile uint32_t lan_poll_mallocs = 0u;
 static volatile uint32_t lan_poll_frees = 0u;
 static volatile uint32_t readsoc_mallocs = 0u;
 static volatile uint32_t readsoc_frees = 0u;
-static volatile uint32_t wr_mallocs_frees = 0u;
-static volatile uint32_t arp_mallocs_frees = 0u;
+static volatile uint32_t wr_hdr_builds = 0u;
+static volatile uint32_t arp_requests = 0u;
+static volatile uint32_t arp_parked = 0u;
+static volatile uint32_t arp_park_drops = 0u;
+static volatile uint32_t arp_unresolved = 0u;
+
+/* the state the rx filters of the chip are set for */
+static uint32_t rxf_ip_addr;
+static bool rxf_bcast;
+static bool rxf_valid;
 static volatile uint32_t wr_soc_err = 0u;
 
-// IP address/mask/gateway
-#ifndef WITH_DHCP
+// IP address/mask/gateway, static or from DHCP
 uint32_t ip_addr;
 uint32_t ip_mask;
 uint32_t ip_gateway;
-#endif
 
 #define ip_broadcast (ip_addr | ~ip_mask)
+#define IP_LIMITED_BROADCAST	inet_addr(255, 255, 255, 255)
+/* flags_framgent_offset, network order */
+#define	IP_FLAG_MF		htons(0x2000U)
+#define	IP_FRAG_OFS_MASK	htons(0x1FFFU)
+#define	IP_FRAG_MASK		(IP_FLAG_MF | IP_FRAG_OFS_MASK)
+
+// Packet buffers: small, then medium, then full frame slots, then large
+// ones for the reassembly
+#define	ETH_BUF_MEDIUM_OFS	(ETH_BUF_SMALL_NUM * ETH_BUF_SMALL)
+#define	ETH_BUF_FULL_OFS	(ETH_BUF_MEDIUM_OFS + ETH_BUF_MEDIUM_NUM * ETH_BUF_MEDIUM)
+#define	ETH_BUF_LARGE_OFS	(ETH_BUF_FULL_OFS + ETH_BUF_FULL_NUM * ETH_BUF_FULL)
+#define	ETH_BUF_ARENA		(ETH_BUF_LARGE_OFS + ETH_BUF_LARGE_NUM * ETH_BUF_LARGE)
 
-// Packet buffers
-static uint8_t eth_buf[NUM_ETH_BUFFERS][ENC28J60_MAXFRAME]; /* ethernet buffers*/
+static uint8_t eth_buf[ETH_BUF_ARENA] __attribute__((aligned(4))); /* ethernet buffers*/
 
 static socket_t sockets[NUM_SOCKETS]; /*  sockets pool */
-/* each net_buf belongs to the one of the sockets */
-/* each eth_buf_state belongs to the one of the sockets*/
-static enum EthBufState eth_buf_state[NUM_ETH_BUFFERS]; /* states of the ethernet buffers */
+
+/* received frames of the socket: eth_buf slots, owned by the queue */
+typedef struct soc_rx_item {
+	uint8_t		*frame;
+	uint16_t	len;		/* UDP payload length */
+} soc_rx_item_t;
+
+static QueueHandle_t soc_rxq[NUM_SOCKETS];
+static StaticQueue_t soc_rxq_cb[NUM_SOCKETS];
+static soc_rx_item_t soc_rxq_items[NUM_SOCKETS][SOC_RXQ_MAX];
+
+/* sockets demux: busy sockets are chained in the buckets of the local
+ * port, free sockets in soc_free; the links are socket indices */
+#define	SOC_NONE	0xFFU
+#if (NUM_SOCKETS >= 0xFFU)
+#error "NUM_SOCKETS must be less than SOC_NONE"
+#endif
+#define	SOC_HASH(port)	((uint16_t)((port) ^ ((port) >> SOC_HASH_BITS)) & SOC_HASH_MASK)
+
+static uint8_t soc_bucket[SOC_HASH_SIZE];
+static uint8_t soc_next[NUM_SOCKETS];
+static uint8_t soc_free;
+
+/* ethernet buffer pool: bit (31 - i) of eth_buf_free is set if buffer i
+ * is free, so CLZ gives the lowest free buffer; changed by LDREX/STREX.
+ * the classes are numbered upwards, the lowest free buffer of the first
+ * class that fits is the smallest one */
+#if (NUM_ETH_BUFFERS > 32U)
+#error "NUM_ETH_BUFFERS must fit in the free mask"
+#endif
+#define	ETH_BUF_BIT(i)	(0x80000000UL >> (i))
+#define	ETH_BUF_ALL	((uint32_t)(0xFFFFFFFFULL << (32U - NUM_ETH_BUFFERS)))
+#define	ETH_BUF_FROM(i)	(ETH_BUF_ALL & (0xFFFFFFFFUL >> (i)))	/* buffers i... */
+/* the large buffers are for the reassembly only, not for the frames */
+#define	ETH_BUF_LARGE_FIRST	(ETH_BUF_SMALL_NUM + ETH_BUF_MEDIUM_NUM + ETH_BUF_FULL_NUM)
+#define	ETH_BUF_FRAMES	(ETH_BUF_ALL & ~ETH_BUF_FROM(ETH_BUF_LARGE_FIRST))
+
+#if (ETH_BUF_SMALL > ETH_BUF_MEDIUM) || (ETH_BUF_MEDIUM > ETH_BUF_FULL) || \
+    (ETH_BUF_FULL > ETH_BUF_LARGE)
+#error "buffer classes must ascend"
+#endif
+#if ((ETH_BUF_SMALL % 4U) != 0U) || ((ETH_BUF_MEDIUM % 4U) != 0U) || \
+    ((ETH_BUF_FULL % 4U) != 0U) || ((ETH_BUF_LARGE % 4U) != 0U)
+#error "buffer sizes must keep the word alignment"
+#endif
+
+static volatile uint32_t eth_buf_free;
+static uint8_t eth_buf_owner[NUM_ETH_BUFFERS];
+
+static volatile uint32_t eth_buf_used;
+static volatile uint32_t eth_buf_used_max;
+static volatile uint32_t eth_buf_held[LAN_BUF_OWNERS];
+static volatile uint32_t eth_buf_held_max[LAN_BUF_OWNERS];
+static volatile uint32_t eth_buf_fails[LAN_BUF_OWNERS];
+
+/* arp_store() modes */
+enum	ArpStore
+	{
+		ARP_REFRESH = 1,	/* known entries only */
+		ARP_ADD_FREE = 2,	/* add if there is a free slot */
+		ARP_ADD = 3,		/* add, evict the LRU entry if full */
+	};
+
+/* home slot of the address in the cache */
+#define ARP_HASH(ip)	((uint32_t)((uint32_t)(ip) * 2654435761U) >> (32U - ARP_CACHE_BITS))
 
 /**
- * @brief arp_cache ARP cache array
+ * @brief arp_cache ARP cache array, open addressed hash with linear probing.
+ * Writers hold ARP_MutexHandle and bump arp_seq around every change,
+ * readers do not lock and retry if arp_seq has changed meanwhile.
  */
 static arp_cache_entry_t arp_cache[ARP_CACHE_SIZE];
+static volatile uint32_t arp_gen = 0u; /* bumped on every MAC change in the cache */
+static volatile uint32_t arp_seq = 0u; /* odd while the cache is being changed */
+static volatile uint32_t arp_evictions = 0u;
+static volatile uint32_t arp_locked_lookups = 0u;
+/* the last lock-free hit, applied to the LRU under the mutex */
+static volatile uint32_t arp_hit_ip = 0u;
+static volatile uint32_t arp_hit_tick = 0u;
+/* frames waiting for the MAC of their next hop */
+static arp_pending_t arp_pending[ARP_PENDING_SIZE];
 
 /* */
 static void icmp_filter(eth_frame_t *frame, uint16_t len);
+static uint16_t icmp_rx_hook(uint8_t *head, uint16_t len);
 
 /* ARP functions */
 static void arp_filter(eth_frame_t *frame, uint16_t len);
-static uint8_t *arp_resolve(uint32_t node_ip_addr);
-static uint8_t *arp_search_cache(uint32_t node_ip_addr);
+static bool arp_lookup(uint32_t node_ip_addr, uint8_t *mac);
+static int arp_find(uint32_t node_ip_addr);
+static void arp_store(uint32_t node_ip_addr, const uint8_t *mac, enum ArpStore mode);
+static void arp_delete(uint32_t idx);
+static void arp_apply_hit(void);
+static void arp_snoop(uint32_t node_ip_addr, const uint8_t *mac);
 static void request_arp(uint32_t node_ip_addr);
-static int arp_get_cache_index(uint32_t node_ip_addr);
 static inline void arp_clear_cache(void);
+static ErrorStatus arp_park(uint32_t node_ip_addr, const uint8_t *hdr, uint16_t hdrlen,
+			    const uint8_t *data, uint16_t len);
+static void arp_flush(uint32_t node_ip_addr, const uint8_t *mac);
+static void arp_tick(void);
 
 /* Ethernet level */
 static void eth_send(eth_frame_t *frame, uint16_t len);
 static void eth_reply(eth_frame_t *frame, uint16_t len);
+static void eth_reply_hdr(eth_frame_t *frame);
 static void eth_resend(eth_frame_t *frame, uint16_t len);
 static eth_frame_t *eth_filter(eth_frame_t *frame, uint16_t len);
 
 /* IP level */
 static uint8_t ip_send(eth_frame_t *frame, uint16_t len);
 static void ip_reply(eth_frame_t *frame, uint16_t len);
+static void ip_reply_hdr(eth_frame_t *frame, uint16_t len);
 static void ip_resend(eth_frame_t *frame, uint16_t len);
-static uint16_t ip_cksum(uint32_t sum, uint8_t *buf, uint16_t len);
+static uint32_t ip_next_hop(uint32_t to_addr);
+static bool ip_route_mac(uint32_t to_addr, uint8_t *mac);
 static eth_frame_t *ip_filter(eth_frame_t *frame, uint16_t len);
+#ifdef WITH_UDP
+static eth_frame_t *ip_reasm_add(const eth_frame_t *frame, uint16_t len);
+static void ip_reasm_poll(void);
+#endif
 
-#if (0)
-void dhcp_filter(eth_frame_t *frame, uint16_t len);
+#ifdef WITH_DHCP
+static void dhcp_filter(eth_frame_t *frame, uint16_t len);
+static void dhcp_poll(void);
+static void dhcp_start(void);
 #endif
 
-/* TCP stubs */
+#ifdef WITH_TCP
+static void tcp_filter(eth_frame_t *frame, uint16_t len);
+static void tcp_poll(void);
+
+/* TCP callbacks */
 static uint8_t tcp_listen(uint8_t id, eth_frame_t *frame);
-static void tcp_read(uint8_t id, eth_frame_t *frame, uint8_t re);
-static void tcp_write(uint8_t id, eth_frame_t *frame, uint16_t len);
+static uint16_t tcp_write(uint8_t id, const uint8_t *data, uint16_t len);
 static void tcp_closed(uint8_t id, uint8_t hard);
+#endif
 
 /* memory dispatcher */
-static uint8_t *lan_getmem(void);
+static uint8_t *lan_getmem(uint16_t len, uint8_t owner);
 static uint8_t *lan_freemem(uint8_t *buf);
+static void lan_buf_give(uint8_t *buf, uint8_t owner);
+static int32_t lan_recv_frame(void);
 
 uint8_t *getMAC(void);
 
@@ -125,9 +242,13 @@ static eth_frame_t *udp_filter(eth_frame_t *frame, uint16_t len);
 
 /* raw socket read */
 static uint16_t read_sock(socket_p soc, uint8_t *buf, int32_t buflen, const uint8_t attempts);
+static void soc_rxq_flush(uint8_t idx);
+static uint8_t soc_index(const socket_t *soc);
 
 /**
  * @brief set_notif_params
+ * @note  readers block on the receive queue of the socket; if TaskToNotify
+ *        is set, read_socket() and read_socket_nowait() wait readTimeOutMS
  * @param soc
  * @param TaskToNotify
  * @param readTimeOutMS
@@ -143,6 +264,75 @@ socket_p set_notif_params(socket_p soc, void *TaskToNotify, uint32_t readTimeOut
 	return retVal;
 }
 
+/**
+  * sets the receive queue of the socket
+  * @param  soc - socket to be changed
+  * @param  depth - frames queued, 1...SOC_RXQ_MAX
+  * @param  policy - SOC_RXQ_DROP_OLDEST or SOC_RXQ_DROP_NEWEST
+  * @retval soc pointer in OK, NULL if ERROR
+  */
+socket_p set_rxq_params(socket_p soc, uint8_t depth, uint8_t policy)
+{
+	if ((soc == NULL) || (soc->soc_state == SOCK_FREE) ||
+	    (depth == 0U) || (depth > SOC_RXQ_MAX) ||
+	    ((policy != SOC_RXQ_DROP_OLDEST) && (policy != SOC_RXQ_DROP_NEWEST))) {
+		return NULL;
+	}
+	taskENTER_CRITICAL();
+	soc->rxq_depth = depth;
+	soc->rxq_policy = policy;
+	taskEXIT_CRITICAL();
+	return soc;
+}
+
+/**
+  * releases the frames queued to the socket
+  * @param idx index of the socket
+  */
+static void soc_rxq_flush(uint8_t idx)
+{
+	soc_rx_item_t item;
+
+	while (xQueueReceive(soc_rxq[idx], &item, 0U) == pdTRUE) {
+		if (lan_freemem(item.frame) == NULL) {
+			readsoc_frees++;
+		}
+	}
+}
+
+/**
+  * @brief soc_index
+  * @param soc pointer to check
+  * @return index of the socket in the pool or SOC_NONE
+  */
+static uint8_t soc_index(const socket_t *soc)
+{
+	uintptr_t ofs = (uintptr_t)soc - (uintptr_t)sockets;
+
+	if ((ofs >= sizeof(sockets)) || ((ofs % sizeof(socket_t)) != 0U)) {
+		return SOC_NONE;
+	}
+	return (uint8_t)(ofs / sizeof(socket_t));
+}
+
+/**
+  * @brief soc_unlink removes the socket from the chain of its port
+  * @note  in critical section
+  * @param idx
+  */
+static void soc_unlink(uint8_t idx)
+{
+	uint8_t *link = &soc_bucket[SOC_HASH(sockets[idx].loc_port)];
+
+	while (*link != SOC_NONE) {
+		if (*link == idx) {
+			*link = soc_next[idx];
+			break;
+		}
+		link = &soc_next[*link];
+	}
+}
+
 /**
   * assigns a socket from free pool
   * @param remIP remote IP
@@ -160,33 +350,47 @@ socket_p bind_socket(const uint32_t remIP, const uint16_t remPort, const uint16_
 	socket_p result;
 	result = NULL;
 	uint8_t i;
-	for (i = 0U; i < NUM_SOCKETS; i++) {
-		/*		if (eth_buf_state[i] == FREE) {		*/ /* is this buffer free ?*/
-		if (sockets[i].soc_state == SOCK_FREE) {
-			/* try to allocate buffer */
-			/*			sockets[i].buf = lan_getmem();
-				if (sockets[i].buf != NULL) {	*/	/* memory allocated */
-			/* +15-Mar-2018 */ sockets[i].buf = NULL;
-			sockets[i].datalost = SOC_DATA_NOT_LOST;
-			sockets[i].soc_state = SOCK_BUSY; /* mark the socket as busy */
-			sockets[i].rem_ip_addr = remIP;
-			sockets[i].rem_port = remPort;
-			sockets[i].last_error = 0U;	 /* no error */
-			sockets[i].proto = IP_PROTOCOL_UDP; /* currently UDP only */
-			sockets[i].mode = mode;
-			sockets[i].len = 0U;
-			sockets[i].loc_ip_addr = ip_addr;
-			if (locPort != 0U) {
-				sockets[i].loc_port = locPort;
-			} else {
-				sockets[i].loc_port = (START_EUPH_PORT + i);
+	uint8_t h;
+	i = soc_free;
+	if (i != SOC_NONE) {
+		soc_free = soc_next[i];
+		sockets[i].datalost = SOC_DATA_NOT_LOST;
+		sockets[i].rxq_depth = SOC_RXQ_DEPTH;
+		sockets[i].rxq_policy = SOC_RXQ_DROP_OLDEST;
+		sockets[i].rxq_drops = 0U;
+		sockets[i].soc_state = SOCK_BUSY; /* mark the socket as busy */
+		sockets[i].rem_ip_addr = remIP;
+		sockets[i].rem_port = remPort;
+		sockets[i].last_error = 0U;	 /* no error */
+		sockets[i].proto = IP_PROTOCOL_UDP; /* currently UDP only */
+		sockets[i].mode = mode;
+		sockets[i].len = 0U;
+		sockets[i].loc_ip_addr = ip_addr;
+		sockets[i].hdr_valid = 0U;
+		if (locPort != 0U) {
+			sockets[i].loc_port = locPort;
+		} else {
+			sockets[i].loc_port = (START_EUPH_PORT + i);
+		}
+		/* the chain is walked in bind order, the first fit wins */
+		h = SOC_HASH(sockets[i].loc_port);
+		soc_next[i] = SOC_NONE;
+		if (soc_bucket[h] == SOC_NONE) {
+			soc_bucket[h] = i;
+		} else {
+			uint8_t j = soc_bucket[h];
+			while (soc_next[j] != SOC_NONE) {
+				j = soc_next[j];
 			}
-			result = &sockets[i]; /* return ptr to it's socket */
-			/*	15-Mar-2018			} */
-			break;
+			soc_next[j] = i;
 		}
+		result = &sockets[i]; /* return ptr to it's socket */
 	}
 	taskEXIT_CRITICAL(); // call may be nested
+	if (result != NULL) {
+		/* a frame may be left by the callback racing close_socket() */
+		soc_rxq_flush(i);
+	}
 	return result;
 } /* end of the function bind_socket */
 
@@ -205,17 +409,12 @@ socket_p change_soc_mode(socket_p soc, const uint8_t mode)
 	if ((soc == NULL) || (soc->soc_state == SOCK_FREE)) {
 		return NULL;
 	}
-	if ((mode == SOC_MODE_READ) || (mode == SOC_MODE_WRITE)) {
+	if (((mode == SOC_MODE_READ) || (mode == SOC_MODE_WRITE)) &&
+	    (soc_index(soc) != SOC_NONE)) { /* soc points to the socket */
 		taskENTER_CRITICAL();
-		uint8_t i;
-		for (i = 0; i < NUM_SOCKETS; i++) {
-			if (soc == &sockets[i]) { /* soc points to the socket */
-				soc->mode = mode;
-				result = soc;
-				break;
-			}
-		}
+		soc->mode = mode;
 		taskEXIT_CRITICAL();
+		result = soc;
 	}
 	return result;
 }
@@ -232,56 +431,154 @@ socket_p close_socket(socket_p soc)
 	if (soc == NULL) { /* function is safe for null pointers (11-Mar-2018) */
 		return NULL;
 	}
-	taskENTER_CRITICAL();
 	socket_p result;
 	result = soc;
 	uint8_t i;
-	for (i = 0; i < NUM_SOCKETS; i++) {
-		if ((soc == &sockets[i]) && (soc->soc_state == SOCK_BUSY)) {
-			/* try to free buffer memory */
-			if (lan_freemem(soc->buf) != NULL) {
-				/* memory manager error !*/
-				UNUSED(0);
-			};
-			memset(soc, 0, sizeof(socket_t));
-			soc->soc_state = SOCK_FREE;
-			result = NULL; /* return NULL */
-			break;
-		}
+	i = soc_index(soc);
+	if (i == SOC_NONE) {
+		return result;
+	}
+	taskENTER_CRITICAL();
+	if (soc->soc_state == SOCK_BUSY) {
+		soc_unlink(i);
+		memset(soc, 0, sizeof(socket_t));
+		soc->soc_state = SOCK_FREE;
+		soc_next[i] = soc_free;
+		soc_free = i;
+		result = NULL; /* return NULL */
 	}
 	taskEXIT_CRITICAL();
+	if (result == NULL) {
+		/* free the frames not read */
+		soc_rxq_flush(i);
+	}
 	return result;
 } /* end of the function close_socket */
 
+/* adds d to *p, returns the new value */
+static inline uint32_t lan_atomic_add(volatile uint32_t *p, uint32_t d)
+{
+	uint32_t v;
+
+	do {
+		v = __LDREXW(p) + d;
+	} while (__STREXW(v, p) != 0U);
+	return v;
+}
+
+/* raises *p to v */
+static inline void lan_atomic_max(volatile uint32_t *p, uint32_t v)
+{
+	do {
+		if (__LDREXW(p) >= v) {
+			__CLREX();
+			break;
+		}
+	} while (__STREXW(v, p) != 0U);
+}
+
+/* index of the buffer, NUM_ETH_BUFFERS if buf is not one of eth_buf */
+static inline uint32_t lan_buf_index(const uint8_t *buf)
+{
+	uintptr_t ofs = (uintptr_t)buf - (uintptr_t)eth_buf;
+
+	if (ofs < ETH_BUF_MEDIUM_OFS) {
+		if ((ofs % ETH_BUF_SMALL) == 0U) {
+			return (uint32_t)(ofs / ETH_BUF_SMALL);
+		}
+	} else if (ofs < ETH_BUF_FULL_OFS) {
+		ofs -= ETH_BUF_MEDIUM_OFS;
+		if ((ofs % ETH_BUF_MEDIUM) == 0U) {
+			return (uint32_t)(ETH_BUF_SMALL_NUM + ofs / ETH_BUF_MEDIUM);
+		}
+	} else if (ofs < ETH_BUF_LARGE_OFS) {
+		ofs -= ETH_BUF_FULL_OFS;
+		if ((ofs % ETH_BUF_FULL) == 0U) {
+			return (uint32_t)(ETH_BUF_SMALL_NUM + ETH_BUF_MEDIUM_NUM +
+					  ofs / ETH_BUF_FULL);
+		}
+	} else if (ofs < ETH_BUF_ARENA) {
+		ofs -= ETH_BUF_LARGE_OFS;
+		if ((ofs % ETH_BUF_LARGE) == 0U) {
+			return (uint32_t)(ETH_BUF_LARGE_FIRST + ofs / ETH_BUF_LARGE);
+		}
+	} else {
+		/* not a buffer */
+	}
+	return NUM_ETH_BUFFERS;
+}
+
+/* address of the buffer i */
+static inline uint8_t *lan_buf_addr(uint32_t i)
+{
+	if (i < ETH_BUF_SMALL_NUM) {
+		return &eth_buf[i * ETH_BUF_SMALL];
+	}
+	i -= ETH_BUF_SMALL_NUM;
+	if (i < ETH_BUF_MEDIUM_NUM) {
+		return &eth_buf[ETH_BUF_MEDIUM_OFS + i * ETH_BUF_MEDIUM];
+	}
+	i -= ETH_BUF_MEDIUM_NUM;
+	if (i < ETH_BUF_FULL_NUM) {
+		return &eth_buf[ETH_BUF_FULL_OFS + i * ETH_BUF_FULL];
+	}
+	i -= ETH_BUF_FULL_NUM;
+	return &eth_buf[ETH_BUF_LARGE_OFS + i * ETH_BUF_LARGE];
+}
+
+/* buffers of the classes that hold len bytes */
+static inline uint32_t lan_buf_fit(uint16_t len)
+{
+	if (len <= ETH_BUF_SMALL) {
+		return ETH_BUF_FRAMES;
+	}
+	if (len <= ETH_BUF_MEDIUM) {
+		return ETH_BUF_FRAMES & ETH_BUF_FROM(ETH_BUF_SMALL_NUM);
+	}
+	if (len <= ETH_BUF_FULL) {
+		return ETH_BUF_FRAMES & ETH_BUF_FROM(ETH_BUF_SMALL_NUM + ETH_BUF_MEDIUM_NUM);
+	}
+	if (len <= ETH_BUF_LARGE) {
+		return ETH_BUF_FROM(ETH_BUF_LARGE_FIRST);
+	}
+	return 0U;
+}
+
+static inline void lan_buf_hold(uint8_t owner)
+{
+	lan_atomic_max(&eth_buf_held_max[owner],
+		       lan_atomic_add(&eth_buf_held[owner], 1U));
+}
+
 /**
-  * searches free ethternet buffer from the pool and returns pointer to it
-  * @param none
+  * takes the smallest free ethernet buffer that holds len bytes
+  * @param len bytes needed
+  * @param owner LAN_BUF_RX ... for the accounting
   * @return pointer to the available buffer or NULL in there is no free buffers left
   */					/*		THREAD-SAFE */
 /* modified 13-Mar-2018 to implement zero-copy */
-static uint8_t *lan_getmem(void)
+static uint8_t *lan_getmem(uint16_t len, uint8_t owner)
 {
-	taskENTER_CRITICAL();
-	uint8_t *result;
-	result = NULL;
-	uint8_t i;
-	for (i = 0u; i < NUM_ETH_BUFFERS; i++) {
-		if (eth_buf_state[i] == ETH_BUF_FREE) {  /* is this buffer free ?*/
-			result = (uint8_t *)eth_buf[i];  /* return ptr to it */
-			eth_buf_state[i] = ETH_BUF_BUSY; /* mark the buffer */
-			break;
+	uint32_t fit = lan_buf_fit(len);
+	uint32_t avail;
+	uint32_t mask;
+	uint32_t i;
+
+	do {
+		avail = __LDREXW(&eth_buf_free);
+		mask = avail & fit;
+		if (mask == 0U) {
+			__CLREX();
+			lan_atomic_add(&eth_buf_fails[owner], 1U);
+			return NULL;
 		}
-	}
-#ifdef NET_BUF_STAT
-	uint8_t tmp = 0u;
-	for (i = 0u; i < NUM_ETH_BUFFERS; i++) {
-		tmp = (eth_buf_state[i] == ETH_BUF_FREE) ? (tmp + 1u) : tmp;
-	}
-	freenb = tmp;
-	minfreenb = (tmp < minfreenb) ? tmp : minfreenb;
-#endif
-	taskEXIT_CRITICAL();
-	return result;
+		i = __CLZ(mask);
+	} while (__STREXW(avail & ~ETH_BUF_BIT(i), &eth_buf_free) != 0U);
+	__DMB();
+	eth_buf_owner[i] = owner;
+	lan_buf_hold(owner);
+	lan_atomic_max(&eth_buf_used_max, lan_atomic_add(&eth_buf_used, 1U));
+	return lan_buf_addr(i);
 }
 
 /**
@@ -292,31 +589,65 @@ static uint8_t *lan_getmem(void)
 /* modified 13-Mar-2018 to implement zero-copy */
 static uint8_t *lan_freemem(uint8_t *buf)
 {
-	taskENTER_CRITICAL();
-	uint8_t *result;
-	result = buf;
-	if (buf != NULL) {
-		uint8_t i;
-		for (i = 0u; i < NUM_ETH_BUFFERS; i++) {
-			if (((uint8_t *)eth_buf[i] == buf) &&
-			    (eth_buf_state[i] == ETH_BUF_BUSY)) { /* is it the buffer ? */
-				eth_buf_state[i] = ETH_BUF_FREE;  /* mark the buffer as free*/
-				result = NULL;
-				break;
-			}
+	uint32_t mask;
+	uint32_t i;
+	uint8_t owner;
+
+	i = lan_buf_index(buf);
+	if (i == NUM_ETH_BUFFERS) {
+		if (buf != NULL) {
+			lan_atomic_add(&lan_freemem_errors, 1U);
 		}
+		return buf;
 	}
-#ifdef NET_BUF_STAT
-	uint8_t tmp = 0u;
-	uint8_t i;
-	for (i = 0u; i < NUM_ETH_BUFFERS; i++) {
-		tmp = (eth_buf_state[i] == ETH_BUF_FREE) ? (tmp + 1u) : tmp;
+	owner = eth_buf_owner[i]; /* before the buffer may be taken again */
+	__DMB();
+	do {
+		mask = __LDREXW(&eth_buf_free);
+		if ((mask & ETH_BUF_BIT(i)) != 0U) {
+			__CLREX();
+			lan_atomic_add(&lan_freemem_errors, 1U);
+			return buf; /* already free */
+		}
+	} while (__STREXW(mask | ETH_BUF_BIT(i), &eth_buf_free) != 0U);
+	lan_atomic_add(&eth_buf_held[owner], (uint32_t)-1);
+	lan_atomic_add(&eth_buf_used, (uint32_t)-1);
+	return NULL;
+}
+
+/**
+  * passes the buffer to another owner, the zero-copy handover
+  * @param buf pointer to the buffer
+  * @param owner the new owner
+  */
+static void lan_buf_give(uint8_t *buf, uint8_t owner)
+{
+	uint32_t i = lan_buf_index(buf);
+
+	if (i == NUM_ETH_BUFFERS) {
+		return;
 	}
-	freenb = tmp;
-	minfreenb = (tmp < minfreenb) ? tmp : minfreenb;
-#endif
-	taskEXIT_CRITICAL();
-	return result;
+	lan_atomic_add(&eth_buf_held[eth_buf_owner[i]], (uint32_t)-1);
+	eth_buf_owner[i] = owner;
+	lan_buf_hold(owner);
+}
+
+/**
+ * @brief lan_get_buf_stat copies the ethernet buffer pool counters
+ * @param st destination
+ */
+void lan_get_buf_stat(lan_buf_stat_t *st)
+{
+	size_t i;
+
+	st->free = NUM_ETH_BUFFERS - eth_buf_used;
+	st->min_free = NUM_ETH_BUFFERS - eth_buf_used_max;
+	for (i = 0U; i < LAN_BUF_OWNERS; i++) {
+		st->held[i] = eth_buf_held[i];
+		st->held_max[i] = eth_buf_held_max[i];
+		st->fails[i] = eth_buf_fails[i];
+	}
+	st->free_errors = lan_freemem_errors;
 }
 
 // TCP connection pool
@@ -327,13 +658,17 @@ tcp_state_t tcp_pool[TCP_MAX_CONNECTIONS];
 // DHCP
 #ifdef WITH_DHCP
 dhcp_status_code_t dhcp_status;
-static uint32_t dhcp_server;
-static uint32_t dhcp_renew_time;
-static uint32_t dhcp_retry_time;
+static dhcp_lease_t dhcp_lease;		/* cached, offered or bound lease */
+static bool dhcp_lease_cached;		/* dhcp_lease is from the last boot */
+static bool dhcp_lease_dirty;		/* dhcp_lease is to be saved */
+static dhcp_lease_cb_t dhcp_lease_cb;
+static uint32_t dhcp_timer;		/* tick of the next message or of T1 */
+static uint32_t dhcp_backoff;		/* DISCOVER retry interval, ms */
+static uint32_t dhcp_lease_end;		/* tick the lease runs out at */
 static uint32_t dhcp_transaction_id;
-static uint32_t ip_addr;
-static uint32_t ip_mask;
-static uint32_t ip_gateway;
+static uint8_t dhcp_tries;
+static volatile uint32_t dhcp_naks = 0u;
+static volatile uint32_t dhcp_reboot_fails = 0u;
 #endif
 
 /*
@@ -350,221 +685,413 @@ static uint32_t ip_gateway;
 	if (sizeof(type) & 1)                                                                      \
 		*(ptr++) = 0;
 
-void dhcp_filter(eth_frame_t *frame, uint16_t len)
+/* eth + ip + udp headers, the message and the options we send */
+#define DHCP_FRAME_LEN	(sizeof(eth_frame_t) + sizeof(ip_packet_t) + sizeof(udp_packet_t) + \
+			 sizeof(dhcp_message_t) + 32U)
+
+#define dhcp_due(t)	((int32_t)(HAL_GetTick() - (t)) >= 0)
+
+/**
+ * @brief dhcp_set_lease gives the last lease to try with INIT-REBOOT,
+ *        must be called before lan_init(); ip_addr == 0 selects DHCP
+ * @param lease
+ */
+void dhcp_set_lease(const dhcp_lease_t *lease)
+{
+	dhcp_lease_cached = false;
+	if ((lease != NULL) && (lease->ip_addr != 0U)) {
+		dhcp_lease = *lease;
+		dhcp_lease_cached = true;
+	}
+}
+
+/**
+ * @brief dhcp_set_lease_cb sets the function the lease is saved with
+ * @param cb
+ */
+void dhcp_set_lease_cb(dhcp_lease_cb_t cb)
+{
+	dhcp_lease_cb = cb;
+}
+
+/* new transaction, xid differs between the boards started at once */
+static void dhcp_new_xid(void)
+{
+	uint32_t mac_lo;
+
+	memcpy(&mac_lo, &mac_addr[2], 4U);
+	dhcp_transaction_id = (HAL_GetTick() + (HAL_GetTick() << 16)) ^ mac_lo;
+}
+
+/* network down, the address is no longer ours */
+static void dhcp_unbind(void)
+{
+	ip_addr = 0U;
+	ip_mask = 0U;
+	ip_gateway = 0U;
+}
+
+/* back to DISCOVER */
+static void dhcp_restart(void)
+{
+	dhcp_unbind();
+	dhcp_status = DHCP_INIT;
+	dhcp_timer = HAL_GetTick();
+	dhcp_backoff = DHCP_DISCOVER_TIMEOUT;
+}
+
+/**
+ * @brief dhcp_send builds and sends the message for the current state
+ *        DISCOVER, or REQUEST for SELECTING, INIT-REBOOT and RENEWING
+ *        (RFC 2131, 4.3.2)
+ * @param type DHCP_MESSAGE_DISCOVER or DHCP_MESSAGE_REQUEST
+ * @return 0 if not sent
+ */
+static uint8_t dhcp_send(uint8_t type)
+{
+	eth_frame_t *frame;
+	ip_packet_t *ip;
+	udp_packet_t *udp;
+	dhcp_message_t *dhcp;
+	uint8_t *op;
+	uint8_t res;
+
+	frame = (void *)lan_getmem((uint16_t)DHCP_FRAME_LEN, LAN_BUF_TX);
+	if (frame == NULL) {
+		return 0U;
+	}
+	ip = (void *)(frame->data);
+	udp = (void *)(ip->data);
+	dhcp = (void *)(udp->data);
+
+	ip->to_addr = inet_addr(255, 255, 255, 255);
+	udp->to_port = DHCP_SERVER_PORT;
+	udp->from_port = DHCP_CLIENT_PORT;
+
+	memset(dhcp, 0, sizeof(dhcp_message_t));
+	dhcp->operation = DHCP_OP_REQUEST;
+	dhcp->hw_addr_type = DHCP_HW_ADDR_TYPE_ETH;
+	dhcp->hw_addr_len = 6;
+	dhcp->transaction_id = dhcp_transaction_id;
+	dhcp->flags = DHCP_FLAG_BROADCAST;
+	memcpy(dhcp->hw_addr, mac_addr, 6);
+	dhcp->magic_cookie = DHCP_MAGIC_COOKIE;
+
+	op = dhcp->options;
+	dhcp_add_option(op, DHCP_CODE_MESSAGETYPE, uint8_t, type);
+	if (dhcp_status == DHCP_RENEWING) {
+		/* the address is ours, no server id and requested address */
+		ip->to_addr = dhcp_lease.server;
+		dhcp->flags = 0U;
+		dhcp->client_addr = ip_addr;
+	} else if (type == DHCP_MESSAGE_REQUEST) {
+		dhcp_add_option(op, DHCP_CODE_REQUESTEDADDR, uint32_t, dhcp_lease.ip_addr);
+		if (dhcp_status == DHCP_WAITING_ACK) {
+			dhcp_add_option(op, DHCP_CODE_DHCPSERVER, uint32_t, dhcp_lease.server);
+		}
+	}
+	*(op++) = DHCP_CODE_PARAMLIST;
+	*(op++) = 5U;
+	*(op++) = DHCP_CODE_SUBNETMASK;
+	*(op++) = DHCP_CODE_GATEWAY;
+	*(op++) = DHCP_CODE_LEASETIME;
+	*(op++) = DHCP_CODE_DHCPSERVER;
+	*(op++) = DHCP_CODE_RENEWTIME;
+	*(op++) = DHCP_CODE_END;
+
+	res = udp_send(frame, (uint16_t)((uint8_t *)op - (uint8_t *)dhcp));
+	/* sent or copied to the ARP queue */
+	lan_freemem((uint8_t *)frame);
+	return res;
+}
+
+/**
+ * @brief dhcp_filter processes the server replies, the messages are
+ *        sent from dhcp_poll()
+ * @param frame
+ * @param len udp payload length
+ */
+static void dhcp_filter(eth_frame_t *frame, uint16_t len)
 {
 	ip_packet_t *ip = (void *)(frame->data);
 	udp_packet_t *udp = (void *)(ip->data);
 	dhcp_message_t *dhcp = (void *)(udp->data);
 	dhcp_option_t *option;
-	uint8_t *op, optlen;
+	uint8_t *op;
+	uint16_t optlen;
 	uint32_t offered_net_mask = 0, offered_gateway = 0;
 	uint32_t lease_time = 0, renew_time = 0, renew_server = 0;
 	uint8_t type = 0;
 	uint32_t temp;
+	uint32_t now;
 
 	// Check if DHCP messages directed to us
-	if ((len >= sizeof(dhcp_message_t)) && (dhcp->operation == (uint8_t)DHCP_OP_REPLY) &&
-	    (dhcp->transaction_id == dhcp_transaction_id) &&
-	    (dhcp->magic_cookie == DHCP_MAGIC_COOKIE)) {
-		len -= (uint16_t)(sizeof(dhcp_message_t));
-
-		// parse DHCP message
-		op = dhcp->options;
-		while (len >= sizeof(dhcp_option_t)) {
-			option = (void *)op;
-			if (option->code == DHCP_CODE_PAD) {
-				op++;
-				len--;
-			} else if (option->code == DHCP_CODE_END) {
-				break;
-			} else {
-				switch (option->code) {
-				case DHCP_CODE_MESSAGETYPE:
+	if ((len < sizeof(dhcp_message_t)) || (dhcp->operation != (uint8_t)DHCP_OP_REPLY) ||
+	    (dhcp->transaction_id != dhcp_transaction_id) ||
+	    (dhcp->magic_cookie != DHCP_MAGIC_COOKIE) ||
+	    (memcmp(dhcp->hw_addr, mac_addr, 6) != 0)) {
+		return;
+	}
+	len -= (uint16_t)(sizeof(dhcp_message_t));
+
+	// parse DHCP message
+	op = dhcp->options;
+	while (len >= sizeof(dhcp_option_t)) {
+		option = (void *)op;
+		if (option->code == DHCP_CODE_PAD) {
+			op++;
+			len--;
+		} else if (option->code == DHCP_CODE_END) {
+			break;
+		} else {
+			optlen = (uint16_t)sizeof(dhcp_option_t) + option->len;
+			if (optlen > len) {
+				break; /* truncated */
+			}
+			/* the values are read from options long enough only */
+			switch (option->code) {
+			case DHCP_CODE_MESSAGETYPE:
+				if (option->len >= 1U) {
 					type = *(option->data);
-					break;
-				case DHCP_CODE_SUBNETMASK:
-					offered_net_mask = *(uint32_t *)(option->data);
-					break;
-				case DHCP_CODE_GATEWAY:
-					offered_gateway = *(uint32_t *)(option->data);
-					break;
-				case DHCP_CODE_DHCPSERVER:
-					renew_server = *(uint32_t *)(option->data);
-					break;
-				case DHCP_CODE_LEASETIME:
-					temp = *(uint32_t *)(option->data);
+				}
+				break;
+			case DHCP_CODE_SUBNETMASK:
+				if (option->len >= 4U) {
+					memcpy(&offered_net_mask, option->data, 4U);
+				}
+				break;
+			case DHCP_CODE_GATEWAY:
+				if (option->len >= 4U) {
+					memcpy(&offered_gateway, option->data, 4U);
+				}
+				break;
+			case DHCP_CODE_DHCPSERVER:
+				if (option->len >= 4U) {
+					memcpy(&renew_server, option->data, 4U);
+				}
+				break;
+			case DHCP_CODE_LEASETIME:
+				if (option->len >= 4U) {
+					memcpy(&temp, option->data, 4U);
 					lease_time = ntohl(temp);
-					if (lease_time > (uint32_t)21600)
-						lease_time = (uint32_t)21600;
-					break;
-				case DHCP_CODE_RENEWTIME:
-					temp = *(uint32_t *)(option->data);
+					if (lease_time > DHCP_LEASE_MAX)
+						lease_time = DHCP_LEASE_MAX;
+				}
+				break;
+			case DHCP_CODE_RENEWTIME:
+				if (option->len >= 4U) {
+					memcpy(&temp, option->data, 4U);
 					renew_time = ntohl(temp);
-					if (renew_time > (uint32_t)21600)
-						renew_time = (uint32_t)21600;
-					break;
-				default:
-					/* MISRA requires comment here!*/
-					break;
+					if (renew_time > DHCP_LEASE_MAX)
+						renew_time = DHCP_LEASE_MAX;
 				}
-
-				optlen = sizeof(dhcp_option_t) + option->len;
-				op += optlen;
-				len -= optlen;
+				break;
+			default:
+				/* MISRA requires comment here!*/
+				break;
 			}
+			op += optlen;
+			len -= optlen;
 		}
+	}
 
-		if (!renew_server)
-			renew_server = ip->from_addr;
-
-		switch (type) {
-		// DHCP offer?
-		case DHCP_MESSAGE_OFFER:
-			if ((dhcp_status == DHCP_WAITING_OFFER) && (dhcp->offered_addr != 0)) {
-				dhcp_status = DHCP_WAITING_ACK;
-
-				// send DHCP request
-				ip->to_addr = inet_addr(255, 255, 255, 255);
-
-				udp->to_port = DHCP_SERVER_PORT;
-				udp->from_port = DHCP_CLIENT_PORT;
-
-				op = dhcp->options;
-				dhcp_add_option(op, DHCP_CODE_MESSAGETYPE, uint8_t,
-						DHCP_MESSAGE_REQUEST);
-				dhcp_add_option(op, DHCP_CODE_REQUESTEDADDR, uint32_t,
-						dhcp->offered_addr);
-				dhcp_add_option(op, DHCP_CODE_DHCPSERVER, uint32_t, renew_server);
-				*(op++) = DHCP_CODE_END;
-
-				dhcp->operation = DHCP_OP_REQUEST;
-				dhcp->offered_addr = 0;
-				dhcp->server_addr = 0;
-				dhcp->flags = DHCP_FLAG_BROADCAST;
+	if (!renew_server)
+		renew_server = ip->from_addr;
+
+	switch (type) {
+	// DHCP offer?
+	case DHCP_MESSAGE_OFFER:
+		if ((dhcp_status == DHCP_WAITING_OFFER) && (dhcp->offered_addr != 0)) {
+			/* the first offer is taken, REQUEST goes out from dhcp_poll() */
+			dhcp_status = DHCP_WAITING_ACK;
+			dhcp_lease.ip_addr = dhcp->offered_addr;
+			dhcp_lease.server = renew_server;
+			dhcp_tries = 0U;
+			dhcp_timer = HAL_GetTick();
+		}
+		break;
 
-				udp_send(frame, (uint8_t *)op - (uint8_t *)dhcp);
-			}
+	// DHCP ack?
+	case DHCP_MESSAGE_ACK:
+		if (((dhcp_status != DHCP_WAITING_ACK) && (dhcp_status != DHCP_REBOOTING) &&
+		     (dhcp_status != DHCP_RENEWING)) || (dhcp->offered_addr == 0U)) {
 			break;
+		}
+		if (!lease_time)
+			lease_time = DHCP_LEASE_MAX;
+		if ((!renew_time) || (renew_time > lease_time))
+			renew_time = lease_time / 2;
+		if (dhcp_status == DHCP_RENEWING) {
+			/* the options may be left out on renewal */
+			if (!offered_net_mask)
+				offered_net_mask = dhcp_lease.ip_mask;
+			if (!offered_gateway)
+				offered_gateway = dhcp_lease.ip_gateway;
+		}
+		/* the gateway MAC stays known if it is the same gateway */
+		if ((dhcp->offered_addr != dhcp_lease.ip_addr) ||
+		    (offered_gateway != dhcp_lease.ip_gateway)) {
+			dhcp_lease.gw_mac_valid = 0U;
+		}
 
-		// DHCP ack?
-		case DHCP_MESSAGE_ACK:
-			if (dhcp_status == DHCP_WAITING_ACK) {
-				if (!renew_time)
-					renew_time = lease_time / 2;
-
-				dhcp_status = DHCP_ASSIGNED;
-				dhcp_server = renew_server;
-				dhcp_renew_time = rtime() + renew_time;
-				dhcp_retry_time = rtime() + lease_time;
-
-				// network up
-				ip_addr = dhcp->offered_addr;
-				ip_mask = offered_net_mask;
-				ip_gateway = offered_gateway;
-			}
-			break;
-		default:
-			break;
+		dhcp_lease.ip_addr = dhcp->offered_addr;
+		dhcp_lease.ip_mask = offered_net_mask;
+		dhcp_lease.ip_gateway = offered_gateway;
+		dhcp_lease.server = renew_server;
+		dhcp_lease.lease_time = lease_time;
+		dhcp_lease_dirty = true;
+		dhcp_lease_cached = false;
+
+		now = HAL_GetTick();
+		dhcp_status = DHCP_ASSIGNED;
+		dhcp_timer = now + renew_time * 1000U;
+		dhcp_lease_end = now + lease_time * 1000U;
+
+		// network up
+		ip_addr = dhcp_lease.ip_addr;
+		ip_mask = dhcp_lease.ip_mask;
+		ip_gateway = dhcp_lease.ip_gateway;
+
+		/* the first publish need not wait for ARP: the replying node is
+		 * on-link, the gateway MAC is known from the last boot */
+		if ((((ip->from_addr ^ ip_addr) & ip_mask) == 0U) && (ip->from_addr != ip_addr)) {
+			arp_snoop(ip->from_addr, frame->from_addr);
+		}
+		if ((dhcp_lease.gw_mac_valid != 0U) && (ip_gateway != 0U)) {
+			arp_snoop(ip_gateway, dhcp_lease.gw_mac);
+		}
+		break;
+
+	case DHCP_MESSAGE_NAK:
+		if ((dhcp_status == DHCP_WAITING_ACK) || (dhcp_status == DHCP_REBOOTING) ||
+		    (dhcp_status == DHCP_RENEWING)) {
+			dhcp_naks++;
+			memset(&dhcp_lease, 0, sizeof(dhcp_lease));
+			dhcp_lease_dirty = true; /* forget the saved one */
+			dhcp_lease_cached = false;
+			dhcp_restart();
 		}
+		break;
+	default:
+		break;
 	}
 }
 
-void dhcp_poll()
+/**
+ * @brief dhcp_poll runs the client from the lan poll task, does not block
+ */
+static void dhcp_poll(void)
 {
-	eth_frame_t *frame = (void *)net_buf;
-	ip_packet_t *ip = (void *)(frame->data);
-	udp_packet_t *udp = (void *)(ip->data);
-	dhcp_message_t *dhcp = (void *)(udp->data);
-	uint8_t *op;
-
-	// Too slow (
-	/* Link is down
-	if(!(enc28j60_read_phy(PHSTAT1) & PHSTAT1_LLSTAT))
-	{
-		dhcp_status = DHCP_INIT;
-		dhcp_retry_time = rtime() + 2;
-
-		*/
-	/* network down */ /*
-		ip_addr = 0;
-		ip_mask = 0;
-		ip_gateway = 0;
+	uint8_t mac[6];
 
+	switch (dhcp_status) {
+	case DHCP_DISABLED:
 		return;
-	}*/
-
-	// time to initiate DHCP
-	//  (startup/lease end)
-	if (rtime() >= dhcp_retry_time) {
-		dhcp_status = DHCP_WAITING_OFFER;
-		dhcp_retry_time = rtime() + 15;
-		dhcp_transaction_id = HAL_GetTick() + (HAL_GetTick() << 16);
 
-		// network down
-		ip_addr = 0;
-		ip_mask = 0;
-		ip_gateway = 0;
-
-		// send DHCP discover
-		ip->to_addr = inet_addr(255, 255, 255, 255);
+	case DHCP_ASSIGNED:
+		/* keep the gateway MAC for the next boot */
+		if ((dhcp_lease.gw_mac_valid == 0U) && (ip_gateway != 0U) &&
+		    arp_lookup(ip_gateway, mac)) {
+			memcpy(dhcp_lease.gw_mac, mac, 6U);
+			dhcp_lease.gw_mac_valid = 1U;
+			dhcp_lease_dirty = true;
+		}
+		if (dhcp_due(dhcp_timer)) {
+			dhcp_status = DHCP_RENEWING;
+			dhcp_tries = 0U;
+		}
+		break;
 
-		udp->to_port = DHCP_SERVER_PORT;
-		udp->from_port = DHCP_CLIENT_PORT;
+	case DHCP_RENEWING:
+		if (dhcp_due(dhcp_lease_end)) {
+			dhcp_restart();
+			break;
+		}
+		if (dhcp_due(dhcp_timer)) {
+			if (dhcp_tries == 0U) {
+				dhcp_new_xid();
+			}
+			dhcp_tries++;
+			(void)dhcp_send(DHCP_MESSAGE_REQUEST);
+			dhcp_timer = HAL_GetTick() + DHCP_RENEW_RETRY;
+		}
+		break;
 
-		memset(dhcp, 0, sizeof(dhcp_message_t));
-		dhcp->operation = DHCP_OP_REQUEST;
-		dhcp->hw_addr_type = DHCP_HW_ADDR_TYPE_ETH;
-		dhcp->hw_addr_len = 6;
-		dhcp->transaction_id = dhcp_transaction_id;
-		dhcp->flags = DHCP_FLAG_BROADCAST;
-		memcpy(dhcp->hw_addr, mac_addr, 6);
-		dhcp->magic_cookie = DHCP_MAGIC_COOKIE;
+	case DHCP_REBOOTING:
+		if (dhcp_due(dhcp_timer)) {
+			if (dhcp_tries >= DHCP_REBOOT_TRIES) {
+				/* nobody answers for the address, start over */
+				dhcp_reboot_fails++;
+				dhcp_restart();
+				break;
+			}
+			if (dhcp_tries == 0U) {
+				dhcp_new_xid();
+			}
+			dhcp_tries++;
+			(void)dhcp_send(DHCP_MESSAGE_REQUEST);
+			dhcp_timer = HAL_GetTick() + DHCP_REBOOT_TIMEOUT;
+		}
+		break;
 
-		op = dhcp->options;
-		dhcp_add_option(op, DHCP_CODE_MESSAGETYPE, uint8_t, DHCP_MESSAGE_DISCOVER);
-		*(op++) = DHCP_CODE_END;
+	case DHCP_WAITING_ACK:
+		if (dhcp_due(dhcp_timer)) {
+			if (dhcp_tries >= DHCP_REQUEST_TRIES) {
+				dhcp_restart();
+				break;
+			}
+			dhcp_tries++;
+			(void)dhcp_send(DHCP_MESSAGE_REQUEST);
+			dhcp_timer = HAL_GetTick() + DHCP_REQUEST_TIMEOUT;
+		}
+		break;
 
-		udp_send(frame, (uint8_t *)op - (uint8_t *)dhcp);
+	case DHCP_INIT:
+	case DHCP_WAITING_OFFER:
+	default:
+		if (dhcp_due(dhcp_timer)) {
+			dhcp_status = DHCP_WAITING_OFFER;
+			dhcp_new_xid();
+			(void)dhcp_send(DHCP_MESSAGE_DISCOVER);
+			dhcp_timer = HAL_GetTick() + dhcp_backoff;
+			if (dhcp_backoff < DHCP_DISCOVER_BACKOFF_MAX) {
+				dhcp_backoff <<= 1;
+			}
+		}
+		break;
 	}
 
-	// time to renew lease
-	if ((rtime() >= dhcp_renew_time) && (dhcp_status == DHCP_ASSIGNED)) {
-		dhcp_transaction_id = HAL_GetTick() + (HAL_GetTick() << 16);
-
-		// send DHCP request
-		ip->to_addr = dhcp_server;
-
-		udp->to_port = DHCP_SERVER_PORT;
-		udp->from_port = DHCP_CLIENT_PORT;
+	/* file I/O is left to the callback, out of the rx path */
+	if (dhcp_lease_dirty) {
+		dhcp_lease_dirty = false;
+		if (dhcp_lease_cb != NULL) {
+			dhcp_lease_cb(&dhcp_lease);
+		}
+	}
+}
 
-		memset(dhcp, 0, sizeof(dhcp_message_t));
-		dhcp->operation = DHCP_OP_REQUEST;
-		dhcp->hw_addr_type = DHCP_HW_ADDR_TYPE_ETH;
-		dhcp->hw_addr_len = 6;
-		dhcp->transaction_id = dhcp_transaction_id;
-		dhcp->client_addr = ip_addr;
-		memcpy(dhcp->hw_addr, mac_addr, 6);
-		dhcp->magic_cookie = DHCP_MAGIC_COOKIE;
-
-		op = dhcp->options;
-		dhcp_add_option(op, DHCP_CODE_MESSAGETYPE, uint8_t, DHCP_MESSAGE_REQUEST);
-		dhcp_add_option(op, DHCP_CODE_REQUESTEDADDR, uint32_t, ip_addr);
-		dhcp_add_option(op, DHCP_CODE_DHCPSERVER, uint32_t, dhcp_server);
-		*(op++) = DHCP_CODE_END;
-
-		if (!udp_send(frame, (uint8_t *)op - (uint8_t *)dhcp)) {
-			dhcp_renew_time = rtime() + (uint32_t)5;
-			return;
-		}
-
-		dhcp_status = DHCP_WAITING_ACK;
+/**
+ * @brief dhcp_start sets the client up from lan_init()
+ */
+static void dhcp_start(void)
+{
+	dhcp_lease_dirty = false;
+	if (ip_addr != 0U) {
+		dhcp_status = DHCP_DISABLED; /* static configuration */
+		return;
+	}
+	dhcp_restart();
+	if (dhcp_lease_cached) {
+		/* INIT-REBOOT: ask for the last address at once */
+		dhcp_status = DHCP_REBOOTING;
+		dhcp_tries = 0U;
 	}
 }
 
 #endif
 
 /*
- * TCP (ver. 3.0)
+ * TCP (ver. 4.0)
  * lots of indian bydlocode here
  *
  * History:
@@ -572,20 +1099,49 @@ void dhcp_poll()
  *	2.0 second attempt, first suitable working variant
  *	2.1 added normal seq/ack management
  *	3.0 added rexmit feature
+ *	4.0 single connection server: send queue, go-back-N retransmission,
+ *	    peer window flow control
  */
 
 #ifdef WITH_TCP
 
+#define TCP_TXQ_MASK	(TCP_TXQ_SIZE - 1U)
+#define TCP_RXQ_MASK	(TCP_RXQ_SIZE - 1U)
+#define TCP_HDR_LEN	(sizeof(eth_frame_t) + sizeof(ip_packet_t) + sizeof(tcp_packet_t))
+
+#if ((TCP_TXQ_SIZE & TCP_TXQ_MASK) != 0U) || ((TCP_RXQ_SIZE & TCP_RXQ_MASK) != 0U)
+#error "TCP queue sizes must be powers of 2"
+#endif
+
 // packet sending mode
-tcp_sending_mode_t tcp_send_mode;
+static tcp_sending_mode_t tcp_send_mode;
 
 // "ack sent" flag
-uint8_t tcp_ack_sent;
+static uint8_t tcp_ack_sent;
+
+/* send queue, stream offsets: tail - acknowledged, head - written */
+static uint8_t tcp_txq[TCP_TXQ_SIZE];
+static volatile uint32_t tcp_txq_head;		/* writer task */
+static volatile uint32_t tcp_txq_tail;		/* lan poll task */
+/* received bytes */
+static uint8_t tcp_rxq[TCP_RXQ_SIZE];
+static volatile uint32_t tcp_rxq_head;		/* lan poll task */
+static volatile uint32_t tcp_rxq_tail;		/* reader task */
+/* bumped by the lan poll task when a connection restarts the streams;
+ * a writer or reader that raced with it does not publish its offset */
+static volatile uint32_t tcp_txq_gen;
+static volatile uint32_t tcp_rxq_gen;
+static volatile uint8_t tcp_close_req;
+static volatile uint8_t tcp_is_up;
+static uint16_t tcp_port;			/* listening, network order */
+static volatile uint32_t tcp_rexmits = 0u;
+static volatile uint32_t tcp_fast_rexmits = 0u;
+static volatile uint32_t tcp_drops = 0u;
 
 // send TCP packet
 // must be set manually:
 //	- tcp.flags
-uint8_t tcp_xmit(tcp_state_t *st, eth_frame_t *frame, uint16_t len)
+static uint8_t tcp_xmit(tcp_state_t *st, eth_frame_t *frame, uint16_t len)
 {
 	uint8_t status = 1;
 	uint16_t temp, plen = len;
@@ -610,8 +1166,8 @@ uint8_t tcp_xmit(tcp_state_t *st, eth_frame_t *frame, uint16_t len)
 	}
 
 	if (tcp_send_mode != TCP_SENDING_RESEND) {
-		// fill packet header ("static" fields)
-		tcp->window = htons(TCP_WINDOW_SIZE);
+		// fill packet header ("static" fields), the window is what we can take
+		tcp->window = htons((uint16_t)(TCP_RXQ_SIZE - (tcp_rxq_head - tcp_rxq_tail)));
 		tcp->urgent_ptr = 0;
 	}
 
@@ -634,7 +1190,7 @@ uint8_t tcp_xmit(tcp_state_t *st, eth_frame_t *frame, uint16_t len)
 	// set checksum
 	plen += sizeof(tcp_packet_t);
 	tcp->cksum = 0;
-	tcp->cksum = ip_cksum(plen + IP_PROTOCOL_TCP, (uint8_t *)tcp - 8, plen + 8);
+	tcp->cksum = inet_fold(inet_sum(htons((uint16_t)(plen + IP_PROTOCOL_TCP)), (uint8_t *)tcp - 8, plen + 8));
 
 	// send packet
 	switch (tcp_send_mode) {
@@ -655,6 +1211,8 @@ uint8_t tcp_xmit(tcp_state_t *st, eth_frame_t *frame, uint16_t len)
 	st->seq_num += len;
 	if ((tcp->flags & TCP_FLAG_SYN) || (tcp->flags & TCP_FLAG_FIN))
 		st->seq_num++;
+	if ((int32_t)(st->seq_num - st->seq_num_max) > 0)
+		st->seq_num_max = st->seq_num;
 
 	// set "ACK sent" flag
 	if ((tcp->flags & TCP_FLAG_ACK) && (status))
@@ -663,96 +1221,140 @@ uint8_t tcp_xmit(tcp_state_t *st, eth_frame_t *frame, uint16_t len)
 	return status;
 }
 
-// sending SYN to peer
-// return: 0xff - error, other value - connection id (not established)
-uint8_t tcp_open(uint32_t addr, uint16_t port, uint16_t local_port)
+// send a segment w/o data in a new frame
+static void tcp_send_ctl(tcp_state_t *st, uint8_t flags)
 {
-	eth_frame_t *frame = (void *)net_buf;
-	ip_packet_t *ip = (void *)(frame->data);
-	tcp_packet_t *tcp = (void *)(ip->data);
-	tcp_state_t *st = 0, *pst;
-	uint8_t id;
-	uint32_t seq_num;
+	eth_frame_t *frame;
+	ip_packet_t *ip;
+	tcp_packet_t *tcp;
 
-	// search for free conection slot
-	for (id = 0; id < TCP_MAX_CONNECTIONS; ++id) {
-		pst = tcp_pool + id;
+	frame = (void *)lan_getmem((uint16_t)(TCP_HDR_LEN + 4U), LAN_BUF_TX);
+	if (frame == NULL) {
+		return; /* the timer retries */
+	}
+	ip = (void *)(frame->data);
+	tcp = (void *)(ip->data);
 
-		if (pst->status == TCP_CLOSED) {
-			st = pst;
+	tcp_send_mode = TCP_SENDING_SEND;
+	tcp->flags = flags;
+	tcp_xmit(st, frame, 0);
+	lan_freemem((uint8_t *)frame);
+}
+
+/**
+  * sends the queued data the peer window allows, then FIN if asked for
+  * segments are copied from the queue, it keeps the bytes until acked
+  * @param st the connection
+  * @param probe one byte may go into a zero window
+  * @return none
+  */
+static void tcp_output(tcp_state_t *st, bool probe)
+{
+	eth_frame_t *frame;
+	ip_packet_t *ip;
+	tcp_packet_t *tcp;
+	uint32_t queued, flight, usable, len, ofs, n;
+
+	if (st->status != TCP_ESTABLISHED) {
+		return;
+	}
+	for (;;) {
+		queued = tcp_txq_head - tcp_txq_tail;
+		__DMB(); /* the data is written before the head */
+		flight = st->seq_num - st->seq_num_saved;
+		usable = (st->snd_wnd > flight) ? (st->snd_wnd - flight) : 0U;
+		if (probe && (usable == 0U) && (flight == 0U)) {
+			usable = 1U;
+		}
+		len = queued - flight;
+		if (len > usable) {
+			len = usable;
+		}
+		if (len > st->mss) {
+			len = st->mss;
+		}
+		if (len == 0U) {
 			break;
 		}
-	}
-
-	// free connection slot found
-	if (st) {
-		// add new connection
-		seq_num = HAL_GetTick() + (HAL_GetTick() << 16);
+		frame = (void *)lan_getmem((uint16_t)(TCP_HDR_LEN + len), LAN_BUF_TX);
+		if (frame == NULL) {
+			break; /* the next poll sends it */
+		}
+		ip = (void *)(frame->data);
+		tcp = (void *)(ip->data);
 
-		st->status = TCP_SYN_SENT;
-		st->event_time = HAL_GetTick();
-		st->seq_num = seq_num;
-		st->ack_num = 0;
-		st->remote_addr = addr;
-		st->remote_port = port;
-		st->local_port = local_port;
-
-#ifdef WITH_TCP_REXMIT
-		st->is_closing = 0;
-		st->rexmit_count = 0;
-		st->seq_num_saved = seq_num;
-#endif
+		ofs = (tcp_txq_tail + flight) & TCP_TXQ_MASK;
+		n = TCP_TXQ_SIZE - ofs;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(tcp->data, &tcp_txq[ofs], n);
+		memcpy(tcp->data + n, tcp_txq, len - n);
 
-		// send packet
+		if (flight == 0U) {
+			st->event_time = HAL_GetTick(); /* the oldest unacked is timed */
+		}
 		tcp_send_mode = TCP_SENDING_SEND;
-		tcp->flags = TCP_FLAG_SYN;
-		if (tcp_xmit(st, frame, 0))
-			return id;
-
-		st->status = TCP_CLOSED;
+		tcp->flags = TCP_FLAG_ACK | TCP_FLAG_PSH;
+		tcp_xmit(st, frame, (uint16_t)len);
+		lan_freemem((uint8_t *)frame);
+		probe = false;
 	}
 
-	return 0xff;
+	// send FIN/ACK once all the data is out (active close, step 1)
+	if ((tcp_close_req != 0U) &&
+	    ((tcp_txq_head - tcp_txq_tail) == (st->seq_num - st->seq_num_saved))) {
+		if (st->seq_num == st->seq_num_saved) {
+			st->event_time = HAL_GetTick();
+		}
+		st->status = TCP_FIN_WAIT;
+		st->is_closing = 1;
+		tcp_send_ctl(st, TCP_FLAG_FIN | TCP_FLAG_ACK);
+	}
 }
 
-// send TCP data
-// dont use somewhere except tcp_write callback!
-void tcp_send(uint8_t id, eth_frame_t *frame, uint16_t len, uint8_t options)
+// MSS option of the SYN, limited by ours
+static uint16_t tcp_peer_mss(const tcp_packet_t *tcp)
 {
-	ip_packet_t *ip = (void *)(frame->data);
-	tcp_packet_t *tcp = (void *)(ip->data);
-	tcp_state_t *st = tcp_pool + id;
-	uint8_t flags = TCP_FLAG_ACK;
-
-	// check if connection established
-	if (st->status != TCP_ESTABLISHED)
-		return;
+	const uint8_t *op = tcp->data;
+	const uint8_t *end = (const uint8_t *)tcp + tcp_head_size(tcp);
+	uint16_t mss = TCP_DEFAULT_MSS;
 
-	// send PSH/ACK
-	if (options & TCP_OPTION_PUSH)
-		flags |= TCP_FLAG_PSH;
-
-	// send FIN/ACK
-	if (options & TCP_OPTION_CLOSE) {
-		flags |= TCP_FLAG_FIN;
-		st->status = TCP_FIN_WAIT;
+	while (op < end) {
+		if (op[0] == 0U) {
+			break; /* end of the list */
+		}
+		if (op[0] == 1U) {
+			op++; /* nop */
+			continue;
+		}
+		if (((op + 2) > end) || (op[1] < 2U) || ((op + op[1]) > end)) {
+			break;
+		}
+		if ((op[0] == 2U) && (op[1] == 4U)) {
+			mss = (uint16_t)(((uint16_t)op[2] << 8) | op[3]);
+		}
+		op += op[1];
 	}
-
-	// send packet
-	tcp->flags = flags;
-	tcp_xmit(st, frame, len);
+	return (mss < TCP_SYN_MSS) ? mss : TCP_SYN_MSS;
 }
 
 // processing tcp packets
-void tcp_filter(eth_frame_t *frame, uint16_t len)
+static void tcp_filter(eth_frame_t *frame, uint16_t len)
 {
 	ip_packet_t *ip = (void *)(frame->data);
 	tcp_packet_t *tcp = (void *)(ip->data);
-	tcp_state_t *st = 0, *pst;
-	uint8_t id, tcpflags;
+	tcp_state_t *st = tcp_pool;
+	uint8_t id = 0U, tcpflags;
+	uint32_t seq, ack, acked, queued;
+	uint16_t taken;
+	bool need_ack = false;
 
 	if (ip->to_addr != ip_addr)
 		return;
+	if ((len < sizeof(tcp_packet_t)) || (tcp_head_size(tcp) < sizeof(tcp_packet_t)) ||
+	    (tcp_head_size(tcp) > len))
+		return;
 
 	// tcp data length
 	len -= tcp_head_size(tcp);
@@ -764,303 +1366,328 @@ void tcp_filter(eth_frame_t *frame, uint16_t len)
 	tcp_send_mode = TCP_SENDING_REPLY;
 	tcp_ack_sent = 0;
 
-	// search connection pool for connection
-	//	to specific port from specific host/port
-	for (id = 0; id < TCP_MAX_CONNECTIONS; ++id) {
-		pst = tcp_pool + id;
-
-		if ((pst->status != TCP_CLOSED) && (ip->from_addr == pst->remote_addr) &&
-		    (tcp->from_port == pst->remote_port) && (tcp->to_port == pst->local_port)) {
-			st = pst;
-			break;
-		}
-	}
-
 	// connection not found/new connection
-	if (!st) {
-		// received SYN - initiating new connection
-		if (tcpflags == TCP_FLAG_SYN) {
-			// search for free slot for connection
-			for (id = 0; id < TCP_MAX_CONNECTIONS; ++id) {
-				pst = tcp_pool + id;
-
-				if (pst->status == TCP_CLOSED) {
-					st = pst;
-					break;
-				}
-			}
-
-			// slot found and app accepts connection?
-			if (st && tcp_listen(id, frame)) {
-				// add embrionic connection to pool
-				st->status = TCP_SYN_RECEIVED;
-				st->event_time = HAL_GetTick();
-				st->seq_num = HAL_GetTick() + (HAL_GetTick() << 16);
-				st->ack_num = ntohl(tcp->seq_num) + 1;
-				st->remote_addr = ip->from_addr;
-				st->remote_port = tcp->from_port;
-				st->local_port = tcp->to_port;
-
-#ifdef WITH_TCP_REXMIT
-				st->is_closing = 0;
-				st->rexmit_count = 0;
-				st->seq_num_saved = st->seq_num;
-#endif
-
-				// send SYN/ACK
-				tcp->flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
-				tcp_xmit(st, frame, 0);
+	if ((st->status == TCP_CLOSED) || (ip->from_addr != st->remote_addr) ||
+	    (tcp->from_port != st->remote_port) || (tcp->to_port != st->local_port)) {
+		// received SYN - a new connection replaces the current one
+		if ((tcpflags == TCP_FLAG_SYN) && tcp_listen(id, frame)) {
+			if (st->status != TCP_CLOSED) {
+				st->status = TCP_CLOSED;
+				tcp_closed(id, 1);
 			}
+			// add embrionic connection to pool
+			st->status = TCP_SYN_RECEIVED;
+			st->event_time = HAL_GetTick();
+			st->seq_num = HAL_GetTick() + (HAL_GetTick() << 16);
+			st->ack_num = ntohl(tcp->seq_num) + 1;
+			st->remote_addr = ip->from_addr;
+			st->remote_port = tcp->from_port;
+			st->local_port = tcp->to_port;
+			st->is_closing = 0;
+			st->rexmit_count = 0;
+			st->seq_num_saved = st->seq_num;
+			st->seq_num_max = st->seq_num;
+			st->rto = TCP_REXMIT_TIMEOUT;
+			st->snd_wnd = ntohs(tcp->window);
+			st->mss = tcp_peer_mss(tcp);
+			st->dup_acks = 0;
+
+			// the streams start empty, each end keeps its own offset
+			taskENTER_CRITICAL();
+			tcp_txq_gen++;
+			tcp_txq_tail = tcp_txq_head;
+			tcp_rxq_gen++;
+			tcp_rxq_head = tcp_rxq_tail;
+			taskEXIT_CRITICAL();
+			tcp_close_req = 0;
+
+			// send SYN/ACK
+			tcp->flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+			tcp_xmit(st, frame, 0);
 		}
+		return;
 	}
 
-	else {
-		// connection reset by peer?
-		if (tcpflags & TCP_FLAG_RST) {
-			if ((st->status == TCP_ESTABLISHED) || (st->status == TCP_FIN_WAIT)) {
-				tcp_closed(id, 1);
-			}
-			st->status = TCP_CLOSED;
-			return;
-		}
+	// connection reset by peer?
+	if (tcpflags & TCP_FLAG_RST) {
+		st->status = TCP_CLOSED;
+		tcp_closed(id, 1);
+		return;
+	}
 
-		// me needs only ack packet
-		if ((ntohl(tcp->seq_num) != st->ack_num) || (ntohl(tcp->ack_num) != st->seq_num) ||
-		    (!(tcpflags & TCP_FLAG_ACK))) {
-			return;
-		}
+	// me needs only ack packet
+	if (!(tcpflags & TCP_FLAG_ACK))
+		return;
 
-#ifdef WITH_TCP_REXMIT
-		// save sequence number
-		st->seq_num_saved = st->seq_num;
+	seq = ntohl(tcp->seq_num);
+	ack = ntohl(tcp->ack_num);
 
-		// reset rexmit counter
-		st->rexmit_count = 0;
-#endif
+	// nothing we have not sent can be acked
+	if (((int32_t)(ack - st->seq_num_saved) < 0) || ((int32_t)(ack - st->seq_num_max) > 0))
+		return;
 
-		// update ack pointer
-		st->ack_num += len;
-		if ((tcpflags & TCP_FLAG_FIN) || (tcpflags & TCP_FLAG_SYN))
-			st->ack_num++;
+	acked = ack - st->seq_num_saved;
+	if (acked != 0U) {
+		// the acked bytes leave the queue, SYN and FIN are not there
+		if (st->status != TCP_SYN_RECEIVED) {
+			queued = tcp_txq_head - tcp_txq_tail;
+			tcp_txq_tail += (acked < queued) ? acked : queued;
+		}
+		st->seq_num_saved = ack;
+		if ((int32_t)(st->seq_num - ack) < 0)
+			st->seq_num = ack;
 
-		// reset timeout counter
+		// reset rexmit counter and timeout
+		st->rexmit_count = 0;
+		st->rto = TCP_REXMIT_TIMEOUT;
+		st->dup_acks = 0;
 		st->event_time = HAL_GetTick();
+	} else if ((len == 0U) && (st->seq_num_max != st->seq_num_saved) &&
+		   (!(tcpflags & TCP_FLAG_FIN)) && (ntohs(tcp->window) == st->snd_wnd)) {
+		// duplicate ack: a segment is lost, go back at once
+		if (++st->dup_acks == TCP_DUP_ACKS) {
+			st->seq_num = st->seq_num_saved;
+			tcp_fast_rexmits++;
+		}
+	}
+	st->snd_wnd = ntohs(tcp->window);
 
-		switch (st->status) {
-		// SYN sent by me (active open, step 1)
-		// awaiting SYN/ACK (active open, step 2)
-		case TCP_SYN_SENT:
-
-			// received packet must be SYN/ACK
-			if (tcpflags != (TCP_FLAG_SYN | TCP_FLAG_ACK)) {
-				st->status = TCP_CLOSED;
-				break;
-			}
-
-			// send ACK (active open, step 3)
+	// out of order or retransmitted data: tell the peer what we wait for
+	if (seq != st->ack_num) {
+		if ((len != 0U) || (tcpflags & TCP_FLAG_FIN)) {
 			tcp->flags = TCP_FLAG_ACK;
 			tcp_xmit(st, frame, 0);
+		}
+		return;
+	}
 
-			// connection is now established
-			st->status = TCP_ESTABLISHED;
-
-			// app can send some data
-			tcp_read(id, frame, 0);
-
-			break;
-
-		// SYN received my me (passive open, step 1)
-		// SYN/ACK sent by me (passive open, step 2)
-		// awaiting ACK (passive open, step 3)
-		case TCP_SYN_RECEIVED:
-
-			// received packet must be ACK
-			if (tcpflags != TCP_FLAG_ACK) {
-				st->status = TCP_CLOSED;
-				break;
-			}
-
-			// connection is now established
-			st->status = TCP_ESTABLISHED;
-
-			// app can send some data
-			tcp_read(id, frame, 0);
-
-			break;
-
-		// connection established
-		// awaiting ACK or FIN/ACK
-		case TCP_ESTABLISHED:
-
-			// received FIN/ACK?
-			// (passive close, step 1)
-			if (tcpflags == (TCP_FLAG_FIN | TCP_FLAG_ACK)) {
-				// feed data to app
-				if (len)
-					tcp_write(id, frame, len);
+	// SYN received my me (passive open, step 1)
+	// SYN/ACK sent by me (passive open, step 2)
+	// awaiting ACK (passive open, step 3)
+	if (st->status == TCP_SYN_RECEIVED) {
+		if (st->seq_num_saved != st->seq_num_max)
+			return;
 
-				// send FIN/ACK (passive close, step 2)
-				tcp->flags = TCP_FLAG_FIN | TCP_FLAG_ACK;
-				tcp_xmit(st, frame, 0);
+		// connection is now established
+		st->status = TCP_ESTABLISHED;
+		tcp_is_up = 1;
+	}
 
-				// connection is now closed
-				st->status = TCP_CLOSED;
-				tcp_closed(id, 0);
-			}
+	// feed data to app, what does not fit is sent again by the peer
+	if (len != 0U) {
+		taken = tcp_write(id, tcp_get_data(tcp), len);
+		st->ack_num += taken;
+		if (taken != len)
+			tcpflags &= (uint8_t)~TCP_FLAG_FIN;
+		need_ack = true;
+	}
 
-			// received ACK
-			else if (tcpflags == TCP_FLAG_ACK) {
-				// feed data to app
-				if (len)
-					tcp_write(id, frame, len);
+	// received FIN/ACK?
+	if (tcpflags & TCP_FLAG_FIN) {
+		st->ack_num++;
 
-				// app can send some data
-				tcp_read(id, frame, 0);
+		// passive close: send FIN/ACK, the queued data is dropped
+		// active close, step 3: our FIN is out, send ACK
+		tcp->flags = (st->status == TCP_FIN_WAIT) ? TCP_FLAG_ACK :
+							    (TCP_FLAG_FIN | TCP_FLAG_ACK);
+		tcp_xmit(st, frame, 0);
 
-				// send ACK
-				if ((len) && (!tcp_ack_sent)) {
-					tcp->flags = TCP_FLAG_ACK;
-					tcp_xmit(st, frame, 0);
-				}
-			}
+		// connection is now closed
+		st->status = TCP_CLOSED;
+		tcp_closed(id, 0);
+		return;
+	}
 
-			break;
+	// the window may be open now
+	tcp_output(st, false);
 
-		// FIN/ACK sent by me (active close, step 1)
-		// awaiting ACK or FIN/ACK
-		case TCP_FIN_WAIT:
+	// send ACK
+	if (need_ack && (!tcp_ack_sent)) {
+		tcp_send_mode = TCP_SENDING_REPLY;
+		tcp->flags = TCP_FLAG_ACK;
+		tcp_xmit(st, frame, 0);
+	}
+}
 
-			// received FIN/ACK?
-			// (active close, step 2)
-			if (tcpflags == (TCP_FLAG_FIN | TCP_FLAG_ACK)) {
-				// feed data to app
-				if (len)
-					tcp_write(id, frame, len);
+// periodic event: retransmission, then the new data
+static void tcp_poll(void)
+{
+	tcp_state_t *st = tcp_pool;
+	uint8_t id = 0U;
+	uint32_t now = HAL_GetTick();
+	bool probe = false;
 
-				// send ACK (active close, step 3)
-				tcp->flags = TCP_FLAG_ACK;
-				tcp_xmit(st, frame, 0);
+	if (st->status == TCP_CLOSED)
+		return;
 
-				// connection is now closed
+	// unacked segments, or data waiting for the window to open
+	if ((st->seq_num_max != st->seq_num_saved) ||
+	    ((st->snd_wnd == 0U) && (tcp_txq_head != tcp_txq_tail))) {
+		if ((now - st->event_time) > st->rto) {
+			// rexmit limit reached?
+			if (st->rexmit_count >= TCP_REXMIT_LIMIT) {
+				// close connection
+				tcp_drops++;
 				st->status = TCP_CLOSED;
-				tcp_closed(id, 0);
+				tcp_closed(id, 1); // callback
+				return;
 			}
+			// exponential backoff
+			st->rexmit_count++;
+			tcp_rexmits++;
+			st->rto = (st->rto < (TCP_REXMIT_TIMEOUT_MAX / 2U)) ? (st->rto * 2U) :
+									       TCP_REXMIT_TIMEOUT_MAX;
+			st->event_time = now;
+			st->dup_acks = 0;
+
+			// load previous state, go back N
+			st->seq_num = st->seq_num_saved;
+
+			switch (st->status) {
+			// rexmit SYN/ACK
+			case TCP_SYN_RECEIVED:
+				tcp_send_ctl(st, TCP_FLAG_SYN | TCP_FLAG_ACK);
+				break;
 
-			// received ACK+data?
-			// (buffer flushing by peer)
-			else if ((tcpflags == TCP_FLAG_ACK) && (len)) {
-				// feed data to app
-				tcp_write(id, frame, len);
-
-				// send ACK
-				tcp->flags = TCP_FLAG_ACK;
-				tcp_xmit(st, frame, 0);
+			// rexmit data+FIN/ACK
+			case TCP_FIN_WAIT:
+				st->status = TCP_ESTABLISHED;
+				st->is_closing = 0;
+				break;
 
-#ifdef WITH_TCP_REXMIT
-				// our data+FIN/ACK acked
-				st->is_closing = 1;
-#endif
+			default:
+				probe = (st->snd_wnd == 0U);
+				break;
 			}
-
-			break;
-
-		default:
-			break;
 		}
+	} else if (st->is_closing && ((now - st->event_time) > TCP_FIN_TIMEOUT)) {
+		// our FIN is acked, the peer does not close
+		st->status = TCP_CLOSED;
+		tcp_closed(id, 0);
+		return;
 	}
+
+	tcp_output(st, probe);
 }
 
-// periodic event
-void tcp_poll()
+/**
+  * sets the port the server accepts the connection on
+  * a new connection replaces the current one
+  * @param port local port, host order; 0 - no new connections
+  * @return none
+  */
+void tcp_stream_listen(uint16_t port)
 {
-#ifdef WITH_TCP_REXMIT
-	eth_frame_t *frame = (void *)net_buf;
-	ip_packet_t *ip = (void *)(frame->data);
-	tcp_packet_t *tcp = (void *)(ip->data);
-#endif
+	tcp_port = htons(port);
+}
 
-	uint8_t id;
-	tcp_state_t *st;
+/**
+  * @return 1 if a connection is established and not being closed
+  */
+uint8_t tcp_stream_up(void)
+{
+	return ((tcp_is_up != 0U) && (tcp_close_req == 0U)) ? 1U : 0U;
+}
 
-	for (id = 0; id < TCP_MAX_CONNECTIONS; ++id) {
-		st = tcp_pool + id;
+/**
+  * @return bytes tcp_stream_write() takes now
+  */
+size_t tcp_stream_space(void)
+{
+	if (tcp_stream_up() == 0U) {
+		return 0U;
+	}
+	return TCP_TXQ_SIZE - (tcp_txq_head - tcp_txq_tail);
+}
 
-#ifdef WITH_TCP_REXMIT
-		// connection timed out?
-		if ((st->status != TCP_CLOSED) &&
-		    (HAL_GetTick() - st->event_time > TCP_REXMIT_TIMEOUT)) {
-			// rexmit limit reached?
-			if (st->rexmit_count > TCP_REXMIT_LIMIT) {
-				// close connection
-				st->status = TCP_CLOSED;
-				tcp_closed(id, 1); // callback
-			}
+/**
+  * queues the data to the connection, does not block
+  * the bytes stay queued until acknowledged by the peer
+  * @param buf data
+  * @param len length
+  * @return bytes queued
+  */
+size_t tcp_stream_write(const uint8_t *buf, size_t len)
+{
+	const size_t want = len;
+	uint32_t gen, head;
+	size_t space;
+	uint32_t ofs, n;
+	bool done;
+
+	do {
+		gen = tcp_txq_gen;
+		__DMB(); /* the generation before the offsets */
+		head = tcp_txq_head;
+		space = tcp_stream_space();
+		len = (want > space) ? space : want;
+		ofs = head & TCP_TXQ_MASK;
+		n = TCP_TXQ_SIZE - ofs;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(&tcp_txq[ofs], buf, n);
+		memcpy(tcp_txq, buf + n, len - n);
+		__DMB(); /* the data before the head */
+		/* a new connection meanwhile: write again into its stream */
+		taskENTER_CRITICAL();
+		done = (gen == tcp_txq_gen);
+		if (done) {
+			tcp_txq_head = head + (uint32_t)len;
+		}
+		taskEXIT_CRITICAL();
+	} while (!done);
+	return len;
+}
 
-			// should rexmit?
-			else {
-				// reset timeout counter
-				st->event_time = HAL_GetTick();
-
-				// increment rexmit counter
-				st->rexmit_count++;
-
-				// load previous state
-				st->seq_num = st->seq_num_saved;
-
-				// will send packets
-				tcp_send_mode = TCP_SENDING_SEND;
-				tcp_ack_sent = 0;
-
-				// rexmit
-				switch (st->status) {
-				// rexmit SYN
-				case TCP_SYN_SENT:
-					tcp->flags = TCP_FLAG_SYN;
-					tcp_xmit(st, frame, 0);
-					break;
-
-				// rexmit SYN/ACK
-				case TCP_SYN_RECEIVED:
-					tcp->flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
-					tcp_xmit(st, frame, 0);
-					break;
-
-				// rexmit data+FIN/ACK or ACK (in FIN_WAIT state)
-				case TCP_FIN_WAIT:
-
-					// data+FIN/ACK acked?
-					if (st->is_closing) {
-						tcp->flags = TCP_FLAG_ACK;
-						tcp_xmit(st, frame, 0);
-						break;
-					}
-
-					// rexmit data+FIN/ACK
-					st->status = TCP_ESTABLISHED;
-
-				// rexmit data
-				case TCP_ESTABLISHED:
-					tcp_read(id, frame, 1);
-					if (!tcp_ack_sent) {
-						tcp->flags = TCP_FLAG_ACK;
-						tcp_xmit(st, frame, 0);
-					}
-					break;
-
-				default:
-					break;
-				}
-			}
+/**
+  * takes the received bytes, does not block
+  * @param buf destination
+  * @param len size of buf
+  * @return bytes read
+  */
+size_t tcp_stream_read(uint8_t *buf, size_t len)
+{
+	const size_t want = len;
+	uint32_t gen, tail, avail;
+	uint32_t ofs, n;
+	bool done;
+
+	do {
+		gen = tcp_rxq_gen;
+		__DMB(); /* the generation before the offsets */
+		tail = tcp_rxq_tail;
+		avail = tcp_rxq_head - tail;
+		__DMB(); /* the head before the data */
+		len = (want > avail) ? avail : want;
+		ofs = tail & TCP_RXQ_MASK;
+		n = TCP_RXQ_SIZE - ofs;
+		if (n > len) {
+			n = len;
 		}
-#else
-		// check if connection timed out
-		if ((st->status != TCP_CLOSED) &&
-		    (HAL_GetTick() - st->event_time > TCP_CONN_TIMEOUT)) {
-			// kill connection
-			st->status = TCP_CLOSED;
-			tcp_closed(id, 1); // callback
+		memcpy(buf, &tcp_rxq[ofs], n);
+		memcpy(buf + n, tcp_rxq, len - n);
+		__DMB(); /* the data is taken before the space is given back */
+		/* a new connection meanwhile: the bytes were the old one's */
+		taskENTER_CRITICAL();
+		done = (gen == tcp_rxq_gen);
+		if (done) {
+			tcp_rxq_tail = tail + (uint32_t)len;
 		}
-#endif
+		taskEXIT_CRITICAL();
+	} while (!done);
+	return len;
+}
+
+/**
+  * closes the connection after the queued data is sent
+  * @param none
+  * @return none
+  */
+void tcp_stream_close(void)
+{
+	if (tcp_is_up != 0U) {
+		tcp_close_req = 1;
 	}
 }
 
@@ -1093,8 +1720,8 @@ uint8_t udp_send(eth_frame_t *frame, uint16_t len)
 
 	udp->len = htons(len);
 	udp->cksum = 0;
-	udp->cksum =
-		ip_cksum((uint32_t)(len + (uint32_t)IP_PROTOCOL_UDP), (uint8_t *)udp - 8, len + 8);
+	udp->cksum = inet_fold(inet_sum(htons((uint16_t)(len + IP_PROTOCOL_UDP)),
+					(uint8_t *)udp - 8, len + 8));
 
 	return ip_send(frame, len);
 }
@@ -1109,6 +1736,7 @@ void udp_reply(eth_frame_t *frame, uint16_t len)
 
 	len += sizeof(udp_packet_t);
 
+	ip->cksum = inet_cksum_adjust32(ip->cksum, ip->to_addr, ip_addr);
 	ip->to_addr = ip_addr;
 
 	temp = udp->from_port;
@@ -1117,9 +1745,10 @@ void udp_reply(eth_frame_t *frame, uint16_t len)
 
 	udp->len = htons(len);
 
+	/* the payload is new, the header is patched by ip_reply() */
 	udp->cksum = 0;
-	udp->cksum =
-		ip_cksum((uint32_t)(len + (uint32_t)IP_PROTOCOL_UDP), (uint8_t *)udp - 8, len + 8);
+	udp->cksum = inet_fold(inet_sum(htons((uint16_t)(len + IP_PROTOCOL_UDP)),
+					(uint8_t *)udp - 8, len + 8));
 
 	ip_reply(frame, len);
 }
@@ -1137,21 +1766,30 @@ static eth_frame_t *udp_filter(eth_frame_t *frame, uint16_t len)
 	retval = frame;
 	ip_packet_t *ip = (void *)(frame->data);
 	udp_packet_t *udp = (void *)(ip->data);
+	uint16_t udp_len;
 
-	if (len >= sizeof(udp_packet_t)) {
-		len = ntohs(udp->len) - sizeof(udp_packet_t);
+	if (len < sizeof(udp_packet_t)) {
+		goto fExit;
+	}
+	/* the datagram must lie within the IP payload ip_filter checked */
+	udp_len = ntohs(udp->len);
+	if ((udp_len < sizeof(udp_packet_t)) || (udp_len > len)) {
+		udp_len_errors++;
+		goto fExit;
+	}
+	len = udp_len - sizeof(udp_packet_t);
 
-		switch (udp->to_port) {
+	switch (udp->to_port) {
 #ifdef WITH_DHCP
-		case DHCP_CLIENT_PORT:
-			dhcp_filter(frame, len);
-			break;
+	case DHCP_CLIENT_PORT:
+		dhcp_filter(frame, len);
+		break;
 #endif
-		default:
-			retval = udp_packet_callback(frame, len); /* callback */
-			break;
-		}
+	default:
+		retval = udp_packet_callback(frame, len); /* callback */
+		break;
 	}
+fExit:
 	return retval;
 }
 
@@ -1163,6 +1801,18 @@ static eth_frame_t *udp_filter(eth_frame_t *frame, uint16_t len)
 
 #ifdef WITH_ICMP
 
+/* echo request to reply, the checksum is patched */
+static inline void icmp_echo_reply_hdr(icmp_echo_packet_t *icmp)
+{
+	uint16_t old;
+	uint16_t new;
+
+	memcpy(&old, &icmp->type, 2);
+	icmp->type = (uint8_t)ICMP_TYPE_ECHO_RPLY;
+	memcpy(&new, &icmp->type, 2);
+	icmp->cksum = inet_cksum_adjust16(icmp->cksum, old, new); // update cksum
+}
+
 /**
   * processes the ICMP packet
   * @param frame pointer to the full eth. frame
@@ -1176,12 +1826,47 @@ static void icmp_filter(eth_frame_t *frame, uint16_t len)
 
 	if (len >= sizeof(icmp_echo_packet_t)) {
 		if (icmp->type == (uint8_t)ICMP_TYPE_ECHO_RQ) {
-			icmp->type = (uint8_t)ICMP_TYPE_ECHO_RPLY;
-			icmp->cksum += 8U; // update cksum
+			icmp_echo_reply_hdr(icmp);
 			ip_reply(frame, len);
 		}
 	}
 }
+
+/* headers of the frame up to the echo data */
+#define	ICMP_ECHO_HEAD	(sizeof(eth_frame_t) + sizeof(ip_packet_t) + sizeof(icmp_echo_packet_t))
+
+/**
+  * answers an echo request to us from the head of the frame while it is
+  * in the chip: the headers cross SPI, the data is copied by the chip
+  * DMA. the checks are the ones of ip_filter(), anything else is read
+  * and goes the usual way. runs inside the chip read
+  * @param head the first ICMP_ECHO_HEAD bytes of the frame
+  * @param len frame length
+  * @return reply length, 0 if it is not an echo request to us
+  */
+static uint16_t icmp_rx_hook(uint8_t *head, uint16_t len)
+{
+	eth_frame_t *frame = (void *)head;
+	ip_packet_t *packet = (void *)(frame->data);
+	icmp_echo_packet_t *icmp = (void *)(packet->data);
+	uint16_t total = ntohs(packet->total_len);
+
+	if ((frame->type != ETH_TYPE_IP) || (packet->ver_head_len != 0x45U) ||
+	    (ip_addr == 0U) || (packet->to_addr != ip_addr) ||
+	    (packet->protocol != IP_PROTOCOL_ICMP) ||
+	    ((packet->flags_framgent_offset & IP_FRAG_MASK) != 0U) ||
+	    (icmp->type != (uint8_t)ICMP_TYPE_ECHO_RQ) ||
+	    (total < sizeof(ip_packet_t) + sizeof(icmp_echo_packet_t)) ||
+	    (total > len - sizeof(eth_frame_t)) ||
+	    (inet_cksum(packet, sizeof(ip_packet_t)) != 0U)) {
+		return 0U;
+	}
+	icmp_echo_reply_hdr(icmp);
+	ip_reply_hdr(frame, total - sizeof(ip_packet_t));
+	eth_reply_hdr(frame);
+	icmp_chip_replies++;
+	return (uint16_t)(total + sizeof(eth_frame_t));
+}
 /*   end of icmp_filter() 									*/
 #endif
 
@@ -1190,27 +1875,33 @@ static void icmp_filter(eth_frame_t *frame, uint16_t len)
  */
 
 /**
- * @brief ip_cksum calculates IP checksum
- * @param sum
- * @param buf
- * @param len
- * @return
+ * @brief ip_next_hop applies the route
+ * @param to_addr destination IP
+ * @return IP of the next hop
  */
-static uint16_t ip_cksum(uint32_t sum, uint8_t *buf, uint16_t len)
+static uint32_t ip_next_hop(uint32_t to_addr)
 {
-	while (len >= 2U) {
-		sum += ((uint16_t)*buf << 8) | *(buf + 1);
-		buf += 2;
-		len -= 2U;
+	if (((to_addr ^ ip_addr) & ip_mask) == 0) {
+		return to_addr;
 	}
+	return ip_gateway;
+}
 
-	if (len != 0) {
-		sum += (uint16_t)*buf << 8;
-	}
-	while (sum >> 16) {
-		sum = (sum & 0xffff) + (sum >> 16);
+/**
+ * @brief ip_route_mac gets MAC of the next hop to the address
+ * @param to_addr destination IP
+ * @param mac the MAC (out)
+ * @return true if resolved, false if not resolved yet
+ */
+static bool ip_route_mac(uint32_t to_addr, uint8_t *mac)
+{
+	if ((to_addr == ip_broadcast) || (to_addr == IP_LIMITED_BROADCAST)) {
+		// use broadcast MAC
+		memset(mac, 0xff, 6);
+		return true;
 	}
-	return (~htons((uint16_t)sum));
+	/* resolve mac address, does not wait */
+	return arp_lookup(ip_next_hop(to_addr), mac);
 }
 
 // send IP packet
@@ -1221,27 +1912,6 @@ static uint16_t ip_cksum(uint32_t sum, uint8_t *buf, uint16_t len)
 static uint8_t ip_send(eth_frame_t *frame, uint16_t len)
 {
 	ip_packet_t *ip = (void *)(frame->data);
-	uint32_t route_ip;
-	uint8_t *mac_addr_to;
-
-	// set frame.dst
-	if (ip->to_addr == ip_broadcast) {
-		// use broadcast MAC
-		memset(frame->to_addr, 0xff, 6);
-	} else {
-		// apply route
-		if (((ip->to_addr ^ ip_addr) & ip_mask) == 0) {
-			route_ip = ip->to_addr;
-		} else {
-			route_ip = ip_gateway;
-		}
-		/* resolve mac address */
-		mac_addr_to = arp_resolve(route_ip); /* it may take time to resolve !*/
-		if (mac_addr_to == NULL) {
-			return 0; // err!
-		}
-		memcpy(frame->to_addr, mac_addr_to, 6);
-	}
 
 	// set frame.type
 	frame->type = (uint16_t)ETH_TYPE_IP;
@@ -1257,31 +1927,59 @@ static uint8_t ip_send(eth_frame_t *frame, uint16_t len)
 	ip->ttl = IP_PACKET_TTL;
 	ip->cksum = 0;
 	ip->from_addr = ip_addr;
-	ip->cksum = ip_cksum(0, (void *)ip, sizeof(ip_packet_t));
+	ip->cksum = inet_cksum(ip, sizeof(ip_packet_t));
+
+	// set frame.dst
+	if (!ip_route_mac(ip->to_addr, frame->to_addr)) {
+		/* the frame waits for the ARP reply */
+		memcpy(frame->from_addr, mac_addr, 6);
+		if (arp_park(ip_next_hop(ip->to_addr), (uint8_t *)frame,
+			     (uint16_t)(len + (uint16_t)sizeof(eth_frame_t)), NULL, 0U) != SUCCESS) {
+			return 0; // err!
+		}
+		return 1; // queued
+	}
 
 	// send frame
 	eth_send(frame, len);
 	return 1; // ok
 }
 
-// send IP packet back
+// turns the received IP header into the one of the reply
 // len is IP packet payload length
-static void ip_reply(eth_frame_t *frame, uint16_t len)
+// the checksum of the received header is patched (RFC 1624)
+static void ip_reply_hdr(eth_frame_t *frame, uint16_t len)
 {
 	ip_packet_t *packet = (void *)(frame->data);
+	uint16_t ck = packet->cksum;
+	uint16_t old;
+	uint16_t new;
 
 	len += sizeof(ip_packet_t);
 
+	ck = inet_cksum_adjust16(ck, packet->total_len, htons(len));
 	packet->total_len = htons(len);
+	ck = inet_cksum_adjust16(ck, packet->fragment_id, 0U);
 	packet->fragment_id = 0;
+	ck = inet_cksum_adjust16(ck, packet->flags_framgent_offset, 0U);
 	packet->flags_framgent_offset = 0;
+	memcpy(&old, &packet->ttl, 2); /* ttl and protocol */
 	packet->ttl = IP_PACKET_TTL;
-	packet->cksum = 0;
+	memcpy(&new, &packet->ttl, 2);
+	ck = inet_cksum_adjust16(ck, old, new);
+	/* from_addr moves to to_addr, to_addr is replaced by ours */
+	ck = inet_cksum_adjust32(ck, packet->to_addr, ip_addr);
 	packet->to_addr = packet->from_addr;
 	packet->from_addr = ip_addr;
-	packet->cksum = ip_cksum(0, (void *)packet, sizeof(ip_packet_t));
+	packet->cksum = ck;
+}
 
-	eth_reply((void *)frame, len);
+// send IP packet back
+// len is IP packet payload length
+static void ip_reply(eth_frame_t *frame, uint16_t len)
+{
+	ip_reply_hdr(frame, len);
+	eth_reply((void *)frame, len + sizeof(ip_packet_t));
 }
 
 // can be called directly after
@@ -1291,61 +1989,289 @@ static void ip_resend(eth_frame_t *frame, uint16_t len)
 	ip_packet_t *ip = (void *)(frame->data);
 
 	len += sizeof(ip_packet_t);
+	ip->cksum = inet_cksum_adjust16(ip->cksum, ip->total_len, htons(len));
 	ip->total_len = htons(len);
-	ip->cksum = 0;
-	ip->cksum = ip_cksum(0, (void *)ip, sizeof(ip_packet_t));
 
 	eth_resend(frame, len);
 }
 
+/*
+ * IP fragments: UDP datagrams only, each in a large buffer of the pool.
+ * overlapping fragments, a datagram over IP_REASM_SIZE and a non-last
+ * fragment of a length not in 8 byte units drop the whole datagram.
+ */
+/* ip payload in a fragment we send, 8 byte units */
+#define	IP_FRAG_DATA		((ETH_MAXFRAME - sizeof(eth_frame_t) - sizeof(ip_packet_t)) & ~7U)
+
+#ifdef WITH_UDP
+#define	IP_REASM_DATA		(IP_REASM_SIZE - sizeof(ip_packet_t))	/* payload, max */
+#define	IP_REASM_BLOCKS		((IP_REASM_DATA + 7U) / 8U)
+
+typedef struct ip_reasm {
+	uint8_t		*buf;		/* large buffer, NULL - the slot is free */
+	uint32_t	from_addr;
+	uint16_t	id;
+	uint16_t	total;		/* payload length, 0 until the last fragment */
+	uint16_t	have;		/* payload bytes received */
+	uint16_t	top;		/* end of the furthest fragment */
+	uint32_t	expires;	/* tick */
+	uint32_t	map[(IP_REASM_BLOCKS + 31U) / 32U];	/* 8 byte blocks received */
+} ip_reasm_t;
+
+static ip_reasm_t ip_reasm[IP_REASM_SLOTS];	/* lan_poll task only */
+
+static void ip_reasm_drop(ip_reasm_t *r)
+{
+	(void)lan_freemem(r->buf);
+	r->buf = NULL;
+	ip_reasm_drops++;
+}
+
+/* the slot of the datagram, a new one for its first fragment */
+static ip_reasm_t *ip_reasm_slot(const eth_frame_t *frame)
+{
+	const ip_packet_t *ip = (const void *)(frame->data);
+	ip_reasm_t *r;
+	ip_reasm_t *unused = NULL;
+	uint32_t i;
+
+	for (i = 0U; i < IP_REASM_SLOTS; i++) {
+		r = &ip_reasm[i];
+		if (r->buf == NULL) {
+			unused = (unused == NULL) ? r : unused;
+		} else if ((r->from_addr == ip->from_addr) && (r->id == ip->fragment_id)) {
+			return r;
+		} else {
+			/* another datagram */
+		}
+	}
+	if (unused == NULL) {
+		return NULL;
+	}
+	unused->buf = lan_getmem(ETH_BUF_LARGE, LAN_BUF_REASM);
+	if (unused->buf == NULL) {
+		return NULL;
+	}
+	/* the headers of the fragment that came first */
+	memcpy(unused->buf, frame, sizeof(eth_frame_t) + sizeof(ip_packet_t));
+	memset(unused->map, 0, sizeof(unused->map));
+	unused->from_addr = ip->from_addr;
+	unused->id = ip->fragment_id;
+	unused->total = 0U;
+	unused->have = 0U;
+	unused->top = 0U;
+	unused->expires = HAL_GetTick() + IP_REASM_TIMEOUT;
+	return unused;
+}
+
+/**
+  * adds a fragment to its datagram
+  * @param frame the fragment, the ip header is checked
+  * @param len ip payload length of the fragment
+  * @return the whole datagram in a large buffer or NULL
+  */
+static eth_frame_t *ip_reasm_add(const eth_frame_t *frame, uint16_t len)
+{
+	const ip_packet_t *ip = (const void *)(frame->data);
+	ip_packet_t *whole;
+	ip_reasm_t *r;
+	uint32_t ofs;
+	uint32_t end;
+	uint32_t b;
+	bool more;
+
+	if (ip->protocol != IP_PROTOCOL_UDP) {
+		ip_reasm_drops++;
+		return NULL;
+	}
+	r = ip_reasm_slot(frame);
+	if (r == NULL) {
+		ip_reasm_drops++;
+		return NULL;
+	}
+	ofs = (uint32_t)ntohs((uint16_t)(ip->flags_framgent_offset & IP_FRAG_OFS_MASK)) * 8U;
+	end = ofs + len;
+	more = (ip->flags_framgent_offset & IP_FLAG_MF) != 0U;
+	if ((len == 0U) || (end > IP_REASM_DATA) || (more && ((len & 7U) != 0U))) {
+		goto fDrop;
+	}
+	if (!more) {
+		if ((r->total != 0U) || (end < r->top)) {
+			goto fDrop; /* second last fragment or data past it */
+		}
+		r->total = (uint16_t)end;
+	} else if ((r->total != 0U) && (end >= r->total)) {
+		goto fDrop; /* past the last fragment */
+	} else {
+		/* a middle one */
+	}
+	r->top = (end > r->top) ? (uint16_t)end : r->top;
+	for (b = ofs / 8U; b <= (end - 1U) / 8U; b++) {
+		if ((r->map[b / 32U] & (1UL << (b % 32U))) != 0U) {
+			goto fDrop; /* overlap */
+		}
+		r->map[b / 32U] |= 1UL << (b % 32U);
+	}
+	memcpy(r->buf + sizeof(eth_frame_t) + sizeof(ip_packet_t) + ofs, ip->data, len);
+	r->have += len;
+	if ((r->total == 0U) || (r->have != r->total)) {
+		return NULL;
+	}
+	whole = (void *)(r->buf + sizeof(eth_frame_t));
+	whole->total_len = htons((uint16_t)(r->total + sizeof(ip_packet_t)));
+	whole->flags_framgent_offset = 0U;
+	whole->cksum = 0U;
+	whole->cksum = inet_cksum(whole, sizeof(ip_packet_t));
+	frame = (const eth_frame_t *)r->buf;
+	r->buf = NULL;
+	ip_reasm_done++;
+	return (eth_frame_t *)frame;
+fDrop:
+	ip_reasm_drop(r);
+	return NULL;
+}
+
+/* drops the datagrams not completed in IP_REASM_TIMEOUT */
+static void ip_reasm_poll(void)
+{
+	uint32_t i;
+
+	for (i = 0U; i < IP_REASM_SLOTS; i++) {
+		if ((ip_reasm[i].buf != NULL) &&
+		    ((int32_t)(HAL_GetTick() - ip_reasm[i].expires) >= 0)) {
+			ip_reasm_drop(&ip_reasm[i]);
+			ip_reasm_timeouts++;
+		}
+	}
+}
+#endif /* WITH_UDP */
+
+/* protocols compiled in */
+static inline bool ip_proto_known(uint8_t proto)
+{
+	switch (proto) {
+#ifdef WITH_ICMP
+	case IP_PROTOCOL_ICMP:
+#endif
+#ifdef WITH_UDP
+	case IP_PROTOCOL_UDP:
+#endif
+#ifdef WITH_TCP
+	case IP_PROTOCOL_TCP:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* broadcasts, and anything while there is no address, are for DHCP
+ * only: the sockets are bound to our unicast address */
+static inline bool ip_bcast_wanted(const ip_packet_t *packet)
+{
+#ifdef WITH_DHCP
+	const udp_packet_t *udp = (const void *)(packet->data);
+
+	return (packet->protocol == IP_PROTOCOL_UDP) &&
+	       ((packet->flags_framgent_offset & IP_FRAG_MASK) == 0U) &&
+	       (ntohs(packet->total_len) >= sizeof(ip_packet_t) + sizeof(udp_packet_t)) &&
+	       (udp->to_port == DHCP_CLIENT_PORT);
+#else
+	UNUSED(packet);
+	return false;
+#endif
+}
+
 /**
   * processes received ip packet
+  * the cheap rejects (version, destination, protocol, length) go first,
+  * the header checksum is verified in one pass without touching the
+  * frame, ip_reply() patches it incrementally
   * @param *frame pointer to the full eth. packet
   * @param len length of the ip part of the packet
   * @return eth_frame_t* changed pointer to the frame or NULL in pointer isn't changed
   */
 static eth_frame_t *ip_filter(eth_frame_t *frame, uint16_t len)
 {
-	uint16_t hcs;
 	ip_packet_t *packet = (void *)(frame->data);
 	eth_frame_t *retval;
+	uint32_t to_addr;
+	uint16_t total;
+	bool bcast;
+
 	retval = frame;
-	//if(len >= sizeof(ip_packet_t))
-	//{
-	hcs = packet->cksum;
-	packet->cksum = 0;
-
-	if ((packet->ver_head_len == 0x45) &&
-	    (ip_cksum(0, (void *)packet, sizeof(ip_packet_t)) == hcs) &&
-	    ((packet->to_addr == ip_addr) || (packet->to_addr == ip_broadcast))) {
+	if ((len < sizeof(ip_packet_t)) || (packet->ver_head_len != 0x45)) {
+		goto fMiss;
+	}
+	to_addr = packet->to_addr;
+	bcast = (to_addr == ip_broadcast) || (to_addr == IP_LIMITED_BROADCAST);
+	/* with no address yet all to our MAC is ours (unicast DHCP offers) */
+	if ((to_addr != ip_addr) && !bcast && (ip_addr != 0U)) {
+		goto fMiss;
+	}
+	if (!ip_proto_known(packet->protocol)) {
+		goto fMiss;
+	}
+	total = ntohs(packet->total_len);
+	if ((total < sizeof(ip_packet_t)) || (total > len)) {
+		goto fMiss;
+	}
+	if ((bcast || (ip_addr == 0U)) && !ip_bcast_wanted(packet)) {
+		goto fMiss;
+	}
+	if (inet_cksum(packet, sizeof(ip_packet_t)) != 0U) {
+		ip_cksum_errors++;
+		goto fExit;
+	}
+	len = total - sizeof(ip_packet_t);
+
+	if ((packet->flags_framgent_offset & IP_FRAG_MASK) != 0U) {
+#ifdef WITH_UDP
+		frame = ip_reasm_add(frame, len);
+		if (frame == NULL) {
+			goto fExit; /* kept a copy or dropped, retval is freed */
+		}
+		/* the datagram goes on in its own buffer */
+		(void)lan_freemem((uint8_t *)retval);
+		retval = frame;
+		packet = (void *)(frame->data);
 		len = ntohs(packet->total_len) - sizeof(ip_packet_t);
+#else
+		goto fMiss;
+#endif
+	}
 
-		switch (packet->protocol) {
+	/* on-link sender: its MAC is right here */
+	if ((ip_addr != 0U) && (((packet->from_addr ^ ip_addr) & ip_mask) == 0U) &&
+	    (packet->from_addr != ip_addr) && (packet->from_addr != ip_broadcast)) {
+		arp_snoop(packet->from_addr, frame->from_addr);
+	}
+
+	switch (packet->protocol) {
 #ifdef WITH_ICMP
-		case IP_PROTOCOL_ICMP:
-			icmp_filter(frame, len);
-			break;
+	case IP_PROTOCOL_ICMP:
+		icmp_filter(frame, len);
+		break;
 #endif
 
 #ifdef WITH_UDP
-		case IP_PROTOCOL_UDP:
-			retval = udp_filter(frame, len);
-			break;
+	case IP_PROTOCOL_UDP:
+		retval = udp_filter(frame, len);
+		break;
 #endif
 
 #ifdef WITH_TCP
-		case IP_PROTOCOL_TCP:
-			tcp_filter(frame, len);
-			break;
+	case IP_PROTOCOL_TCP:
+		tcp_filter(frame, len);
+		break;
 #endif
-		default:
-			ip_filter_misses++;
-			break;
-		}
-
-	} else { /* bad IP packet */
-		;
+	default:
+		break;
 	}
+	goto fExit;
+fMiss:
+	ip_filter_misses++;
+fExit:
 	return retval;
 }
 
@@ -1355,7 +2281,7 @@ static eth_frame_t *ip_filter(eth_frame_t *frame, uint16_t len)
 /**
  * @brief arp_get_entry_string returns pointer to the string
  * @param number index of the entry
- * @return pointer to the result string or NULL
+ * @return pointer to the result string or NULL if the entry is empty
  */
 char * arp_get_entry_string(size_t number)
 {
@@ -1364,7 +2290,7 @@ char * arp_get_entry_string(size_t number)
 	static const size_t t_len = sizeof(retVal_template);
 	static char retVal[41];
 	char * ptarget = NULL;
-	if (number < ARP_CACHE_SIZE) {
+	if ((number < ARP_CACHE_SIZE) && (arp_cache[number].ip_addr != 0U)) {
 		/* convert entry to the string */
 		ptarget = &retVal[0];
 		for (size_t i = 0U; i < 6U; i++) { /* MAC */
@@ -1386,158 +2312,484 @@ char * arp_get_entry_string(size_t number)
 			*ptarget = '.';
 			ptarget++;
 		}
-		*(ptarget - 1U) = ' ';
-		uint16_to_asciiz((uint16_t)arp_cache[number].age, ptarget);
-		*(ptarget + 5) = '\n';
-		ptarget = retVal;
+		*(ptarget - 1U) = ' ';
+		uint16_to_asciiz((uint16_t)arp_cache[number].age, ptarget);
+		*(ptarget + 5) = '\n';
+		ptarget = retVal;
+	}
+	return ptarget;
+}
+
+/* arp_seq odd: readers fall back to the mutex */
+static inline void arp_write_begin(void)
+{
+	arp_seq++;
+	__DMB();
+}
+
+static inline void arp_write_end(void)
+{
+	__DMB();
+	arp_seq++;
+}
+
+/**
+ * @brief arp_clear_cache
+ */
+static inline void arp_clear_cache(void)
+{
+	TAKE_MUTEX(ARP_MutexHandle);
+	arp_write_begin();
+	memset(arp_cache, 0 ,sizeof (arp_cache));
+	arp_write_end();
+	arp_gen++;
+	GIVE_MUTEX(ARP_MutexHandle);
+}
+
+/** decrements time to live of the arp cache entry every 1s
+  * invalidates the outdated entry
+  * @param none
+  * @return none
+  */
+void arp_age_entries(void)
+{
+	uint32_t i = 0U;
+	TAKE_MUTEX(ARP_MutexHandle);
+	/* the outdated entries go first: a deletion shifts the chain back and
+	 * may wrap its start into the last slots, ageing in the same walk
+	 * would count such an entry twice */
+	while (i < ARP_CACHE_SIZE) {
+		if ((arp_cache[i].ip_addr != 0U) && (arp_cache[i].age == 0)) {
+			/* the next entry of the chain may move here, check it again */
+			arp_delete(i);
+		} else {
+			i++;
+		}
+	}
+	for (i = 0U; i < ARP_CACHE_SIZE; i++) {
+		if (arp_cache[i].ip_addr != 0U) {
+			arp_cache[i].age--;
+		}
+	}
+	GIVE_MUTEX(ARP_MutexHandle);
+}
+
+/**
+ * @brief arp_find returns index of the entry in the cache or -1
+ * @note  the caller holds ARP_MutexHandle or validates arp_seq
+ * @param node_ip_addr
+ * @return
+ */
+static int arp_find(uint32_t node_ip_addr)
+{
+	uint32_t i = ARP_HASH(node_ip_addr);
+	uint32_t ip;
+
+	for (uint32_t n = 0U; n < ARP_CACHE_SIZE; n++) {
+		ip = arp_cache[i].ip_addr;
+		if (ip == node_ip_addr) {
+			return (int)i;
+		}
+		if (ip == 0U) {
+			break; /* end of the chain */
+		}
+		i = (i + 1U) & ARP_CACHE_MASK;
+	}
+	return -1;
+}
+
+/** looks for the cache for MAC by given IP, does not lock
+  * @param uint32_t node_ip_addr the address to be found
+  * @param mac the MAC found (out)
+  * @return true if found
+  * 									THREAD-SAFE
+  */
+static bool arp_lookup(uint32_t node_ip_addr, uint8_t *mac)
+{
+	uint32_t seq;
+	int i;
+
+	if (node_ip_addr == 0U) {
+		return false;
+	}
+	for (uint32_t n = 0U; n < 2U; n++) {
+		seq = arp_seq;
+		__DMB();
+		if ((seq & 1U) != 0U) {
+			break; /* a writer is active, it may be preempted by us */
+		}
+		i = arp_find(node_ip_addr);
+		if (i >= 0) {
+			memcpy(mac, arp_cache[i].mac_addr, 6);
+		}
+		__DMB();
+		if (arp_seq == seq) {
+			if (i >= 0) {
+				/* a reader does not write the cache, leave a hint */
+				arp_hit_tick = HAL_GetTick();
+				__DMB();
+				arp_hit_ip = node_ip_addr;
+			}
+			return (i >= 0);
+		}
+	}
+	/* wait for the writer, the mutex boosts its priority */
+	arp_locked_lookups++;
+	TAKE_MUTEX(ARP_MutexHandle);
+	i = arp_find(node_ip_addr);
+	if (i >= 0) {
+		memcpy(mac, arp_cache[i].mac_addr, 6);
+		arp_cache[i].used = HAL_GetTick();
+	}
+	GIVE_MUTEX(ARP_MutexHandle);
+	return (i >= 0);
+}
+
+/**
+ * @brief arp_apply_hit stamps the entry of the last lock-free hit as used
+ * @note  the caller holds ARP_MutexHandle; the hits of other lookups
+ *        overwriting it meanwhile are lost, the LRU is approximate
+ */
+static void arp_apply_hit(void)
+{
+	uint32_t ip = arp_hit_ip;
+	uint32_t tick;
+	int i;
+
+	if (ip == 0U) {
+		return;
+	}
+	__DMB(); /* the address before its tick */
+	tick = arp_hit_tick;
+	arp_hit_ip = 0U;
+	i = arp_find(ip);
+	if (i >= 0) {
+		arp_cache[i].used = tick;
+	}
+}
+
+/**
+ * @brief arp_delete removes the entry, the rest of its chain is shifted back
+ * @note  the caller holds ARP_MutexHandle
+ * @param idx index of the entry
+ */
+static void arp_delete(uint32_t idx)
+{
+	uint32_t j = idx;
+	uint32_t home;
+
+	arp_write_begin();
+	arp_cache[idx].ip_addr = 0U; /* the hole, stops the scan on a full table */
+	for (;;) {
+		j = (j + 1U) & ARP_CACHE_MASK;
+		if (arp_cache[j].ip_addr == 0U) {
+			break;
+		}
+		home = ARP_HASH(arp_cache[j].ip_addr);
+		/* the entry may fill the hole if its home is not in (idx, j] */
+		if (((j - home) & ARP_CACHE_MASK) >= ((j - idx) & ARP_CACHE_MASK)) {
+			arp_cache[idx] = arp_cache[j];
+			arp_cache[j].ip_addr = 0U;
+			idx = j;
+		}
+	}
+	memset(&arp_cache[idx], 0, sizeof(arp_cache_entry_t));
+	arp_write_end();
+	arp_gen++;
+}
+
+/**
+ * @brief arp_store adds or refreshes the entry
+ * @note  the caller holds ARP_MutexHandle
+ * @param node_ip_addr
+ * @param mac
+ * @param mode ARP_REFRESH, ARP_ADD_FREE or ARP_ADD
+ */
+static void arp_store(uint32_t node_ip_addr, const uint8_t *mac, enum ArpStore mode)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t lru = 0U;
+	uint32_t i;
+	int idx;
+
+	arp_apply_hit();
+	idx = arp_find(node_ip_addr);
+	if ((idx < 0) && (mode != ARP_REFRESH)) {
+		/* first free slot of the chain */
+		i = ARP_HASH(node_ip_addr);
+		for (uint32_t n = 0U; n < ARP_CACHE_SIZE; n++) {
+			if (arp_cache[i].ip_addr == 0U) {
+				idx = (int)i;
+				break;
+			}
+			i = (i + 1U) & ARP_CACHE_MASK;
+		}
+		if ((idx < 0) && (mode == ARP_ADD)) {
+			/* full, evict the least recently used entry */
+			for (i = 1U; i < ARP_CACHE_SIZE; i++) {
+				if ((now - arp_cache[i].used) > (now - arp_cache[lru].used)) {
+					lru = i;
+				}
+			}
+			arp_delete(lru);
+			arp_evictions++;
+			i = ARP_HASH(node_ip_addr);
+			while (arp_cache[i].ip_addr != 0U) {
+				i = (i + 1U) & ARP_CACHE_MASK;
+			}
+			idx = (int)i;
+		}
 	}
-	return ptarget;
+	if (idx < 0) {
+		return;
+	}
+	arp_write_begin();
+	if ((arp_cache[idx].ip_addr != node_ip_addr) ||
+	    (memcmp(arp_cache[idx].mac_addr, mac, 6) != 0)) {
+		arp_gen++;
+	}
+	arp_cache[idx].ip_addr = node_ip_addr;
+	memcpy(arp_cache[idx].mac_addr, mac, 6);
+	arp_cache[idx].age = (int32_t)ARP_TIMEOUT_S;
+	arp_cache[idx].used = now;
+	arp_write_end();
 }
 
 /**
- * @brief arp_clear_cache
+ * @brief arp_snoop learns the MAC of an on-link sender from its IP packet
+ * @note  a full cache is not evicted for it
+ * @param node_ip_addr sender IP
+ * @param mac sender MAC
  */
-static inline void arp_clear_cache(void)
+static void arp_snoop(uint32_t node_ip_addr, const uint8_t *mac)
 {
+	if ((node_ip_addr == 0U) || ((mac[0] & 0x01U) != 0U)) {
+		return; /* no multicast senders */
+	}
 	TAKE_MUTEX(ARP_MutexHandle);
-	memset(arp_cache, 0 ,sizeof (arp_cache));
+	arp_store(node_ip_addr, mac, ARP_ADD_FREE);
 	GIVE_MUTEX(ARP_MutexHandle);
 }
 
-/** decrements time to live of the arp cache entry every 1s
-  * invalidates the outdated entry
-  * @param none
+/**
+  * sends ARP request
+  * @papram node_ip_addr ip address to be reached
   * @return none
+  * the request is built on the stack, no eth_buf is taken     THREAD - SAFE
   */
-void arp_age_entries(void)
+static void request_arp(uint32_t node_ip_addr)
 {
-	uint8_t i;
-	TAKE_MUTEX(ARP_MutexHandle);
-	for (i = 0; i < ARP_CACHE_SIZE; i++) {
-		if (arp_cache[i].age > 0) {
-			arp_cache[i].age--;
-		} else {
-			memset(&arp_cache[i], 0, sizeof(arp_cache_entry_t));
-		}
-		GIVE_MUTEX(ARP_MutexHandle);
-	}
+	uint32_t buf[(sizeof(eth_frame_t) + sizeof(arp_message_t) + 3U) / 4U];
+	eth_frame_t *frame = (eth_frame_t *)buf;
+	arp_message_t *msg = (void *)(frame->data);
+
+	memset(frame->to_addr, 0xff, 6);
+	frame->type = ETH_TYPE_ARP;
+	msg->hw_type = ARP_HW_TYPE_ETH;
+	msg->proto_type = ARP_PROTO_TYPE_IP;
+	msg->hw_addr_len = 6;
+	msg->proto_addr_len = 4;
+	msg->type = ARP_TYPE_REQUEST;
+	memcpy(msg->mac_addr_from, mac_addr, 6);
+	msg->ip_addr_from = ip_addr;
+	memset(msg->mac_addr_to, 0x00, 6);
+	msg->ip_addr_to = node_ip_addr;
+	eth_send(frame, sizeof(arp_message_t));
+	arp_requests++;
+	return;
 }
 
-/** looks for the cache for MAC by given IP
-  * @param uint32_t node_ip_addr the address to be found
-  * @return NULL if not found; pointer to the valid MAC if found
-  * 									THREAD-SAFE
+/**
+  * @brief arp_park queues a frame until its next hop is resolved
+  * @note  the frame is copied to an eth_buf slot, the first frame to
+  *        an unknown next hop sends the ARP request. If the queue of the
+  *        next hop is full the oldest frame is dropped.
+  * @param node_ip_addr next hop
+  * @param hdr frame (headers), eth from_addr must be set
+  * @param hdrlen its length
+  * @param data the rest of the frame or NULL
+  * @param len its length
+  * @return ErrorStatus SUCCESS if queued			THREAD-SAFE
   */
-static uint8_t *arp_search_cache(uint32_t node_ip_addr)
+static ErrorStatus arp_park(uint32_t node_ip_addr, const uint8_t *hdr, uint16_t hdrlen,
+			    const uint8_t *data, uint16_t len)
 {
-	int i;
-	uint8_t *result = NULL;
-	i = arp_get_cache_index(node_ip_addr);
-	if (i != -1) {
-		result = arp_cache[i].mac_addr;
+	ErrorStatus result = ERROR;
+	arp_pending_t *p = NULL;
+	uint8_t *buf;
+	uint8_t *dropped = NULL;
+	bool request = false;
+	size_t i;
+
+	if ((node_ip_addr == 0U) || ((uint32_t)hdrlen + len > ETH_MAXFRAME)) {
+		arp_park_drops++;
+		return ERROR;
+	}
+	buf = lan_getmem(hdrlen + len, LAN_BUF_ARP);
+	if (buf == NULL) {
+		arp_park_drops++;
+		return ERROR;
+	}
+	memcpy(buf, hdr, hdrlen);
+	if (data != NULL) {
+		memcpy(buf + hdrlen, data, len);
 	}
-	return result;
-}
 
-/**
- * @brief arp_get_cache_index returns index of te entry in the cache or -1
- * @param node_ip_addr
- * @return
- */
-static int arp_get_cache_index(uint32_t node_ip_addr)
-{
-	int rv = -1;
 	TAKE_MUTEX(ARP_MutexHandle);
-	for (int i = 0; i < ARP_CACHE_SIZE; ++i) {
-		if (arp_cache[i].ip_addr == node_ip_addr) {
-			rv = i;
+	for (i = 0U; i < ARP_PENDING_SIZE; i++) {
+		if (arp_pending[i].ip_addr == node_ip_addr) {
+			p = &arp_pending[i];
 			break;
 		}
 	}
+	if (p == NULL) {
+		for (i = 0U; i < ARP_PENDING_SIZE; i++) {
+			if (arp_pending[i].ip_addr == 0U) {
+				p = &arp_pending[i];
+				p->ip_addr = node_ip_addr;
+				p->tries = 1U;
+				p->backoff = ARP_TIMEOUT;
+				p->next_try = HAL_GetTick() + ARP_TIMEOUT;
+				p->nframes = 0U;
+				request = true;
+				break;
+			}
+		}
+	}
+	if (p != NULL) {
+		if (p->nframes == ARP_PENDING_FRAMES) {
+			dropped = p->frame[0];
+			for (i = 1U; i < ARP_PENDING_FRAMES; i++) {
+				p->frame[i - 1U] = p->frame[i];
+				p->len[i - 1U] = p->len[i];
+			}
+			p->nframes--;
+		}
+		p->frame[p->nframes] = buf;
+		p->len[p->nframes] = hdrlen + len;
+		p->nframes++;
+		buf = NULL;
+		result = SUCCESS;
+	}
 	GIVE_MUTEX(ARP_MutexHandle);
-	return rv;
+
+	if (dropped != NULL) {
+		(void)lan_freemem(dropped);
+		arp_park_drops++;
+	}
+	if (buf != NULL) {
+		/* all next hop entries are busy: the frame is dropped, the
+		 * reply still puts the MAC into the cache for the next write */
+		(void)lan_freemem(buf);
+		arp_park_drops++;
+		request = true;
+	} else {
+		arp_parked++;
+	}
+	if (request) {
+		request_arp(node_ip_addr);
+	}
+	return result;
 }
 
 /**
-  * sends ARP request
-  * @papram node_ip_addr ip address to be reached
-  * @return none
-  * This is asynchronous function            THREAD - SAFE
+  * @brief arp_flush sends the frames parked for the resolved next hop
+  * @param node_ip_addr next hop
+  * @param mac its MAC, NULL drops the frames
+  * @return none							THREAD-SAFE
   */
-static void request_arp(uint32_t node_ip_addr)
+static void arp_flush(uint32_t node_ip_addr, const uint8_t *mac)
 {
-	eth_frame_t *frame;
-	/*	uint8_t *mac; */
-	frame = (eth_frame_t *)lan_getmem(); /* get buffer from the pool */
-	if (frame != NULL) {		     /* not enough memory */
-		arp_mallocs_frees++;
-		arp_message_t *msg = (void *)(frame->data);
-		memset(frame->to_addr, 0xff, 6);
-		frame->type = ETH_TYPE_ARP;
-		msg->hw_type = ARP_HW_TYPE_ETH;
-		msg->proto_type = ARP_PROTO_TYPE_IP;
-		msg->hw_addr_len = 6;
-		msg->proto_addr_len = 4;
-		msg->type = ARP_TYPE_REQUEST;
-		memcpy(msg->mac_addr_from, mac_addr, 6);
-		msg->ip_addr_from = ip_addr;
-		memset(msg->mac_addr_to, 0x00, 6);
-		msg->ip_addr_to = node_ip_addr;
-		eth_send(frame, sizeof(arp_message_t));
-		if (lan_freemem((uint8_t *)frame) != NULL) {
-			UNUSED(0);
-		} else {
-			arp_mallocs_frees--;
+	uint8_t *frame[ARP_PENDING_FRAMES];
+	uint16_t len[ARP_PENDING_FRAMES];
+	uint8_t n = 0U;
+	size_t i;
+
+	TAKE_MUTEX(ARP_MutexHandle);
+	for (i = 0U; i < ARP_PENDING_SIZE; i++) {
+		if ((node_ip_addr != 0U) && (arp_pending[i].ip_addr == node_ip_addr)) {
+			n = arp_pending[i].nframes;
+			memcpy(frame, arp_pending[i].frame, sizeof(frame));
+			memcpy(len, arp_pending[i].len, sizeof(len));
+			memset(&arp_pending[i], 0, sizeof(arp_pending_t));
+			break;
 		}
 	}
-	return;
-}
+	GIVE_MUTEX(ARP_MutexHandle);
 
-/**
-  * resolves MAC address
-  * @param uint32_t node_ip_addr  the IP address requested
-  * @return pointer to the MAC address or NULL if not resolver
-  * function does not breals any other buffer				THREAD-SAFE
-  */
-static uint8_t *arp_resolve(uint32_t node_ip_addr)
-{
-	uint8_t *mac;
-	mac = NULL;
-	uint8_t i;
-	/* search arp cache */
-	for (i = 0; i < NUM_ARP_RETRIES; i++) {
-		mac = arp_search_cache(node_ip_addr);
+	for (i = 0U; i < n; i++) {
 		if (mac != NULL) {
-			goto fExit;
+			memcpy(((eth_frame_t *)frame[i])->to_addr, mac, 6);
+			enc28j60_send_packet(frame[i], len[i]);
 		} else {
-			request_arp(node_ip_addr);
-			osDelay(ARP_TIMEOUT); /* let's wait for cache update */
+			arp_park_drops++;
 		}
+		(void)lan_freemem(frame[i]);
 	}
-fExit:
-	return mac;
 }
 
 /**
- * @brief arp_get_oldest_index returns the oldest arp entry index
- * @return
- */
-static int arp_get_oldest_index(void)
+  * @brief arp_tick retransmits ARP requests with exponential backoff
+  *        and gives up the next hops that do not answer
+  * @note  called by the lan task on every wake-up
+  * @return none
+  */
+static void arp_tick(void)
 {
-	int retVal = 0;
-	int32_t oldest = INT32_MAX;
-	uint8_t i;
-	for (i = 0; i < ARP_CACHE_SIZE; i++) {
-		if (arp_cache[i].age < oldest) {
-			oldest = arp_cache[i].age;
-			retVal = i;
+	uint32_t now = HAL_GetTick();
+	uint32_t node_ip_addr;
+	uint8_t mac[6];
+	bool request;
+	bool giveup;
+	size_t i;
+
+	if (arp_hit_ip != 0U) {
+		TAKE_MUTEX(ARP_MutexHandle);
+		arp_apply_hit();
+		GIVE_MUTEX(ARP_MutexHandle);
+	}
+	for (i = 0U; i < ARP_PENDING_SIZE; i++) {
+		node_ip_addr = arp_pending[i].ip_addr;
+		if (node_ip_addr == 0U) {
+			continue;
+		}
+		/* the reply may come between the cache miss and arp_park() */
+		if (arp_lookup(node_ip_addr, mac)) {
+			arp_flush(node_ip_addr, mac);
+			continue;
+		}
+		request = false;
+		giveup = false;
+		TAKE_MUTEX(ARP_MutexHandle);
+		if ((arp_pending[i].ip_addr == node_ip_addr) &&
+		    ((int32_t)(now - arp_pending[i].next_try) >= 0)) {
+			if (arp_pending[i].tries < NUM_ARP_RETRIES) {
+				arp_pending[i].tries++;
+				arp_pending[i].backoff <<= 1;
+				if (arp_pending[i].backoff > ARP_BACKOFF_MAX) {
+					arp_pending[i].backoff = ARP_BACKOFF_MAX;
+				}
+				arp_pending[i].next_try = now + arp_pending[i].backoff;
+				request = true;
+			} else {
+				giveup = true;
+			}
+		}
+		GIVE_MUTEX(ARP_MutexHandle);
+
+		if (request) {
+			request_arp(node_ip_addr);
+		} else if (giveup) {
+			arp_unresolved++;
+			arp_flush(node_ip_addr, NULL);
 		}
 	}
-	return retVal;
 }
 
 /**
   * processes received ARP packet
+  * a known sender is refreshed by any ARP packet (RFC 826 merge),
+  * that includes gratuitous ARP; it is added if the packet is for us
   * @param *frame pointer to the full eth. packet
   * @param len length of the packet
   * @return none
@@ -1545,39 +2797,26 @@ static int arp_get_oldest_index(void)
 static void arp_filter(eth_frame_t *frame, uint16_t len)
 {
 	arp_message_t *msg = (void *)(frame->data);
+	bool for_me;
 
 	if (len >= sizeof(arp_message_t)) {
 		if ((msg->hw_type == ARP_HW_TYPE_ETH) && (msg->proto_type == ARP_PROTO_TYPE_IP) &&
-		    (msg->ip_addr_to == ip_addr)) {
-			switch (msg->type) {
-			case ARP_TYPE_REQUEST: {
+		    (msg->ip_addr_from != 0U) && (msg->ip_addr_from != ip_addr)) {
+			for_me = (msg->ip_addr_to == ip_addr);
+			TAKE_MUTEX(ARP_MutexHandle);
+			arp_store(msg->ip_addr_from, msg->mac_addr_from,
+				  for_me ? ARP_ADD : ARP_REFRESH);
+			GIVE_MUTEX(ARP_MutexHandle);
+			/* send the frames waiting for this MAC */
+			arp_flush(msg->ip_addr_from, msg->mac_addr_from);
+
+			if (for_me && (msg->type == ARP_TYPE_REQUEST)) {
 				msg->type = ARP_TYPE_RESPONSE;
 				memcpy(msg->mac_addr_to, msg->mac_addr_from, 6);
 				memcpy(msg->mac_addr_from, mac_addr, 6);
 				msg->ip_addr_to = msg->ip_addr_from;
 				msg->ip_addr_from = ip_addr;
 				eth_reply(frame, sizeof(arp_message_t));
-				break;
-			}
-			case ARP_TYPE_RESPONSE: {
-				int idx = 0;
-				/* was there this IP already ?*/
-				idx = arp_get_cache_index(msg->ip_addr_from);
-				if (idx == -1) {
-					/* is there free entry ? */
-					idx = (uint8_t)arp_get_cache_index(0);
-					if (idx == -1) {
-						/* no free entry */
-						idx = (uint8_t)arp_get_oldest_index();
-					}
-				}
-				TAKE_MUTEX(ARP_MutexHandle);
-				arp_cache[idx].ip_addr = msg->ip_addr_from;
-				memcpy(arp_cache[idx].mac_addr, msg->mac_addr_from, 6);
-				arp_cache[idx].age = (int32_t)ARP_TIMEOUT_S;
-				GIVE_MUTEX(ARP_MutexHandle);
-				break;
-			}
 			}
 		}
 	}
@@ -1606,10 +2845,15 @@ static void eth_send(eth_frame_t *frame, uint16_t len)
 }
 
 // send Ethernet frame back
-static void eth_reply(eth_frame_t *frame, uint16_t len)
+static void eth_reply_hdr(eth_frame_t *frame)
 {
 	memcpy(frame->to_addr, frame->from_addr, 6);
 	memcpy(frame->from_addr, mac_addr, 6);
+}
+
+static void eth_reply(eth_frame_t *frame, uint16_t len)
+{
+	eth_reply_hdr(frame);
 	enc28j60_send_packet((void *)frame, (uint16_t)(len + (uint16_t)sizeof(eth_frame_t)));
 }
 
@@ -1634,12 +2878,11 @@ static eth_frame_t *eth_filter(eth_frame_t *frame, uint16_t len)
 			break;
 		default:
 			eth_filter_misses++;
-			put_dump(frame, (unsigned long)0, (int)len, sizeof(char));
-
+			pcap_capture((uint8_t *)frame, len);
 			break;
 		}
 	} else { /* something wrong with the frame arrived */
-		put_dump(frame, (unsigned long)0, (int)len, sizeof(char));
+		pcap_capture((uint8_t *)frame, len);
 	}
 	return retval;
 }
@@ -1664,50 +2907,159 @@ void lan_init() /* NOT THREAD-SAFE */
 	//	ip_mask = tmp.ip;
 
 	uint8_t i;
-	for (i = 0u; i < NUM_ETH_BUFFERS; i++) {
-		eth_buf_state[i] = ETH_BUF_FREE; /* initialize states array */
+	eth_buf_free = ETH_BUF_ALL; /* all buffers are free */
+#ifdef WITH_UDP
+	memset(ip_reasm, 0, sizeof(ip_reasm));
+#endif
+	for (i = 0u; i < SOC_HASH_SIZE; i++) {
+		soc_bucket[i] = SOC_NONE;
 	}
-	for (i = 0u; i < NUM_SOCKETS; i++) {
+	soc_free = SOC_NONE;
+	for (i = NUM_SOCKETS; i-- > 0u; ) {
 		sockets[i].soc_state = SOCK_FREE;
-		/*		sockets[i].buf = (uint8_t*)&(eth_buf[i]);	*/ /* link the buffer with the socket */
-		sockets[i].buf = NULL;
+		soc_next[i] = soc_free; /* the lowest index is bound first */
+		soc_free = i;
+		soc_rxq[i] = xQueueCreateStatic(SOC_RXQ_MAX, sizeof(soc_rx_item_t),
+						(uint8_t *)soc_rxq_items[i], &soc_rxq_cb[i]);
 	}
 
 	osMutexStaticDef(CRC_Mutex, &ARP_Mutex_ControlBlock);
 	ARP_MutexHandle = osMutexCreate(osMutex(CRC_Mutex));
 
 	enc28j60_init(mac_addr);
+#ifdef WITH_ICMP
+	enc28j60_set_rx_hook(icmp_rx_hook, ICMP_ECHO_HEAD);
+#endif
+	rxf_valid = false;
 	wr_soc_err = 0U;
 
 #ifdef WITH_DHCP
-	dhcp_retry_time = rtime() + (uint32_t)2;
+	dhcp_start();
+#endif
+}
+
+/**
+  * keeps the chip filters in line with the address and the DHCP state
+  * unicast frames to our MAC pass; of the broadcasts only ARP requests
+  * for our address, or all of them while the address is not known yet
+  * (DHCP offers and acks may be broadcast). multicast is not used.
+  * @param none
+  * @return none
+  */
+static void lan_rx_filter_poll(void)
+{
+	enc28j60_rx_filter_t f;
+	uint16_t type = ETH_TYPE_ARP;
+	uint16_t op = ARP_TYPE_REQUEST;
+	uint32_t ip = ip_addr;
+	bool bcast = (ip == 0U);
+
+#ifdef WITH_DHCP
+	/* NAKs are broadcast, RENEWING gets them too */
+	bcast = bcast || ((dhcp_status != DHCP_ASSIGNED) && (dhcp_status != DHCP_DISABLED));
 #endif
+	if (rxf_valid && (rxf_ip_addr == ip) && (rxf_bcast == bcast)) {
+		return;
+	}
+	memset(&f, 0, sizeof(f));
+	f.erxfcon = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_PMEN;
+	if (bcast) {
+		f.erxfcon |= ERXFCON_BCEN;
+	}
+	/* pattern: ff:ff:ff:ff:ff:ff, ARP, request, target ip */
+	memset(f.pm_data, 0xFF, 6U);
+	f.pm_mask[0] = 0x3FU;				/* 0...5 */
+	memcpy(&f.pm_data[12], &type, 2U);
+	f.pm_mask[1] = 0x30U;				/* 12, 13 */
+	memcpy(&f.pm_data[20], &op, 2U);
+	f.pm_mask[2] = 0x30U;				/* 20, 21 */
+	if (ip != 0U) {
+		memcpy(&f.pm_data[38], &ip, 4U);
+		f.pm_mask[4] = 0xC0U;			/* 38, 39 */
+		f.pm_mask[5] = 0x03U;			/* 40, 41 */
+	}
+	enc28j60_set_rx_filter(&f);
+	rxf_ip_addr = ip;
+	rxf_bcast = bcast;
+	rxf_valid = true;
+}
+
+/**
+  * takes the rx buffer once the frame length is known
+  * @param len frame length
+  * @return the buffer or NULL
+  */
+static uint8_t *lan_rx_getbuf(uint16_t len)
+{
+	/* the replies built in the received frame are not longer */
+	return lan_getmem(len, LAN_BUF_RX);
+}
+
+/**
+  * receives and filters one ethernet frame
+  * @param none
+  * @return length of the frame, 0 if nothing arrived,
+  *         -1 if there is no free buffer
+  */
+static int32_t lan_recv_frame(void)
+{
+	int32_t len;
+	uint8_t *net_buf;
+	eth_frame_t *retval;
+	len = enc28j60_recv_packet_alloc(lan_rx_getbuf, &net_buf);
+	if (len < 0) {
+		lan_getmem_errors++; /* the frame waits in the chip */
+		return -1;
+	}
+	if (net_buf == NULL) {
+		return len; /* bad, or answered in the chip */
+	}
+	lan_poll_mallocs++;
+	retval = eth_filter((eth_frame_t *)net_buf, (uint16_t)len);
+	if (retval != NULL) {
+		if ((lan_freemem((uint8_t *)retval)) == NULL) {
+			lan_poll_frees++;
+		}
+	}
+	return len;
 }
 
 /**
-  * receives the ethernet packet
+  * receives the ethernet packets
   * lan_poll must be started as separate thread!
   * @param none
   * @return none
   */                                             /* THREAD - SAFE */
 void lan_poll()
 {
-	uint16_t len;
-	uint8_t *net_buf;
-	eth_frame_t *retval;
-	net_buf = lan_getmem();
-	retval = (eth_frame_t *)net_buf;
-	if (net_buf != NULL) {
-		lan_poll_mallocs++;
-		len = enc28j60_recv_packet(net_buf, ENC28J60_MAXFRAME);
-		if (len == 0u) {
-			/* nothing is arrived, free mem*/
-			goto fExit;
-		}
-		retval = eth_filter((eth_frame_t *)net_buf, len);
-	} else {
-		lan_getmem_errors++;
+	int32_t res;
+#if (LAN_RX_INTERRUPT == 1)
+	uint32_t n = 0U;
+	/* INT is deasserted while draining, the next frame gives a new edge */
+	enc28j60_int_disable();
+	do {
+		res = lan_recv_frame();
+		n++;
+	} while ((res > 0) && (n < LAN_RX_BURST));
+	/* retire the sent frame (TXIF) and start the next queued one */
+	enc28j60_tx_poll();
+	arp_tick();
+	lan_rx_filter_poll();
+	if (res >= 0) {
+		/* re-arm; frames left in the chip re-assert INT at once.
+		 * on buffer shortage the idle poll timeout picks them up */
+		enc28j60_int_enable();
 	}
+#else
+	res = lan_recv_frame();
+	UNUSED(res);
+	enc28j60_tx_poll();
+	arp_tick();
+	lan_rx_filter_poll();
+#endif
+#ifdef WITH_UDP
+	ip_reasm_poll();
+#endif
 #ifdef WITH_DHCP
 	dhcp_poll();
 #endif
@@ -1715,15 +3067,6 @@ void lan_poll()
 #ifdef WITH_TCP
 	tcp_poll();
 #endif
-fExit:
-	if (retval != NULL) {
-		if ((lan_freemem((uint8_t *)retval)) != NULL) {
-			UNUSED(0); /* Memory manager error */
-			lan_freemem_errors++;
-		} else {
-			lan_poll_frees++;
-		}
-	}
 	return;
 }
 /*   end of lan_poll() */
@@ -1764,7 +3107,9 @@ uint32_t htonl(uint32_t a)
 static uint16_t read_sock(socket_p soc, uint8_t *buf, int32_t buflen, const uint8_t attempts)
 {
 	uint16_t result = 0x00U;
-	uint8_t maxattempts = attempts;
+	soc_rx_item_t item;
+	TickType_t timeout;
+	uintptr_t payload;
 
 	if (soc == NULL) {
 		goto fExit;
@@ -1772,83 +3117,29 @@ static uint16_t read_sock(socket_p soc, uint8_t *buf, int32_t buflen, const uint
 	if ((soc->mode & SOC_MODE_READ) != SOC_MODE_READ) { /* socket open not for reading */
 		soc->last_error = SOC_ERR_WRONG_SOC_MODE;
 		goto fExit;
+	}
+	/* wait for the data on the socket queue */
+	if (soc->TaskToNotify != NULL) {
+		timeout = pdMS_TO_TICKS(soc->readTimeOutMS);
 	} else {
-		/* wait for the data */
-#if (LAN_NOTIFICATION != 1)
-		while ((soc->mode & SOC_NEW_DATA) != SOC_NEW_DATA) {
-			/** @TODO add wait for semaphore here 		*/
-			if ((maxattempts--) == 0U) {
-				goto fExit;
-			}
-			osDelay(5U); /* 5 ms */
-		}
-#else
-		uint32_t timeout = pdMS_TO_TICKS(soc->readTimeOutMS);
-		uint32_t notif_val;
-		if (soc->TaskToNotify != NULL) {
-			if (xTaskNotifyWait(ULONG_MAX, ULONG_MAX, &notif_val, timeout) != pdTRUE) {
-				goto fExit;
-			}
-		} else {
-			while ((soc->mode & SOC_NEW_DATA) != SOC_NEW_DATA) {
-				/** @TODO add wait for semaphore here 		*/
-				if ((maxattempts--) == 0U) {
-					goto fExit;
-				}
-				osDelay(5U); /* 5 ms */
-			}
-		}
-#endif
-		/* data arrived here */
-		uintptr_t payload;
-		uintptr_t start_pos;
-		payload = (uintptr_t)soc->len; /* soc->len is a UDP payload size */
-		/* if soc->proto != UDP, soc->len means total eth frame size */
-
-		if (soc->proto == (uint8_t)IP_PROTOCOL_UDP) { /* include empty UDP */
-			start_pos = (uintptr_t)UDP_PAYLOAD_START;
-		} else {
-			start_pos = 0U;
-		}
-		if (payload > (uintptr_t)buflen) {
-			soc->last_error =
-				SOC_ERR_NOT_ENOUGH_MEM_BUF; /* data received is longer than buffer supplied */
-			payload = (uintptr_t)buflen;
-		}
-		const uint8_t *sr;
-		uint8_t *dst;
-		sr = (uint8_t *)(soc->buf + start_pos);
-		dst = buf;
-		result = (uint16_t)payload;
-		if (((payload % sizeof(uint32_t)) == 0U) &&
-		    (((uintptr_t)sr % sizeof(uint32_t)) == 0U) &&
-		    (((uintptr_t)dst % sizeof(uint32_t)) == 0U)) {
-			payload /= sizeof(uint32_t);
-			uint32_t *d = (uint32_t *)dst;
-			uint32_t *ss = (uint32_t *)sr;
-			while (payload > 0U) {
-				*d = *ss;
-				d++;
-				ss++;
-				payload -= sizeof(uint32_t);
-			}
-			socfastreads++;
-		} else {
-			while (payload > 0U) { /* copy data */
-				*dst = *sr;
-				dst++;
-				sr++;
-				payload--;
-			}
-		}
-		soc->mode = soc->mode & (~SOC_NEW_DATA); /*clear new data flag */
-		/* free soc->buf memory +15-Mar-2018*/
-		soc->buf = lan_freemem(soc->buf);
-		if (soc->buf != NULL) {
-			lan_freemem_errors++;
-		} else {
-			readsoc_frees++;
-		}
+		timeout = pdMS_TO_TICKS(5U * (uint32_t)attempts); /* 5 ms per attempt */
+	}
+	if (xQueueReceive(soc_rxq[soc - sockets], &item, timeout) != pdTRUE) {
+		goto fExit;
+	}
+	/* data arrived here */
+	soc->len = item.len; /* soc->len is a UDP payload size */
+	payload = (uintptr_t)item.len;
+	if (payload > (uintptr_t)buflen) {
+		soc->last_error =
+			SOC_ERR_NOT_ENOUGH_MEM_BUF; /* data received is longer than buffer supplied */
+		payload = (uintptr_t)buflen;
+	}
+	memcpy(buf, item.frame + UDP_PAYLOAD_START, payload);
+	result = (uint16_t)payload;
+	/* free the frame memory */
+	if (lan_freemem(item.frame) == NULL) {
+		readsoc_frees++;
 	}
 fExit:
 	if (result != 0u) {
@@ -1876,58 +3167,173 @@ uint16_t read_socket(socket_p soc, uint8_t *buf, int32_t buflen)
 	return (read_sock(soc, buf, buflen, 100u));
 }
 
+/**
+  * builds the cached eth/ip/udp header of the socket
+  * the header is built even if the MAC isn't resolved yet, then it
+  * stays invalid and the frame is parked by the caller
+  * @param soc the pointer to the socket
+  * @return ErrorStatus SUCCESS or ERROR if the MAC isn't resolved
+  */
+static ErrorStatus soc_build_hdr(socket_p soc)
+{
+	eth_frame_t *frame = (eth_frame_t *)soc->hdr;
+	ip_packet_t *ip = (ip_packet_t *)(frame->data);
+	udp_packet_t *udp = (udp_packet_t *)(ip->data);
+	bool resolved;
+	uint32_t gen;
+
+	gen = arp_gen; /* before resolving, a change meanwhile rebuilds again */
+	resolved = ip_route_mac(soc->rem_ip_addr, frame->to_addr);
+	memcpy(frame->from_addr, mac_addr, 6);
+	frame->type = (uint16_t)ETH_TYPE_IP;
+
+	ip->ver_head_len = 0x45;
+	ip->tos = 0;
+	ip->total_len = 0;
+	ip->fragment_id = 0;
+	ip->flags_framgent_offset = 0;
+	ip->ttl = IP_PACKET_TTL;
+	ip->protocol = IP_PROTOCOL_UDP;
+	ip->cksum = 0;
+	ip->from_addr = ip_addr;
+	ip->to_addr = soc->rem_ip_addr;
+
+	udp->from_port = htons(soc->loc_port);
+	udp->to_port = htons(soc->rem_port);
+	udp->len = 0;
+	udp->cksum = 0;
+
+	/* length independent parts of the checksums */
+	soc->hdr_ip_sum = inet_sum(0U, ip, sizeof(ip_packet_t));
+	soc->hdr_udp_sum = inet_sum(htons(IP_PROTOCOL_UDP), &ip->from_addr, 8U);
+	soc->hdr_udp_sum = inet_sum(soc->hdr_udp_sum, udp, 4U);
+
+	soc->hdr_arp_gen = gen;
+	soc->hdr_src_ip = ip_addr;
+	soc->hdr_valid = resolved ? 1U : 0U;
+	wr_hdr_builds++;
+	return resolved ? SUCCESS : ERROR;
+}
+
+/**
+  * sends the datagram with the header in soc->hdr in IP fragments,
+  * the udp header is in the first one
+  * @param soc the pointer to the socket, the header is resolved
+  * @param *buf the payload
+  * @param buflen its length
+  * @return none
+  */
+static void soc_send_frags(socket_p soc, const uint8_t *buf, uint16_t buflen)
+{
+	static volatile uint32_t ip_id = 0u;
+	uint8_t hdr[UDP_PAYLOAD_START];
+	ip_packet_t *ip = (ip_packet_t *)(hdr + sizeof(eth_frame_t));
+	uint16_t total = buflen + (uint16_t)sizeof(udp_packet_t);
+	uint16_t ofs;
+	uint16_t n;
+	uint16_t flags;
+
+	memcpy(hdr, soc->hdr, UDP_PAYLOAD_START);
+	/* nonzero, not repeated while the fragments may live */
+	ip->fragment_id = htons((uint16_t)(lan_atomic_add(&ip_id, 1U) | 0x8000U));
+	for (ofs = 0U; ofs < total; ofs += n) {
+		n = ((total - ofs) > IP_FRAG_DATA) ? (uint16_t)IP_FRAG_DATA : (total - ofs);
+		flags = (uint16_t)(ofs / 8U);
+		if ((ofs + n) < total) {
+			flags |= 0x2000U; /* MF */
+		}
+		ip->total_len = htons((uint16_t)(n + sizeof(ip_packet_t)));
+		ip->flags_framgent_offset = htons(flags);
+		ip->cksum = 0U;
+		ip->cksum = inet_cksum(ip, sizeof(ip_packet_t));
+		if (ofs == 0U) {
+			n -= (uint16_t)sizeof(udp_packet_t);
+			enc28j60_send_packet2(hdr, UDP_PAYLOAD_START, buf, n);
+			n += (uint16_t)sizeof(udp_packet_t);
+		} else {
+			enc28j60_send_packet2(hdr, UDP_PAYLOAD_START - sizeof(udp_packet_t),
+					      buf + ofs - sizeof(udp_packet_t), n);
+		}
+		ip_frags_sent++;
+	}
+}
+
+/**
+  * the largest payload write_socket() takes
+  * @param fragments 0 - in a single frame, else in IP fragments
+  * @return bytes
+  */
+uint16_t udp_max_payload(uint8_t fragments)
+{
+	return (fragments != 0U) ? UDP_DGRAM_MAX :
+				   (uint16_t)(ETH_MAXFRAME - UDP_PAYLOAD_START);
+}
+
 /**
   * sends data from buf via previously opened socket !!!! UDP ONLY !!!!
+  * the payload goes to the chip right after the cached header, no copy;
+  * if the next hop isn't resolved yet the frame is parked, no waiting.
+  * a payload over one frame is sent in IP fragments, it can't be parked:
+  * the MAC is requested and ERROR returned with SOC_ERR_NOT_RESOLVED;
+  * the same if the frame can't be parked, it is dropped then
   * @param soc the pointer to the socket
   * @param *buf is the pointer to the data
-  * @param buflen length of the data
+  * @param buflen length of the data, UDP_DGRAM_MAX max
   * @return ErrorStatus SUCCESS or ERROR             THREAD - SAFE
   */
 ErrorStatus write_socket(socket_p soc, uint8_t *buf, int32_t buflen)
 {
 	ErrorStatus result;
 	result = ERROR;
-	eth_frame_t *frame;
 
 	/*  ETH_MAXFRAME (600 bytes) - UDP_PAYLOAD_START (42)  =  558 bytes for data */
 	const int32_t max_payload_len = ((int32_t)ETH_MAXFRAME - (int32_t)UDP_PAYLOAD_START);
 
 	if ((soc != NULL) && (soc->mode == SOC_MODE_WRITE) &&
-	    (buflen <= max_payload_len)) { /* socket is OK for writing */
-					   /* len is also OK */
-		/*+15-Mar-2018 : try to allocate soc->buf memory */
-		taskENTER_CRITICAL();
-		soc->buf = lan_getmem();
-		taskEXIT_CRITICAL();
-		if (soc->buf == NULL) {
-			lan_getmem_errors++;
-			goto fExit; /* malloc error */
-/**/		}
-wr_mallocs_frees++;
-frame = (eth_frame_t *)(soc->buf);
-ip_packet_t *ip = (ip_packet_t *)(frame->data);
-udp_packet_t *udp = (udp_packet_t *)(ip->data);
-uint8_t *udp_data_p = (udp->data);
-
-memcpy(udp_data_p, buf, (size_t)buflen); /* copy the payload */
-
-ip->to_addr = soc->rem_ip_addr;
-udp->from_port = htons(soc->loc_port);
-udp->to_port = htons(soc->rem_port);
-soc->len = (uint16_t)buflen;
-
-result = (udp_send(frame, (uint16_t)buflen) == 1u) ? SUCCESS : ERROR;
-/*+15-Mar-2018 : free soc->buf memory */
-taskENTER_CRITICAL();
-soc->buf = lan_freemem(soc->buf);
-taskEXIT_CRITICAL();
-if (soc->buf != NULL) {
-	lan_freemem_errors++;
-} else {
-	wr_mallocs_frees--;
-}
+	    (buflen >= 0) && (buflen <= (int32_t)UDP_DGRAM_MAX)) { /* socket is OK for writing */
+								    /* len is also OK */
+		if ((soc->hdr_valid == 0U) || (soc->hdr_arp_gen != arp_gen) ||
+		    (soc->hdr_src_ip != ip_addr)) {
+			(void)soc_build_hdr(soc);
+		}
+		eth_frame_t *frame = (eth_frame_t *)soc->hdr;
+		ip_packet_t *ip = (ip_packet_t *)(frame->data);
+		udp_packet_t *udp = (udp_packet_t *)(ip->data);
+		uint16_t udp_len = (uint16_t)buflen + (uint16_t)sizeof(udp_packet_t);
+		uint16_t ip_len = udp_len + (uint16_t)sizeof(ip_packet_t);
+		uint32_t sum;
+
+		if ((buflen > max_payload_len) && (soc->hdr_valid == 0U)) {
+			request_arp(ip_next_hop(soc->rem_ip_addr));
+			soc->last_error = SOC_ERR_NOT_RESOLVED;
+			return ERROR; /* not a stack failure, the caller retries */
+		}
+		/* patch the length dependent fields only */
+		ip->total_len = htons(ip_len);
+		ip->cksum = inet_fold(soc->hdr_ip_sum + htons(ip_len));
+		udp->len = htons(udp_len);
+		sum = soc->hdr_udp_sum + ((uint32_t)htons(udp_len) << 1);
+		udp->cksum = inet_fold(inet_sum(sum, buf, (uint16_t)buflen));
+		if (udp->cksum == 0U) {
+			udp->cksum = 0xFFFFU; /* zero means "no checksum" */
+		}
+		soc->len = (uint16_t)buflen;
+
+		if (buflen > max_payload_len) {
+			soc_send_frags(soc, buf, (uint16_t)buflen);
+			result = SUCCESS;
+		} else if (soc->hdr_valid != 0U) {
+			enc28j60_send_packet2(soc->hdr, UDP_PAYLOAD_START, buf, (uint16_t)buflen);
+			result = SUCCESS;
+		} else if (arp_park(ip_next_hop(soc->rem_ip_addr), soc->hdr,
+				    UDP_PAYLOAD_START, buf, (uint16_t)buflen) == SUCCESS) {
+			result = SUCCESS;
+		} else {
+			/* counted in arp_park_drops, not a stack failure */
+			soc->last_error = SOC_ERR_NOT_RESOLVED;
+			return ERROR;
+		}
 	}
-fExit:
 	if (result == ERROR) {
 		wr_soc_err++;
 		if (wr_soc_err > 3) {
@@ -1954,8 +3360,11 @@ static eth_frame_t *udp_packet_callback(eth_frame_t *frame, uint16_t len)
 	eth_frame_t *retval;
 	retval = frame;
 
-	/* add 06-Sep-2019 */
-	bool needNotify = false;
+	bool fits = false;
+	soc_rx_item_t item;
+	soc_rx_item_t old;
+	uint8_t depth = 0U;
+	uint8_t policy = SOC_RXQ_DROP_OLDEST;
 
 	if (frame == NULL) {
 		return frame; /* function is safe against null pointers (11-Mar-2018) */
@@ -1963,94 +3372,104 @@ static eth_frame_t *udp_packet_callback(eth_frame_t *frame, uint16_t len)
 	uint8_t i;
 	ip_packet_t *ip = (void *)(frame->data);
 	udp_packet_t *udp = (udp_packet_t *)(ip->data);
+	uint16_t to_port = ntohs(udp->to_port);
 	taskENTER_CRITICAL();
-	for (i = 0u; i < NUM_SOCKETS; i++) {
+	for (i = soc_bucket[SOC_HASH(to_port)]; i != SOC_NONE; i = soc_next[i]) {
 		if ((sockets[i].rem_ip_addr == ip->from_addr) &&
 		    (sockets[i].loc_ip_addr == ip->to_addr) &&
 		    /*		 (sockets[i].mode == SOC_MODE_READ) && */
 		    ((sockets[i].mode & SOC_MODE_READ) != 0U) && /* + 15-Mar-2018  */
 		    (sockets[i].proto == (uint8_t)IP_PROTOCOL_UDP) &&
-		    (sockets[i].loc_port == ntohs(udp->to_port))) {
+		    (sockets[i].loc_port == to_port)) {
 			/* receive from ANY port added 11-03-2018 */
 			sockets[i].rem_port = (sockets[i].rem_port == 0U) ? ntohs(udp->from_port) :
 									    sockets[i].rem_port;
 
 			if (sockets[i].rem_port == ntohs(udp->from_port)) {
 				/* proceed with payload  */
-				sockets[i].len = len;
-				if ((sockets[i].mode & SOC_NEW_DATA) != 0U) {
-					/* previous new data is not read, will be overwritten !*/
-					sockets[i].datalost = SOC_DATA_LOST; /* + 15-Mar-2018  */
-					socdatalosts++;			     /* + 15-Mar-2018  */
-				}
-				sockets[i].mode |= SOC_NEW_DATA; /* set flag */
-				/* zero-copy implementation 13-Mar-2018 */
-				/* swap sockets[i].buf and frame */
-				retval = (eth_frame_t *)sockets[i].buf;
-				sockets[i].buf = (uint8_t *)frame;
-				readsoc_mallocs++;
-				udp_fits_callbacks++;
-				needNotify = true;
+				depth = sockets[i].rxq_depth;
+				policy = sockets[i].rxq_policy;
+				fits = true;
 				break; /* only first fit socket has new data */
 			}
 		} /* end of the "5 conditions" if */
-	}	 /* end of for i loop */
+	}	 /* end of the chain walk */
 	taskEXIT_CRITICAL();
-	/* notify task here */
-	/* notification added 06-Sep-2019 */
-	if ((needNotify) && (sockets[i].TaskToNotify != NULL)) {
-		xTaskNotify(sockets[i].TaskToNotify, /* the task which is waiting for the data */
-			    (uint32_t)(&sockets[i]), /* pointer for fast socket access */
-			    eSetValueWithOverwrite);
+
+	if (fits) {
+		udp_fits_callbacks++;
+		/* zero-copy: the frame goes to the socket queue */
+		if (uxQueueMessagesWaiting(soc_rxq[i]) >= depth) {
+			sockets[i].datalost = SOC_DATA_LOST;
+			sockets[i].rxq_drops++;
+			socdatalosts++;
+			if (policy == SOC_RXQ_DROP_NEWEST) {
+				goto fExit; /* the frame is released by the caller */
+			}
+			if (xQueueReceive(soc_rxq[i], &old, 0U) == pdTRUE) {
+				(void)lan_freemem(old.frame);
+				readsoc_frees++;
+			}
+		}
+		item.frame = (uint8_t *)frame;
+		item.len = len;
+		lan_buf_give(item.frame, LAN_BUF_SOCK);
+		if (xQueueSend(soc_rxq[i], &item, 0U) == pdTRUE) {
+			retval = NULL;
+			readsoc_mallocs++;
+		}
 	}
+fExit:
 	udp_callbacks++;
 	return retval;
 }
 
-/** runs out of freertos!  every 1ms by TIM0 stimulus
-  * returns num of free netbuffers
-  * @param none
-  * @return nb number of free buffers
-  */
-void nb_stat(void)
-{
-#ifndef NET_BUF_STAT
-	uint8_t i;
-	uint32_t tmp = 0u;
-	for (i = 0u; i < NUM_ETH_BUFFERS; i++) {
-		tmp = (eth_buf_state[i] == ETH_BUF_FREE) ? (tmp + 1u) : tmp;
-	}
-	freenb = tmp;
-	minfreenb = (tmp < minfreenb) ? tmp : minfreenb;
-#endif
-}
 /**/
 
-// TCP callbacks
+#ifdef WITH_TCP
+// TCP callbacks, the stream of tcp_stream_*()
+
+// SYN arrived: accept on the listening port only
 static uint8_t tcp_listen(uint8_t id, eth_frame_t *frame)
 {
-	UNUSED(frame);
-	return id;
-}
+	ip_packet_t *ip = (void *)(frame->data);
+	tcp_packet_t *tcp = (void *)(ip->data);
 
-static void tcp_read(uint8_t id, eth_frame_t *frame, uint8_t re)
-{
-	UNUSED(frame);
-	UNUSED(re);
 	UNUSED(id);
+	return ((tcp_port != 0U) && (tcp->to_port == tcp_port)) ? 1U : 0U;
 }
 
-static void tcp_write(uint8_t id, eth_frame_t *frame, uint16_t len)
+// in order data arrived: as much as fits, the rest comes again
+static uint16_t tcp_write(uint8_t id, const uint8_t *data, uint16_t len)
 {
-	UNUSED(frame);
-	UNUSED(len);
+	uint32_t head = tcp_rxq_head;
+	uint32_t space = TCP_RXQ_SIZE - (head - tcp_rxq_tail);
+	uint32_t ofs, n;
+
 	UNUSED(id);
+	if (len > space) {
+		len = (uint16_t)space;
+	}
+	ofs = head & TCP_RXQ_MASK;
+	n = TCP_RXQ_SIZE - ofs;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(&tcp_rxq[ofs], data, n);
+	memcpy(tcp_rxq, data + n, len - n);
+	__DMB();
+	tcp_rxq_head = head + len;
+	return len;
 }
 
+// connection is gone, hard - reset or timed out
 static void tcp_closed(uint8_t id, uint8_t hard)
 {
 	UNUSED(id);
 	UNUSED(hard);
+	tcp_is_up = 0;
+	tcp_close_req = 0;
 }
+#endif
 
 /*###################################### EOF #####################################################*/
@@ -0,0 +1,178 @@
+/** @file pcap_ring.c
+ *  @brief sampled capture ring of the received frames, pcap export
+ *
+ *  There is one writer, the lan poll task. A slot being written has an
+ *  odd sequence number, a reader copies the slot and takes it only if
+ *  the number is the same even value before and after the copy.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "pcap_ring.h"
+
+#if ((PCAP_RING_SLOTS & (PCAP_RING_SLOTS - 1U)) != 0U)
+#error "PCAP_RING_SLOTS must be a power of 2"
+#endif
+
+#define	PCAP_MAGIC		0xA1B2C3D4UL
+#define	PCAP_LINKTYPE_ETHERNET	1U
+
+typedef struct pcap_slot {
+	volatile uint32_t	seq;	/* 2n + 2 when record n is complete */
+	uint32_t		tick;
+	uint16_t		len;
+	uint16_t		caplen;
+	uint8_t			data[PCAP_SNAPLEN];
+} pcap_slot_t;
+
+static pcap_slot_t pcap_ring[PCAP_RING_SLOTS];
+static volatile uint32_t pcap_head;	/* records written */
+static volatile uint16_t pcap_every = PCAP_SAMPLE_DEFAULT;
+static uint16_t pcap_skip;
+
+/* for statistic purpose */
+static volatile uint32_t pcap_seen = 0U;
+static volatile uint32_t pcap_lost = 0U;	/* overwritten while exported */
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, 4U); /* native order, the magic tells the reader */
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, 2U);
+}
+
+/**
+ * @brief pcap_capture stores the frame head if it is its turn
+ * @param frame
+ * @param len length of the whole frame
+ * @note  called by the lan poll task only
+ */
+void pcap_capture(const uint8_t *frame, uint16_t len)
+{
+	pcap_slot_t *s;
+	uint32_t n;
+
+	pcap_seen++;
+	if (pcap_every == 0U) {
+		return;
+	}
+	if (++pcap_skip < pcap_every) {
+		return;
+	}
+	pcap_skip = 0U;
+
+	n = pcap_head;
+	s = &pcap_ring[n & (PCAP_RING_SLOTS - 1U)];
+	s->seq = (n << 1) + 1U;
+	__DMB();
+	s->tick = HAL_GetTick();
+	s->len = len;
+	s->caplen = (len < PCAP_SNAPLEN) ? len : (uint16_t)PCAP_SNAPLEN;
+	memcpy(s->data, frame, s->caplen);
+	__DMB();
+	s->seq = (n << 1) + 2U;
+	pcap_head = n + 1U;
+}
+
+/**
+ * @brief pcap_set_sampling sets the sampling rate
+ * @param every n-th frame is stored, 0 stops the capture
+ */
+void pcap_set_sampling(uint16_t every)
+{
+	pcap_every = every;
+}
+
+/**
+ * @brief pcap_export_begin takes a snapshot of the ring
+ * @param ex export state, the pcap file header is sent first
+ */
+void pcap_export_begin(pcap_export_t *ex)
+{
+	ex->end = pcap_head;
+	ex->next = (ex->end > PCAP_RING_SLOTS) ? (ex->end - PCAP_RING_SLOTS) : 0U;
+	put32(&ex->rec[0], PCAP_MAGIC);
+	put16(&ex->rec[4], 2U);			/* version 2.4 */
+	put16(&ex->rec[6], 4U);
+	put32(&ex->rec[8], 0U);			/* thiszone */
+	put32(&ex->rec[12], 0U);		/* sigfigs */
+	put32(&ex->rec[16], PCAP_SNAPLEN);
+	put32(&ex->rec[20], PCAP_LINKTYPE_ETHERNET);
+	ex->len = PCAP_HDR_LEN;
+	ex->pos = 0U;
+}
+
+/* copies the record ex->next into ex->rec, false if it is overwritten */
+static bool pcap_export_fetch(pcap_export_t *ex)
+{
+	const pcap_slot_t *s = &pcap_ring[ex->next & (PCAP_RING_SLOTS - 1U)];
+	uint32_t seq = (ex->next << 1) + 2U;
+	uint32_t tick;
+	uint16_t len;
+	uint16_t caplen;
+
+	if (s->seq != seq) {
+		return false;
+	}
+	__DMB();
+	tick = s->tick;
+	len = s->len;
+	caplen = s->caplen;
+	memcpy(&ex->rec[PCAP_REC_HDR_LEN], s->data, caplen);
+	__DMB();
+	if (s->seq != seq) {
+		return false;
+	}
+	put32(&ex->rec[0], tick / 1000U);
+	put32(&ex->rec[4], (tick % 1000U) * 1000U);
+	put32(&ex->rec[8], caplen);
+	put32(&ex->rec[12], len);
+	ex->len = (uint16_t)(PCAP_REC_HDR_LEN + caplen);
+	ex->pos = 0U;
+	return true;
+}
+
+/**
+ * @brief pcap_export_read streams the pcap file
+ * @param ex export state
+ * @param buf destination
+ * @param len bytes wanted
+ * @return bytes stored, less than len at the end of the file
+ */
+size_t pcap_export_read(pcap_export_t *ex, uint8_t *buf, size_t len)
+{
+	size_t done = 0U;
+	size_t n;
+
+	while (done < len) {
+		if (ex->pos == ex->len) {
+			if (ex->next == ex->end) {
+				break;
+			}
+			if (!pcap_export_fetch(ex)) {
+				pcap_lost++;
+			}
+			ex->next++;
+			continue;
+		}
+		n = (size_t)(ex->len - ex->pos);
+		if (n > (len - done)) {
+			n = len - done;
+		}
+		memcpy(buf + done, &ex->rec[ex->pos], n);
+		ex->pos = (uint16_t)(ex->pos + n);
+		done += n;
+	}
+	return done;
+}
@@ -0,0 +1,15 @@
+/** @file manchester_host_tests.h
+ *  @brief host tests of the Manchester PHY
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef MANCHESTER_HOST_TESTS_H
+#define MANCHESTER_HOST_TESTS_H
+
+void TEST_decode(void);
+void TEST_line(void);
+
+#endif // MANCHESTER_HOST_TESTS_H
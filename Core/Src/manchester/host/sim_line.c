@@ -0,0 +1,187 @@
+/** @file sim_line.c
+ *  @brief simulated Manchester line between two boards
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_line.h"
+
+/* IC1F = IC2F = 1111b: fDTS / 32, N = 8 at 72 MHz */
+#define	SIM_FILTER_NS	3556U
+
+typedef struct sim_edge {
+	int64_t		t;		/* ns from the first half-bit */
+	uint8_t		level;		/* line level after the edge */
+} sim_edge_t;
+
+static sim_edge_t line[SIM_LINE_MAX_EDGES];
+
+/**
+ * @brief sim_line_init sets up an ideal line of the firmware configuration
+ * @param l
+ * @param bitRate
+ */
+void sim_line_init(sim_line_t *l, size_t bitRate)
+{
+	memset(l, 0, sizeof(*l));
+	l->half_ns = (uint32_t)(1000000000U / (2U * bitRate));
+	l->tick_ns = 1000U;	/* PSC 71 at 72 MHz */
+	l->filter_ns = SIM_FILTER_NS;
+	l->active_high = true;
+}
+
+/**
+ * @brief sim_context fills the context the way MANCHESTER_InitContext does
+ * for the OpenTherm framing of manchester_task
+ * @param c
+ * @param bitRate
+ * @param tick_ns capture timer tick
+ * @param tolerance HALF_BYTE_TOLERANCE or another divider
+ */
+void sim_context(MANCHESTER_Context_t *c, size_t bitRate, uint32_t tick_ns,
+		 uint32_t tolerance)
+{
+	uint32_t timerClkFreq = 1000000000U / tick_ns;
+	uint32_t tol;
+
+	memset(c, 0, sizeof(*c));
+	c->numStartBits = 1U;
+	c->numStopBits = 1U;
+	c->bitRate = bitRate;
+	c->bitOrder = MANCHESTER_BitOrderMSBFirst;
+	c->startStopBit = 1U;
+	c->halfBitTime = timerClkFreq / ((uint32_t)bitRate * 2U);
+	tol = c->halfBitTime / tolerance;
+	c->halfBitMinTime = c->halfBitTime - tol;
+	c->halfBitMaxTime = c->halfBitTime + tol;
+	c->pulseTimeout = (1000U / ((uint32_t)bitRate * 2U)) + 2U;
+	c->filterTime = 7U;
+}
+
+static int32_t sim_jitter(uint32_t jitter_ns)
+{
+	if (jitter_ns == 0U) {
+		return 0;
+	}
+	return (int32_t)(rand() % (2 * (int32_t)jitter_ns + 1)) - (int32_t)jitter_ns;
+}
+
+static size_t sim_push(size_t n, int64_t t, uint8_t level)
+{
+	if (n >= SIM_LINE_MAX_EDGES) {
+		return n;
+	}
+	/* jitter never reorders the edges */
+	if ((n != 0U) && (t <= line[n - 1U].t)) {
+		t = line[n - 1U].t + 1;
+	}
+	line[n].t = t;
+	line[n].level = level;
+	return n + 1U;
+}
+
+/**
+ * @brief sim_line_run plays the waveform over the line into the capture
+ * @param l
+ * @param wave BSRR words, one per half-bit
+ * @param words
+ * @param pin the tx pin mask
+ * @param edges capture buffer, timer counts
+ * @param max_edges
+ * @return edge times stored; 0 if the line was not empty when armed
+ */
+size_t sim_line_run(sim_line_t *l, const uint32_t *wave, size_t words,
+		    uint32_t pin, uint32_t *edges, size_t max_edges)
+{
+	uint8_t pin_level = 0U;		/* the tx pin idles low */
+	const uint8_t idle = l->invert ? 1U : 0U;
+	const uint8_t active = l->active_high ? 1U : 0U;
+	size_t n = 0U;
+	size_t out = 0U;
+
+	for (size_t k = 0U; k < words; k++) {
+		/* the line is idle for a half-bit before the frame */
+		int64_t t = (int64_t)(k + 1U) * l->half_ns;
+		uint8_t lvl = pin_level;
+
+		if ((wave[k] & pin) != 0U) {
+			lvl = 1U;
+		} else if ((wave[k] & (pin << 16)) != 0U) {
+			lvl = 0U;
+		}
+		if (lvl != pin_level) {
+			pin_level = lvl;
+			n = sim_push(n, t + sim_jitter(l->jitter_ns),
+				     pin_level ^ idle);
+		}
+		if ((l->glitch_ns != 0U) && (l->glitch_every != 0U) &&
+		    ((k % l->glitch_every) == (l->glitch_every - 1U)) &&
+		    ((k + 1U) < words)) {
+			uint8_t cur = pin_level ^ idle;
+
+			t += l->half_ns / 2U;
+			n = sim_push(n, t, cur ^ 1U);
+			n = sim_push(n, t + l->glitch_ns, cur);
+		}
+	}
+	l->edges += (uint32_t)n;
+
+	/* the capture is armed only on the empty line */
+	if (idle == active) {
+		return 0U;
+	}
+	for (size_t i = 0U; i < n; i++) {
+		if (((i + 1U) < n) && ((line[i + 1U].t - line[i].t) < l->filter_ns)) {
+			l->filtered++;
+			i++;
+			continue;
+		}
+		if (out >= max_edges) {
+			break;
+		}
+		/* the filter delays every edge it lets through */
+		edges[out++] = (uint16_t)(l->t0 +
+			(uint32_t)((line[i].t + l->filter_ns) / l->tick_ns));
+	}
+	/* the DMA stores a pulse on its edge to the empty level */
+	return out & ~(size_t)1U;
+}
+
+/**
+ * @brief sim_timer_stage the timer stopped by configTimer: ARR loaded by
+ * the update event, the counter cleared
+ * @param t
+ * @param arr
+ */
+void sim_timer_stage(sim_timer_t *t, uint32_t arr)
+{
+	memset(t, 0, sizeof(*t));
+	t->regs.ARR = arr;
+	t->arr = arr;
+}
+
+/**
+ * @brief sim_timer_first_cc4 starts the counter as it was left
+ * @param t
+ * @return ticks from CEN to the first CC4 match
+ */
+uint32_t sim_timer_first_cc4(sim_timer_t *t)
+{
+	uint32_t cnt = t->regs.CNT;
+	uint32_t ccr = t->regs.CCR4;
+
+	/* the update event written since the stage loads the preload */
+	if ((t->regs.EGR & TIM_EGR_UG) != 0U) {
+		t->arr = t->regs.ARR;
+		t->regs.EGR = 0U;
+	}
+	if (cnt < ccr) {
+		return ccr - cnt;
+	}
+	return (t->arr - cnt + 1U) + ccr;
+}
@@ -0,0 +1,60 @@
+/** @file sim_line.h
+ *  @brief simulated Manchester line between two boards
+ *
+ *  The transmitting side plays a BSRR waveform the way the timer-paced
+ *  DMA of manchester.c does, the line may invert, jitter and glitch, and
+ *  the receiving side stores the edge times the way the IC1/IC2 capture
+ *  with the DMA burst does: 16 bit counter, input filter, the first
+ *  edge going to the active level.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#ifndef SIM_LINE_H
+#define SIM_LINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "manchester.h"
+
+/* transitions of the longest simulated frame, glitches included */
+#define	SIM_LINE_MAX_EDGES	512U
+
+typedef struct sim_line {
+	/* transmitter */
+	uint32_t	half_ns;	/* half-bit the waveform is played at */
+	/* line */
+	uint32_t	jitter_ns;	/* every edge moves by up to +-jitter_ns */
+	uint32_t	glitch_ns;	/* length of a glitch, 0 - none */
+	uint32_t	glitch_every;	/* a glitch in every n-th half-bit */
+	bool		invert;		/* the line inverts the tx pin */
+	/* receiver */
+	uint32_t	tick_ns;	/* capture timer tick */
+	uint32_t	filter_ns;	/* shorter levels never reach the capture */
+	bool		active_high;	/* IC1 takes the rising edges */
+	uint16_t	t0;		/* counter value when the frame starts */
+	/* statistics */
+	uint32_t	edges;		/* transitions put on the line */
+	uint32_t	filtered;	/* levels the input filter swallowed */
+} sim_line_t;
+
+/* up-counting timer with the ARR preloaded, the code under test writes
+ * the register block */
+typedef struct sim_timer {
+	TIM_TypeDef	regs;
+	uint32_t	arr;		/* active ARR */
+} sim_timer_t;
+
+void sim_line_init(sim_line_t *l, size_t bitRate);
+void sim_context(MANCHESTER_Context_t *c, size_t bitRate, uint32_t tick_ns,
+		 uint32_t tolerance);
+size_t sim_line_run(sim_line_t *l, const uint32_t *wave, size_t words,
+		    uint32_t pin, uint32_t *edges, size_t max_edges);
+void sim_timer_stage(sim_timer_t *t, uint32_t arr);
+uint32_t sim_timer_first_cc4(sim_timer_t *t);
+
+#endif // SIM_LINE_H
@@ -0,0 +1,447 @@
+/** @file test_decode.c
+ *  @brief tests and benchmark of the table-driven Manchester decoder
+ *
+ *  Frames are generated as edge time stamps of the 16 bit capture timer,
+ *  1 us ticks, OpenTherm framing (1 start bit, 32 bits MSB first, 1 stop
+ *  bit, 1000 bit/s) unless a case says otherwise.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "testhelpers.h"
+#include "manchester_host_tests.h"
+#include "manchester_decode.h"
+#include "bit_queue.h"
+
+#define	T_HALF		500U		/* ticks, 1000 bit/s */
+#define	T_MAX_EDGES	(2U * MANCHESTER_DECODE_BITS + 2U)
+#define	T_FRAMES	2000U
+#define	B_FRAMES	256U
+#define	B_ROUNDS	200U
+
+typedef struct test_frame {
+	uint32_t	edges[T_MAX_EDGES];
+	size_t		n;
+} test_frame_t;
+
+static MANCHESTER_Context_t ctx;
+
+static void ctx_init(size_t numStart, size_t numStop, MANCHESTER_BitOrder_t order)
+{
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.numStartBits = numStart;
+	ctx.numStopBits = numStop;
+	ctx.bitRate = 1000U;
+	ctx.bitOrder = order;
+	ctx.startStopBit = 1U;
+	/* as MANCHESTER_InitContext() has it */
+	ctx.halfBitTime = T_HALF;
+	ctx.halfBitMinTime = T_HALF - T_HALF / HALF_BYTE_TOLERANCE;
+	ctx.halfBitMaxTime = T_HALF + T_HALF / HALF_BYTE_TOLERANCE;
+}
+
+/* half-bit levels of a frame, 1 is active; bit 1 goes active first */
+static size_t make_levels(uint8_t *lv, const uint8_t *payload, size_t numBits,
+			  uint8_t stopBit)
+{
+	size_t n = 0U;
+
+	for (size_t i = 0U; i < ctx.numStartBits; i++) {
+		lv[n++] = ctx.startStopBit;
+		lv[n++] = !ctx.startStopBit;
+	}
+	for (size_t i = 0U; i < numBits; i++) {
+		size_t byte = i / 8U;
+		size_t rem = numBits % 8U;
+		size_t bit = i % 8U;
+		uint8_t mask;
+
+		if (ctx.bitOrder == MANCHESTER_BitOrderLSBFirst) {
+			mask = (uint8_t)(1U << bit);
+		} else if (byte < numBits / 8U) {
+			mask = (uint8_t)(0x80U >> bit);
+		} else {
+			mask = (uint8_t)(0x80U >> (8U - rem + bit));
+		}
+		lv[n++] = ((payload[byte] & mask) != 0U);
+		lv[n++] = ((payload[byte] & mask) == 0U);
+	}
+	for (size_t i = 0U; i < ctx.numStopBits; i++) {
+		lv[n++] = stopBit;
+		lv[n++] = !stopBit;
+	}
+	return n;
+}
+
+/* edges of the levels, each moved by up to +-jitter ticks */
+static void make_edges(test_frame_t *f, const uint8_t *lv, size_t nh,
+		       uint32_t t0, uint32_t half, uint32_t jitter)
+{
+	uint8_t prev = 0U;
+	uint32_t t = t0;
+
+	f->n = 0U;
+	for (size_t k = 0U; k <= nh; k++) {
+		uint8_t l = (k < nh) ? lv[k] : 0U;
+
+		if (l != prev) {
+			int32_t j = (jitter == 0U) ? 0 :
+				(int32_t)(rand() % (2 * (int32_t)jitter + 1)) - (int32_t)jitter;
+			f->edges[f->n++] = (uint16_t)(t + (uint32_t)j);
+			prev = l;
+		}
+		t += half;
+	}
+}
+
+static void make_frame(test_frame_t *f, const uint8_t *payload, size_t numBits,
+		       uint32_t jitter)
+{
+	uint8_t lv[2U * MANCHESTER_DECODE_BITS];
+	size_t nh = make_levels(lv, payload, numBits, ctx.startStopBit);
+
+	/* random start, the 16 bit counter wraps inside some frames */
+	make_edges(f, lv, nh, (uint32_t)rand(), T_HALF, jitter);
+}
+
+static uint32_t rand32(void)
+{
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+/*
+ * the former receiver: processPulse() and the bit queue, fed pulse by pulse
+ * the way receiveBits() did from the EXTI notifications
+ */
+typedef struct ref_rx {
+	const test_frame_t *f;
+	size_t next;		/* next active pulse */
+	uint8_t hasLow1T;
+	BitQueue_t qu;
+} ref_rx_t;
+
+static int ref_pulse(ref_rx_t *r)
+{
+	const uint32_t *e = r->f->edges;
+	size_t p = 2U * r->next;
+	uint32_t high, low;
+	uint8_t activeBits = r->hasLow1T;
+	uint8_t tmp = 0U;
+
+	if (p + 1U >= r->f->n) {
+		return -1;
+	}
+	high = (uint16_t)(e[p + 1U] - e[p]);
+	low = (p + 2U < r->f->n) ? (uint16_t)(e[p + 2U] - e[p + 1U]) :
+				   ctx.halfBitTime;
+	r->next++;
+	if ((high > ctx.halfBitMinTime) && (high < ctx.halfBitMaxTime)) {
+		tmp = (uint8_t)(0x01U << activeBits);
+		activeBits++;
+	} else if ((high > 2U * ctx.halfBitMinTime) && (high < 2U * ctx.halfBitMaxTime)) {
+		tmp = (uint8_t)(0x03U << activeBits);
+		activeBits += 2U;
+	} else {
+		return -1;
+	}
+	if ((low > ctx.halfBitMinTime) && (low < ctx.halfBitMaxTime)) {
+		activeBits++;
+	} else if ((low > 2U * ctx.halfBitMinTime) && (low < 2U * ctx.halfBitMaxTime)) {
+		activeBits += 2U;
+	} else {
+		return -1;
+	}
+	while (activeBits > 1U) {
+		if ((tmp & 0x03U) == 0x01U) {
+			putBitInQueue(1U, &r->qu);
+		} else if ((tmp & 0x03U) == 0x02U) {
+			putBitInQueue(0U, &r->qu);
+		} else {
+			return -1;
+		}
+		activeBits -= 2U;
+		tmp >>= 2;
+	}
+	r->hasLow1T = (activeBits == 1U);
+	return 0;
+}
+
+static int ref_bit(ref_rx_t *r, uint8_t *bit)
+{
+	while (dequeueBit(bit, &r->qu) == bqEmpty) {
+		if (ref_pulse(r) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* processStartStopBits() and processPayLoad() */
+static int ref_decode(const test_frame_t *f, MANCHESTER_Data_t *data)
+{
+	ref_rx_t r = { .f = f };
+	uint8_t bit;
+	size_t i;
+
+	for (i = 0U; i < ctx.numStartBits; i++) {
+		if ((ref_bit(&r, &bit) != 0) || (bit != ctx.startStopBit)) {
+			return -1;
+		}
+	}
+	for (i = 0U; i < data->numBits; i++) {
+		size_t byte = i / 8U;
+		size_t rem = data->numBits % 8U;
+		uint8_t mask;
+
+		if (ctx.bitOrder == MANCHESTER_BitOrderLSBFirst) {
+			mask = (uint8_t)(1U << (i % 8U));
+		} else if (byte < data->numBits / 8U) {
+			mask = (uint8_t)(0x80U >> (i % 8U));
+		} else {
+			mask = (uint8_t)(0x80U >> (8U - rem + i % 8U));
+		}
+		if ((i % 8U) == 0U) {
+			data->dataPtr[byte] = 0U;
+		}
+		if (ref_bit(&r, &bit) != 0) {
+			return -1;
+		}
+		if (bit != 0U) {
+			data->dataPtr[byte] |= mask;
+		}
+	}
+	for (i = 0U; i < ctx.numStopBits; i++) {
+		if ((ref_bit(&r, &bit) != 0) || (bit != ctx.startStopBit)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static MANCHESTER_DecodeStatus_t decode(const test_frame_t *f, uint8_t *out,
+					size_t numBits)
+{
+	MANCHESTER_Data_t d = { .dataPtr = out, .numBits = numBits };
+
+	return MANCHESTER_Decode(f->edges, f->n, &ctx, &d);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* clean and jittered OpenTherm frames */
+static void TEST_decode_frames(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	static const uint32_t fixed[] = { 0x00000000U, 0xFFFFFFFFU, 0xAAAAAAAAU,
+					  0x55555555U, 0x80000001U, 0x7FFFFFFEU };
+	test_frame_t f;
+	uint8_t in[4], out[4];
+	unsigned int errors = 0U;
+
+	srand(2U);
+	ctx_init(1U, 1U, MANCHESTER_BitOrderMSBFirst);
+	for (size_t i = 0U; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+		memcpy(in, &fixed[i], 4U);
+		make_frame(&f, in, 32U, 0U);
+		if ((decode(&f, out, 32U) != mdOk) || (memcmp(in, out, 4U) != 0)) {
+			errors++;
+		}
+	}
+	TEST_CHECK(0, errors == 0U);
+
+	errors = 0U;
+	for (unsigned int i = 0U; i < T_FRAMES; i++) {
+		uint32_t w = rand32();
+
+		memcpy(in, &w, 4U);
+		make_frame(&f, in, 32U, 0U);
+		if ((decode(&f, out, 32U) != mdOk) || (memcmp(in, out, 4U) != 0)) {
+			errors++;
+		}
+	}
+	TEST_CHECK(1, errors == 0U);
+
+	/* every interval stays inside the tolerance */
+	errors = 0U;
+	for (unsigned int i = 0U; i < T_FRAMES; i++) {
+		uint32_t w = rand32();
+
+		memcpy(in, &w, 4U);
+		make_frame(&f, in, 32U, T_HALF / HALF_BYTE_TOLERANCE / 2U - 1U);
+		if ((decode(&f, out, 32U) != mdOk) || (memcmp(in, out, 4U) != 0)) {
+			errors++;
+		}
+	}
+	TEST_CHECK(2, errors == 0U);
+
+	/* LSB first, a partial last byte, several start and stop bits */
+	errors = 0U;
+	ctx_init(3U, 2U, MANCHESTER_BitOrderLSBFirst);
+	for (unsigned int i = 0U; i < T_FRAMES; i++) {
+		uint32_t w = rand32() & 0x0FFFU;
+
+		memcpy(in, &w, 4U);
+		make_frame(&f, in, 12U, 5U);
+		memset(out, 0xEE, sizeof(out));
+		if ((decode(&f, out, 12U) != mdOk) || (memcmp(in, out, 2U) != 0)) {
+			errors++;
+		}
+	}
+	TEST_CHECK(3, errors == 0U);
+
+	errors = 0U;
+	ctx_init(1U, 1U, MANCHESTER_BitOrderMSBFirst);
+	for (unsigned int i = 0U; i < T_FRAMES; i++) {
+		uint32_t w = rand32() & 0x07FFU;
+		uint8_t ref[4];
+		MANCHESTER_Data_t d = { .dataPtr = ref, .numBits = 11U };
+
+		memcpy(in, &w, 4U);
+		make_frame(&f, in, 11U, 10U);
+		if ((decode(&f, out, 11U) != mdOk) || (ref_decode(&f, &d) != 0) ||
+		    (memcmp(ref, out, 2U) != 0)) {
+			errors++;
+		}
+	}
+	TEST_CHECK(4, errors == 0U);
+
+	TestFooter(test_name);
+}
+
+/* damaged frames are rejected for the right reason */
+static void TEST_decode_errors(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	test_frame_t f, g;
+	uint8_t lv[2U * MANCHESTER_DECODE_BITS];
+	uint8_t in[4] = { 0x12U, 0x34U, 0x56U, 0x78U };
+	uint8_t out[4];
+	size_t nh;
+
+	srand(3U);
+	ctx_init(1U, 1U, MANCHESTER_BitOrderMSBFirst);
+
+	/* a 5 us glitch in the middle of the frame */
+	make_frame(&f, in, 32U, 0U);
+	g.n = 0U;
+	for (size_t i = 0U; i < f.n; i++) {
+		g.edges[g.n++] = f.edges[i];
+		if (i == f.n / 2U) {
+			g.edges[g.n++] = (uint16_t)(f.edges[i] + 100U);
+			g.edges[g.n++] = (uint16_t)(f.edges[i] + 105U);
+		}
+	}
+	TEST_CHECK(0, decode(&g, out, 32U) == mdBadPulse);
+
+	/* the last active pulse is lost */
+	f.n -= 2U;
+	TEST_CHECK(1, decode(&f, out, 32U) == mdShort);
+
+	/* stop bit 0 */
+	nh = make_levels(lv, in, 32U, 0U);
+	make_edges(&f, lv, nh, 0U, T_HALF, 0U);
+	TEST_CHECK(2, decode(&f, out, 32U) == mdBadStartStop);
+
+	/* both halves of a bit active, all the levels of valid lengths */
+	nh = make_levels(lv, in, 32U, 1U);
+	for (size_t k = 4U; k + 3U < nh; k += 2U) {
+		if ((lv[k - 1U] == 0U) && (lv[k + 2U] == 0U)) {
+			lv[k] = 1U;
+			lv[k + 1U] = 1U;
+			break;
+		}
+	}
+	make_edges(&f, lv, nh, 0U, T_HALF, 0U);
+	TEST_CHECK(3, decode(&f, out, 32U) == mdBadSymbol);
+
+	/* 10 % slow, out of the 1/12 tolerance */
+	nh = make_levels(lv, in, 32U, 1U);
+	make_edges(&f, lv, nh, 0U, T_HALF + T_HALF / 10U, 0U);
+	TEST_CHECK(4, decode(&f, out, 32U) == mdBadPulse);
+
+	/* 7 % fast is still taken */
+	make_edges(&f, lv, nh, 0U, T_HALF - T_HALF * 7U / 100U, 0U);
+	TEST_CHECK(5, (decode(&f, out, 32U) == mdOk) && (memcmp(in, out, 4U) == 0));
+
+	/* nothing captured */
+	f.n = 0U;
+	TEST_CHECK(6, decode(&f, out, 32U) == mdShort);
+
+	/* longer than the decoder takes */
+	ctx_init(MAX_NUM_START_BITS, MAX_NUM_STOP_BITS, MANCHESTER_BitOrderMSBFirst);
+	TEST_CHECK(7, decode(&f, out, 40U) == mdTooLong);
+
+	TestFooter(test_name);
+}
+
+/* frames per CPU second: the table decoder against the former path */
+static void TEST_decode_bench(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	static test_frame_t frames[B_FRAMES];
+	uint8_t in[4], out[4];
+	volatile unsigned int sink = 0U;
+	double t0, t_tab, t_ref;
+
+	srand(4U);
+	ctx_init(1U, 1U, MANCHESTER_BitOrderMSBFirst);
+	for (unsigned int i = 0U; i < B_FRAMES; i++) {
+		uint32_t w = rand32();
+
+		memcpy(in, &w, 4U);
+		make_frame(&frames[i], in, 32U, 10U);
+	}
+
+	t0 = now_ns();
+	for (unsigned int r = 0U; r < B_ROUNDS; r++) {
+		for (unsigned int i = 0U; i < B_FRAMES; i++) {
+			sink += decode(&frames[i], out, 32U);
+			sink += out[0];
+		}
+	}
+	t_tab = (now_ns() - t0) / (B_ROUNDS * B_FRAMES);
+
+	t0 = now_ns();
+	for (unsigned int r = 0U; r < B_ROUNDS; r++) {
+		for (unsigned int i = 0U; i < B_FRAMES; i++) {
+			MANCHESTER_Data_t d = { .dataPtr = out, .numBits = 32U };
+
+			sink += (unsigned int)ref_decode(&frames[i], &d);
+			sink += out[0];
+		}
+	}
+	t_ref = (now_ns() - t0) / (B_ROUNDS * B_FRAMES);
+
+	printf("\ttable decoder   %8.1f ns/frame %10.0f frames/s\n",
+	       t_tab, 1e9 / t_tab);
+	printf("\tpulse+bit queue %8.1f ns/frame %10.0f frames/s\n",
+	       t_ref, 1e9 / t_ref);
+	printf("\tspeedup %.1fx\n", t_ref / t_tab);
+	TEST_CHECK(0, t_tab < t_ref);
+
+	TestFooter(test_name);
+}
+
+void TEST_decode(void)
+{
+	TEST_decode_frames();
+	TEST_decode_errors();
+	TEST_decode_bench();
+}
@@ -0,0 +1,330 @@
+/** @file test_line.c
+ *  @brief conformance tests and throughput of the Manchester PHY over the
+ *  simulated line
+ *
+ *  Every frame goes the way it does between the boards: MANCHESTER_Encode
+ *  builds the waveform, sim_line_run plays it over the line into the edge
+ *  capture, MANCHESTER_Decode takes it back. A frame that decodes must
+ *  decode to what was sent, whatever the line did to it.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "testhelpers.h"
+#include "manchester_host_tests.h"
+#include "manchester_decode.h"
+#include "manchester_encode.h"
+#include "sim_line.h"
+
+#define	L_PIN		0x0004U		/* MANCHESTER_TX_Pin */
+#define	L_BITRATE	1000U
+#define	L_FRAMES	1000U
+#define	L_SWEEP_FRAMES	100U
+#define	B_FRAMES	256U
+#define	B_ROUNDS	100U
+
+typedef struct line_result {
+	unsigned int	ok;
+	unsigned int	rejected;
+	unsigned int	wrong;		/* decoded to something else */
+	unsigned int	status[mdTooLong + 1];
+} line_result_t;
+
+static uint32_t rand32(void)
+{
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+/* one OpenTherm frame over the line */
+static MANCHESTER_DecodeStatus_t line_frame(sim_line_t *l,
+					    const MANCHESTER_Context_t *c,
+					    uint32_t word, line_result_t *res)
+{
+	uint32_t wave[MANCHESTER_WAVE_WORDS(MANCHESTER_DECODE_BITS)];
+	uint32_t edges[2U * MANCHESTER_CAPTURE_PAIRS];
+	uint32_t out = ~word;
+	MANCHESTER_Data_t tx = { .dataPtr = (uint8_t *)&word, .numBits = 32U };
+	MANCHESTER_Data_t rx = { .dataPtr = (uint8_t *)&out, .numBits = 32U };
+	MANCHESTER_DecodeStatus_t md;
+	size_t words, n;
+
+	words = MANCHESTER_Encode(&tx, c, wave, L_PIN, L_PIN << 16);
+	n = sim_line_run(l, wave, words, L_PIN, edges,
+			 sizeof(edges) / sizeof(edges[0]));
+	md = MANCHESTER_Decode(edges, n, c, &rx);
+	res->status[md]++;
+	if (md != mdOk) {
+		res->rejected++;
+	} else if (out != word) {
+		res->wrong++;
+	} else {
+		res->ok++;
+	}
+	return md;
+}
+
+static void line_frames(sim_line_t *l, const MANCHESTER_Context_t *c,
+			unsigned int frames, line_result_t *res)
+{
+	memset(res, 0, sizeof(*res));
+	for (unsigned int i = 0U; i < frames; i++) {
+		l->t0 = (uint16_t)rand();
+		line_frame(l, c, rand32(), res);
+	}
+}
+
+/* both boards, both line polarities */
+static void TEST_line_polarity(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	MANCHESTER_Context_t c;
+	sim_line_t l;
+	line_result_t res;
+
+	srand(10U);
+	sim_context(&c, L_BITRATE, 1000U, HALF_BYTE_TOLERANCE);
+	sim_line_init(&l, L_BITRATE);
+
+	/* the receiver active high */
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(0, res.ok == L_FRAMES);
+
+	/* the line inverts, the receiver active low */
+	l.invert = true;
+	l.active_high = false;
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(1, res.ok == L_FRAMES);
+
+	/* the capture is never armed on an active idle line */
+	l.active_high = true;
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(2, (res.status[mdShort] == L_FRAMES) && (res.wrong == 0U));
+
+	/* the 16 bit counter wraps in the middle of every frame */
+	l.invert = false;
+	memset(&res, 0, sizeof(res));
+	for (unsigned int i = 0U; i < L_FRAMES; i++) {
+		l.t0 = (uint16_t)(0xFFFFU - 17000U + (unsigned int)rand() % 1000U);
+		line_frame(&l, &c, rand32(), &res);
+	}
+	TEST_CHECK(3, res.ok == L_FRAMES);
+
+	/* other bit rates */
+	sim_context(&c, 500U, 1000U, HALF_BYTE_TOLERANCE);
+	sim_line_init(&l, 500U);
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(4, res.ok == L_FRAMES);
+	sim_context(&c, 2000U, 1000U, HALF_BYTE_TOLERANCE);
+	sim_line_init(&l, 2000U);
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(5, res.ok == L_FRAMES);
+
+	TestFooter(test_name);
+}
+
+/*
+ * sweeps the transmitter bit time against a receiver of the nominal rate;
+ * returns the accepted range in 0.1 % steps
+ */
+static void line_sweep(uint32_t tolerance, int *lo, int *hi, unsigned int *wrong)
+{
+	MANCHESTER_Context_t c;
+	sim_line_t l;
+	line_result_t res;
+
+	sim_context(&c, L_BITRATE, 1000U, tolerance);
+	*lo = 0;
+	*hi = 0;
+	*wrong = 0U;
+	for (int pm = -200; pm <= 200; pm += 5) {
+		sim_line_init(&l, L_BITRATE);
+		l.half_ns = (uint32_t)((int64_t)l.half_ns * (1000 + pm) / 1000);
+		line_frames(&l, &c, L_SWEEP_FRAMES, &res);
+		*wrong += res.wrong;
+		if (res.ok == L_SWEEP_FRAMES) {
+			if (pm < *lo) {
+				*lo = pm;
+			}
+			if (pm > *hi) {
+				*hi = pm;
+			}
+		}
+	}
+}
+
+/* the timing envelope follows the tolerance divider */
+static void TEST_line_envelope(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	int lo, hi;
+	unsigned int wrong;
+
+	srand(11U);
+	/* 1/12: 8.3 % on every level, quantization and filter included */
+	line_sweep(HALF_BYTE_TOLERANCE, &lo, &hi, &wrong);
+	printf("\ttolerance 1/%u: bit time %+.1f %% .. %+.1f %%\n",
+	       (unsigned int)HALF_BYTE_TOLERANCE, lo / 10.0, hi / 10.0);
+	TEST_CHECK(0, (lo <= -75) && (lo > -90) && (hi >= 75) && (hi < 90));
+	TEST_CHECK(1, wrong == 0U);
+
+	line_sweep(8U, &lo, &hi, &wrong);
+	printf("\ttolerance 1/8: bit time %+.1f %% .. %+.1f %%\n", lo / 10.0, hi / 10.0);
+	TEST_CHECK(2, (lo <= -115) && (lo > -130) && (hi >= 115) && (hi < 130));
+	TEST_CHECK(3, wrong == 0U);
+
+	TestFooter(test_name);
+}
+
+/* jitter and glitches */
+static void TEST_line_noise(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	MANCHESTER_Context_t c;
+	sim_line_t l;
+	line_result_t res;
+
+	srand(12U);
+	sim_context(&c, L_BITRATE, 1000U, HALF_BYTE_TOLERANCE);
+
+	/* within the tolerance: +-15 us on every edge */
+	sim_line_init(&l, L_BITRATE);
+	l.jitter_ns = 15000U;
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(0, res.ok == L_FRAMES);
+
+	/* far out of it: some frames lost, none wrong */
+	l.jitter_ns = 25000U;
+	line_frames(&l, &c, L_FRAMES, &res);
+	printf("\tjitter 25 us: %u of %u rejected\n", res.rejected, L_FRAMES);
+	TEST_CHECK(1, (res.rejected != 0U) && (res.wrong == 0U));
+
+	/* 2 us spikes never pass the input filter */
+	sim_line_init(&l, L_BITRATE);
+	l.glitch_ns = 2000U;
+	l.glitch_every = 7U;
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(2, (res.ok == L_FRAMES) && (l.filtered != 0U));
+
+	/* 10 us ones do, the frames are rejected as bad pulses */
+	l.glitch_ns = 10000U;
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(3, (res.status[mdBadPulse] == L_FRAMES) && (res.wrong == 0U));
+
+	/* a single spike in the frame */
+	l.glitch_every = 40U;
+	line_frames(&l, &c, L_FRAMES, &res);
+	TEST_CHECK(4, (res.ok == 0U) && (res.wrong == 0U));
+
+	TestFooter(test_name);
+}
+
+/* the first half-bit goes out within a half-bit of the counter start */
+static void TEST_line_wave_start(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	MANCHESTER_Context_t c;
+	sim_timer_t t;
+	uint32_t first;
+
+	sim_context(&c, L_BITRATE, 1000U, HALF_BYTE_TOLERANCE);
+
+	/* stage 4 from the table: ARR 65535 active */
+	sim_timer_stage(&t, 65535U);
+	MANCHESTER_WaveTimerArm(&t.regs, c.halfBitTime);
+	first = sim_timer_first_cc4(&t);
+	TEST_CHECK(0, (first <= c.halfBitTime) && (t.arr == c.halfBitTime - 1U));
+
+	/* stage 4 from the image: the period active already */
+	sim_timer_stage(&t, c.halfBitTime - 1U);
+	MANCHESTER_WaveTimerArm(&t.regs, 0U);
+	first = sim_timer_first_cc4(&t);
+	TEST_CHECK(1, (first <= c.halfBitTime) && (t.arr == c.halfBitTime - 1U));
+
+	TestFooter(test_name);
+}
+
+static double cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* decoded frames per CPU second, the decoder alone and the whole chain */
+static void TEST_line_bench(void)
+{
+	const char *test_name = __FUNCTION__;
+	TestHeader(test_name);
+
+	static uint32_t edges[B_FRAMES][2U * MANCHESTER_CAPTURE_PAIRS];
+	static size_t nedges[B_FRAMES];
+	uint32_t wave[MANCHESTER_WAVE_WORDS(MANCHESTER_DECODE_BITS)];
+	MANCHESTER_Context_t c;
+	sim_line_t l;
+	line_result_t res;
+	volatile unsigned int sink = 0U;
+	double t0, t_dec, t_chain;
+	uint32_t out;
+	MANCHESTER_Data_t rx = { .dataPtr = (uint8_t *)&out, .numBits = 32U };
+
+	srand(13U);
+	sim_context(&c, L_BITRATE, 1000U, HALF_BYTE_TOLERANCE);
+	sim_line_init(&l, L_BITRATE);
+	l.jitter_ns = 10000U;
+	for (unsigned int i = 0U; i < B_FRAMES; i++) {
+		uint32_t word = rand32();
+		MANCHESTER_Data_t tx = { .dataPtr = (uint8_t *)&word, .numBits = 32U };
+		size_t words = MANCHESTER_Encode(&tx, &c, wave, L_PIN, L_PIN << 16);
+
+		nedges[i] = sim_line_run(&l, wave, words, L_PIN, edges[i],
+					 2U * MANCHESTER_CAPTURE_PAIRS);
+	}
+
+	t0 = cpu_ns();
+	for (unsigned int r = 0U; r < B_ROUNDS; r++) {
+		for (unsigned int i = 0U; i < B_FRAMES; i++) {
+			sink += MANCHESTER_Decode(edges[i], nedges[i], &c, &rx);
+		}
+	}
+	t_dec = (cpu_ns() - t0) / (B_ROUNDS * B_FRAMES);
+
+	memset(&res, 0, sizeof(res));
+	t0 = cpu_ns();
+	for (unsigned int r = 0U; r < B_ROUNDS; r++) {
+		for (unsigned int i = 0U; i < B_FRAMES; i++) {
+			line_frame(&l, &c, rand32(), &res);
+		}
+	}
+	t_chain = (cpu_ns() - t0) / (B_ROUNDS * B_FRAMES);
+
+	printf("\tdecode          %8.1f ns/frame %10.0f frames/CPU-s\n",
+	       t_dec, 1e9 / t_dec);
+	printf("\tencode+line+dec %8.1f ns/frame %10.0f frames/CPU-s\n",
+	       t_chain, 1e9 / t_chain);
+	TEST_CHECK(0, res.ok == B_ROUNDS * B_FRAMES);
+
+	TestFooter(test_name);
+}
+
+void TEST_line(void)
+{
+	TEST_line_polarity();
+	TEST_line_envelope();
+	TEST_line_noise();
+	TEST_line_wave_start();
+	TEST_line_bench();
+}
@@ -0,0 +1,25 @@
+/** @file test_main.c
+ *  @brief host test runner for the Manchester PHY
+ *
+ *  Build and run with the Makefile of this directory:
+ *
+ *	make -C Core/Src/manchester/host run
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include "testhelpers.h"
+#include "manchester_host_tests.h"
+
+unsigned int test_failures = 0U;
+
+int main(void)
+{
+	TEST_decode();
+	TEST_line();
+
+	printf("%u failure(s)\n", test_failures);
+	return (test_failures == 0U) ? 0 : 1;
+}
@@ -21,6 +21,7 @@
 #include "cmsis_os.h"
 
 #include <limits.h>
+#include <stddef.h>
 
 #ifdef STM32F303xC
 
@@ -47,13 +48,18 @@
 #include "tim.h"
 #include "manchester.h"
 #include "bit_queue.h"
+#include "manchester_decode.h"
+#include "manchester_encode.h"
 
 #ifdef MASTERBOARD
 #define EMPTY_LINE	(GPIO_PIN_RESET)
 #define ACTIVE_LINE	(GPIO_PIN_SET)
+/* IC1 captures the edge to the active level, IC2 the edge to the empty one */
+#define CAPTURE_CCER	(TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC2P)
 #elif SLAVEBOARD
 #define EMPTY_LINE	(GPIO_PIN_SET)
 #define ACTIVE_LINE	(GPIO_PIN_RESET)
+#define CAPTURE_CCER	(TIM_CCER_CC1E | TIM_CCER_CC1P | TIM_CCER_CC2E)
 #else
 	#error "MASTER_BOARD or SLAVEBOARD must be defined!"
 #endif
@@ -80,6 +86,50 @@ typedef struct TimerCfg {
 	uint8_t NeedMSPInit;
 } TimerCfg_t;
 
+/* TIM2_CH2/CH4 request, the same channel on F1 and F3; TIM2_CH1 shares
+ * DMA1_Channel5 with SPI2_TX and TIM2_UP DMA1_Channel2 with USART3_TX.
+ * Rx and tx take turns under the timer mutex. */
+#define MANCH_DMA		DMA1_Channel7
+#define MANCH_DMA_IFCR		DMA_IFCR_CGIF7
+#define MANCH_DMA_TCIF		DMA_ISR_TCIF7
+#define MANCH_DMA_TEIF		DMA_ISR_TEIF7
+
+#ifdef MANCHESTER_RX_DMA
+#define CAPTURE_STAGE		6u
+
+/* every IC2 request bursts CCR1 and CCR2 out through DMAR */
+#define CAPTURE_DCR	(((uint32_t)(offsetof(TIM_TypeDef, CCR1) / 4u) <<     \
+			  TIM_DCR_DBA_Pos) | (1u << TIM_DCR_DBL_Pos))
+
+/* edges of the frame being received */
+typedef struct EdgeCapture {
+	/* pairs of the times of the edges to the active and to the empty
+	 * level, timer ticks */
+	uint32_t buf[2u * MANCHESTER_CAPTURE_PAIRS];
+	size_t pairs;		/* active pulses captured */
+	uint32_t frameTicks;	/* first edge to the end of the frame */
+	uint8_t active;		/* the frame is in buf, not to be received
+				 * edge by edge */
+} EdgeCapture_t;
+
+#if (MANCHESTER_CAPTURE_PAIRS > MANCHESTER_DECODE_BITS)
+#error "a captured frame must fit the decoder"
+#endif
+
+static EdgeCapture_t capture;
+#endif
+
+#ifdef MANCHESTER_TX_DMA
+#define WAVE_STAGE		4u
+/* BSRR images of the tx pin levels */
+#define WAVE_SET		((uint32_t)MANCHESTER_TX_Pin)
+#define WAVE_RESET		((uint32_t)MANCHESTER_TX_Pin << 16u)
+
+/* the frame to be sent, one BSRR word per half-bit and the last half-bit
+ * once more to mark the end of the frame */
+static uint32_t wave[MANCHESTER_WAVE_WORDS(MANCHESTER_WAVE_BITS)];
+#endif
+
 /* static functions */
 
 static ErrorStatus transmitBit(uint32_t timeoutMS, uint8_t bit);
@@ -87,6 +137,15 @@ static ErrorStatus transmitStartStopBits(uint32_t timeoutMS, uint8_t val, size_t
 
 static void configTimer(TIM_HandleTypeDef *htim, size_t stage);
 
+#ifdef MANCHESTER_TIMER_IMAGES
+static ErrorStatus prepareTimerImages(MANCHESTER_Context_t *context);
+#endif
+
+#ifdef MANCHESTER_TX_DMA
+static ErrorStatus transmitWave(MANCHESTER_Data_t *data,
+				MANCHESTER_Context_t *context);
+#endif
+
 ErrorStatus processPulse(PulseData_t *const p,
 			 MANCHESTER_Context_t *const context,
 			 BitQueue_t *const qu);
@@ -101,6 +160,11 @@ ErrorStatus prepareRx(MANCHESTER_Context_t *const context);
 
 ErrorStatus receiveBits(MANCHESTER_Context_t *context, BitQueue_t *qu);
 
+#ifdef MANCHESTER_RX_DMA
+static ErrorStatus captureFrame(MANCHESTER_Context_t *const context,
+				size_t nBits);
+#endif
+
 /* access to the timer mutex */
 extern osMutexId ManchesterTimer01MutexHandle;
 //extern uint32_t measured1;
@@ -133,7 +197,17 @@ static TimerCfg_t timerCfgData[] = {
 
 /* 3 */	{ 0,0,0,0,0,0,0,0,0},
 
-/* 4 */	{ 0,0,0,0,0,0,0,0,0},
+	/* for transmit by DMA, CC4 requests every half-bit */
+/* 4 */	{ .CCMR1 = 0u,
+	  .CR1 = TIM_CLOCKDIVISION_DIV1 | TIM_COUNTERMODE_UP |
+		 TIM_AUTORELOAD_PRELOAD_ENABLE,
+	  .CR2 = TIM_TRGO_RESET,
+	  .SMCR = 0u,
+	  .PSC = 71u,
+	  .CCER = 0u,
+	  .ARR = 65535u,
+	  .state = HAL_TIM_STATE_READY,
+	  .NeedMSPInit = 0 },
 
 	/* for transmit */
 /* 5 */	{ .CCMR1 = 0u,
@@ -147,7 +221,18 @@ static TimerCfg_t timerCfgData[] = {
 	  .state = HAL_TIM_STATE_READY,
 	  .NeedMSPInit = 1 },
 
-/* 6 */	{ 0,0,0,0,0,0,0,0,0},
+	/* for receiving by DMA edge capture, both channels on TI1 */
+/* 6 */	{ .CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_IC1F |
+		   TIM_CCMR1_CC2S_1 | TIM_CCMR1_IC2F,
+	  .CR1 = TIM_CLOCKDIVISION_DIV1 | TIM_COUNTERMODE_UP |
+		 TIM_AUTORELOAD_PRELOAD_ENABLE,
+	  .CR2 = TIM_TRGO_RESET,
+	  .SMCR = 0u,
+	  .PSC = 71u,
+	  .CCER = CAPTURE_CCER,
+	  .ARR = 65535u,
+	  .state = HAL_TIM_STATE_READY,
+	  .NeedMSPInit = 0 },
 
 	/* for receiving using EXTI */
 /* 7 */	{ .CCMR1 = 0u,
@@ -163,6 +248,26 @@ static TimerCfg_t timerCfgData[] = {
 
 };
 
+#ifdef MANCHESTER_TIMER_IMAGES
+#define NUM_STAGES	(sizeof(timerCfgData) / sizeof(timerCfgData[0]))
+
+/* checked register values of a stage for the timer of the context */
+typedef struct TimerImage {
+	uint32_t CR1;
+	uint32_t SMCR;
+	uint32_t CCMR1;
+	uint32_t CCMR2;
+	uint32_t CCER;
+	uint32_t CR2;
+	uint32_t PSC;
+	uint32_t ARR;
+	HAL_TIM_StateTypeDef state;
+	uint8_t valid;
+} TimerImage_t;
+
+static TimerImage_t timerImage[NUM_STAGES];
+#endif
+
 
 #if(0)
 /**
@@ -239,6 +344,17 @@ ErrorStatus MANCHESTER_InitContext(MANCHESTER_Context_t *context,
 	/* pulse detection timeout in ms */
 	context->pulseTimeout = (1000u / (bitRate * 2u)) + 2u;
 	context->filterTime = 7u; /* 7 us*/
+#ifdef MANCHESTER_TIMER_IMAGES
+	if (prepareTimerImages(context) != SUCCESS) {
+		goto fExit;
+	}
+#endif
+#ifdef MANCHESTER_TX_DMA
+	/* the end of the waveform is reported from here */
+	HAL_NVIC_SetPriority(DMA1_Channel7_IRQn,
+			     configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0u);
+	HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+#endif
 	retVal = SUCCESS;
 fExit:
 	return retVal;
@@ -258,6 +374,7 @@ fExit:
 #ifdef MANCHESTER_DEBUG
 volatile static size_t bits_received;
 volatile static size_t mr_err;
+volatile static MANCHESTER_DecodeStatus_t md_err;
 #define MR_ERR_LINE mr_err = __LINE__
 #else
 #define MR_ERR_LINE
@@ -279,6 +396,7 @@ ErrorStatus MANCHESTER_Receive(MANCHESTER_Data_t *data,
 #ifdef MANCHESTER_DEBUG
 	bits_received = 0x00u;
 	mr_err = 0x00u;
+	md_err = mdOk;
 #endif
 	/* FREERTOS mutex*/
 	BaseType_t mut = 0;
@@ -296,7 +414,27 @@ ErrorStatus MANCHESTER_Receive(MANCHESTER_Data_t *data,
 				     portMAX_DELAY);
 	}
 
+#ifdef MANCHESTER_RX_DMA
+	retVal = captureFrame(context, context->numStartBits + data->numBits +
+					       context->numStopBits);
+	if ((retVal == SUCCESS) && (capture.active != 0x00U)) {
+		/* the whole frame is in the buffer */
+		MANCHESTER_DecodeStatus_t md;
+
+		md = MANCHESTER_Decode(capture.buf, 2u * capture.pairs,
+				       context, data);
+		if (md != mdOk) {
+#ifdef MANCHESTER_DEBUG
+			md_err = md;
+#endif
+			MR_ERR_LINE;
+			retVal = ERROR;
+		}
+		goto fExit;
+	}
+#else
 	retVal = prepareRx(context);
+#endif
 	if (retVal != SUCCESS) {
 		MR_ERR_LINE;
 		goto fExit;
@@ -322,6 +460,9 @@ ErrorStatus MANCHESTER_Receive(MANCHESTER_Data_t *data,
 	retVal = SUCCESS;
 
 fExit:
+#ifdef MANCHESTER_RX_DMA
+	capture.active = 0x00U;
+#endif
 	HAL_NVIC_DisableIRQ(EXTI0_IRQn);
 	context->htim->Instance->DIER = 0U;
 	configTimer(context->htim, 0x00u);
@@ -521,6 +662,127 @@ fExit:
 	return retVal;
 }
 
+#ifdef MANCHESTER_RX_DMA
+/**
+ * @brief capturePin switches the rx pin between the EXTI input and TIM2_CH1
+ * @param on
+ */
+static void capturePin(uint8_t on)
+{
+#ifdef STM32F303xC
+	const uint32_t pos = (uint32_t)__builtin_ctz(MANCHESTER_RX_Pin);
+	uint32_t moder;
+
+	moder = MANCHESTER_RX_GPIO_Port->MODER & ~(GPIO_MODER_MODER0 << (2u * pos));
+	if (on != 0x00U) {
+		MANCHESTER_RX_GPIO_Port->AFR[0] =
+			(MANCHESTER_RX_GPIO_Port->AFR[0] & ~(0x0FU << (4u * pos))) |
+			((uint32_t)GPIO_AF1_TIM2 << (4u * pos));
+		moder |= (GPIO_MODER_MODER0_1 << (2u * pos));
+	}
+	MANCHESTER_RX_GPIO_Port->MODER = moder;
+#else
+	/* the F1 timer takes an input pin as it is */
+	(void)on;
+#endif
+}
+
+/**
+ * @brief captureFrame waits for a frame and lets the timer store the time of
+ * its every edge to capture.buf. IC1 catches the edges to the active level,
+ * IC2 the edges to the empty one and requests a DMA burst of CCR1 and CCR2.
+ * The first edge arms CC3 at the end of the frame, its interrupt is the only
+ * notification of the task.
+ * @param context
+ * @param nBits start, data and stop bits of the frame
+ * @return ERROR if no frame has come or it has not fit the buffer
+ */
+#ifdef MANCHESTER_DEBUG
+volatile static uint32_t cf_err;
+#define CF_ERR_LINE do {cf_err = __LINE__; STROBE_0;} while(0)
+#else
+#define CF_ERR_LINE
+#endif
+
+static ErrorStatus captureFrame(MANCHESTER_Context_t *const context,
+				size_t nBits)
+{
+#ifdef MANCHESTER_DEBUG
+	cf_err = 0x00U;
+#endif
+	ErrorStatus retVal = ERROR;
+	TIM_TypeDef *const tim = context->htim->Instance;
+	BaseType_t xResult;
+	uint32_t ulNotifiedValue;
+	uint32_t left;
+
+	capture.active = 0x00U;
+	capture.pairs = 0u;
+	/* the frame may be as long as the tolerance allows, plus a half-bit */
+	capture.frameTicks = 2u * context->halfBitMaxTime * nBits +
+			     context->halfBitTime;
+	if ((nBits >= MANCHESTER_CAPTURE_PAIRS) ||
+	    (capture.frameTicks > 0xFFFFU)) {
+		/* does not fit, receive edge by edge */
+		return prepareRx(context);
+	}
+
+	configTimer(context->htim, CAPTURE_STAGE);
+	if (HAL_GPIO_ReadPin(MANCHESTER_RX_GPIO_Port, MANCHESTER_RX_Pin) !=
+	    EMPTY_LINE) {
+		CF_ERR_LINE;
+		goto fExit;
+	}
+	capturePin(0x01U);
+
+	MANCH_DMA->CCR = 0x00U;
+	DMA1->IFCR = MANCH_DMA_IFCR;
+	MANCH_DMA->CPAR = (uint32_t)&tim->DMAR;
+	MANCH_DMA->CMAR = (uint32_t)capture.buf;
+	MANCH_DMA->CNDTR = 2u * MANCHESTER_CAPTURE_PAIRS;
+	MANCH_DMA->CCR = DMA_CCR_PL_1 | DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 |
+			   DMA_CCR_MINC | DMA_CCR_EN;
+
+	tim->DCR = CAPTURE_DCR;
+#ifndef MANCHESTER_TIMER_IMAGES
+	tim->CCMR2 = 0x00U;
+#endif
+	tim->CNT = 0x00U;
+	tim->SR = 0x00U;
+	tim->DIER = TIM_DIER_CC1IE | TIM_DIER_CC2DE;
+	tim->CR1 |= TIM_CR1_CEN;
+
+	xResult = xTaskNotifyWait(pdFALSE, ULONG_MAX, &ulNotifiedValue,
+				  pdMS_TO_TICKS(WAIT_FOR_START_MAX_MS +
+						capture.frameTicks / 1000u + 2u));
+	tim->DIER = 0x00U;
+	tim->CR1 &= ~TIM_CR1_CEN;
+	left = MANCH_DMA->CNDTR;
+	MANCH_DMA->CCR = 0x00U;
+	capturePin(0x00U);
+	STROBE_0;
+
+	if (xResult != pdPASS) {
+		CF_ERR_LINE;
+		goto fExit;
+	}
+	if (left == 0u) {
+		/* more edges than a frame may have */
+		CF_ERR_LINE;
+		goto fExit;
+	}
+	capture.pairs = (2u * MANCHESTER_CAPTURE_PAIRS - left) / 2u;
+	if (capture.pairs == 0u) {
+		CF_ERR_LINE;
+		goto fExit;
+	}
+	capture.active = 0x01U;
+	retVal = SUCCESS;
+fExit:
+	return retVal;
+}
+#endif
+
 /**
  * @brief processPulse
  * @param p
@@ -741,6 +1003,109 @@ fExit:
 	return retVal;
 }
 
+#ifdef MANCHESTER_TIMER_IMAGES
+/**
+ * @brief prepareTimerImages checks the stages against the timer of the
+ * context and stores the register values to be written. The bit times of
+ * the context are put into the ARR of the transmit stages here, the timer
+ * MSP is initialized here once and never on a stage change.
+ * @param context with the bit times calculated
+ * @return ERROR if a stage does not fit the timer
+ */
+static ErrorStatus prepareTimerImages(MANCHESTER_Context_t *context)
+{
+	ErrorStatus retVal = ERROR;
+	TIM_HandleTypeDef *const htim = context->htim;
+	const uint32_t arrMax =
+		(IS_TIM_32B_COUNTER_INSTANCE(htim->Instance) != 0u) ?
+			UINT32_MAX : 0xFFFFu;
+	const uint32_t psc = htim->Instance->PSC & 0xFFFFu;
+	uint8_t needMSPInit = 0x00U;
+	size_t stage;
+
+	for (stage = 0u; stage < NUM_STAGES; stage++) {
+		timerImage[stage].valid = 0x00U;
+	}
+	if ((context->halfBitTime < 2u) || (context->halfBitTime > arrMax)) {
+		goto fExit;
+	}
+	for (stage = 0u; stage < NUM_STAGES; stage++) {
+		const TimerCfg_t *const cfg = &timerCfgData[stage];
+		TimerImage_t *const img = &timerImage[stage];
+
+		/* the bit times are counted with the prescaler running now */
+		if ((cfg->state != HAL_TIM_STATE_RESET) && (cfg->PSC != psc)) {
+			goto fExit;
+		}
+		img->CR1 = cfg->CR1 & ~TIM_CR1_CEN;
+		img->SMCR = cfg->SMCR;
+		img->CCMR1 = cfg->CCMR1;
+		img->CCMR2 = 0x00U;
+		img->CCER = cfg->CCER;
+		img->CR2 = cfg->CR2;
+		img->PSC = cfg->PSC & 0xFFFFu;
+		/* as the hardware reads it back */
+		img->ARR = (cfg->ARR > arrMax) ? arrMax : cfg->ARR;
+		img->state = cfg->state;
+		if (cfg->NeedMSPInit == 1u) {
+			needMSPInit = 0x01U;
+		}
+	}
+	timerImage[5u].ARR = context->halfBitTime;
+#ifdef MANCHESTER_TX_DMA
+	timerImage[WAVE_STAGE].ARR = context->halfBitTime - 1u;
+#endif
+	if (needMSPInit != 0x00U) {
+		HAL_TIM_Base_MspInit(htim);
+	}
+	for (stage = 0u; stage < NUM_STAGES; stage++) {
+		timerImage[stage].valid = 0x01U;
+	}
+	retVal = SUCCESS;
+fExit:
+	return retVal;
+}
+
+/**
+ * @brief applyTimerImage switches the timer to the stage writing only the
+ * registers which differ, in the order the hardware needs: requests off
+ * and the counter stopped first, the channels disabled while their
+ * CCxS bits change, the update event last to load PSC and ARR and to
+ * restart the counter.
+ * @param htim
+ * @param img
+ */
+static void applyTimerImage(TIM_HandleTypeDef *htim, const TimerImage_t *img)
+{
+	TIM_TypeDef *const tim = htim->Instance;
+
+	tim->DIER = 0x00U;
+	tim->CR1 = img->CR1;
+	if (tim->SMCR != img->SMCR) {
+		tim->SMCR = img->SMCR;
+	}
+	if ((tim->CCMR1 != img->CCMR1) || (tim->CCMR2 != img->CCMR2)) {
+		tim->CCER = 0x00U;
+		tim->CCMR1 = img->CCMR1;
+		tim->CCMR2 = img->CCMR2;
+	}
+	if (tim->CCER != img->CCER) {
+		tim->CCER = img->CCER;
+	}
+	if (tim->CR2 != img->CR2) {
+		tim->CR2 = img->CR2;
+	}
+	if (tim->PSC != img->PSC) {
+		tim->PSC = img->PSC;
+	}
+	if (tim->ARR != img->ARR) {
+		tim->ARR = img->ARR;
+	}
+	tim->EGR = TIM_EGR_UG;
+	htim->State = img->state;
+}
+#endif
+
 /**
  * @brief configTimer configures the selected timer for
  * @param htim
@@ -748,6 +1113,12 @@ fExit:
  */
 static void configTimer(TIM_HandleTypeDef *htim, size_t stage)
 {
+#ifdef MANCHESTER_TIMER_IMAGES
+	if (timerImage[stage].valid != 0x00U) {
+		applyTimerImage(htim, &timerImage[stage]);
+		return;
+	}
+#endif
 	if (timerCfgData[stage].state == HAL_TIM_STATE_RESET) {
 		//		HAL_TIM_Base_MspDeInit(htim);
 	} else {
@@ -828,10 +1199,19 @@ ErrorStatus MANCHESTER_Transmit(MANCHESTER_Data_t *data,
 
 	xTaskNotifyStateClear(ManchTaskHandle);
 
+#ifdef MANCHESTER_TX_DMA
+	if ((context->numStartBits + data->numBits + context->numStopBits) <=
+	    MANCHESTER_WAVE_BITS) {
+		retVal = transmitWave(data, context);
+		goto fExit;
+	}
+#endif
 	/* initialize timer hardware for transmission */
 	configTimer(htim, 5u);
+#ifndef MANCHESTER_TIMER_IMAGES
 	htim->Instance->ARR = context->halfBitTime;
 	htim->Instance->EGR = TIM_EGR_UG;
+#endif
 
 	htim->Instance->SR = 0u;
 	htim->Instance->CR1 = htim->Instance->CR1 | TIM_CR1_CEN;
@@ -919,6 +1299,80 @@ fExit:
 	return retVal;
 }
 
+#ifdef MANCHESTER_TX_DMA
+/**
+ * @brief transmitWave sends the whole frame with one DMA transfer to the BSRR
+ * of the tx pin paced by the timer. The task sleeps until the transfer
+ * complete interrupt.
+ * @param data
+ * @param context
+ * @return SUCCESS or ERROR
+ */
+static ErrorStatus transmitWave(MANCHESTER_Data_t *data,
+				MANCHESTER_Context_t *context)
+{
+	ErrorStatus retVal = ERROR;
+	TIM_TypeDef *const tim = context->htim->Instance;
+	BaseType_t xResult;
+	uint32_t ulNotifiedValue;
+	size_t n;
+
+	n = MANCHESTER_Encode(data, context, wave, WAVE_SET, WAVE_RESET);
+
+	configTimer(context->htim, WAVE_STAGE);
+#ifdef MANCHESTER_TIMER_IMAGES
+	/* the stage image has loaded the half-bit period */
+	MANCHESTER_WaveTimerArm(tim, 0u);
+#else
+	MANCHESTER_WaveTimerArm(tim, context->halfBitTime);
+#endif
+
+	MANCH_DMA->CCR = 0x00U;
+	DMA1->IFCR = MANCH_DMA_IFCR;
+	MANCH_DMA->CPAR = (uint32_t)&MANCHESTER_TX_GPIO_Port->BSRR;
+	MANCH_DMA->CMAR = (uint32_t)wave;
+	MANCH_DMA->CNDTR = n;
+	MANCH_DMA->CCR = DMA_CCR_PL_1 | DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 |
+			 DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TEIE |
+			 DMA_CCR_TCIE | DMA_CCR_EN;
+
+	tim->SR = 0x00U;
+	tim->DIER = TIM_DIER_CC4DE;
+	tim->CR1 |= TIM_CR1_CEN;
+
+	xResult = xTaskNotifyWait(pdFALSE, ULONG_MAX, &ulNotifiedValue,
+				  pdMS_TO_TICKS((n * context->halfBitTime) /
+						1000u + context->pulseTimeout));
+	tim->DIER = 0x00U;
+	tim->CR1 &= ~TIM_CR1_CEN;
+	MANCH_DMA->CCR = 0x00U;
+
+	if ((xResult == pdPASS) && (ulNotifiedValue == 1u)) {
+		retVal = SUCCESS;
+	}
+	return retVal;
+}
+
+/**
+ * @brief MANCHESTER_DmaISR the end of the transmitted waveform
+ */
+void MANCHESTER_DmaISR(void)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	uint32_t isr = DMA1->ISR;
+
+	if ((isr & (MANCH_DMA_TCIF | MANCH_DMA_TEIF)) == 0x00U) {
+		return;
+	}
+	DMA1->IFCR = MANCH_DMA_IFCR;
+	MANCH_DMA->CCR &= ~(DMA_CCR_TCIE | DMA_CCR_TEIE);
+	xTaskNotifyFromISR(ManchTaskHandle,
+			   ((isr & MANCH_DMA_TEIF) == 0x00U) ? 1u : 0u,
+			   eSetValueWithOverwrite, &xHigherPriorityTaskWoken);
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+#endif
+
 /**
  * @brief transmitStartStopBits
  * @param htim timer to use to transmit
@@ -1009,6 +1463,19 @@ void MANCHESTER_TimerISR(void)
 	if (__HAL_TIM_GET_FLAG(&MANCHESTER_Timer, TIM_FLAG_CC1) != RESET) {
 		if (__HAL_TIM_GET_IT_SOURCE(&MANCHESTER_Timer, TIM_IT_CC1) != RESET) {
 			__HAL_TIM_CLEAR_FLAG(&MANCHESTER_Timer, TIM_FLAG_CC1);
+#ifdef MANCHESTER_RX_DMA
+			if ((MANCHESTER_Timer.Instance->DIER & TIM_DIER_CC2DE) != 0x00U) {
+				/* the first edge of the frame, DMA takes the rest;
+				 * CC3 marks the end of the frame */
+				MANCHESTER_Timer.Instance->CCR3 =
+					(MANCHESTER_Timer.Instance->CCR1 +
+					 capture.frameTicks) & 0xFFFFU;
+				__HAL_TIM_CLEAR_FLAG(&MANCHESTER_Timer, TIM_FLAG_CC3);
+				MANCHESTER_Timer.Instance->DIER =
+					TIM_DIER_CC2DE | TIM_DIER_CC3IE;
+				return;
+			}
+#endif
 			if ((MANCHESTER_Timer.Instance->CCMR1 & TIM_CCMR1_CC1S) != 0x00U) {
 //				MANCHESTER_DebugLEDToggle();
 				notification = HAL_TIM_ReadCapturedValue(&MANCHESTER_Timer, TIM_CHANNEL_1);
@@ -1017,6 +1484,18 @@ void MANCHESTER_TimerISR(void)
 		}
 	}
 
+#ifdef MANCHESTER_RX_DMA
+	/* end of the captured frame */
+	if (__HAL_TIM_GET_FLAG(&MANCHESTER_Timer, TIM_FLAG_CC3) != RESET) {
+		if (__HAL_TIM_GET_IT_SOURCE(&MANCHESTER_Timer, TIM_IT_CC3) != RESET) {
+			__HAL_TIM_CLEAR_FLAG(&MANCHESTER_Timer, TIM_FLAG_CC3);
+			MANCHESTER_Timer.Instance->DIER &= ~TIM_DIER_CC3IE;
+			notification = capture.frameTicks;
+			goto fExit;
+		}
+	}
+#endif
+
 	/* update event */
 	if (__HAL_TIM_GET_FLAG(&MANCHESTER_Timer, TIM_FLAG_UPDATE) != RESET) {
 		if (__HAL_TIM_GET_IT_SOURCE(&MANCHESTER_Timer, TIM_IT_UPDATE) != RESET) {
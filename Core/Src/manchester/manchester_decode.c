@@ -0,0 +1,163 @@
+/** @file manchester_decode.c
+ *  @brief table-driven decoder of captured Manchester frames
+ *
+ *  The edge intervals are turned into a string of half-bit levels, then
+ *  every 8 half-bits (4 bits) are looked up in cellNibble[] and the data
+ *  bytes are cut out of the resulting bit string, reversed by a table for
+ *  the LSB first order. A bit 1 is the active half-bit followed by the
+ *  empty one, as the EXTI receiver and the transmitter have it.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <limits.h>
+
+#include "manchester_decode.h"
+
+/* one more word: a half-bit past the frame may be stored, and getBits()
+ * reads a 64 bit window */
+#define HALF_WORDS	((2u * MANCHESTER_DECODE_BITS) / 32u + 1u)
+#define BIT_WORDS	(MANCHESTER_DECODE_BITS / 32u + 1u)
+
+/* a cell of two half-bits: 10b is 1, 01b is 0, otherwise 0x10 */
+#define MD_CELL(c)	(((c) == 2u) ? 1u : (((c) == 1u) ? 0u : 0x10u))
+
+/* four cells -> the bits in the low nibble, the first cell in bit 3;
+ * bits 7..4 flag the bad cells, the first cell in bit 7 */
+#define MD_NIB(b)	((uint8_t)((MD_CELL(((b) >> 6) & 3u) << 3) |       \
+				   (MD_CELL(((b) >> 4) & 3u) << 2) |       \
+				   (MD_CELL(((b) >> 2) & 3u) << 1) |       \
+				   MD_CELL((b) & 3u)))
+
+#define MD_REV(b)	((uint8_t)((((b) & 0x01u) << 7) | (((b) & 0x02u) << 5) | \
+				   (((b) & 0x04u) << 3) | (((b) & 0x08u) << 1) | \
+				   (((b) & 0x10u) >> 1) | (((b) & 0x20u) >> 3) | \
+				   (((b) & 0x40u) >> 5) | (((b) & 0x80u) >> 7)))
+
+#define MD_R4(f, b)	f(b), f((b) + 1u), f((b) + 2u), f((b) + 3u)
+#define MD_R16(f, b)	MD_R4(f, b), MD_R4(f, (b) + 4u), MD_R4(f, (b) + 8u), \
+			MD_R4(f, (b) + 12u)
+#define MD_R64(f, b)	MD_R16(f, b), MD_R16(f, (b) + 16u), \
+			MD_R16(f, (b) + 32u), MD_R16(f, (b) + 48u)
+#define MD_R256(f)	MD_R64(f, 0u), MD_R64(f, 64u), MD_R64(f, 128u), \
+			MD_R64(f, 192u)
+
+static const uint8_t cellNibble[256] = { MD_R256(MD_NIB) };
+static const uint8_t revByte[256] = { MD_R256(MD_REV) };
+
+/**
+ * @brief getBits reads a field of a MSB first bit string
+ * @param w the string
+ * @param pos first bit of the field
+ * @param len 1..16
+ * @return the field, its first bit the highest
+ */
+static uint32_t getBits(const uint32_t *w, size_t pos, size_t len)
+{
+	uint64_t win;
+
+	win = ((uint64_t)w[pos / 32u] << 32) | w[pos / 32u + 1u];
+	return (uint32_t)(win >> (64u - (pos % 32u) - len)) &
+	       ((1u << len) - 1u);
+}
+
+/**
+ * @brief MANCHESTER_Decode decodes a captured frame
+ * @param edges times of the edges, timer ticks of the 16 bit counter
+ * @param numEdges
+ * @param context bit timing, start and stop bits, bit order
+ * @param data dataPtr and numBits of the payload; numBitsActual is set
+ * @return mdOk or the reason the frame is rejected
+ */
+MANCHESTER_DecodeStatus_t MANCHESTER_Decode(const uint32_t *edges,
+					    size_t numEdges,
+					    const MANCHESTER_Context_t *context,
+					    MANCHESTER_Data_t *data)
+{
+	uint32_t half[HALF_WORDS] = { 0u };
+	uint32_t bits[BIT_WORDS + 1u] = { 0u };
+	const uint32_t min1 = context->halfBitMinTime;
+	const uint32_t max1 = context->halfBitMaxTime;
+	const size_t nBits = context->numStartBits + data->numBits +
+			     context->numStopBits;
+	const size_t need = 2u * nBits;
+	size_t n = 0u;
+	size_t i;
+
+	if (nBits > MANCHESTER_DECODE_BITS) {
+		return mdTooLong;
+	}
+
+	/* edge intervals -> half-bit levels, the active level is 1 */
+	for (i = 0u; ((i + 1u) < numEdges) && (n < need); i++) {
+		uint32_t d = (uint16_t)(edges[i + 1u] - edges[i]);
+		size_t len;
+
+		if ((d > min1) && (d < max1)) {
+			len = 1u;
+		} else if ((d > 2u * min1) && (d < 2u * max1)) {
+			len = 2u;
+		} else {
+			return mdBadPulse;
+		}
+		if ((i & 1u) == 0u) {
+			half[n / 32u] |= 0x80000000u >> (n % 32u);
+			if (len == 2u) {
+				half[(n + 1u) / 32u] |= 0x80000000u >> ((n + 1u) % 32u);
+			}
+		}
+		n += len;
+	}
+	/* the line stays empty after the last edge, that may be the second
+	 * half of the last bit */
+	if ((n < need) && (((numEdges & 1u) != 0u) || ((n + 1u) < need))) {
+		return mdShort;
+	}
+
+	/* 4 bits per step */
+	for (i = 0u; i < nBits; i += 4u) {
+		uint8_t sym = (uint8_t)(half[i / 16u] >> (24u - 8u * ((i / 4u) % 4u)));
+		uint8_t nib = cellNibble[sym];
+		uint8_t used = ((nBits - i) >= 4u) ? 0xF0u :
+			(uint8_t)(0xF0u << (4u - (nBits - i)));
+
+		if ((nib & used) != 0u) {
+			return mdBadSymbol;
+		}
+		bits[i / 32u] |= (uint32_t)(nib & 0x0Fu) << (28u - (i % 32u));
+	}
+
+	if (getBits(bits, 0u, context->numStartBits) !=
+	    ((context->startStopBit != 0u) ?
+		     ((1u << context->numStartBits) - 1u) : 0u)) {
+		return mdBadStartStop;
+	}
+	if ((context->numStopBits != 0u) &&
+	    (getBits(bits, nBits - context->numStopBits, context->numStopBits) !=
+	     ((context->startStopBit != 0u) ?
+		      ((1u << context->numStopBits) - 1u) : 0u))) {
+		return mdBadStartStop;
+	}
+
+	/* one table step per byte */
+	size_t pos = context->numStartBits;
+	for (i = 0u; i < (data->numBits / CHAR_BIT); i++) {
+		uint8_t b = (uint8_t)getBits(bits, pos, CHAR_BIT);
+
+		data->dataPtr[i] = (context->bitOrder == MANCHESTER_BitOrderLSBFirst) ?
+					   revByte[b] : b;
+		pos += CHAR_BIT;
+	}
+	size_t rem = data->numBits % CHAR_BIT;
+	if (rem != 0u) {
+		/* in the low bits of the last byte */
+		uint8_t b = (uint8_t)getBits(bits, pos, rem);
+
+		data->dataPtr[i] = (context->bitOrder == MANCHESTER_BitOrderLSBFirst) ?
+			(uint8_t)(revByte[b] >> (CHAR_BIT - rem)) : b;
+	}
+	data->numBitsActual = data->numBits;
+	return mdOk;
+}
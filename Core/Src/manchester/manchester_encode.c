@@ -0,0 +1,95 @@
+/** @file manchester_encode.c
+ *  @brief Manchester waveform builder
+ *
+ *  A bit 1 is the high half-bit followed by the low one, as transmitBit
+ *  sends it and the decoders expect it.
+ *
+ *  @author turchenkov@gmail.com
+ *  @bug
+ *  @date 17-Oct-2026
+ */
+
+#include <limits.h>
+
+#include "manchester_encode.h"
+
+/**
+ * @brief waveBit puts the two halves of a bit to the waveform
+ * @param w
+ * @param val 0 as logic 0, logic one otherwize
+ * @param high
+ * @param low
+ * @return the next free position
+ */
+static uint32_t *waveBit(uint32_t *w, uint8_t val, uint32_t high, uint32_t low)
+{
+	w[0] = (val == 0u) ? low : high;
+	w[1] = (val == 0u) ? high : low;
+	return &w[2];
+}
+
+/**
+ * @brief MANCHESTER_Encode lays out the start bits, the payload in the bit
+ * order of the context and the stop bits. The last half-bit is repeated so
+ * that the end of the waveform is the end of the frame.
+ * @param data
+ * @param context
+ * @param wave MANCHESTER_WAVE_WORDS() of the frame
+ * @param high word that drives the pin high
+ * @param low word that drives the pin low
+ * @return number of words
+ */
+size_t MANCHESTER_Encode(const MANCHESTER_Data_t *data,
+			 const MANCHESTER_Context_t *context, uint32_t *wave,
+			 uint32_t high, uint32_t low)
+{
+	uint32_t *w = wave;
+	size_t i;
+
+	for (i = 0u; i < context->numStartBits; i++) {
+		w = waveBit(w, context->startStopBit, high, low);
+	}
+	for (i = 0u; i < data->numBits; i++) {
+		size_t byte = i / CHAR_BIT;
+		size_t bit = i % CHAR_BIT;
+		uint8_t mask;
+
+		if (context->bitOrder == MANCHESTER_BitOrderLSBFirst) {
+			mask = (uint8_t)(0x01u << bit);
+		} else if (byte < (data->numBits / CHAR_BIT)) {
+			mask = (uint8_t)(0x80u >> bit);
+		} else {
+			/* the highest bits of the last byte are skipped */
+			mask = (uint8_t)(0x80u >> (CHAR_BIT -
+						   (data->numBits % CHAR_BIT) + bit));
+		}
+		w = waveBit(w, data->dataPtr[byte] & mask, high, low);
+	}
+	for (i = 0u; i < context->numStopBits; i++) {
+		w = waveBit(w, context->startStopBit, high, low);
+	}
+	/* holds the last half-bit for its full time */
+	w[0] = w[-1];
+	return (size_t)(&w[1] - wave);
+}
+
+/**
+ * @brief MANCHESTER_WaveTimerArm sets the stopped up-counting timer to play
+ * the waveform: a CC4 request at every update, the first half-bit on the
+ * next tick after CEN
+ * @param tim
+ * @param halfBitTime the half-bit period in ticks to load, 0 if ARR holds
+ * it already
+ */
+void MANCHESTER_WaveTimerArm(TIM_TypeDef *tim, uint32_t halfBitTime)
+{
+	if (halfBitTime != 0u) {
+		tim->ARR = halfBitTime - 1u;
+		/* ARR is preloaded, without the update the old period runs
+		 * until the counter wraps */
+		tim->EGR = TIM_EGR_UG;
+		tim->CCMR2 = 0x00U;
+	}
+	tim->CCR4 = 0x00U;
+	tim->CNT = tim->ARR;
+}
@@ -41,6 +41,7 @@
 /* USER CODE BEGIN Includes */
 
 #include "manchester.h"
+#include "lan_poll_task.h"
 
 /* USER CODE END Includes */
 
@@ -404,5 +405,28 @@ void EXTI0_IRQHandler(void)
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_0);
 }
 
+#ifdef MANCHESTER_TX_DMA
+/**
+  * @brief This function handles DMA1 channel7 global interrupt (Manchester tx).
+  */
+void DMA1_Channel7_IRQHandler(void)
+{
+  MANCHESTER_DmaISR();
+}
+#endif
+
+#if (LAN_RX_INTERRUPT == 1)
+/**
+  * @brief This function handles EXTI line[9:5] interrupts (ENC28J60 INT).
+  */
+void EXTI9_5_IRQHandler(void)
+{
+  if (__HAL_GPIO_EXTI_GET_IT(ENC28J60_INT_Pin) != RESET) {
+    __HAL_GPIO_EXTI_CLEAR_IT(ENC28J60_INT_Pin);
+    LAN_IntISR();
+  }
+}
+#endif
+
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -28,6 +28,7 @@
 #include "logging.h"
 
 #include "lan.h"
+#include "pcap_ring.h"
 #include "tiny-fs.h"
 #include "ip_helpers.h"
 
@@ -48,6 +49,7 @@
 static uint8_t tftp_buffer[TFTP_BUFFER_SIZE];
 static tftp_context_t tftp_context;
 static tftp_context_p context1;
+static pcap_export_t pcap_export;	/* PCAP_FILE_NAME read state */
 
 #ifdef TFTP_ERR_STATS
 static uint16_t send_err_errors;
@@ -613,6 +615,18 @@ static void TFTP_Open_File(tftp_context_p context)
 		goto fExit;
 	}
 
+	/* the capture ring is a read-only virtual file */
+	if (strcmp(context->FileName, PCAP_FILE_NAME) == 0) {
+		if (context->OpCode == TFTP_RRQ) {
+			pcap_export_begin(&pcap_export);
+			context->Capture = 1U;
+			context->ErrCode = TFTP_ERROR_NOERROR;
+		} else {
+			context->ErrCode = TFTP_ERROR_ACCESS_VIOLATION;
+		}
+		goto fExit;
+	}
+
 	/* the file is the file */
 	FRESULT res = FR_OK;
 	fMode_t req_mode;
@@ -651,6 +665,11 @@ fExit:
 static void TFTP_Close_File(tftp_context_p context)
 {
 	FRESULT res;
+	if (context->Capture != 0U) {
+		context->Capture = 0U;
+		context->ErrCode = TFTP_ERROR_NOERROR;
+		return;
+	}
 	res = CloseFile(&context->file);
 
 	if (res == FR_OK) {
@@ -687,6 +706,7 @@ static void TFTP_Init_Context(const tftp_context_p context)
 	context->out_sock = NULL;
 
 	context->file.media = (Media_Desc_t *)&Media0;
+	context->Capture = 0U;
 }
 
 /**
@@ -758,6 +778,12 @@ static void TFTP_Block_Read(const tftp_context_p context)
 	memset(context->DataPtr, 0, TFTP_DATA_LEN_MAX);
 
 #endif
+	if (context->Capture != 0U) {
+		context->DataLen = pcap_export_read(&pcap_export, dptr, btr);
+		context->BlockNum++;
+		context->ErrCode = TFTP_ERROR_NOERROR;
+		return;
+	}
 	FRESULT res;
 	res = f_read(&context->file, dptr, btr, &br);
 	context->DataLen = br;
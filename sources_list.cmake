@@ -34,7 +34,9 @@ set(GROUP_CORE_SRC_JSON
 
 set(GROUP_CORE_SRC_LAN
 	        Core/Src/lan/enc28j60.c
+		Core/Src/lan/inet_cksum.c
 		Core/Src/lan/lan.c
+		Core/Src/lan/pcap_ring.c
 )
 
 set(GROUP_CORE_SRC_MQTT_SN
@@ -45,6 +47,8 @@ set(GROUP_CORE_SRC_MQTT_SN
 set(GROUP_CORE_SRC_MANCHESTER
 	        Core/Src/manchester/bit_queue.c
 		Core/Src/manchester/manchester.c
+		Core/Src/manchester/manchester_decode.c
+		Core/Src/manchester/manchester_encode.c
 )
 
 set(GROUP_CORE_SRC_MQTTSNPACKET